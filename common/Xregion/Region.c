@@ -156,9 +156,65 @@ XCreateRegion(void)
     temp->extents.x2 = 0;
     temp->extents.y2 = 0;
     temp->size = 1;
+    temp->inlineRects = NULL;
+    temp->inlineSize = 0;
+    temp->spare = NULL;
+    temp->spareSize = 0;
     return( temp );
 }
 
+void
+XInitRegion(
+    Region r,
+    BOX *inlineRects,
+    long inlineSize)
+{
+    r->numRects = 0;
+    r->extents.x1 = 0;
+    r->extents.y1 = 0;
+    r->extents.x2 = 0;
+    r->extents.y2 = 0;
+    r->rects = inlineRects;
+    r->size = inlineSize;
+    r->inlineRects = inlineRects;
+    r->inlineSize = inlineSize;
+    r->spare = NULL;
+    r->spareSize = 0;
+}
+
+void
+XFiniRegion(
+    Region r)
+{
+    if (r->rects != r->inlineRects)
+	Xfree(r->rects);
+    Xfree(r->spare);
+}
+
+int
+XReserveRegion(
+    Region r,
+    long n)
+{
+    BOX *newRects;
+
+    if (r->size >= n)
+	return 1;
+
+    if (r->rects == r->inlineRects) {
+	if (! (newRects = Xmalloc(n * sizeof(BOX))))
+	    return 0;
+	memcpy(newRects, r->rects, r->numRects * sizeof(BOX));
+    } else {
+	if (! (newRects = Xrealloc(r->rects, n * sizeof(BOX))))
+	    return 0;
+    }
+
+    r->rects = newRects;
+    r->size = n;
+    return 1;
+}
+
 int
 XClipBox(
     Region r,
@@ -187,6 +243,8 @@ XUnionRectWithRegion(
     region.extents.x2 = rect->x + rect->width;
     region.extents.y2 = rect->y + rect->height;
     region.size = 1;
+    region.inlineRects = NULL;
+    region.spare = NULL;
 
     return XUnionRegion(&region, source, dest);
 }
@@ -291,7 +349,7 @@ int
 XDestroyRegion(
     Region r)
 {
-    Xfree( (char *) r->rects );
+    XFiniRegion(r);
     Xfree( (char *) r );
     return 1;
 }
@@ -522,22 +580,8 @@ miRegionCopy(
 {
     if (dstrgn != rgn) /*  don't want to copy to itself */
     {
-        if (dstrgn->size < rgn->numRects)
-        {
-            if (dstrgn->rects)
-            {
-		BOX *prevRects = dstrgn->rects;
-
-		dstrgn->rects = Xrealloc(dstrgn->rects,
-					 rgn->numRects * (sizeof(BOX)));
-		if (! dstrgn->rects) {
-		    Xfree(prevRects);
-		    dstrgn->size = 0;
-		    return 0;
-		}
-            }
-            dstrgn->size = rgn->numRects;
-	}
+        if (! XReserveRegion(dstrgn, rgn->numRects))
+            return 0;
         dstrgn->numRects = rgn->numRects;
         dstrgn->extents.x1 = rgn->extents.x1;
         dstrgn->extents.y1 = rgn->extents.y1;
@@ -722,6 +766,12 @@ miCoalesce(
  *
  *-----------------------------------------------------------------------
  */
+/*
+ * Spare arrays larger than this are only kept if they are a reasonable
+ * fit for the region
+ */
+#define SPARE_LIMIT 256
+
 /* static void*/
 static void
 miRegionOp(
@@ -761,6 +811,8 @@ miRegionOp(
     register short  	ybot;	    	    	/* Bottom of intersection */
     register short  	ytop;	    	    	/* Top of intersection */
     BoxPtr  	  	oldRects;   	    	/* Old rects for newReg */
+    long    	  	oldSize;    	    	/* Size of oldRects */
+    long    	  	newSize;    	    	/* Initial size for newReg */
     int	    	  	prevBand;   	    	/* Index of start of
 						 * previous band in newReg */
     int	    	  	curBand;    	    	/* Index of start of current
@@ -785,6 +837,7 @@ miRegionOp(
     r2End = r2 + reg2->numRects;
 
     oldRects = newReg->rects;
+    oldSize = newReg->size;
 
     EMPTY_REGION(newReg);
 
@@ -792,14 +845,29 @@ miRegionOp(
      * Allocate a reasonable number of rectangles for the new region. The idea
      * is to allocate enough so the individual functions don't need to
      * reallocate and copy the array, which is time consuming, yet we don't
-     * have to worry about using too much memory. I hope to be able to
-     * nuke the Xrealloc() at the end of this function eventually.
+     * have to worry about using too much memory.
+     *
+     * The result is built in the array left over from the previous
+     * operation on this region, so a region that is operated on over
+     * and over soon stops needing the allocator at all.
      */
-    newReg->size = max(reg1->numRects,reg2->numRects) * 2;
-
-    if (! (newReg->rects = Xmalloc (sizeof(BoxRec) * newReg->size))) {
-	newReg->size = 0;
-	return;
+    newSize = max(reg1->numRects,reg2->numRects) * 2;
+
+    newReg->rects = newReg->spare;
+    newReg->size = newReg->spareSize;
+    newReg->spare = NULL;
+    newReg->spareSize = 0;
+
+    if (newReg->size < newSize) {
+	BoxPtr prev_rects = newReg->rects;
+	newReg->rects = Xrealloc (newReg->rects, sizeof(BoxRec) * newSize);
+	if (! newReg->rects) {
+	    Xfree(prev_rects);
+	    newReg->rects = oldRects;
+	    newReg->size = oldSize;
+	    return;
+	}
+	newReg->size = newSize;
     }
 
     /*
@@ -975,38 +1043,35 @@ miRegionOp(
     }
 
     /*
-     * A bit of cleanup. To keep regions from growing without bound,
-     * we shrink the array of rectangles to match the new number of
-     * rectangles in the region. This never goes to 0, however...
-     *
-     * Only do this stuff if the number of rectangles allocated is more than
-     * twice the number of rectangles in the region (a simple optimization...).
+     * A bit of cleanup. A result that fits in the storage embedded
+     * with the region is moved there. Whichever heap array is then not
+     * in use is kept for the next operation, unless it has grown far
+     * beyond what this region needs, so that regions don't keep
+     * hold of lots of memory after an unusually complex update.
      */
-    if (newReg->numRects < (newReg->size >> 1))
+    if (newReg->inlineRects && (newReg->numRects <= newReg->inlineSize))
     {
-	if (REGION_NOT_EMPTY(newReg))
-	{
-	    BoxPtr prev_rects = newReg->rects;
-	    newReg->rects = Xrealloc (newReg->rects,
-				      sizeof(BoxRec) * newReg->numRects);
-	    if (! newReg->rects)
-		newReg->rects = prev_rects;
-	    else
-		newReg->size = newReg->numRects;
-	}
-	else
-	{
-	    /*
-	     * No point in doing the extra work involved in an Xrealloc if
-	     * the region is empty
-	     */
-	    newReg->size = 1;
-	    Xfree(newReg->rects);
-	    newReg->rects = Xmalloc(sizeof(BoxRec));
-	}
+	memcpy(newReg->inlineRects, newReg->rects,
+	       newReg->numRects * sizeof(BoxRec));
+	if (oldRects != newReg->inlineRects)
+	    Xfree(oldRects);
+	oldRects = newReg->rects;
+	oldSize = newReg->size;
+	newReg->rects = newReg->inlineRects;
+	newReg->size = newReg->inlineSize;
+    }
+
+    if (oldRects == newReg->inlineRects)
+	return;
+
+    if ((oldSize > SPARE_LIMIT) && (oldSize > newReg->numRects * 4))
+    {
+	Xfree (oldRects);
+	return;
     }
-    Xfree (oldRects);
-    return;
+
+    newReg->spare = oldRects;
+    newReg->spareSize = oldSize;
 }
 
 
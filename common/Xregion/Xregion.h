@@ -48,9 +48,7 @@ SOFTWARE.
 #ifndef _X11_XREGION_H_
 #define _X11_XREGION_H_
 
-typedef struct {
-    short x1, x2, y1, y2;
-} Box, BOX, BoxRec, *BoxPtr;
+#include "Xregionstr.h"
 
 typedef struct {
     short x, y, width, height;
@@ -72,13 +70,6 @@ typedef struct {
  *   clip region
  */
 
-typedef struct _XRegion {
-    long size;
-    long numRects;
-    BOX *rects;
-    BOX extents;
-} REGION;
-
 /* Xutil.h contains the declaration:
  * typedef struct _XRegion *Region;
  */
@@ -187,4 +178,29 @@ typedef struct _POINTBLOCK {
     struct _POINTBLOCK *next;
 } POINTBLOCK;
 
+/*
+ * Regions embedded in other objects, with a few rectangles worth of
+ * storage of their own, are set up and torn down with these instead
+ * of XCreateRegion() and XDestroyRegion().
+ */
+#define XInitRegion vncXInitRegion
+#define XFiniRegion vncXFiniRegion
+#define XReserveRegion vncXReserveRegion
+
+extern void XInitRegion(
+    Region		/* r */,
+    BOX*		/* inlineRects */,
+    long		/* inlineSize */
+);
+
+extern void XFiniRegion(
+    Region		/* r */
+);
+
+/* Makes room for at least n rectangles, keeping the current ones */
+extern int XReserveRegion(
+    Region		/* r */,
+    long		/* n */
+);
+
 #endif /* _X11_XREGION_H_ */
@@ -0,0 +1,203 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <assert.h>
+
+#include <vector>
+
+#include <os/Mutex.h>
+#include <rdr/BufferPool.h>
+
+using namespace rdr;
+
+// Size classes go from MinSize to MaxSize, with four classes for every
+// doubling so that no more than a quarter of a buffer is wasted
+static const size_t MinSize = 1024;
+static const size_t MaxSize = 4 * 1024 * 1024;
+static const int NumClasses = 12 * 4 + 1;
+
+static const size_t DefaultBudget = 64 * 1024 * 1024;
+
+struct PoolState {
+  PoolState() : budget(DefaultBudget), inUse(0), cached(0) {}
+
+  os::Mutex mutex;
+  std::vector<U8*> freeBuffers[NumClasses];
+  size_t budget;
+  size_t inUse;
+  size_t cached;
+};
+
+// Buffers can be freed by static destructors, so the state has to
+// outlive everything else
+static PoolState& state()
+{
+  static PoolState* s = new PoolState();
+  return *s;
+}
+
+static size_t classSize(int index)
+{
+  size_t size, step;
+
+  size = MinSize;
+  step = MinSize / 4;
+
+  while (index--) {
+    size += step;
+    // Reached the next power of two?
+    if ((size & (size - 1)) == 0)
+      step = size / 4;
+  }
+
+  return size;
+}
+
+static int sizeClass(size_t* len)
+{
+  size_t size, step;
+  int index;
+
+  size = MinSize;
+  step = MinSize / 4;
+  index = 0;
+
+  while (size < *len) {
+    size += step;
+    index++;
+    if ((size & (size - 1)) == 0)
+      step = size / 4;
+  }
+
+  assert(index < NumClasses);
+
+  *len = size;
+  return index;
+}
+
+static void trim(PoolState* s)
+{
+  int index;
+
+  // Get rid of the biggest buffers first
+  index = NumClasses - 1;
+  while ((s->inUse + s->cached > s->budget) && (s->cached > 0)) {
+    if (s->freeBuffers[index].empty()) {
+      index--;
+      continue;
+    }
+
+    delete [] s->freeBuffers[index].back();
+    s->freeBuffers[index].pop_back();
+    s->cached -= classSize(index);
+  }
+}
+
+U8* BufferPool::alloc(size_t* len)
+{
+  PoolState& s = state();
+  int index;
+  U8* buf;
+
+  if (*len > MaxSize) {
+    os::AutoMutex a(&s.mutex);
+    buf = new U8[*len];
+    s.inUse += *len;
+    return buf;
+  }
+
+  index = sizeClass(len);
+
+  os::AutoMutex a(&s.mutex);
+
+  if (!s.freeBuffers[index].empty()) {
+    buf = s.freeBuffers[index].back();
+    s.freeBuffers[index].pop_back();
+    s.cached -= *len;
+  } else {
+    buf = new U8[*len];
+  }
+
+  s.inUse += *len;
+
+  return buf;
+}
+
+void BufferPool::free(U8* buf, size_t len)
+{
+  PoolState& s = state();
+  size_t size;
+  int index;
+
+  if (buf == NULL)
+    return;
+
+  os::AutoMutex a(&s.mutex);
+
+  assert(s.inUse >= len);
+  s.inUse -= len;
+
+  if ((len > MaxSize) || (s.inUse + s.cached + len > s.budget)) {
+    delete [] buf;
+    return;
+  }
+
+  size = len;
+  index = sizeClass(&size);
+  assert(size == len);
+
+  s.freeBuffers[index].push_back(buf);
+  s.cached += len;
+}
+
+void BufferPool::setBudget(size_t bytes)
+{
+  PoolState& s = state();
+
+  os::AutoMutex a(&s.mutex);
+
+  s.budget = bytes;
+  trim(&s);
+}
+
+bool BufferPool::overBudget()
+{
+  PoolState& s = state();
+
+  os::AutoMutex a(&s.mutex);
+
+  return s.inUse > s.budget;
+}
+
+size_t BufferPool::inUse()
+{
+  PoolState& s = state();
+
+  os::AutoMutex a(&s.mutex);
+
+  return s.inUse;
+}
+
+size_t BufferPool::cached()
+{
+  PoolState& s = state();
+
+  os::AutoMutex a(&s.mutex);
+
+  return s.cached;
+}
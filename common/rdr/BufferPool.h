@@ -0,0 +1,56 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// BufferPool hands out the scratch buffers that streams and encoders
+// grow on demand. Requests are rounded up to a size class, and freed
+// buffers are kept for reuse by anyone in the process for as long as
+// the pool stays within its budget. Beyond that they are given back to
+// the system. Buffers larger than the biggest size class are allocated
+// as is and never kept.
+//
+
+#ifndef __RDR_BUFFERPOOL_H__
+#define __RDR_BUFFERPOOL_H__
+
+#include <stddef.h>
+
+#include <rdr/types.h>
+
+namespace rdr {
+
+  class BufferPool {
+  public:
+    // alloc() returns a buffer of at least *len bytes, and updates
+    // *len with how big it really is. That size must be given back to
+    // free().
+    static U8* alloc(size_t* len);
+    static void free(U8* buf, size_t len);
+
+    // The budget covers both the buffers in use and the ones kept for
+    // reuse, in bytes
+    static void setBudget(size_t bytes);
+    static bool overBudget();
+
+    static size_t inUse();
+    static size_t cached();
+  };
+
+}
+
+#endif
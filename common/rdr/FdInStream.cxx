@@ -56,6 +56,10 @@ using namespace rdr;
 enum { DEFAULT_BUF_SIZE = 8192,
        MIN_BULK_SIZE = 1024 };
 
+// How long to back off when select() keeps saying there is something
+// to read but recv() disagrees
+enum { SPURIOUS_WAKEUP_DELAY = 10 };
+
 FdInStream::FdInStream(int fd_, int timeoutms_, int bufSize_,
                        bool closeWhenDone_)
   : fd(fd_), closeWhenDone(closeWhenDone_),
@@ -164,11 +168,13 @@ int FdInStream::overrun(int itemSize, int nItems, bool wait)
 // returned if no bytes can be read without blocking.  Otherwise if a
 // blockCallback is set, it will be called (repeatedly) instead of blocking.
 // If alternatively there is a timeout set and that timeout expires, it throws
-// a TimedOut exception.  Otherwise it returns the number of bytes read.  It
-// never attempts to recv() unless select() indicates that the fd is readable -
-// this means it can be used on an fd which has been set non-blocking.  It also
-// has to cope with the annoying possibility of both select() and recv()
-// returning EINTR.
+// a TimedOut exception.  Otherwise it returns the number of bytes read.
+// Where MSG_DONTWAIT is available it tries recv() straight away, as there is
+// usually data waiting when we get here, and only falls back to select() if
+// nothing could be read.  Elsewhere it never attempts to recv() unless
+// select() indicates that the fd is readable.  Either way it can be used on an
+// fd which has been set non-blocking.  It also has to cope with the annoying
+// possibility of both select() and recv() returning EINTR.
 //
 
 int FdInStream::readWithTimeoutOrCallback(void* buf, int len, bool wait)
@@ -178,7 +184,22 @@ int FdInStream::readWithTimeoutOrCallback(void* buf, int len, bool wait)
     gettimeofday(&before, 0);
 
   int n;
+#ifdef MSG_DONTWAIT
+  bool retried = false;
+  bool spurious = false;
+  struct timeval waitStart;
+#endif
   while (true) {
+#ifdef MSG_DONTWAIT
+    do {
+      n = ::recv(fd, (char*)buf, len, MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+
+    if (n >= 0) break;
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+      throw SystemException("read",errno);
+#endif
+
     do {
       fd_set fds;
       struct timeval tv;
@@ -198,18 +219,53 @@ int FdInStream::readWithTimeoutOrCallback(void* buf, int len, bool wait)
       n = select(fd+1, &fds, 0, 0, tvp);
     } while (n < 0 && errno == EINTR);
 
-    if (n > 0) break;
+    if (n > 0) {
+#ifdef MSG_DONTWAIT
+      // select() can also wake us up for things that recv() doesn't
+      // return (e.g. zero-copy completions on the error queue), and it
+      // will keep doing so. Give recv() one more go, after that treat
+      // it as if there was nothing to read so that we don't spin.
+      if (!retried) {
+        retried = true;
+        continue;
+      }
+      if (!spurious) {
+        gettimeofday(&waitStart, 0);
+        spurious = true;
+      }
+      n = 0;
+#else
+      do {
+        n = ::recv(fd, (char*)buf, len, 0);
+      } while (n < 0 && errno == EINTR);
+      break;
+#endif
+    }
     if (n < 0) throw SystemException("select",errno);
     if (!wait) return 0;
+#ifdef MSG_DONTWAIT
+    if (spurious && !blockCallback) {
+      struct timeval now, tv;
+
+      // Not a real timeout, so keep waiting for as long as one hasn't
+      // passed, just not in a busy loop
+      gettimeofday(&now, 0);
+      if ((timeoutms != -1) &&
+          ((now.tv_sec - waitStart.tv_sec) * 1000 +
+           (now.tv_usec - waitStart.tv_usec) / 1000 >= timeoutms))
+        throw TimedOut();
+
+      tv.tv_sec = 0;
+      tv.tv_usec = SPURIOUS_WAKEUP_DELAY * 1000;
+      select(0, 0, 0, 0, &tv);
+      continue;
+    }
+#endif
     if (!blockCallback) throw TimedOut();
 
     blockCallback->blockCallback();
   }
 
-  do {
-    n = ::recv(fd, (char*)buf, len, 0);
-  } while (n < 0 && errno == EINTR);
-
   if (n < 0) throw SystemException("read",errno);
   if (n == 0) throw EndOfStream();
 
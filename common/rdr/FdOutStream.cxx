@@ -35,6 +35,13 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define HAVE_ZEROCOPY
+#include <netinet/in.h>
+#include <linux/errqueue.h>
 #endif
 
 /* Old systems have select() in sys/time.h */
@@ -47,13 +54,37 @@
 #include <rfb/util.h>
 
 
+#ifdef _WIN32
+struct iovec {
+  void* iov_base;
+  size_t iov_len;
+};
+#endif
+
 using namespace rdr;
 
 enum { DEFAULT_BUF_SIZE = 16384 };
 
+// Limit on queued data before we consider the client hopelessly behind
+enum { MAX_BUFFER_USAGE = 64 * 1024 * 1024 };
+
+// Number of segments to gather in a single send
+enum { MAX_IOV = 64 };
+
+// Number of sent segments to keep around for reuse
+enum { MAX_SPARE_SEGMENTS = 4 };
+
+// Amount of data to gather before sending in non-blocking mode
+enum { MIN_BATCH_SIZE = 65536 };
+
+// Sends smaller than this are cheaper to copy than to pin and track
+enum { MIN_ZEROCOPY_SIZE = 65536 };
+
 FdOutStream::FdOutStream(int fd_, bool blocking_, int timeoutms_, int bufSize_)
   : fd(fd_), blocking(blocking_), timeoutms(timeoutms_),
-    bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0)
+    bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0),
+    pendingBytes(0), zeroCopy(false), zeroCopyNext(0), zeroCopyDone(0),
+    flushCallback(NULL)
 {
   ptr = start = sentUpTo = new U8[bufSize];
   end = start + bufSize;
@@ -65,9 +96,25 @@ FdOutStream::~FdOutStream()
 {
   try {
     blocking = true;
+    corked = false;
     flush();
   } catch (Exception&) {
   }
+
+  while (!pending.empty()) {
+    delete [] pending.front().start;
+    pending.pop_front();
+  }
+  while (!spare.empty()) {
+    delete [] spare.front();
+    spare.pop_front();
+  }
+  // The kernel holds its own references to the pages by now
+  while (!inflight.empty()) {
+    delete [] inflight.front().start;
+    inflight.pop_front();
+  }
+
   delete [] start;
 }
 
@@ -79,14 +126,34 @@ void FdOutStream::setBlocking(bool blocking_) {
   blocking = blocking_;
 }
 
+bool FdOutStream::setZeroCopy(bool enable)
+{
+#ifdef HAVE_ZEROCOPY
+  if (enable && !zeroCopy) {
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0)
+      return false;
+  }
+  zeroCopy = enable;
+  return true;
+#else
+  return !enable;
+#endif
+}
+
+void FdOutStream::setFlushCallback(FdOutStreamFlushCallback* flushCallback_)
+{
+  flushCallback = flushCallback_;
+}
+
 int FdOutStream::length()
 {
-  return offset + ptr - sentUpTo;
+  return offset + bufferUsage();
 }
 
 int FdOutStream::bufferUsage()
 {
-  return ptr - sentUpTo;
+  return pendingBytes + (ptr - sentUpTo);
 }
 
 unsigned FdOutStream::getIdleTime()
@@ -96,10 +163,48 @@ unsigned FdOutStream::getIdleTime()
 
 void FdOutStream::flush()
 {
-  while (sentUpTo < ptr) {
-    int n = writeWithTimeout((const void*) sentUpTo,
-                             ptr - sentUpTo,
-                             blocking? timeoutms : 0);
+  struct timeval flushStart, flushEnd;
+  int startOffset;
+
+  if (!inflight.empty())
+    reapZeroCopy();
+
+  // While corked, gather up small writes and send them in one go
+  if (corked && (bufferUsage() < MIN_BATCH_SIZE))
+    return;
+
+  if (flushCallback)
+    gettimeofday(&flushStart, NULL);
+  startOffset = offset;
+
+  while (bufferUsage() > 0) {
+    struct iovec iov[MAX_IOV];
+    std::list<Segment>::iterator iter;
+    bool useZeroCopy;
+    int iovcnt;
+
+    useZeroCopy = zeroCopy && (bufferUsage() >= MIN_ZEROCOPY_SIZE);
+
+    // The kernel keeps reading from what we give it, so the current
+    // segment must not be rewritten after the send
+    if (useZeroCopy && (ptr > sentUpTo))
+      newSegment();
+
+    iovcnt = 0;
+    for (iter = pending.begin();
+         (iter != pending.end()) && (iovcnt < MAX_IOV); ++iter) {
+      iov[iovcnt].iov_base = iter->sentUpTo;
+      iov[iovcnt].iov_len = iter->end - iter->sentUpTo;
+      iovcnt++;
+    }
+    if ((iovcnt < MAX_IOV) && (ptr > sentUpTo)) {
+      iov[iovcnt].iov_base = sentUpTo;
+      iov[iovcnt].iov_len = ptr - sentUpTo;
+      iovcnt++;
+    }
+
+    int n = writeWithTimeout(iov, iovcnt, blocking? timeoutms : 0,
+                             &useZeroCopy);
 
     // Timeout?
     if (n == 0) {
@@ -110,10 +215,27 @@ void FdOutStream::flush()
       throw TimedOut();
     }
 
-    sentUpTo += n;
+    if (useZeroCopy)
+      markZeroCopy(n);
+
+    consume(n);
     offset += n;
   }
 
+  if (flushCallback && (offset != startOffset)) {
+    long long usecs;
+
+    gettimeofday(&flushEnd, NULL);
+    usecs = (flushEnd.tv_sec - flushStart.tv_sec) * 1000000LL +
+            (flushEnd.tv_usec - flushStart.tv_usec);
+
+    // The clock might have been changed
+    if (usecs < 0)
+      usecs = 0;
+
+    flushCallback->flushCallback(usecs);
+  }
+
    // Managed to flush everything?
   if (sentUpTo == ptr)
     ptr = sentUpTo = start;
@@ -125,27 +247,27 @@ int FdOutStream::overrun(int itemSize, int nItems)
   if (itemSize > bufSize)
     throw Exception("FdOutStream overrun: max itemSize exceeded");
 
-  // First try to get rid of the data we have
-  flush();
+  // First try to get rid of the data we have, although when not
+  // blocking we gather a bit more first to save on system calls
+  if (blocking || (bufferUsage() >= MIN_BATCH_SIZE))
+    flush();
 
   // Still not enough space?
   if (itemSize > end - ptr) {
     // Can we shuffle things around?
     // (don't do this if it gains us less than 25%)
-    if ((sentUpTo - start > bufSize / 4) &&
+    if (pending.empty() &&
+        (sentUpTo - start > bufSize / 4) &&
         (itemSize < bufSize - (ptr - sentUpTo))) {
       memmove(start, sentUpTo, ptr - sentUpTo);
       ptr = start + (ptr - sentUpTo);
       sentUpTo = start;
     } else {
-      // Have to get rid of more data, so turn off non-blocking
-      // for a bit...
-      bool realBlocking;
-
-      realBlocking = blocking;
-      blocking = true;
-      flush();
-      blocking = realBlocking;
+      // Queue what we have rather than waiting for the socket
+      if (bufferUsage() + bufSize > MAX_BUFFER_USAGE)
+        throw Exception("FdOutStream overrun: too much data queued");
+
+      newSegment();
     }
   }
 
@@ -156,58 +278,239 @@ int FdOutStream::overrun(int itemSize, int nItems)
   return nItems;
 }
 
+void FdOutStream::newSegment()
+{
+  Segment segment;
+
+  segment.start = start;
+  segment.sentUpTo = sentUpTo;
+  segment.end = ptr;
+
+  segment.zeroCopy = false;
+  segment.zeroCopySeq = 0;
+  pending.push_back(segment);
+
+  pendingBytes += ptr - sentUpTo;
+
+  if (!spare.empty()) {
+    start = spare.front();
+    spare.pop_front();
+  } else {
+    start = new U8[bufSize];
+  }
+
+  ptr = sentUpTo = start;
+  end = start + bufSize;
+}
+
+void FdOutStream::consume(int n)
+{
+  while ((n > 0) && !pending.empty()) {
+    Segment& segment = pending.front();
+    int len;
+
+    len = segment.end - segment.sentUpTo;
+    if (n < len) {
+      segment.sentUpTo += n;
+      pendingBytes -= n;
+      return;
+    }
+
+    n -= len;
+    pendingBytes -= len;
+
+    if (segment.zeroCopy)
+      inflight.push_back(segment);
+    else
+      recycle(segment.start);
+
+    pending.pop_front();
+  }
+
+  sentUpTo += n;
+}
+
+void FdOutStream::recycle(U8* segment)
+{
+  if (spare.size() < MAX_SPARE_SEGMENTS)
+    spare.push_back(segment);
+  else
+    delete [] segment;
+}
+
+void FdOutStream::markZeroCopy(int n)
+{
+  std::list<Segment>::iterator iter;
+
+  for (iter = pending.begin(); (iter != pending.end()) && (n > 0); ++iter) {
+    iter->zeroCopy = true;
+    iter->zeroCopySeq = zeroCopyNext;
+    n -= iter->end - iter->sentUpTo;
+  }
+
+  // The kernel numbers every successful zero-copy send
+  zeroCopyNext++;
+}
+
+void FdOutStream::reapZeroCopy()
+{
+#ifdef HAVE_ZEROCOPY
+  while (true) {
+    struct msghdr msg;
+    struct cmsghdr* cmsg;
+    char control[256];
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+      break;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      struct sock_extended_err* serr;
+
+      if (!((cmsg->cmsg_level == SOL_IP) &&
+            (cmsg->cmsg_type == IP_RECVERR)) &&
+          !((cmsg->cmsg_level == SOL_IPV6) &&
+            (cmsg->cmsg_type == IPV6_RECVERR)))
+        continue;
+
+      serr = (struct sock_extended_err*)CMSG_DATA(cmsg);
+      if ((serr->ee_errno != 0) ||
+          (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY))
+        continue;
+
+      // Sends ee_info through ee_data are done, and TCP reports
+      // them in order
+      if ((int)(serr->ee_data + 1 - zeroCopyDone) > 0)
+        zeroCopyDone = serr->ee_data + 1;
+    }
+  }
+#endif
+
+  while (!inflight.empty()) {
+    if ((int)(inflight.front().zeroCopySeq - zeroCopyDone) >= 0)
+      break;
+    recycle(inflight.front().start);
+    inflight.pop_front();
+  }
+}
+
 //
 // writeWithTimeout() writes up to the given length in bytes from the given
-// buffer to the file descriptor.  If there is a timeout set and that timeout
+// buffers to the file descriptor.  If there is a timeout set and that timeout
 // expires, it throws a TimedOut exception.  Otherwise it returns the number of
-// bytes written.  It never attempts to send() unless select() indicates that
-// the fd is writable - this means it can be used on an fd which has been set
-// non-blocking.  It also has to cope with the annoying possibility of both
-// select() and send() returning EINTR.
+// bytes written.  Where MSG_DONTWAIT is available it tries to send() straight
+// away, as the socket is rarely full, and only waits in select() if nothing
+// could be sent.  Elsewhere it never attempts to send() unless select()
+// indicates that the fd is writable.  Either way it can be used on an fd
+// which has been set non-blocking.  It also has to cope with the annoying
+// possibility of both select() and send() returning EINTR.
 //
 
-int FdOutStream::writeWithTimeout(const void* data, int length, int timeoutms)
+int FdOutStream::writeWithTimeout(const struct iovec* iov, int iovcnt,
+                                  int timeoutms, bool* zeroCopy)
 {
   int n;
 
-  do {
-    fd_set fds;
-    struct timeval tv;
-    struct timeval* tvp = &tv;
+  while (true) {
+#ifdef MSG_DONTWAIT
+    n = sendData(iov, iovcnt, zeroCopy);
+    if (n >= 0)
+      break;
 
-    if (timeoutms != -1) {
-      tv.tv_sec = timeoutms / 1000;
-      tv.tv_usec = (timeoutms % 1000) * 1000;
-    } else {
-      tvp = NULL;
-    }
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+      throw SystemException("write", errno);
+
+    if (timeoutms == 0)
+      return 0;
+#endif
+
+    do {
+      fd_set fds;
+      struct timeval tv;
+      struct timeval* tvp = &tv;
+
+      if (timeoutms != -1) {
+        tv.tv_sec = timeoutms / 1000;
+        tv.tv_usec = (timeoutms % 1000) * 1000;
+      } else {
+        tvp = NULL;
+      }
 
-    FD_ZERO(&fds);
-    FD_SET(fd, &fds);
-    n = select(fd+1, 0, &fds, 0, tvp);
-  } while (n < 0 && errno == EINTR);
+      FD_ZERO(&fds);
+      FD_SET(fd, &fds);
+      n = select(fd+1, 0, &fds, 0, tvp);
+    } while (n < 0 && errno == EINTR);
 
-  if (n < 0)
-    throw SystemException("select", errno);
+    if (n < 0)
+      throw SystemException("select", errno);
 
-  if (n == 0)
-    return 0;
+    if (n == 0)
+      return 0;
+
+#ifndef MSG_DONTWAIT
+    n = sendData(iov, iovcnt, zeroCopy);
+    if (n < 0)
+      throw SystemException("write", errno);
+
+    break;
+#endif
+  }
+
+  gettimeofday(&lastWrite, NULL);
+
+  return n;
+}
+
+int FdOutStream::sendData(const struct iovec* iov, int iovcnt,
+                          bool* zeroCopy)
+{
+  int n;
 
   do {
+#ifdef _WIN32
+    // No gathering send here, so just send the first buffer
+    n = ::send(fd, (const char*)iov[0].iov_base, iov[0].iov_len, 0);
+    *zeroCopy = false;
+#else
+    struct msghdr msg;
+    int flags;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec*)iov;
+    msg.msg_iovlen = iovcnt;
+
     // select only guarantees that you can write SO_SNDLOWAT without
     // blocking, which is normally 1. Use MSG_DONTWAIT to avoid
     // blocking, when possible.
-#ifndef MSG_DONTWAIT
-    n = ::send(fd, (const char*)data, length, 0);
-#else
-    n = ::send(fd, (const char*)data, length, MSG_DONTWAIT);
+    flags = 0;
+#ifdef MSG_DONTWAIT
+    flags |= MSG_DONTWAIT;
 #endif
-  } while (n < 0 && (errno == EINTR));
 
-  if (n < 0)
-    throw SystemException("write", errno);
+#ifdef HAVE_ZEROCOPY
+    if (*zeroCopy) {
+      n = ::sendmsg(fd, &msg, flags | MSG_ZEROCOPY);
+      // Out of memory for pinning pages, so copy this time
+      if ((n < 0) && (errno == ENOBUFS))
+        *zeroCopy = false;
+      // Not supported on this socket (e.g. kernel TLS), so stop trying
+      else if ((n < 0) && (errno == EOPNOTSUPP)) {
+        *zeroCopy = false;
+        this->zeroCopy = false;
+      } else
+        continue;
+    }
+#else
+    *zeroCopy = false;
+#endif
 
-  gettimeofday(&lastWrite, NULL);
+    n = ::sendmsg(fd, &msg, flags);
+#endif
+  } while (n < 0 && (errno == EINTR));
 
   return n;
 }
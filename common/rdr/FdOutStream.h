@@ -20,16 +20,37 @@
 //
 // FdOutStream streams to a file descriptor.
 //
+// In non-blocking mode, data that cannot be sent right away is queued
+// in a chain of fixed size segments rather than blocking the caller.
+// The queue is written with a single gathering send whenever possible.
+//
+// On Linux, large sends can optionally use MSG_ZEROCOPY. The kernel
+// then keeps referring to our segments until it reports completion on
+// the socket error queue, so such segments are held back from reuse
+// until that happens.
+//
 
 #ifndef __RDR_FDOUTSTREAM_H__
 #define __RDR_FDOUTSTREAM_H__
 
 #include <sys/time.h>
 
+#include <list>
+
 #include <rdr/OutStream.h>
 
+struct iovec;
+
 namespace rdr {
 
+  class FdOutStreamFlushCallback {
+  public:
+    // Called after every flush() that wrote anything, with how long it
+    // took in microseconds
+    virtual void flushCallback(unsigned long long usecs) = 0;
+    virtual ~FdOutStreamFlushCallback() {}
+  };
+
   class FdOutStream : public OutStream {
 
   public:
@@ -41,6 +62,13 @@ namespace rdr {
     void setBlocking(bool blocking);
     int getFd() { return fd; }
 
+    // Use zero-copy sends for large amounts of queued data, if the
+    // platform and socket support it. Returns false if they don't.
+    bool setZeroCopy(bool enable);
+    bool getZeroCopy() { return zeroCopy; }
+
+    void setFlushCallback(FdOutStreamFlushCallback* flushCallback);
+
     void flush();
     int length();
 
@@ -50,7 +78,31 @@ namespace rdr {
 
   private:
     int overrun(int itemSize, int nItems);
-    int writeWithTimeout(const void* data, int length, int timeoutms);
+    int writeWithTimeout(const struct iovec* iov, int iovcnt,
+                         int timeoutms, bool* zeroCopy);
+    int sendData(const struct iovec* iov, int iovcnt, bool* zeroCopy);
+
+    // Queue the current segment and continue in an empty one
+    void newSegment();
+    // Drop n sent bytes from the front of the queue
+    void consume(int n);
+    // Keep a sent segment for reuse, or free it
+    void recycle(U8* segment);
+
+    // Note which queued segments the last n bytes were sent from
+    void markZeroCopy(int n);
+    // Collect completion notifications and release finished segments
+    void reapZeroCopy();
+
+    struct Segment {
+      U8* start;
+      U8* sentUpTo;
+      U8* end;
+      // Sequence number of the last zero-copy send using this segment
+      bool zeroCopy;
+      unsigned zeroCopySeq;
+    };
+
     int fd;
     bool blocking;
     int timeoutms;
@@ -59,6 +111,22 @@ namespace rdr {
     U8* start;
     U8* sentUpTo;
     struct timeval lastWrite;
+
+    // Full segments waiting to be sent, oldest first, all queued
+    // before the current one (start..ptr)
+    std::list<Segment> pending;
+    int pendingBytes;
+
+    // Sent segments kept for reuse
+    std::list<U8*> spare;
+
+    // Sent segments the kernel may still be reading from
+    bool zeroCopy;
+    unsigned zeroCopyNext;
+    unsigned zeroCopyDone;
+    std::list<Segment> inflight;
+
+    FdOutStreamFlushCallback* flushCallback;
   };
 
 }
@@ -0,0 +1,134 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <rdr/KernelTLS.h>
+
+#ifdef HAVE_GNUTLS
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#endif
+
+#if defined(__linux__) && defined(TCP_ULP) && defined(SOL_TLS) && \
+    defined(TLS_1_3_VERSION) && (GNUTLS_VERSION_NUMBER >= 0x030603)
+#define HAVE_KTLS
+#endif
+
+using namespace rdr;
+
+#ifdef HAVE_KTLS
+
+template<class T>
+static bool setCryptoInfo(int fd, bool receive, unsigned short version,
+                          unsigned short cipher, const gnutls_datum_t& key,
+                          const gnutls_datum_t& iv, const unsigned char* seq)
+{
+  T info;
+
+  memset(&info, 0, sizeof(info));
+  info.info.version = version;
+  info.info.cipher_type = cipher;
+
+  if (key.size != sizeof(info.key))
+    return false;
+  memcpy(info.key, key.data, sizeof(info.key));
+
+  // The salt is the implicit part of the nonce. TLS 1.2 sends the
+  // rest with each record, starting from the sequence number, whilst
+  // TLS 1.3 takes it from the IV.
+  if (iv.size < sizeof(info.salt))
+    return false;
+  memcpy(info.salt, iv.data, sizeof(info.salt));
+
+  if ((version == TLS_1_2_VERSION) && (sizeof(info.salt) != 0)) {
+    memcpy(info.iv, seq, sizeof(info.iv));
+  } else {
+    if (iv.size != sizeof(info.salt) + sizeof(info.iv))
+      return false;
+    memcpy(info.iv, iv.data + sizeof(info.salt), sizeof(info.iv));
+  }
+
+  memcpy(info.rec_seq, seq, sizeof(info.rec_seq));
+
+  // Fails with EEXIST if the other direction got there first
+  if ((setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) &&
+      (errno != EEXIST))
+    return false;
+
+  if (setsockopt(fd, SOL_TLS, receive ? TLS_RX : TLS_TX,
+                 &info, sizeof(info)) < 0)
+    return false;
+
+  return true;
+}
+
+#endif
+
+bool rdr::enableKernelTLS(gnutls_session_t session, int fd, bool receive)
+{
+#ifdef HAVE_KTLS
+  gnutls_datum_t mac, iv, key;
+  unsigned char seq[8];
+  unsigned short version;
+
+  switch (gnutls_protocol_get_version(session)) {
+  case GNUTLS_TLS1_2:
+    version = TLS_1_2_VERSION;
+    break;
+  case GNUTLS_TLS1_3:
+    version = TLS_1_3_VERSION;
+    break;
+  default:
+    return false;
+  }
+
+  if (gnutls_record_get_state(session, receive ? 1 : 0,
+                              &mac, &iv, &key, seq) < 0)
+    return false;
+
+  switch (gnutls_cipher_get(session)) {
+  case GNUTLS_CIPHER_AES_128_GCM:
+    return setCryptoInfo<struct tls12_crypto_info_aes_gcm_128>(
+      fd, receive, version, TLS_CIPHER_AES_GCM_128, key, iv, seq);
+  case GNUTLS_CIPHER_AES_256_GCM:
+    return setCryptoInfo<struct tls12_crypto_info_aes_gcm_256>(
+      fd, receive, version, TLS_CIPHER_AES_GCM_256, key, iv, seq);
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+  case GNUTLS_CIPHER_CHACHA20_POLY1305:
+    return setCryptoInfo<struct tls12_crypto_info_chacha20_poly1305>(
+      fd, receive, version, TLS_CIPHER_CHACHA20_POLY1305, key, iv, seq);
+#endif
+  default:
+    return false;
+  }
+#else
+  return false;
+#endif
+}
+
+#endif
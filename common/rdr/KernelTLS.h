@@ -0,0 +1,45 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// enableKernelTLS() hands one direction of an established GnuTLS
+// session over to the kernel (Linux kTLS), so that plain data written
+// to or read from the socket is encrypted or decrypted there. It only
+// succeeds for the AEAD ciphers the kernel knows about, and returns
+// false if the platform, the kernel or the socket does not support it,
+// in which case the session is left untouched.
+//
+
+#ifndef __RDR_KERNELTLS_H__
+#define __RDR_KERNELTLS_H__
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_GNUTLS
+#include <gnutls/gnutls.h>
+
+namespace rdr {
+
+  bool enableKernelTLS(gnutls_session_t session, int fd, bool receive);
+
+}
+
+#endif
+#endif
@@ -23,6 +23,7 @@
 #ifndef __RDR_MEMOUTSTREAM_H__
 #define __RDR_MEMOUTSTREAM_H__
 
+#include <rdr/BufferPool.h>
 #include <rdr/OutStream.h>
 
 namespace rdr {
@@ -32,12 +33,13 @@ namespace rdr {
   public:
 
     MemOutStream(int len=1024) {
-      start = ptr = new U8[len];
-      end = start + len;
+      size_t size = len;
+      start = ptr = BufferPool::alloc(&size);
+      end = start + size;
     }
 
     virtual ~MemOutStream() {
-      delete [] start;
+      BufferPool::free(start, end - start);
     }
 
     void writeBytes(const void* data, int length) {
@@ -55,6 +57,20 @@ namespace rdr {
 
     const void* data() { return (const void*)start; }
 
+    // capacity() is how much memory the buffer currently holds.
+
+    size_t capacity() { return end - start; }
+
+    // release() discards the contents and gives a grown buffer back to
+    // the pool, leaving a minimal one.
+
+    void release() {
+      size_t size = 0;
+      BufferPool::free(start, end - start);
+      start = ptr = BufferPool::alloc(&size);
+      end = start + size;
+    }
+
   protected:
 
     // overrun() either doubles the buffer or adds enough space for nItems of
@@ -65,12 +81,13 @@ namespace rdr {
       if (len < (end - start) * 2)
         len = (end - start) * 2;
 
-      U8* newStart = new U8[len];
+      size_t size = len;
+      U8* newStart = BufferPool::alloc(&size);
       memcpy(newStart, start, ptr - start);
       ptr = newStart + (ptr - start);
-      delete [] start;
+      BufferPool::free(start, end - start);
       start = newStart;
-      end = newStart + len;
+      end = newStart + size;
 
       return nItems;
     }
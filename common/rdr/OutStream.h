@@ -34,7 +34,7 @@ namespace rdr {
 
   protected:
 
-    OutStream() {}
+    OutStream() : corked(false) {}
 
   public:
 
@@ -130,6 +130,11 @@ namespace rdr {
 
     virtual void flush() {}
 
+    // cork() requests that the stream holds back small flushes until it
+    // is uncorked again, at which point everything is flushed.
+
+    virtual void cork(bool enable) { corked = enable; if (!enable) flush(); }
+
     // getptr(), getend() and setptr() are "dirty" methods which allow you to
     // manipulate the buffer directly.  This is useful for a stream which is a
     // wrapper around an underlying stream.
@@ -151,6 +156,8 @@ namespace rdr {
 
     U8* ptr;
     U8* end;
+
+    bool corked;
   };
 
 }
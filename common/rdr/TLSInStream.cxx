@@ -23,6 +23,8 @@
 #endif
 
 #include <rdr/Exception.h>
+#include <rdr/FdInStream.h>
+#include <rdr/KernelTLS.h>
 #include <rdr/TLSException.h>
 #include <rdr/TLSInStream.h>
 #include <errno.h>
@@ -37,6 +39,12 @@ ssize_t TLSInStream::pull(gnutls_transport_ptr_t str, void* data, size_t size)
   TLSInStream* self= (TLSInStream*) str;
   InStream *in = self->in;
 
+  // The kernel has already decrypted whatever is in there
+  if (self->offloaded) {
+    gnutls_transport_set_errno(self->session, EIO);
+    return -1;
+  }
+
   try {
     if (!in->check(1, 1, false)) {
       gnutls_transport_set_errno(self->session, EAGAIN);
@@ -57,7 +65,8 @@ ssize_t TLSInStream::pull(gnutls_transport_ptr_t str, void* data, size_t size)
 }
 
 TLSInStream::TLSInStream(InStream* _in, gnutls_session_t _session)
-  : session(_session), in(_in), bufSize(DEFAULT_BUF_SIZE), offset(0)
+  : session(_session), in(_in), bufSize(DEFAULT_BUF_SIZE), offset(0),
+    offloaded(false)
 {
   gnutls_transport_ptr_t recv, send;
 
@@ -77,14 +86,51 @@ TLSInStream::~TLSInStream()
 
 int TLSInStream::pos()
 {
+  if (offloaded)
+    return offset + in->pos() + (ptr - in->getptr());
+
   return offset + ptr - start;
 }
 
+bool TLSInStream::offload()
+{
+  FdInStream* fdin;
+
+  fdin = dynamic_cast<FdInStream*>(in);
+  if (!fdin)
+    return false;
+
+  // Records that have already been read can't be given back
+  if ((ptr != end) || (in->getptr() != in->getend()) ||
+      (gnutls_record_check_pending(session) != 0))
+    return false;
+
+  if (!enableKernelTLS(session, fdin->getFd(), true))
+    return false;
+
+  offset = pos() - in->pos();
+  offloaded = true;
+  ptr = in->getptr();
+  end = in->getend();
+
+  return true;
+}
+
 int TLSInStream::overrun(int itemSize, int nItems, bool wait)
 {
   if (itemSize > bufSize)
     throw Exception("TLSInStream overrun: max itemSize exceeded");
 
+  // Anything other than application data (e.g. an alert) makes the
+  // kernel fail the read, which ends the connection
+  if (offloaded) {
+    in->setptr(ptr);
+    nItems = in->check(itemSize, nItems, wait);
+    ptr = in->getptr();
+    end = in->getend();
+    return nItems;
+  }
+
   if (end - ptr != 0)
     memmove(start, ptr, end - ptr);
 
@@ -38,6 +38,11 @@ namespace rdr {
 
     int pos();
 
+    // Let the kernel decrypt from now on, reading straight from the
+    // underlying stream. Only possible if nothing has been read ahead.
+    bool offload();
+    bool isOffloaded() { return offloaded; }
+
   private:
     int overrun(int itemSize, int nItems, bool wait);
     int readTLS(U8* buf, int len, bool wait);
@@ -48,6 +53,9 @@ namespace rdr {
     int bufSize;
     int offset;
     U8* start;
+
+    // With offloading, ptr and end refer to the buffer of in
+    bool offloaded;
   };
 };
 
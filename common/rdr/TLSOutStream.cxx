@@ -23,13 +23,18 @@
 #endif
 
 #include <rdr/Exception.h>
+#include <rdr/FdOutStream.h>
+#include <rdr/KernelTLS.h>
 #include <rdr/TLSException.h>
 #include <rdr/TLSOutStream.h>
+#include <rfb/LogWriter.h>
 #include <errno.h>
 
 #ifdef HAVE_GNUTLS
 using namespace rdr;
 
+static rfb::LogWriter vlog("TLSOutStream");
+
 enum { DEFAULT_BUF_SIZE = 16384 };
 
 ssize_t TLSOutStream::push(gnutls_transport_ptr_t str, const void* data,
@@ -38,6 +43,12 @@ ssize_t TLSOutStream::push(gnutls_transport_ptr_t str, const void* data,
   TLSOutStream* self= (TLSOutStream*) str;
   OutStream *out = self->out;
 
+  // GnuTLS no longer knows the state of the sending side
+  if (self->offloaded) {
+    gnutls_transport_set_errno(self->session, EIO);
+    return -1;
+  }
+
   try {
     out->writeBytes(data, size);
     out->flush();
@@ -50,7 +61,8 @@ ssize_t TLSOutStream::push(gnutls_transport_ptr_t str, const void* data,
 }
 
 TLSOutStream::TLSOutStream(OutStream* _out, gnutls_session_t _session)
-  : session(_session), out(_out), bufSize(DEFAULT_BUF_SIZE), offset(0)
+  : session(_session), out(_out), bufSize(DEFAULT_BUF_SIZE), offset(0),
+    records(0), recordBytes(0), offloaded(false)
 {
   gnutls_transport_ptr_t recv, send;
 
@@ -72,33 +84,67 @@ TLSOutStream::~TLSOutStream()
 #endif
   gnutls_transport_set_push_function(session, NULL);
 
+  if (records > 0) {
+    vlog.debug("Sent %llu bytes in %u records (%llu bytes per record)",
+               recordBytes, records, recordBytes / records);
+  }
+
   delete [] start;
 }
 
 int TLSOutStream::length()
 {
+  if (offloaded)
+    return offset + out->length() + (ptr - out->getptr());
+
   return offset + ptr - start;
 }
 
 void TLSOutStream::flush()
 {
-  U8* sentUpTo = start;
-  while (sentUpTo < ptr) {
-    int n = writeTLS(sentUpTo, ptr - sentUpTo);
-    sentUpTo += n;
-    offset += n;
+  if (offloaded) {
+    out->setptr(ptr);
+    out->flush();
+    ptr = out->getptr();
+    end = out->getend();
+    return;
   }
 
-  ptr = start;
+  if (corked)
+    return;
+
+  writeBuffer();
   out->flush();
 }
 
+void TLSOutStream::cork(bool enable)
+{
+  OutStream::cork(enable);
+
+  if (offloaded)
+    out->setptr(ptr);
+  out->cork(enable);
+  if (offloaded) {
+    ptr = out->getptr();
+    end = out->getend();
+  }
+}
+
 int TLSOutStream::overrun(int itemSize, int nItems)
 {
   if (itemSize > bufSize)
     throw Exception("TLSOutStream overrun: max itemSize exceeded");
 
-  flush();
+  if (offloaded) {
+    out->setptr(ptr);
+    nItems = out->check(itemSize, nItems);
+    ptr = out->getptr();
+    end = out->getend();
+    return nItems;
+  }
+
+  // The buffer holds exactly one full size record
+  writeBuffer();
 
   if (itemSize * nItems > end - ptr)
     nItems = (end - ptr) / itemSize;
@@ -106,6 +152,56 @@ int TLSOutStream::overrun(int itemSize, int nItems)
   return nItems;
 }
 
+bool TLSOutStream::offload()
+{
+  FdOutStream* fdout;
+  bool zeroCopy;
+
+  fdout = dynamic_cast<FdOutStream*>(out);
+  if (!fdout)
+    return false;
+
+  // Everything encrypted so far has to be on its way before the
+  // kernel takes over, so we can't let it linger in a corked stream
+  writeBuffer();
+  out->cork(false);
+  if (corked)
+    out->cork(true);
+
+  // Anything still queued has already been encrypted
+  if (fdout->bufferUsage() > 0)
+    return false;
+
+  // The kernel's TLS sendmsg() refuses MSG_ZEROCOPY, so that has to
+  // be turned off before the socket changes under the stream's feet
+  zeroCopy = fdout->getZeroCopy();
+  fdout->setZeroCopy(false);
+
+  if (!enableKernelTLS(session, fdout->getFd(), false)) {
+    fdout->setZeroCopy(zeroCopy);
+    return false;
+  }
+
+  offset = length() - out->length();
+  offloaded = true;
+  ptr = out->getptr();
+  end = out->getend();
+
+  return true;
+}
+
+void TLSOutStream::writeBuffer()
+{
+  U8* sentUpTo = start;
+  while (sentUpTo < ptr) {
+    int n = writeTLS(sentUpTo, ptr - sentUpTo);
+    sentUpTo += n;
+    offset += n;
+  }
+
+  ptr = start;
+}
+
 int TLSOutStream::writeTLS(const U8* data, int length)
 {
   int n;
@@ -117,6 +213,9 @@ int TLSOutStream::writeTLS(const U8* data, int length)
   if (n < 0)
     throw TLSException("writeTLS", n);
 
+  records++;
+  recordBytes += n;
+
   return n;
 }
 
@@ -38,10 +38,20 @@ namespace rdr {
     void flush();
     int length();
 
+    // Partial records are held back whilst corked, so that small
+    // writes end up in full size records
+    virtual void cork(bool enable);
+
+    // Let the kernel encrypt from now on, writing straight through to
+    // the underlying stream. Returns false if that isn't possible.
+    bool offload();
+    bool isOffloaded() { return offloaded; }
+
   protected:
     int overrun(int itemSize, int nItems);
 
   private:
+    void writeBuffer();
     int writeTLS(const U8* data, int length);
     static ssize_t push(gnutls_transport_ptr_t str, const void* data, size_t size);
 
@@ -50,6 +60,13 @@ namespace rdr {
     int bufSize;
     U8* start;
     int offset;
+
+    // For statistics
+    unsigned records;
+    unsigned long long recordBytes;
+
+    // With offloading, ptr and end refer to the buffer of out
+    bool offloaded;
   };
 };
 
@@ -66,8 +66,27 @@ void ZlibInStream::removeUnderlying()
 
 void ZlibInStream::reset()
 {
-  deinit();
-  init();
+  removeUnderlying();
+
+  // Keep the allocated state and window around for the next stream
+  if (inflateReset(zs) != Z_OK)
+    throw Exception("ZlibInStream: inflateReset failed");
+}
+
+int ZlibInStream::detach()
+{
+  int left;
+
+  left = bytesIn;
+
+  ptr = end = start;
+  underlying = 0;
+  bytesIn = 0;
+
+  if (inflateReset(zs) != Z_OK)
+    throw Exception("ZlibInStream: inflateReset failed");
+
+  return left;
 }
 
 void ZlibInStream::init()
@@ -127,17 +146,33 @@ int ZlibInStream::overrun(int itemSize, int nItems, bool wait)
 
 bool ZlibInStream::decompress(bool wait)
 {
+  int rc;
+
   zs->next_out = (U8*)end;
   zs->avail_out = start + bufSize - end;
 
-  int n = underlying->check(1, 1, wait);
-  if (n == 0) return false;
-  zs->next_in = (U8*)underlying->getptr();
-  zs->avail_in = underlying->getend() - underlying->getptr();
-  if ((int)zs->avail_in > bytesIn)
-    zs->avail_in = bytesIn;
+  while (true) {
+    zs->next_in = (U8*)underlying->getptr();
+    zs->avail_in = underlying->getend() - underlying->getptr();
+    if ((int)zs->avail_in > bytesIn)
+      zs->avail_in = bytesIn;
+
+    // zlib can have output left over from earlier input that didn't
+    // fit in the buffer, so it gets to go first even if there is no
+    // new input. It tells us if it can't do anything without more.
+    rc = inflate(zs, Z_SYNC_FLUSH);
+    if (rc != Z_BUF_ERROR)
+      break;
+
+    // Never read beyond the compressed data, as that is someone
+    // else's
+    if (bytesIn == 0)
+      throw Exception("ZlibInStream: not enough compressed data");
+
+    if (underlying->check(1, 1, wait) == 0)
+      return false;
+  }
 
-  int rc = inflate(zs, Z_SYNC_FLUSH);
   if (rc != Z_OK) {
     throw Exception("ZlibInStream: inflate failed");
   }
@@ -41,6 +41,10 @@ namespace rdr {
     void removeUnderlying();
     int pos();
     void reset();
+    // Like reset(), but leaves whatever is left of the compressed data
+    // in the underlying stream. Returns how much that is, for the
+    // caller to skip.
+    int detach();
 
   private:
 
@@ -18,7 +18,9 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 
+#include <rdr/BufferPool.h>
 #include <rdr/ZlibOutStream.h>
 #include <rdr/Exception.h>
 #include <rfb/LogWriter.h>
@@ -33,33 +35,79 @@ using namespace rdr;
 
 enum { DEFAULT_BUF_SIZE = 16384 };
 
+// zlib doesn't tell us the size of what it frees, so we keep it in
+// front of every allocation. Two words keep the alignment.
+static voidpf zlibAlloc(voidpf opaque, uInt items, uInt size)
+{
+  size_t* block;
+
+  block = (size_t*)malloc(sizeof(size_t) * 2 + (size_t)items * size);
+  if (block == NULL)
+    return Z_NULL;
+
+  block[0] = (size_t)items * size;
+  *(size_t*)opaque += block[0];
+
+  return block + 2;
+}
+
+static void zlibFree(voidpf opaque, voidpf address)
+{
+  size_t* block;
+
+  block = (size_t*)address - 2;
+  *(size_t*)opaque -= block[0];
+
+  free(block);
+}
+
 ZlibOutStream::ZlibOutStream(OutStream* os, int bufSize_, int compressLevel)
   : underlying(os), compressionLevel(compressLevel), newLevel(compressLevel),
-    bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0)
+    bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0),
+    zs(NULL), zlibMemory(0), start(NULL)
 {
-  zs = new z_stream;
-  zs->zalloc    = Z_NULL;
-  zs->zfree     = Z_NULL;
-  zs->opaque    = Z_NULL;
-  zs->next_in   = Z_NULL;
-  zs->avail_in  = 0;
-  if (deflateInit(zs, compressLevel) != Z_OK) {
-    delete zs;
-    throw Exception("ZlibOutStream: deflateInit failed");
-  }
-  ptr = start = new U8[bufSize];
-  end = start + bufSize;
+  // The compression state is set up on first use
+  ptr = end = NULL;
 }
 
 ZlibOutStream::~ZlibOutStream()
 {
+  if (zs == NULL)
+    return;
+
   try {
     flush();
   } catch (Exception&) {
   }
-  delete [] start;
-  deflateEnd(zs);
-  delete zs;
+  release();
+}
+
+void ZlibOutStream::init()
+{
+  size_t size;
+
+  if (zs != NULL)
+    return;
+
+  // Any level change is picked up by the new stream right away
+  compressionLevel = newLevel;
+
+  zs = new z_stream;
+  zs->zalloc    = zlibAlloc;
+  zs->zfree     = zlibFree;
+  zs->opaque    = &zlibMemory;
+  zs->next_in   = Z_NULL;
+  zs->avail_in  = 0;
+  if (deflateInit(zs, compressionLevel) != Z_OK) {
+    delete zs;
+    zs = NULL;
+    throw Exception("ZlibOutStream: deflateInit failed");
+  }
+
+  size = bufSize;
+  ptr = start = BufferPool::alloc(&size);
+  bufSize = size;
+  end = start + bufSize;
 }
 
 void ZlibOutStream::setUnderlying(OutStream* os)
@@ -82,6 +130,7 @@ int ZlibOutStream::length()
 
 void ZlibOutStream::flush()
 {
+  init();
   checkCompressionLevel();
 
   zs->next_in = start;
@@ -98,6 +147,35 @@ void ZlibOutStream::flush()
   ptr = start;
 }
 
+void ZlibOutStream::reset()
+{
+  flush();
+
+  if (deflateReset(zs) != Z_OK)
+    throw Exception("ZlibOutStream: deflateReset failed");
+}
+
+size_t ZlibOutStream::memoryUsage()
+{
+  if (zs == NULL)
+    return 0;
+
+  return zlibMemory + bufSize;
+}
+
+void ZlibOutStream::release()
+{
+  if (zs == NULL)
+    return;
+
+  deflateEnd(zs);
+  delete zs;
+  zs = NULL;
+
+  BufferPool::free(start, bufSize);
+  ptr = start = end = NULL;
+}
+
 int ZlibOutStream::overrun(int itemSize, int nItems)
 {
 #ifdef ZLIBOUT_DEBUG
@@ -107,6 +185,13 @@ int ZlibOutStream::overrun(int itemSize, int nItems)
   if (itemSize > bufSize)
     throw Exception("ZlibOutStream overrun: max itemSize exceeded");
 
+  if (zs == NULL) {
+    init();
+    if (itemSize * nItems > end - ptr)
+      nItems = (end - ptr) / itemSize;
+    return nItems;
+  }
+
   checkCompressionLevel();
 
   while (end - ptr < itemSize) {
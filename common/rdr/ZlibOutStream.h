@@ -43,8 +43,23 @@ namespace rdr {
     void flush();
     int length();
 
+    // reset() flushes any pending data and then starts a new zlib
+    // stream, reusing the existing compression state.
+    void reset();
+
+    // memoryUsage() is how much memory the buffer and zlib's
+    // compression state currently hold.
+    size_t memoryUsage();
+
+    // release() frees all memory, throwing away the compression state.
+    // Any later data starts a new zlib stream, so the other end has to
+    // be told to reset its stream as well. There must be no pending
+    // data.
+    void release();
+
   private:
 
+    void init();
     int overrun(int itemSize, int nItems);
     void deflate(int flush);
     void checkCompressionLevel();
@@ -55,6 +70,7 @@ namespace rdr {
     int bufSize;
     int offset;
     z_stream_s* zs;
+    size_t zlibMemory;
     U8* start;
   };
 
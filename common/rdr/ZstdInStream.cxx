@@ -0,0 +1,170 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_ZSTD
+
+#include <assert.h>
+#include <string.h>
+
+#include <rdr/ZstdInStream.h>
+#include <rdr/Exception.h>
+
+#include <zstd.h>
+
+using namespace rdr;
+
+enum { DEFAULT_BUF_SIZE = 65536 };
+
+// Largest history window we accept from the peer
+enum { WINDOW_LOG_MAX = 23 };
+
+ZstdInStream::ZstdInStream(int bufSize_)
+  : underlying(0), bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0),
+    ds(NULL), bytesIn(0), pending(false)
+{
+  ptr = end = start = new U8[bufSize];
+  init();
+}
+
+ZstdInStream::~ZstdInStream()
+{
+  deinit();
+  delete [] start;
+}
+
+void ZstdInStream::setUnderlying(InStream* is, int bytesIn_)
+{
+  underlying = is;
+  bytesIn = bytesIn_;
+  ptr = end = start;
+}
+
+int ZstdInStream::pos()
+{
+  return offset + ptr - start;
+}
+
+void ZstdInStream::removeUnderlying()
+{
+  ptr = end = start;
+  if (!underlying) return;
+
+  while ((bytesIn > 0) || pending) {
+    decompress(true);
+    end = start; // throw away any data
+  }
+  underlying = 0;
+}
+
+void ZstdInStream::reset()
+{
+  deinit();
+  init();
+}
+
+void ZstdInStream::init()
+{
+  assert(ds == NULL);
+
+  ds = ZSTD_createDCtx();
+  if (ds == NULL)
+    throw Exception("ZstdInStream: ZSTD_createDCtx failed");
+
+  ZSTD_DCtx_setParameter(ds, ZSTD_d_windowLogMax, WINDOW_LOG_MAX);
+}
+
+void ZstdInStream::deinit()
+{
+  assert(ds != NULL);
+  removeUnderlying();
+  ZSTD_freeDCtx(ds);
+  ds = NULL;
+  pending = false;
+}
+
+int ZstdInStream::overrun(int itemSize, int nItems, bool wait)
+{
+  if (itemSize > bufSize)
+    throw Exception("ZstdInStream overrun: max itemSize exceeded");
+  if (!underlying)
+    throw Exception("ZstdInStream overrun: no underlying stream");
+
+  if (end - ptr != 0)
+    memmove(start, ptr, end - ptr);
+
+  offset += ptr - start;
+  end -= ptr - start;
+  ptr = start;
+
+  while (end - ptr < itemSize) {
+    if (!decompress(wait))
+      return 0;
+  }
+
+  if (itemSize * nItems > end - ptr)
+    nItems = (end - ptr) / itemSize;
+
+  return nItems;
+}
+
+// decompress() calls the decompressor once.  Note that this won't necessarily
+// generate any output data - it may just consume some input data.  Returns
+// false if wait is false and we would block on the underlying stream.
+
+bool ZstdInStream::decompress(bool wait)
+{
+  ZSTD_inBuffer in;
+  ZSTD_outBuffer out;
+  size_t rc;
+
+  out.dst = (U8*)end;
+  out.size = start + bufSize - end;
+  out.pos = 0;
+
+  // zstd may be holding on to output from input it has already
+  // consumed, so we might not need anything from the underlying stream
+  in.src = NULL;
+  in.size = 0;
+  in.pos = 0;
+  if (bytesIn > 0) {
+    int n = underlying->check(1, 1, wait);
+    if (n == 0) return false;
+    in.src = underlying->getptr();
+    in.size = underlying->getend() - underlying->getptr();
+    if ((int)in.size > bytesIn)
+      in.size = bytesIn;
+  } else if (!pending) {
+    throw Exception("ZstdInStream: not enough compressed data");
+  }
+
+  rc = ZSTD_decompressStream(ds, &out, &in);
+  if (ZSTD_isError(rc))
+    throw Exception("ZstdInStream: decompression failed: %s",
+                    ZSTD_getErrorName(rc));
+
+  bytesIn -= in.pos;
+  underlying->setptr(underlying->getptr() + in.pos);
+  end += out.pos;
+
+  // A full output buffer means there might be more to come
+  pending = (out.pos == out.size);
+
+  return true;
+}
+
+#endif
@@ -0,0 +1,151 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_ZSTD
+
+#include <rdr/ZstdOutStream.h>
+#include <rdr/Exception.h>
+
+#include <zstd.h>
+
+using namespace rdr;
+
+enum { DEFAULT_BUF_SIZE = 65536 };
+
+// Size of the history window, large enough to cover a full 1080p
+// frame at 24 bits per pixel. The decoder has to be able to hold this
+// much, so it is part of the protocol.
+enum { WINDOW_LOG = 23 };
+
+ZstdOutStream::ZstdOutStream(OutStream* os, int bufSize_, int compressLevel)
+  : underlying(os), compressionLevel(compressLevel), newLevel(compressLevel),
+    bufSize(bufSize_ ? bufSize_ : DEFAULT_BUF_SIZE), offset(0)
+{
+  cs = ZSTD_createCCtx();
+  if (cs == NULL)
+    throw Exception("ZstdOutStream: ZSTD_createCCtx failed");
+
+  ZSTD_CCtx_setParameter(cs, ZSTD_c_compressionLevel, compressionLevel);
+  ZSTD_CCtx_setParameter(cs, ZSTD_c_windowLog, WINDOW_LOG);
+  ZSTD_CCtx_setParameter(cs, ZSTD_c_enableLongDistanceMatching, 1);
+
+  ptr = start = new U8[bufSize];
+  end = start + bufSize;
+}
+
+ZstdOutStream::~ZstdOutStream()
+{
+  try {
+    flush();
+  } catch (Exception&) {
+  }
+  delete [] start;
+  ZSTD_freeCCtx(cs);
+}
+
+void ZstdOutStream::setUnderlying(OutStream* os)
+{
+  underlying = os;
+}
+
+void ZstdOutStream::setCompressionLevel(int level)
+{
+  if (level < 1 || level > 19)
+    level = 1;
+
+  newLevel = level;
+}
+
+int ZstdOutStream::length()
+{
+  return offset + ptr - start;
+}
+
+size_t ZstdOutStream::memoryUsage()
+{
+  return bufSize + ZSTD_sizeof_CCtx(cs);
+}
+
+void ZstdOutStream::flush()
+{
+  // The level can only be changed between frames, and ending a frame
+  // throws away the history, so only do so when asked to
+  if (newLevel != compressionLevel) {
+    compress(ZSTD_e_end);
+    ZSTD_CCtx_setParameter(cs, ZSTD_c_compressionLevel, newLevel);
+    compressionLevel = newLevel;
+  } else {
+    compress(ZSTD_e_flush);
+  }
+
+  offset += ptr - start;
+  ptr = start;
+}
+
+int ZstdOutStream::overrun(int itemSize, int nItems)
+{
+  if (itemSize > bufSize)
+    throw Exception("ZstdOutStream overrun: max itemSize exceeded");
+
+  while (end - ptr < itemSize) {
+    compress(ZSTD_e_continue);
+    offset += ptr - start;
+    ptr = start;
+  }
+
+  if (itemSize * nItems > end - ptr)
+    nItems = (end - ptr) / itemSize;
+
+  return nItems;
+}
+
+void ZstdOutStream::compress(int mode)
+{
+  ZSTD_inBuffer in;
+  size_t rc;
+
+  if (!underlying)
+    throw Exception("ZstdOutStream: underlying OutStream has not been set");
+
+  in.src = start;
+  in.size = ptr - start;
+  in.pos = 0;
+
+  if ((mode == ZSTD_e_continue) && (in.size == 0))
+    return;
+
+  // Keep going until all input has been consumed, and for flushes
+  // until zstd reports that nothing is left in its internal buffers
+  do {
+    ZSTD_outBuffer out;
+
+    underlying->check(1);
+    out.dst = underlying->getptr();
+    out.size = underlying->getend() - underlying->getptr();
+    out.pos = 0;
+
+    rc = ZSTD_compressStream2(cs, &out, &in, (ZSTD_EndDirective)mode);
+    if (ZSTD_isError(rc))
+      throw Exception("ZstdOutStream: compression failed: %s",
+                      ZSTD_getErrorName(rc));
+
+    underlying->setptr((U8*)out.dst + out.pos);
+  } while ((in.pos < in.size) || ((mode != ZSTD_e_continue) && (rc != 0)));
+}
+
+#endif
@@ -0,0 +1,70 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// ZstdOutStream streams to a compressed data stream (underlying),
+// compressing with zstd on the fly. The compression context is kept
+// for the lifetime of the stream so that later data can refer back to
+// anything within the window, and long distance matching is enabled so
+// that repeated content far apart (e.g. a previous frame) is found.
+//
+
+#ifndef __RDR_ZSTDOUTSTREAM_H__
+#define __RDR_ZSTDOUTSTREAM_H__
+
+#include <stddef.h>
+
+#include <rdr/OutStream.h>
+
+struct ZSTD_CCtx_s;
+
+namespace rdr {
+
+  class ZstdOutStream : public OutStream {
+
+  public:
+
+    ZstdOutStream(OutStream* os=0, int bufSize=0, int compressionLevel=1);
+    virtual ~ZstdOutStream();
+
+    void setUnderlying(OutStream* os);
+    void setCompressionLevel(int level=1);
+    void flush();
+    int length();
+
+    // memoryUsage() is how much memory the buffer and the compression
+    // context currently hold.
+    size_t memoryUsage();
+
+  private:
+
+    int overrun(int itemSize, int nItems);
+    void compress(int mode);
+
+    OutStream* underlying;
+    int compressionLevel;
+    int newLevel;
+    int bufSize;
+    int offset;
+    ZSTD_CCtx_s* cs;
+    U8* start;
+  };
+
+} // end of namespace rdr
+
+#endif
@@ -724,6 +724,7 @@ void CConnection::updateEncodings()
     encodings.push_back(pseudoEncodingVMwareCursor);
     encodings.push_back(pseudoEncodingCursor);
     encodings.push_back(pseudoEncodingXCursor);
+    encodings.push_back(pseudoEncodingCursorCache);
   }
   if (supportsDesktopResize) {
     encodings.push_back(pseudoEncodingDesktopSize);
@@ -741,6 +742,9 @@ void CConnection::updateEncodings()
   encodings.push_back(pseudoEncodingFence);
   encodings.push_back(pseudoEncodingQEMUKeyEvent);
 
+  if (Decoder::supported(encodingZstd))
+    encodings.push_back(pseudoEncodingZstd);
+
   if (Decoder::supported(preferredEncoding)) {
     encodings.push_back(preferredEncoding);
   }
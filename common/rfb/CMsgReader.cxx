@@ -33,14 +33,16 @@
 
 static rfb::LogWriter vlog("CMsgReader");
 
-static rfb::IntParameter maxCutText("MaxCutText", "Maximum permitted length of an incoming clipboard update", 256*1024);
+static rfb::IntParameter maxCutText("MaxCutText", "Maximum permitted length of an incoming clipboard update", 1024*1024);
 
 using namespace rfb;
 
 CMsgReader::CMsgReader(CMsgHandler* handler_, rdr::InStream* is_)
   : imageBufIdealSize(0), handler(handler_), is(is_),
-    nUpdateRectsLeft(0)
+    nUpdateRectsLeft(0), cursorCacheStoreSlot(-1)
 {
+  for (int i = 0;i < cursorCacheSlots;i++)
+    cursorCache[i].valid = false;
 }
 
 CMsgReader::~CMsgReader()
@@ -108,6 +110,9 @@ void CMsgReader::readMsg()
     case pseudoEncodingVMwareCursor:
       readSetVMwareCursor(w, h, Point(x,y));
       break;
+    case pseudoEncodingCursorCache:
+      readCursorCache(w, h, Point(x,y));
+      break;
     case pseudoEncodingDesktopName:
       readSetDesktopName(x, y, w, h);
       break;
@@ -375,7 +380,7 @@ void CMsgReader::readSetXCursor(int width, int height, const Point& hotspot)
     }
   }
 
-  handler->setCursor(width, height, hotspot, rgba.buf);
+  setCursor(width, height, hotspot, rgba.buf);
 }
 
 void CMsgReader::readSetCursor(int width, int height, const Point& hotspot)
@@ -416,7 +421,7 @@ void CMsgReader::readSetCursor(int width, int height, const Point& hotspot)
     }
   }
 
-  handler->setCursor(width, height, hotspot, rgba.buf);
+  setCursor(width, height, hotspot, rgba.buf);
 }
 
 void CMsgReader::readSetCursorWithAlpha(int width, int height, const Point& hotspot)
@@ -461,8 +466,8 @@ void CMsgReader::readSetCursorWithAlpha(int width, int height, const Point& hots
 
   pb.commitBufferRW(pb.getRect());
 
-  handler->setCursor(width, height, hotspot,
-                     pb.getBuffer(pb.getRect(), &stride));
+  setCursor(width, height, hotspot,
+            pb.getBuffer(pb.getRect(), &stride));
 }
 
 void CMsgReader::readSetVMwareCursor(int width, int height, const Point& hotspot)
@@ -540,19 +545,70 @@ void CMsgReader::readSetVMwareCursor(int width, int height, const Point& hotspot
       }
     }
 
-    handler->setCursor(width, height, hotspot, data.buf);
+    setCursor(width, height, hotspot, data.buf);
   } else if (type == 1) {
     rdr::U8Array data(width*height*4);
 
     // FIXME: Is alpha premultiplied?
     is->readBytes(data.buf, width*height*4);
 
-    handler->setCursor(width, height, hotspot, data.buf);
+    setCursor(width, height, hotspot, data.buf);
   } else {
     throw Exception("Unknown cursor type");
   }
 }
 
+void CMsgReader::readCursorCache(int width, int height, const Point& hotspot)
+{
+  rdr::U8 op;
+  rdr::U32 slot;
+
+  op = is->readU8();
+  slot = is->readU32();
+
+  if (slot >= (rdr::U32)cursorCacheSlots)
+    throw Exception("Invalid cursor cache slot %u", (unsigned)slot);
+
+  switch (op) {
+  case cursorCacheStore:
+    cursorCacheStoreSlot = slot;
+    break;
+  case cursorCacheUse:
+    {
+      const CursorCacheEntry* entry;
+
+      entry = &cursorCache[slot];
+      if (!entry->valid)
+        throw Exception("Empty cursor cache slot %u", (unsigned)slot);
+
+      handler->setCursor(entry->width, entry->height, entry->hotspot,
+                         entry->data.empty() ? NULL : &entry->data[0]);
+    }
+    break;
+  default:
+    throw Exception("Unknown cursor cache operation %d", (int)op);
+  }
+}
+
+void CMsgReader::setCursor(int width, int height, const Point& hotspot,
+                           const rdr::U8* data)
+{
+  if (cursorCacheStoreSlot >= 0) {
+    CursorCacheEntry* entry;
+
+    entry = &cursorCache[cursorCacheStoreSlot];
+    entry->valid = true;
+    entry->width = width;
+    entry->height = height;
+    entry->hotspot = hotspot;
+    entry->data.assign(data, data + width*height*4);
+
+    cursorCacheStoreSlot = -1;
+  }
+
+  handler->setCursor(width, height, hotspot, data);
+}
+
 void CMsgReader::readSetDesktopName(int x, int y, int w, int h)
 {
   char* name = is->readString();
@@ -24,9 +24,12 @@
 #ifndef __RFB_CMSGREADER_H__
 #define __RFB_CMSGREADER_H__
 
+#include <vector>
+
 #include <rdr/types.h>
 
 #include <rfb/Rect.h>
+#include <rfb/cursorCacheTypes.h>
 #include <rfb/encodings.h>
 
 namespace rdr { class InStream; }
@@ -65,15 +68,31 @@ namespace rfb {
     void readSetCursor(int width, int height, const Point& hotspot);
     void readSetCursorWithAlpha(int width, int height, const Point& hotspot);
     void readSetVMwareCursor(int width, int height, const Point& hotspot);
+    void readCursorCache(int width, int height, const Point& hotspot);
     void readSetDesktopName(int x, int y, int w, int h);
     void readExtendedDesktopSize(int x, int y, int w, int h);
     void readLEDState();
     void readVMwareLEDState();
 
+    void setCursor(int width, int height, const Point& hotspot,
+                   const rdr::U8* data);
+
     CMsgHandler* handler;
     rdr::InStream* is;
     int nUpdateRectsLeft;
 
+    // Cursors the server has asked us to keep, and the slot for the
+    // next cursor shape if it is to be kept
+    struct CursorCacheEntry {
+      bool valid;
+      int width, height;
+      Point hotspot;
+      std::vector<rdr::U8> data;
+    };
+
+    CursorCacheEntry cursorCache[cursorCacheSlots];
+    int cursorCacheStoreSlot;
+
     static const int maxCursorSize = 256;
   };
 }
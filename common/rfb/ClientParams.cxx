@@ -136,6 +136,10 @@ void ClientParams::setEncodings(int nEncodings, const rdr::S32* encodings)
 
     encodings_.insert(encodings[i]);
   }
+
+  // Someone else might mean something different by the Zstd number
+  if (encodings_.count(pseudoEncodingZstd) == 0)
+    encodings_.erase(encodingZstd);
 }
 
 void ClientParams::setLEDState(unsigned int state)
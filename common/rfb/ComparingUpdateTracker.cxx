@@ -28,8 +28,8 @@ using namespace rfb;
 static LogWriter vlog("ComparingUpdateTracker");
 
 ComparingUpdateTracker::ComparingUpdateTracker(PixelBuffer* buffer)
-  : fb(buffer), oldFb(fb->getPF(), 0, 0), firstCompare(true),
-    enabled(true), totalPixels(0), missedPixels(0)
+  : fb(buffer), fbRect(fb->getRect()), oldFb(fb->getPF(), 0, 0),
+    firstCompare(true), enabled(true), totalPixels(0), missedPixels(0)
 {
     changed.assign_union(fb->getRect());
 }
@@ -43,8 +43,7 @@ ComparingUpdateTracker::~ComparingUpdateTracker()
 
 bool ComparingUpdateTracker::compare()
 {
-  std::vector<Rect> rects;
-  std::vector<Rect>::iterator i;
+  Region::const_iterator i;
 
   if (!enabled)
     return false;
@@ -62,25 +61,33 @@ bool ComparingUpdateTracker::compare()
     }
 
     firstCompare = false;
+    exposed.clear();
 
     return false;
   }
 
-  copied.get_rects(&rects, copy_delta.x<=0, copy_delta.y<=0);
-  for (i = rects.begin(); i != rects.end(); i++)
+  for (i = copied.begin(copy_delta.x<=0, copy_delta.y<=0);
+       i != copied.end(); ++i)
     oldFb.copyRect(*i, copy_delta);
 
-  changed.get_rects(&rects);
+  // Areas exposed by a resize have never been sent, so there is
+  // nothing to compare them with
+  for (i = exposed.begin(); i != exposed.end(); ++i) {
+    int srcStride;
+    const rdr::U8* srcData = fb->getBuffer(*i, &srcStride);
+    oldFb.imageRect(*i, srcData, srcStride);
+  }
 
-  Region newChanged;
-  for (i = rects.begin(); i != rects.end(); i++)
+  Region newChanged = changed.intersect(exposed);
+  Region compared = changed.subtract(exposed);
+  for (i = compared.begin(); i != compared.end(); ++i)
     compareRect(*i, &newChanged);
 
-  changed.get_rects(&rects);
-  for (i = rects.begin(); i != rects.end(); i++)
+  exposed.clear();
+
+  for (i = changed.begin(); i != changed.end(); ++i)
     totalPixels += i->area();
-  newChanged.get_rects(&rects);
-  for (i = rects.begin(); i != rects.end(); i++)
+  for (i = newChanged.begin(); i != newChanged.end(); ++i)
     missedPixels += i->area();
 
   if (changed.equals(newChanged))
@@ -104,6 +111,40 @@ void ComparingUpdateTracker::disable()
   firstCompare = true;
 }
 
+void ComparingUpdateTracker::resize(PixelBuffer* buffer)
+{
+  Rect oldRect, newRect;
+  Region newArea;
+  Region::const_iterator i;
+  rdr::U32 black;
+
+  oldRect = fbRect;
+  newRect = buffer->getRect();
+  black = 0;
+
+  fb = buffer;
+  fbRect = newRect;
+
+  intersect(newRect);
+
+  newArea = Region(newRect).subtract(oldRect);
+  add_changed(newArea);
+
+  // Nothing to preserve if the next compare() starts afresh anyway
+  if (firstCompare)
+    return;
+
+  oldFb.resize(fb->width(), fb->height());
+
+  // Viewers start out with black in new areas, so keep mirroring them
+  // in case something gets copied from there before the next compare()
+  for (i = newArea.begin(); i != newArea.end(); ++i)
+    oldFb.fillRect(*i, &black);
+
+  exposed.assign_intersect(newRect);
+  exposed.assign_union(newArea);
+}
+
 void ComparingUpdateTracker::compareRect(const Rect& r, Region* newChanged)
 {
   if (!r.enclosed_by(fb->getRect())) {
@@ -41,12 +41,21 @@ namespace rfb {
     virtual void enable();
     virtual void disable();
 
+    // resize() switches to a buffer of a different size, whose contents
+    // are the same as the old one where they overlap. Only the newly
+    // exposed area is marked as changed. The old buffer is not accessed,
+    // so it may already be gone or be the same object as the new one.
+
+    void resize(PixelBuffer* buffer);
+
     void logStats();
 
   private:
     void compareRect(const Rect& r, Region* newchanged);
     PixelBuffer* fb;
+    Rect fbRect;
     ManagedPixelBuffer oldFb;
+    Region exposed;
     bool firstCompare;
     bool enabled;
 
@@ -21,6 +21,7 @@
 #include <rfb/Cursor.h>
 #include <rfb/LogWriter.h>
 #include <rfb/Exception.h>
+#include <rfb/PixelFormatSIMD.h>
 
 using namespace rfb;
 
@@ -245,6 +246,7 @@ void Cursor::crop()
 }
 
 RenderedCursor::RenderedCursor()
+  : blendWidth(0), blendHeight(0)
 {
 }
 
@@ -293,22 +295,135 @@ void RenderedCursor::update(PixelBuffer* framebuffer,
   buffer.imageRect(buffer.getRect(), data, stride);
 
   diff = offset.subtract(rawOffset);
-  for (int y = 0;y < buffer.height();y++) {
-    for (int x = 0;x < buffer.width();x++) {
-      size_t idx;
-      rdr::U8 bg[4], fg[4];
-      rdr::U8 rgb[3];
 
-      idx = (y+diff.y)*cursor->width() + (x+diff.x);
-      memcpy(fg, cursor->getBuffer() + idx*4, 4);
+  if (format.is888())
+    blend888(cursor, diff);
+  else
+    blendGeneric(cursor, diff);
+}
+
+void RenderedCursor::prepareBlend(const Cursor* cursor)
+{
+  size_t size;
+  const rdr::U8* src;
+  rdr::U8 *invAlpha, *premul;
+
+  size = cursor->width() * cursor->height() * 4;
+
+  if ((blendWidth == cursor->width()) &&
+      (blendHeight == cursor->height()) &&
+      blendFormat.equal(format) &&
+      (memcmp(&blendSource[0], cursor->getBuffer(), size) == 0))
+    return;
+
+  blendFormat = format;
+  blendWidth = cursor->width();
+  blendHeight = cursor->height();
+  blendSource.assign(cursor->getBuffer(), cursor->getBuffer() + size);
+  blendInvAlpha.resize(size);
+  blendPremul.resize(size);
+
+  src = cursor->getBuffer();
+  invAlpha = &blendInvAlpha[0];
+  premul = &blendPremul[0];
+
+  // Transparent pixels keep the framebuffer as it is, and everything
+  // else gets the padding cleared, just as bufferFromRGB() does
+  for (size_t i = 0;i < size / 4;i++) {
+    rdr::U8 rgb[3], a;
+
+    a = src[3];
+
+    if (a == 0x00) {
+      memset(invAlpha, 0xff, 4);
+      memset(premul, 0, 4);
+    } else {
+      // FIXME: Gamma aware blending
+      for (int j = 0;j < 3;j++)
+        rgb[j] = 255 - a;
+      format.bufferFromRGB(invAlpha, rgb, 1);
+
+      for (int j = 0;j < 3;j++)
+        rgb[j] = (unsigned)src[j]*a/255;
+      format.bufferFromRGB(premul, rgb, 1);
+    }
+
+    src += 4;
+    invAlpha += 4;
+    premul += 4;
+  }
+}
+
+void RenderedCursor::blend888(const Cursor* cursor, const Point& diff)
+{
+  Rect rect;
+  rdr::U8* data;
+  int stride;
+
+  const rdr::U8 *invAlpha, *premul;
+  int done;
+
+  prepareBlend(cursor);
+
+  rect = buffer.getRect();
+  data = buffer.getBufferRW(rect, &stride);
+
+  invAlpha = &blendInvAlpha[(diff.y * cursor->width() + diff.x) * 4];
+  premul = &blendPremul[(diff.y * cursor->width() + diff.x) * 4];
+
+  done = simdBlend32(data, invAlpha, premul, rect.width(), rect.height(),
+                     stride, cursor->width());
 
-      if (fg[3] == 0x00)
+  for (int y = 0;y < rect.height();y++) {
+    rdr::U8* dst;
+    const rdr::U8 *ia, *pm;
+
+    dst = data + (y * stride + done) * 4;
+    ia = invAlpha + (y * cursor->width() + done) * 4;
+    pm = premul + (y * cursor->width() + done) * 4;
+
+    for (int i = 0;i < (rect.width() - done) * 4;i++)
+      dst[i] = (unsigned)dst[i]*ia[i]/255 + pm[i];
+  }
+
+  buffer.commitBufferRW(rect);
+}
+
+void RenderedCursor::blendGeneric(const Cursor* cursor, const Point& diff)
+{
+  Rect rect;
+  rdr::U8* data;
+  int stride;
+
+  int bytesPerPixel;
+  std::vector<rdr::U8> rgbRow;
+
+  rect = buffer.getRect();
+  data = buffer.getBufferRW(rect, &stride);
+
+  bytesPerPixel = format.bpp/8;
+  rgbRow.resize(rect.width() * 3);
+
+  for (int y = 0;y < rect.height();y++) {
+    rdr::U8* row;
+    const rdr::U8* fg;
+
+    row = data + y * stride * bytesPerPixel;
+    fg = cursor->getBuffer() + ((y + diff.y) * cursor->width() + diff.x) * 4;
+
+    format.rgbFromBuffer(&rgbRow[0], row, rect.width());
+
+    for (int x = 0;x < rect.width();x++) {
+      rdr::U8* rgb;
+
+      rgb = &rgbRow[x * 3];
+
+      if (fg[3] == 0x00) {
+        fg += 4;
         continue;
-      else if (fg[3] == 0xff) {
+      } else if (fg[3] == 0xff) {
         memcpy(rgb, fg, 3);
       } else {
-        buffer.getImage(bg, Rect(x, y, x+1, y+1));
-        format.rgbFromBuffer(rgb, bg, 1);
         // FIXME: Gamma aware blending
         for (int i = 0;i < 3;i++) {
           rgb[i] = (unsigned)rgb[i]*(255-fg[3])/255 +
@@ -316,8 +431,11 @@ void RenderedCursor::update(PixelBuffer* framebuffer,
         }
       }
 
-      format.bufferFromRGB(bg, rgb, 1);
-      buffer.imageRect(Rect(x, y, x+1, y+1), bg);
+      format.bufferFromRGB(row + x * bytesPerPixel, rgb, 1);
+
+      fg += 4;
     }
   }
+
+  buffer.commitBufferRW(rect);
 }
@@ -24,6 +24,8 @@
 #ifndef __RFB_CURSOR_H__
 #define __RFB_CURSOR_H__
 
+#include <vector>
+
 #include <rfb/PixelBuffer.h>
 
 namespace rfb {
@@ -65,8 +67,21 @@ namespace rfb {
     void update(PixelBuffer* framebuffer, Cursor* cursor, const Point& pos);
 
   protected:
+    void prepareBlend(const Cursor* cursor);
+    void blend888(const Cursor* cursor, const Point& diff);
+    void blendGeneric(const Cursor* cursor, const Point& diff);
+
     ManagedPixelBuffer buffer;
     Point offset;
+
+    // The cursor image prepared for blending into an 888 framebuffer,
+    // i.e. an inverse alpha and a premultiplied colour for every byte
+    // of every pixel. Kept until the cursor or the format changes.
+    PixelFormat blendFormat;
+    int blendWidth, blendHeight;
+    std::vector<rdr::U8> blendSource;
+    std::vector<rdr::U8> blendInvAlpha;
+    std::vector<rdr::U8> blendPremul;
   };
 
 }
@@ -26,6 +26,8 @@
 #include <rfb/HextileDecoder.h>
 #include <rfb/ZRLEDecoder.h>
 #include <rfb/TightDecoder.h>
+#include <rfb/ZstdDecoder.h>
+#include <rfb/H264Decoder.h>
 
 using namespace rfb;
 
@@ -61,6 +63,12 @@ bool Decoder::supported(int encoding)
   case encodingHextile:
   case encodingZRLE:
   case encodingTight:
+#ifdef HAVE_ZSTD
+  case encodingZstd:
+#endif
+#ifdef HAVE_H264
+  case encodingH264:
+#endif
     return true;
   default:
     return false;
@@ -82,6 +90,14 @@ Decoder* Decoder::createDecoder(int encoding)
     return new ZRLEDecoder();
   case encodingTight:
     return new TightDecoder();
+#ifdef HAVE_ZSTD
+  case encodingZstd:
+    return new ZstdDecoder();
+#endif
+#ifdef HAVE_H264
+  case encodingH264:
+    return new H264Decoder();
+#endif
   default:
     return NULL;
   }
@@ -21,6 +21,11 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
+
+#include <rdr/BufferPool.h>
+
+#include <rfb/Configuration.h>
 #include <rfb/EncodeManager.h>
 #include <rfb/Encoder.h>
 #include <rfb/Palette.h>
@@ -28,6 +33,7 @@
 #include <rfb/SMsgWriter.h>
 #include <rfb/UpdateTracker.h>
 #include <rfb/LogWriter.h>
+#include <rfb/util.h>
 
 #include <rfb/RawEncoder.h>
 #include <rfb/RREEncoder.h>
@@ -35,11 +41,33 @@
 #include <rfb/ZRLEEncoder.h>
 #include <rfb/TightEncoder.h>
 #include <rfb/TightJPEGEncoder.h>
+#include <rfb/ZstdEncoder.h>
+#include <rfb/H264Encoder.h>
 
 using namespace rfb;
 
 static LogWriter vlog("EncodeManager");
 
+IntParameter compressLevelRange("CompressLevelRange",
+                                "How far the compression level may be "
+                                "moved from what the client asked for, "
+                                "to balance CPU time against network "
+                                "speed (0 to disable)", 2, 0, 9);
+IntParameter scratchMemoryLimit("ScratchMemoryLimit",
+                                "Memory in MiB that encoding buffers of all "
+                                "connections may use before idle connections "
+                                "are made to give theirs back early",
+                                64, 0);
+IntParameter scratchIdleTime("ScratchIdleTime",
+                             "Seconds a connection must be idle before its "
+                             "encoding buffers are freed (0 to disable)",
+                             10, 0);
+IntParameter refineQuality("RefineQuality",
+                           "JPEG quality level that lossy areas below it "
+                           "are first brought up to, before they are "
+                           "refreshed losslessly (-1 to disable)",
+                           8, -1, 9);
+
 // Split each rectangle into smaller ones no larger than this area,
 // and no wider than this width.
 static const int SubRectMaxArea = 65536;
@@ -54,6 +82,38 @@ static const int SolidBlockMinArea = 2048;
 // How long we consider a region recently changed (in ms)
 static const int RecentChangeTimeout = 50;
 
+// Refreshes are picked in tiles of this size, closest to the pointer
+// first
+static const int RefreshTileSize = 64;
+// Conservative guesses at the compression ratio of the refresh steps
+static const int RefineCompressionRatio = 4;
+static const int LosslessCompressionRatio = 2;
+
+// An area has to keep changing for this long (in ms), at least this
+// often (in frames per second), before it is treated as video
+static const unsigned VideoDetectTime = 1000;
+static const unsigned VideoMinFrameRate = 10;
+// How long video has to stay still before it is considered stopped
+static const unsigned VideoStopTime = 500;
+// Don't bother with video smaller than this
+static const int VideoMinArea = 160 * 120;
+
+// How often the compression level is reconsidered (in ms)
+static const unsigned CompressAdaptInterval = 1000;
+
+// How long a connection has to be idle (in ms) before giving back its
+// encoding buffers when over the memory limit
+static const int PressureReleaseTime = 1000;
+
+// Full colour areas are classified as synthetic or natural content
+// in tiles of this size
+static const int ClassifyTileSize = 16;
+// Neighbouring pixels that differ more than this (summed over the
+// channels) form an edge
+static const int ClassifyEdgeThreshold = 96;
+// Tiles with this many colours or fewer are always synthetic
+static const int ClassifyMaxSyntheticColours = 8;
+
 namespace rfb {
 
 enum EncoderClass {
@@ -63,6 +123,8 @@ enum EncoderClass {
   encoderTight,
   encoderTightJPEG,
   encoderZRLE,
+  encoderZstd,
+  encoderH264,
   encoderClassMax,
 };
 
@@ -81,6 +143,21 @@ struct RectInfo {
   Palette palette;
 };
 
+struct RefreshTile {
+  Rect rect;
+  unsigned distance;
+
+  bool operator<(const RefreshTile& other) const {
+    return distance < other.distance;
+  }
+};
+
+enum ContentClass {
+  contentNatural,
+  contentSynthetic,
+  contentChanging,
+};
+
 };
 
 static const char *encoderClassName(EncoderClass klass)
@@ -98,6 +175,10 @@ static const char *encoderClassName(EncoderClass klass)
     return "Tight (JPEG)";
   case encoderZRLE:
     return "ZRLE";
+  case encoderZstd:
+    return "Zstd";
+  case encoderH264:
+    return "H.264";
   case encoderClassMax:
     break;
   }
@@ -128,7 +209,10 @@ static const char *encoderTypeName(EncoderType type)
 }
 
 EncodeManager::EncodeManager(SConnection* conn_)
-  : conn(conn_), recentChangeTimer(this)
+  : conn(conn_), recentChangeTimer(this), releaseTimer(this),
+    videoCandidateFrames(0), compressLevel(-1),
+    linkBandwidth(0), adaptEncodeTime(0), adaptBytes(0),
+    compressLevelChanges(0), peakMemory(0)
 {
   StatsVector::iterator iter;
 
@@ -141,16 +225,29 @@ EncodeManager::EncodeManager(SConnection* conn_)
   encoders[encoderTight] = new TightEncoder(conn);
   encoders[encoderTightJPEG] = new TightJPEGEncoder(conn);
   encoders[encoderZRLE] = new ZRLEEncoder(conn);
+#ifdef HAVE_ZSTD
+  encoders[encoderZstd] = new ZstdEncoder(conn);
+#endif
+#ifdef HAVE_H264
+  encoders[encoderH264] = new H264Encoder(conn);
+#endif
 
   updates = 0;
   memset(&copyStats, 0, sizeof(copyStats));
+  memset(&classifierStats, 0, sizeof(classifierStats));
   stats.resize(encoderClassMax);
+  encoderLatency.resize(encoderClassMax);
+  updateEncoderTime.resize(encoderClassMax, -1);
   for (iter = stats.begin();iter != stats.end();++iter) {
     StatsVector::value_type::iterator iter2;
     iter->resize(encoderTypeMax);
     for (iter2 = iter->begin();iter2 != iter->end();++iter2)
       memset(&*iter2, 0, sizeof(EncoderStats));
   }
+
+  gettimeofday(&adaptStart, NULL);
+
+  rdr::BufferPool::setBudget((size_t)scratchMemoryLimit * 1024 * 1024);
 }
 
 EncodeManager::~EncodeManager()
@@ -179,6 +276,16 @@ void EncodeManager::logStats()
 
   vlog.info("Framebuffer updates: %u", updates);
 
+  iecPrefix(memoryUsage(), "B", a, sizeof(a));
+  iecPrefix(peakMemory, "B", b, sizeof(b));
+  vlog.info("  Memory: %s (peak %s)", a, b);
+
+  if (compressLevelChanges != 0) {
+    vlog.info("  Compression level: %d (%u changes, client asked for %d)",
+              compressLevel, compressLevelChanges,
+              conn->client.compressLevel);
+  }
+
   if (copyStats.rects != 0) {
     vlog.info("  %s:", "CopyRect");
 
@@ -198,6 +305,20 @@ void EncodeManager::logStats()
               a, ratio);
   }
 
+  if (classifierStats.rects != 0) {
+    vlog.info("  Content classifier:");
+
+    siPrefix(classifierStats.syntheticTiles, "tiles", a, sizeof(a));
+    siPrefix(classifierStats.naturalTiles, "tiles", b, sizeof(b));
+    vlog.info("    Synthetic: %s, natural: %s", a, b);
+    vlog.info("    Rects: %u lossless, %u lossy, %u changing",
+              classifierStats.lossless,
+              classifierStats.rects - classifierStats.lossless -
+              classifierStats.changing,
+              classifierStats.changing);
+    vlog.info("    Time: %g ms", classifierStats.time / 1000.0);
+  }
+
   for (i = 0;i < stats.size();i++) {
     // Did this class do anything at all?
     for (j = 0;j < stats[i].size();j++) {
@@ -237,6 +358,58 @@ void EncodeManager::logStats()
   vlog.info("  Total: %s, %s", a, b);
   iecPrefix(bytes, "B", a, sizeof(a));
   vlog.info("         %s (1:%g ratio)", a, ratio);
+
+  logEncodeLatency(encodeLatency, encoderLatency);
+}
+
+void EncodeManager::mergeEncodeLatency(LatencyHistogram* total,
+                                       LatencyVector* classes)
+{
+  size_t i;
+
+  total->merge(encodeLatency);
+
+  classes->resize(encoderClassMax);
+  for (i = 0;i < encoderLatency.size();i++)
+    (*classes)[i].merge(encoderLatency[i]);
+}
+
+void EncodeManager::logEncodeLatency(const LatencyHistogram& total,
+                                     const LatencyVector& classes)
+{
+  size_t i;
+  char a[1024];
+
+  if (total.count() == 0)
+    return;
+
+  vlog.info("  Encoding time per update:");
+
+  total.print(a, sizeof(a));
+  vlog.info("    Total: %s", a);
+
+  for (i = 0;i < classes.size();i++) {
+    if (classes[i].count() == 0)
+      continue;
+
+    classes[i].print(a, sizeof(a));
+    vlog.info("    %s: %s", encoderClassName((EncoderClass)i), a);
+  }
+}
+
+size_t EncodeManager::memoryUsage()
+{
+  std::vector<Encoder*>::iterator iter;
+  size_t usage;
+
+  usage = convertedPixelBuffer.memoryUsage() + classifyBuffer.capacity();
+
+  for (iter = encoders.begin();iter != encoders.end();iter++) {
+    if (*iter != NULL)
+      usage += (*iter)->memoryUsage();
+  }
+
+  return usage;
 }
 
 bool EncodeManager::supported(int encoding)
@@ -247,6 +420,9 @@ bool EncodeManager::supported(int encoding)
   case encodingHextile:
   case encodingZRLE:
   case encodingTight:
+#ifdef HAVE_ZSTD
+  case encodingZstd:
+#endif
     return true;
   default:
     return false;
@@ -273,34 +449,99 @@ int EncodeManager::getNextLosslessRefresh(const Region& req)
 void EncodeManager::pruneLosslessRefresh(const Region& limits)
 {
   lossyRegion.assign_intersect(limits);
+  coarseRegion.assign_intersect(limits);
   pendingRefreshRegion.assign_intersect(limits);
 }
 
 void EncodeManager::writeUpdate(const UpdateInfo& ui, const PixelBuffer* pb,
                                 const RenderedCursor* renderedCursor)
 {
-  doUpdate(true, ui.changed, ui.copied, ui.copy_delta, pb, renderedCursor);
+  updateVideoRect(ui.changed);
 
-  recentlyChangedRegion.assign_union(ui.changed);
-  recentlyChangedRegion.assign_union(ui.copied);
-  if (!recentChangeTimer.isStarted())
-    recentChangeTimer.start(RecentChangeTimeout);
+  sendUpdate(ui, pb, renderedCursor);
+}
+
+bool EncodeManager::writePriorityUpdate(UpdateInfo* ui, const Region& focus,
+                                        const PixelBuffer* pb,
+                                        const RenderedCursor* renderedCursor)
+{
+  UpdateInfo first;
+
+  // Video detection needs to see the update as a whole
+  updateVideoRect(ui->changed);
+
+  first.changed = ui->changed.intersect(focus);
+
+  // The video is always sent in one piece, so it can't go first
+  first.changed.assign_subtract(videoRect);
+
+  if (first.changed.is_empty() || first.changed.equals(ui->changed))
+    return false;
+
+  // Copies have to be done before anything else is drawn
+  first.copied = ui->copied;
+  first.copy_delta = ui->copy_delta;
+
+  sendUpdate(first, pb, renderedCursor);
+
+  ui->changed.assign_subtract(first.changed);
+  ui->copied.clear();
+
+  return true;
+}
+
+void EncodeManager::writeDeferredUpdate(const UpdateInfo& ui,
+                                        const PixelBuffer* pb,
+                                        const RenderedCursor* renderedCursor)
+{
+  sendUpdate(ui, pb, renderedCursor);
 }
 
 void EncodeManager::writeLosslessRefresh(const Region& req, const PixelBuffer* pb,
                                          const RenderedCursor* renderedCursor,
-                                         size_t maxUpdateSize)
+                                         size_t maxUpdateSize,
+                                         const Point& focus)
 {
-  doUpdate(false, getLosslessRefresh(req, maxUpdateSize),
-           Region(), Point(), pb, renderedCursor);
+  Region refresh;
+  bool refine;
+
+  refresh = getLosslessRefresh(req, maxUpdateSize, focus, &refine);
+
+  if (refine) {
+    doUpdate(true, refineQuality, refresh, Region(), Point(),
+             pb, renderedCursor);
+
+    // Nothing has changed, so the final step can follow as soon as
+    // there is room for it
+    pendingRefreshRegion.assign_union(refresh.intersect(lossyRegion));
+  } else {
+    doUpdate(false, -1, refresh, Region(), Point(), pb, renderedCursor);
+  }
 }
 
 bool EncodeManager::handleTimeout(Timer* t)
 {
   if (t == &recentChangeTimer) {
+    Region refresh;
+
+    // Video frames don't arrive in every interval, so give it a while
+    // before deciding it has stopped
+    if (!videoRect.is_empty()) {
+      if (!recentlyChangedRegion.intersect(videoRect).is_empty())
+        gettimeofday(&videoLastChange, NULL);
+      else if (msSince(&videoLastChange) >= VideoStopTime) {
+        vlog.debug("Video at %dx%d+%d+%d stopped", videoRect.width(),
+                   videoRect.height(), videoRect.tl.x, videoRect.tl.y);
+        videoRect.clear();
+        videoCandidate.clear();
+      }
+    }
+
     // Any lossy region that wasn't recently updated can
     // now be scheduled for a refresh
-    pendingRefreshRegion.assign_union(lossyRegion.subtract(recentlyChangedRegion));
+    refresh = lossyRegion.subtract(recentlyChangedRegion);
+    refresh.assign_subtract(videoRect);
+    pendingRefreshRegion.assign_union(refresh);
     recentlyChangedRegion.clear();
 
     // Will there be more to do? (i.e. do we need another round)
@@ -308,20 +549,65 @@ bool EncodeManager::handleTimeout(Timer* t)
       return true;
   }
 
+  if (t == &releaseTimer)
+    releaseMemory();
+
   return false;
 }
 
-void EncodeManager::doUpdate(bool allowLossy, const Region& changed_,
+void EncodeManager::releaseMemory()
+{
+  std::vector<Encoder*>::iterator iter;
+  size_t before;
+  char a[1024];
+
+  before = memoryUsage();
+
+  for (iter = encoders.begin();iter != encoders.end();iter++) {
+    if (*iter != NULL)
+      (*iter)->releaseMemory();
+  }
+
+  convertedPixelBuffer.release();
+  std::vector<rdr::U8>().swap(classifyBuffer);
+
+  iecPrefix(before - memoryUsage(), "B", a, sizeof(a));
+  vlog.debug("Connection idle, released %s of encoding buffers", a);
+}
+
+void EncodeManager::sendUpdate(const UpdateInfo& ui, const PixelBuffer* pb,
+                               const RenderedCursor* renderedCursor)
+{
+  doUpdate(true, -1, ui.changed, ui.copied, ui.copy_delta,
+           pb, renderedCursor);
+
+  recentlyChangedRegion.assign_union(ui.changed);
+  recentlyChangedRegion.assign_union(ui.copied);
+  if (!recentChangeTimer.isStarted())
+    recentChangeTimer.start(RecentChangeTimeout);
+}
+
+void EncodeManager::doUpdate(bool allowLossy, int minQuality,
+                             const Region& changed_,
                              const Region& copied, const Point& copyDelta,
                              const PixelBuffer* pb,
                              const RenderedCursor* renderedCursor)
 {
     int nRects;
     Region changed, cursorRegion;
+    Rect video;
+    struct timeval start, end;
+    int startLength;
+    size_t memory;
+    size_t i;
 
     updates++;
 
-    prepareEncoders(allowLossy);
+    adaptCompressLevel();
+    prepareEncoders(allowLossy, minQuality);
+
+    gettimeofday(&start, NULL);
+    startLength = conn->getOutStream()->length();
 
     changed = changed_;
 
@@ -337,12 +623,25 @@ void EncodeManager::doUpdate(bool allowLossy, const Region& changed_,
       changed.assign_subtract(renderedCursor->getEffectiveRect());
     }
 
+    /*
+     * Video is sent as a single rect for the entire area, as long as
+     * some part of it has changed.
+     */
+    if (allowLossy && !videoRect.is_empty() &&
+        videoRect.enclosed_by(pb->getRect()) &&
+        !changed.intersect(videoRect).is_empty()) {
+      video = videoRect;
+      changed.assign_subtract(video);
+    }
+
     if (conn->client.supportsEncoding(pseudoEncodingLastRect))
       nRects = 0xFFFF;
     else {
       nRects = copied.numRects();
       nRects += computeNumRects(changed);
       nRects += computeNumRects(cursorRegion);
+      if (!video.is_empty())
+        nRects++;
     }
 
     conn->writer()->writeFramebufferUpdateStart(nRects);
@@ -350,6 +649,9 @@ void EncodeManager::doUpdate(bool allowLossy, const Region& changed_,
     if (conn->client.supportsEncoding(encodingCopyRect))
       writeCopyRects(copied, copyDelta);
 
+    if (!video.is_empty())
+      writeVideoRect(video, pb);
+
     /*
      * We start by searching for solid rects, which are then removed
      * from the changed region.
@@ -360,13 +662,41 @@ void EncodeManager::doUpdate(bool allowLossy, const Region& changed_,
     writeRects(changed, pb);
     writeRects(cursorRegion, renderedCursor);
 
+    writeQueuedRects();
+
     conn->writer()->writeFramebufferUpdateEnd();
+
+    gettimeofday(&end, NULL);
+    adaptEncodeTime += (end.tv_sec - start.tv_sec) * 1000000ULL +
+                       (end.tv_usec - start.tv_usec);
+    adaptBytes += conn->getOutStream()->length() - startLength;
+
+    encodeLatency.add((end.tv_sec - start.tv_sec) * 1000000ULL +
+                      (end.tv_usec - start.tv_usec));
+    for (i = 0;i < updateEncoderTime.size();i++) {
+      if (updateEncoderTime[i] < 0)
+        continue;
+      encoderLatency[i].add(updateEncoderTime[i]);
+      updateEncoderTime[i] = -1;
+    }
+
+    memory = memoryUsage();
+    if (memory > peakMemory)
+      peakMemory = memory;
+
+    // Give back the buffers once things go quiet, sooner if memory is
+    // getting tight
+    if (rdr::BufferPool::overBudget())
+      releaseTimer.start(PressureReleaseTime);
+    else if (scratchIdleTime > 0)
+      releaseTimer.start(secsToMillis(scratchIdleTime));
 }
 
-void EncodeManager::prepareEncoders(bool allowLossy)
+void EncodeManager::prepareEncoders(bool allowLossy, int minQuality)
 {
   enum EncoderClass solid, bitmap, bitmapRLE;
   enum EncoderClass indexed, indexedRLE, fullColour;
+  enum EncoderClass lossless;
 
   bool allowJPEG;
 
@@ -407,6 +737,13 @@ void EncodeManager::prepareEncoders(bool allowLossy)
     bitmapRLE = indexedRLE = encoderZRLE;
     bitmap = indexed = encoderZRLE;
     break;
+#ifdef HAVE_ZSTD
+  case encodingZstd:
+    fullColour = encoderZstd;
+    bitmapRLE = indexedRLE = encoderZstd;
+    bitmap = indexed = encoderZstd;
+    break;
+#endif
   }
 
   // Any encoders still unassigned?
@@ -457,21 +794,42 @@ void EncodeManager::prepareEncoders(bool allowLossy)
     indexed = indexedRLE = fullColour = encoderTightJPEG;
   }
 
+  // Synthetic content looks bad with lossy encoders, and would have
+  // to be refreshed later anyway
+  lossless = fullColour;
+  if ((encoders[fullColour]->flags & EncoderLossy) &&
+      (conn->client.subsampling != subsampleGray)) {
+    if ((preferred == encodingTight) &&
+        encoders[encoderTight]->isSupported())
+      lossless = encoderTight;
+    else if (encoders[encoderZRLE]->isSupported())
+      lossless = encoderZRLE;
+    else if (encoders[encoderTight]->isSupported())
+      lossless = encoderTight;
+    else if (encoders[encoderHextile]->isSupported())
+      lossless = encoderHextile;
+  }
+
   activeEncoders[encoderSolid] = solid;
   activeEncoders[encoderBitmap] = bitmap;
   activeEncoders[encoderBitmapRLE] = bitmapRLE;
   activeEncoders[encoderIndexed] = indexed;
   activeEncoders[encoderIndexedRLE] = indexedRLE;
   activeEncoders[encoderFullColour] = fullColour;
+  losslessFullColour = lossless;
 
   for (iter = activeEncoders.begin(); iter != activeEncoders.end(); ++iter) {
     Encoder *encoder;
 
     encoder = encoders[*iter];
 
-    encoder->setCompressLevel(conn->client.compressLevel);
+    encoder->setCompressLevel(compressLevel);
 
-    if (allowLossy) {
+    if (allowLossy && (minQuality != -1)) {
+      int level = __rfbmax(conn->client.qualityLevel, minQuality);
+      encoder->setQualityLevel(level);
+      encoder->setFineQualityLevel(-1, subsampleUndefined);
+    } else if (allowLossy) {
       encoder->setQualityLevel(conn->client.qualityLevel);
       encoder->setFineQualityLevel(conn->client.fineQualityLevel,
                                    conn->client.subsampling);
@@ -482,35 +840,126 @@ void EncodeManager::prepareEncoders(bool allowLossy)
       encoder->setFineQualityLevel(-1, subsampleUndefined);
     }
   }
+
+  encoders[losslessFullColour]->setCompressLevel(compressLevel);
+}
+
+void EncodeManager::adaptCompressLevel()
+{
+  int clientLevel, range;
+  int baseLevel, minLevel, maxLevel;
+  unsigned long long linkTime;
+
+  clientLevel = conn->client.compressLevel;
+  range = compressLevelRange;
+
+  if ((range == 0) || (linkBandwidth == 0)) {
+    compressLevel = clientLevel;
+    return;
+  }
+
+  // Stay close to what the client asked for. If it didn't ask, then
+  // anything that actually compresses is fine.
+  if (clientLevel == -1) {
+    baseLevel = 2;
+    minLevel = 1;
+    maxLevel = 9;
+  } else {
+    baseLevel = clientLevel;
+    minLevel = __rfbmax(clientLevel - range, 0);
+    maxLevel = __rfbmin(clientLevel + range, 9);
+  }
+
+  if (compressLevel == -1)
+    compressLevel = baseLevel;
+  compressLevel = __rfbmax(compressLevel, minLevel);
+  compressLevel = __rfbmin(compressLevel, maxLevel);
+
+  if (msSince(&adaptStart) < CompressAdaptInterval)
+    return;
+
+  if (adaptBytes != 0) {
+    // Microseconds needed to get the data across
+    linkTime = adaptBytes * 1000000 / linkBandwidth;
+
+    // Encoding and sending overlap, so we do best when they take about
+    // as long. Otherwise move effort over to whichever side is idle.
+    if ((adaptEncodeTime > linkTime * 2) && (compressLevel > minLevel)) {
+      compressLevel--;
+      compressLevelChanges++;
+      vlog.debug("Encoding is the bottleneck, lowering compression "
+                 "level to %d", compressLevel);
+    } else if ((linkTime > adaptEncodeTime * 2) &&
+               (compressLevel < maxLevel)) {
+      compressLevel++;
+      compressLevelChanges++;
+      vlog.debug("Network is the bottleneck, raising compression "
+                 "level to %d", compressLevel);
+    }
+  }
+
+  gettimeofday(&adaptStart, NULL);
+  adaptEncodeTime = 0;
+  adaptBytes = 0;
 }
 
 Region EncodeManager::getLosslessRefresh(const Region& req,
-                                         size_t maxUpdateSize)
+                                         size_t maxUpdateSize,
+                                         const Point& focus, bool* refine)
 {
-  std::vector<Rect> rects;
-  Region refresh;
+  Region pending, refresh;
+  Region::const_iterator i;
+  std::vector<RefreshTile> tiles;
+  std::vector<RefreshTile>::const_iterator tile;
   size_t area;
 
-  // We make a conservative guess at the compression ratio at 2:1
-  maxUpdateSize *= 2;
+  pending = pendingRefreshRegion.intersect(req);
+
+  // Bring the worst areas up to a decent quality before making
+  // anything lossless
+  *refine = !pending.intersect(coarseRegion).is_empty();
+  if (*refine) {
+    pending.assign_intersect(coarseRegion);
+    maxUpdateSize *= RefineCompressionRatio;
+  } else {
+    maxUpdateSize *= LosslessCompressionRatio;
+  }
 
   // We will measure pixels, not bytes (assume 32 bpp)
   maxUpdateSize /= 4;
 
+  // The area the user is looking at is most likely where the pointer
+  // is, so start there and work outwards
+  for (i = pending.begin(); i != pending.end(); ++i) {
+    for (int y = i->tl.y - i->tl.y % RefreshTileSize; y < i->br.y;
+         y += RefreshTileSize) {
+      for (int x = i->tl.x - i->tl.x % RefreshTileSize; x < i->br.x;
+           x += RefreshTileSize) {
+        RefreshTile t;
+        int dx, dy;
+
+        t.rect.setXYWH(x, y, RefreshTileSize, RefreshTileSize);
+        t.rect = t.rect.intersect(*i);
+
+        dx = (t.rect.tl.x + t.rect.br.x) / 2 - focus.x;
+        dy = (t.rect.tl.y + t.rect.br.y) / 2 - focus.y;
+        t.distance = dx * dx + dy * dy;
+
+        tiles.push_back(t);
+      }
+    }
+  }
+
+  std::sort(tiles.begin(), tiles.end());
+
   area = 0;
-  pendingRefreshRegion.intersect(req).get_rects(&rects);
-  while (!rects.empty()) {
-    size_t idx;
+  for (tile = tiles.begin(); tile != tiles.end(); ++tile) {
     Rect rect;
 
-    // Grab a random rect so we don't keep damaging and restoring the
-    // same rect over and over
-    idx = rand() % rects.size();
-
-    rect = rects[idx];
+    rect = tile->rect;
 
-    // Add rects until we exceed the threshold, then include as much as
-    // possible of the final rect
+    // Add tiles until we exceed the threshold, then include as much as
+    // possible of the final tile
     if ((area + rect.area()) > maxUpdateSize) {
       // Use the narrowest axis to avoid getting to thin rects
       if (rect.width() > rect.height()) {
@@ -526,8 +975,6 @@ Region EncodeManager::getLosslessRefresh(const Region& req,
 
     area += rect.area();
     refresh.assign_union(Region(rect));
-
-    rects.erase(rects.begin() + idx);
   }
 
   return refresh;
@@ -536,12 +983,10 @@ Region EncodeManager::getLosslessRefresh(const Region& req,
 int EncodeManager::computeNumRects(const Region& changed)
 {
   int numRects;
-  std::vector<Rect> rects;
-  std::vector<Rect>::const_iterator rect;
+  Region::const_iterator rect;
 
   numRects = 0;
-  changed.get_rects(&rects);
-  for (rect = rects.begin(); rect != rects.end(); ++rect) {
+  for (rect = changed.begin(); rect != changed.end(); ++rect) {
     int w, h, sw, sh;
 
     w = rect->width();
@@ -568,12 +1013,17 @@ int EncodeManager::computeNumRects(const Region& changed)
 }
 
 Encoder *EncodeManager::startRect(const Rect& rect, int type)
+{
+  return startRect(rect, type, activeEncoders[type]);
+}
+
+Encoder *EncodeManager::startRect(const Rect& rect, int type, int klass)
 {
   Encoder *encoder;
-  int klass, equiv;
+  int equiv;
 
   activeType = type;
-  klass = activeEncoders[activeType];
+  activeClass = klass;
 
   beforeLength = conn->getOutStream()->length();
 
@@ -585,12 +1035,20 @@ Encoder *EncodeManager::startRect(const Rect& rect, int type)
   encoder = encoders[klass];
   conn->writer()->startRect(rect, encoder->encoding);
 
+  gettimeofday(&rectStart, NULL);
+
   if ((encoder->flags & EncoderLossy) &&
       ((encoder->losslessQuality == -1) ||
-       (encoder->getQualityLevel() < encoder->losslessQuality)))
+       (encoder->getQualityLevel() < encoder->losslessQuality))) {
     lossyRegion.assign_union(Region(rect));
-  else
+    if (encoder->getQualityLevel() < refineQuality)
+      coarseRegion.assign_union(Region(rect));
+    else
+      coarseRegion.assign_subtract(Region(rect));
+  } else {
     lossyRegion.assign_subtract(Region(rect));
+    coarseRegion.assign_subtract(Region(rect));
+  }
 
   // This was either a rect getting refreshed, or a rect that just got
   // new content. Either way we should not try to refresh it anymore.
@@ -603,26 +1061,34 @@ void EncodeManager::endRect()
 {
   int klass;
   int length;
+  struct timeval now;
 
   conn->writer()->endRect();
 
   length = conn->getOutStream()->length() - beforeLength;
 
-  klass = activeEncoders[activeType];
+  klass = activeClass;
   stats[klass][activeType].bytes += length;
+
+  // For rects encoded on worker threads this is the time spent waiting
+  // for them, which is what matters for the update
+  gettimeofday(&now, NULL);
+  if (updateEncoderTime[klass] < 0)
+    updateEncoderTime[klass] = 0;
+  updateEncoderTime[klass] += (now.tv_sec - rectStart.tv_sec) * 1000000LL +
+                              (now.tv_usec - rectStart.tv_usec);
 }
 
 void EncodeManager::writeCopyRects(const Region& copied, const Point& delta)
 {
-  std::vector<Rect> rects;
-  std::vector<Rect>::const_iterator rect;
+  Region::const_iterator rect;
 
   Region lossyCopy;
 
   beforeLength = conn->getOutStream()->length();
 
-  copied.get_rects(&rects, delta.x <= 0, delta.y <= 0);
-  for (rect = rects.begin(); rect != rects.end(); ++rect) {
+  for (rect = copied.begin(delta.x <= 0, delta.y <= 0);
+       rect != copied.end(); ++rect) {
     int equiv;
 
     copyStats.rects++;
@@ -641,11 +1107,104 @@ void EncodeManager::writeCopyRects(const Region& copied, const Point& delta)
   lossyCopy.assign_intersect(copied);
   lossyRegion.assign_union(lossyCopy);
 
+  lossyCopy = coarseRegion;
+  lossyCopy.translate(delta);
+  lossyCopy.assign_intersect(copied);
+  coarseRegion.assign_union(lossyCopy);
+
   // Stop any pending refresh as a copy is enough that we consider
   // this region to be recently changed
   pendingRefreshRegion.assign_subtract(copied);
 }
 
+void EncodeManager::updateVideoRect(const Region& changed)
+{
+  Region::const_iterator rect;
+
+  Rect candidate;
+  unsigned elapsed;
+
+  if ((encoders[encoderH264] == NULL) ||
+      !encoders[encoderH264]->isSupported()) {
+    videoRect.clear();
+    return;
+  }
+
+  // Video is usually the largest thing changing on every update
+  for (rect = changed.begin(); rect != changed.end(); ++rect) {
+    if (rect->area() > candidate.area())
+      candidate = *rect;
+  }
+
+  // H.264 works on 2x2 blocks of pixels
+  candidate.tl.x = (candidate.tl.x + 1) & ~1;
+  candidate.tl.y = (candidate.tl.y + 1) & ~1;
+  candidate.br.x &= ~1;
+  candidate.br.y &= ~1;
+
+  if (candidate.area() < VideoMinArea)
+    return;
+
+  if (candidate.equals(videoRect))
+    return;
+
+  if (!candidate.equals(videoCandidate)) {
+    videoCandidate = candidate;
+    gettimeofday(&videoCandidateStart, NULL);
+    videoCandidateFrames = 1;
+    return;
+  }
+
+  videoCandidateFrames++;
+
+  elapsed = msSince(&videoCandidateStart);
+  if (elapsed < VideoDetectTime)
+    return;
+
+  if ((videoCandidateFrames * 1000 / elapsed) < VideoMinFrameRate) {
+    videoCandidateFrames = 0;
+    gettimeofday(&videoCandidateStart, NULL);
+    return;
+  }
+
+  vlog.debug("Video detected at %dx%d+%d+%d", candidate.width(),
+             candidate.height(), candidate.tl.x, candidate.tl.y);
+
+  videoRect = candidate;
+  gettimeofday(&videoLastChange, NULL);
+}
+
+void EncodeManager::writeVideoRect(const Rect& rect, const PixelBuffer* pb)
+{
+  H264Encoder *encoder;
+  PixelBuffer *ppb;
+
+  encoder = (H264Encoder*)startRect(rect, encoderFullColour, encoderH264);
+
+  encoder->setRect(rect);
+  encoder->setQualityLevel(conn->client.qualityLevel);
+
+  ppb = preparePixelBuffer(rect, pb, false);
+
+  encoder->writeRect(ppb, Palette());
+
+  endRect();
+}
+
+void EncodeManager::writeQueuedRects()
+{
+  TightJPEGEncoder *encoder;
+  Rect rect;
+
+  encoder = (TightJPEGEncoder*)encoders[encoderTightJPEG];
+
+  while (encoder->peekQueuedRect(&rect)) {
+    startRect(rect, encoderFullColour, encoderTightJPEG);
+    encoder->writeQueuedRect();
+    endRect();
+  }
+}
+
 void EncodeManager::writeSolidRects(Region *changed, const PixelBuffer* pb)
 {
   std::vector<Rect> rects;
@@ -755,11 +1314,9 @@ void EncodeManager::findSolidRect(const Rect& rect, Region *changed,
 
 void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb)
 {
-  std::vector<Rect> rects;
-  std::vector<Rect>::const_iterator rect;
+  Region::const_iterator rect;
 
-  changed.get_rects(&rects);
-  for (rect = rects.begin(); rect != rects.end(); ++rect) {
+  for (rect = changed.begin(); rect != changed.end(); ++rect) {
     int w, h, sw, sh;
     Rect sr;
 
@@ -806,6 +1363,7 @@ void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb)
 
   bool useRLE;
   EncoderType type;
+  int klass;
 
   // FIXME: This is roughly the algorithm previously used by the Tight
   //        encoder. It seems a bit backwards though, that higher
@@ -869,7 +1427,39 @@ void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb)
       type = encoderIndexed;
   }
 
-  encoder = startRect(rect, type);
+  klass = activeEncoders[type];
+
+  // Too many colours for a palette, but a lossy encoder isn't
+  // necessarily the best choice either
+  if ((type == encoderFullColour) && (klass != losslessFullColour)) {
+    struct timeval start, end;
+
+    gettimeofday(&start, NULL);
+
+    classifierStats.rects++;
+    switch (classifyContent(rect, ppb)) {
+    case contentSynthetic:
+      classifierStats.lossless++;
+      klass = losslessFullColour;
+      break;
+    case contentChanging:
+      classifierStats.changing++;
+      break;
+    }
+
+    gettimeofday(&end, NULL);
+    classifierStats.time += (end.tv_sec - start.tv_sec) * 1000000ULL +
+                            (end.tv_usec - start.tv_usec);
+  }
+
+  // JPEG is slow enough that it is worth doing on worker threads. The
+  // rects are sent once the rest of the update has been written.
+  if ((type == encoderFullColour) && (klass == encoderTightJPEG)) {
+    ((TightJPEGEncoder*)encoders[klass])->queueRect(pb, rect);
+    return;
+  }
+
+  encoder = startRect(rect, type, klass);
 
   if (encoder->flags & EncoderUseNativePF)
     ppb = preparePixelBuffer(rect, pb, false);
@@ -1043,6 +1633,117 @@ bool EncodeManager::analyseRect(const PixelBuffer *pb,
   }
 }
 
+int EncodeManager::classifyContent(const Rect& rect, const PixelBuffer *pb)
+{
+  const rdr::U8* buffer;
+  int stride;
+
+  int width, height;
+  int synthetic, natural;
+
+  // Areas that keep changing will get a lossless refresh once they
+  // settle, so there is no point in spending effort on them now. Video
+  // has already been picked out by updateVideoRect().
+  if (!recentlyChangedRegion.intersect(rect).is_empty())
+    return contentChanging;
+
+  width = pb->width();
+  height = pb->height();
+
+  classifyBuffer.resize(width * height * 3);
+
+  buffer = pb->getBuffer(pb->getRect(), &stride);
+  pb->getPF().rgbFromBuffer(&classifyBuffer[0], buffer,
+                            width, stride, height);
+
+  synthetic = natural = 0;
+
+  for (int ty = 0; ty < height; ty += ClassifyTileSize) {
+    for (int tx = 0; tx < width; tx += ClassifyTileSize) {
+      int tw, th;
+      int pairs, flat, edges;
+      rdr::U32 colours[ClassifyMaxSyntheticColours];
+      int numColours;
+
+      tw = __rfbmin(ClassifyTileSize, width - tx);
+      th = __rfbmin(ClassifyTileSize, height - ty);
+
+      pairs = flat = edges = 0;
+      numColours = 0;
+
+      for (int y = ty; y < ty + th; y++) {
+        const rdr::U8* pixel;
+
+        pixel = &classifyBuffer[(y * width + tx) * 3];
+
+        for (int x = tx; x < tx + tw; x++) {
+          rdr::U32 colour;
+          int diff;
+
+          colour = pixel[0] << 16 | pixel[1] << 8 | pixel[2];
+
+          // Track the first few colours only, as we only care if
+          // there are more than that
+          if (numColours <= ClassifyMaxSyntheticColours) {
+            int i;
+            for (i = 0; i < numColours; i++) {
+              if (colours[i] == colour)
+                break;
+            }
+            if (i == numColours) {
+              if (numColours < ClassifyMaxSyntheticColours)
+                colours[numColours] = colour;
+              numColours++;
+            }
+          }
+
+          // Gradients to the right and downwards
+          if (x + 1 < tx + tw) {
+            diff = abs(pixel[0] - pixel[3]) + abs(pixel[1] - pixel[4]) +
+                   abs(pixel[2] - pixel[5]);
+            pairs++;
+            if (diff == 0)
+              flat++;
+            else if (diff > ClassifyEdgeThreshold)
+              edges++;
+          }
+          if (y + 1 < ty + th) {
+            const rdr::U8* below = pixel + width * 3;
+            diff = abs(pixel[0] - below[0]) + abs(pixel[1] - below[1]) +
+                   abs(pixel[2] - below[2]);
+            pairs++;
+            if (diff == 0)
+              flat++;
+            else if (diff > ClassifyEdgeThreshold)
+              edges++;
+          }
+
+          pixel += 3;
+        }
+      }
+
+      // Few colours, large flat areas or sharp edges next to flat areas
+      // (text, UI elements) compress well losslessly and suffer the
+      // most from lossy compression. Gradients and noise without flat
+      // areas are natural images.
+      if ((numColours <= ClassifyMaxSyntheticColours) ||
+          (flat * 2 >= pairs) ||
+          ((edges * 8 >= pairs) && (flat * 4 >= pairs)))
+        synthetic++;
+      else
+        natural++;
+    }
+  }
+
+  classifierStats.syntheticTiles += synthetic;
+  classifierStats.naturalTiles += natural;
+
+  if (synthetic > natural)
+    return contentSynthetic;
+
+  return contentNatural;
+}
+
 void EncodeManager::OffsetPixelBuffer::update(const PixelFormat& pf,
                                               int width, int height,
                                               const rdr::U8* data_,
@@ -22,7 +22,10 @@
 
 #include <vector>
 
+#include <sys/time.h>
+
 #include <rdr/types.h>
+#include <rfb/LatencyHistogram.h>
 #include <rfb/PixelBuffer.h>
 #include <rfb/Region.h>
 #include <rfb/Timer.h>
@@ -44,6 +47,16 @@ namespace rfb {
 
     void logStats();
 
+    // Bytes held in scratch buffers and compression state
+    size_t memoryUsage();
+
+    // Time spent encoding each update, in total and per encoder. The
+    // figures of several connections can be merged and logged together.
+    typedef std::vector<LatencyHistogram> LatencyVector;
+    void mergeEncodeLatency(LatencyHistogram* total, LatencyVector* classes);
+    static void logEncodeLatency(const LatencyHistogram& total,
+                                 const LatencyVector& classes);
+
     // Hack to let ConnParams calculate the client's preferred encoding
     static bool supported(int encoding);
 
@@ -55,32 +68,61 @@ namespace rfb {
     void writeUpdate(const UpdateInfo& ui, const PixelBuffer* pb,
                      const RenderedCursor* renderedCursor);
 
+    // writePriorityUpdate() sends the part of an update that is within
+    // the focus region as an update of its own, and removes it from ui.
+    // The rest is then sent with writeDeferredUpdate(). If splitting the
+    // update isn't worthwhile then nothing is sent and false is returned,
+    // in which case all of ui goes through writeDeferredUpdate().
+    bool writePriorityUpdate(UpdateInfo* ui, const Region& focus,
+                             const PixelBuffer* pb,
+                             const RenderedCursor* renderedCursor);
+    void writeDeferredUpdate(const UpdateInfo& ui, const PixelBuffer* pb,
+                             const RenderedCursor* renderedCursor);
+
+    // writeLosslessRefresh() improves lossy areas that have settled down,
+    // starting with the ones closest to focus. Poor quality areas are
+    // first brought up to a decent level, and only then made lossless.
     void writeLosslessRefresh(const Region& req, const PixelBuffer* pb,
                               const RenderedCursor* renderedCursor,
-                              size_t maxUpdateSize);
+                              size_t maxUpdateSize, const Point& focus);
+
+    // Estimated speed of the link to the client in bytes per second,
+    // used to balance compression effort against it. Zero if unknown.
+    void setLinkBandwidth(size_t bandwidth) { linkBandwidth = bandwidth; }
 
   protected:
     virtual bool handleTimeout(Timer* t);
 
-    void doUpdate(bool allowLossy, const Region& changed,
+    void releaseMemory();
+
+    void sendUpdate(const UpdateInfo& ui, const PixelBuffer* pb,
+                    const RenderedCursor* renderedCursor);
+    void doUpdate(bool allowLossy, int minQuality, const Region& changed,
                   const Region& copied, const Point& copy_delta,
                   const PixelBuffer* pb,
                   const RenderedCursor* renderedCursor);
-    void prepareEncoders(bool allowLossy);
+    void prepareEncoders(bool allowLossy, int minQuality);
+    void adaptCompressLevel();
 
-    Region getLosslessRefresh(const Region& req, size_t maxUpdateSize);
+    Region getLosslessRefresh(const Region& req, size_t maxUpdateSize,
+                              const Point& focus, bool* refine);
 
     int computeNumRects(const Region& changed);
 
     Encoder *startRect(const Rect& rect, int type);
+    Encoder *startRect(const Rect& rect, int type, int klass);
     void endRect();
 
+    void updateVideoRect(const Region& changed);
+    void writeVideoRect(const Rect& rect, const PixelBuffer* pb);
+
     void writeCopyRects(const Region& copied, const Point& delta);
     void writeSolidRects(Region *changed, const PixelBuffer* pb);
     void findSolidRect(const Rect& rect, Region *changed, const PixelBuffer* pb);
     void writeRects(const Region& changed, const PixelBuffer* pb);
 
     void writeSubRect(const Rect& rect, const PixelBuffer *pb);
+    void writeQueuedRects();
 
     bool checkSolidTile(const Rect& r, const rdr::U8* colourValue,
                         const PixelBuffer *pb);
@@ -95,6 +137,7 @@ namespace rfb {
 
     bool analyseRect(const PixelBuffer *pb,
                      struct RectInfo *info, int maxColours);
+    int classifyContent(const Rect& rect, const PixelBuffer *pb);
 
   protected:
     // Preprocessor generated, optimised methods
@@ -120,12 +163,24 @@ namespace rfb {
 
     std::vector<Encoder*> encoders;
     std::vector<int> activeEncoders;
+    // Used instead of a lossy full colour encoder for synthetic content
+    int losslessFullColour;
 
     Region lossyRegion;
+    // Lossy areas of a quality that is worth improving in a first step
+    Region coarseRegion;
     Region recentlyChangedRegion;
     Region pendingRefreshRegion;
 
     Timer recentChangeTimer;
+    Timer releaseTimer;
+
+    // Area currently sent as video, and the one that might become it
+    Rect videoRect;
+    Rect videoCandidate;
+    struct timeval videoCandidateStart;
+    unsigned videoCandidateFrames;
+    struct timeval videoLastChange;
 
     struct EncoderStats {
       unsigned rects;
@@ -135,12 +190,39 @@ namespace rfb {
     };
     typedef std::vector< std::vector<struct EncoderStats> > StatsVector;
 
+    struct ClassifierStats {
+      unsigned rects;
+      unsigned lossless;
+      unsigned changing;
+      unsigned long long syntheticTiles;
+      unsigned long long naturalTiles;
+      unsigned long long time;
+    };
+
     unsigned updates;
     EncoderStats copyStats;
+    ClassifierStats classifierStats;
     StatsVector stats;
     int activeType;
+    int activeClass;
     int beforeLength;
 
+    LatencyHistogram encodeLatency;
+    LatencyVector encoderLatency;
+    std::vector<long long> updateEncoderTime;
+    struct timeval rectStart;
+
+    // Compression level picked from how long encoding takes compared
+    // to sending the result, and how it got there
+    int compressLevel;
+    size_t linkBandwidth;
+    struct timeval adaptStart;
+    unsigned long long adaptEncodeTime;
+    unsigned long long adaptBytes;
+    unsigned compressLevelChanges;
+
+    size_t peakMemory;
+
     class OffsetPixelBuffer : public FullFramePixelBuffer {
     public:
       OffsetPixelBuffer() {}
@@ -152,6 +234,8 @@ namespace rfb {
 
     OffsetPixelBuffer offsetPixelBuffer;
     ManagedPixelBuffer convertedPixelBuffer;
+
+    std::vector<rdr::U8> classifyBuffer;
   };
 }
 
@@ -20,6 +20,8 @@
 #ifndef __RFB_ENCODER_H__
 #define __RFB_ENCODER_H__
 
+#include <stddef.h>
+
 #include <rdr/types.h>
 #include <rfb/Rect.h>
 
@@ -84,6 +86,15 @@ namespace rfb {
                                 const PixelFormat& pf,
                                 const rdr::U8* colour)=0;
 
+    // memoryUsage() returns how many bytes the encoder is holding on to
+    // in scratch buffers and compression state.
+    virtual size_t memoryUsage() { return 0; };
+
+    // releaseMemory() gives back as much of that memory as the encoding
+    // allows. It is called when the connection has been idle for a
+    // while, so the memory will simply be allocated again if needed.
+    virtual void releaseMemory() {};
+
   protected:
     // Helper method for redirecting a single colour palette to the
     // short cut method.
@@ -0,0 +1,213 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_H264
+
+#include <string.h>
+
+#include <wels/codec_api.h>
+
+#include <rdr/InStream.h>
+#include <rdr/MemInStream.h>
+#include <rdr/OutStream.h>
+
+#include <rfb/Exception.h>
+#include <rfb/H264Decoder.h>
+#include <rfb/LogWriter.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/ServerParams.h>
+
+using namespace rfb;
+
+static LogWriter vlog("H264Decoder");
+
+static const rdr::U32 resetContextFlag = 1 << 0;
+static const rdr::U32 resetAllContextsFlag = 1 << 1;
+
+// The server is free to have several video areas going at once
+static const size_t MaxContexts = 64;
+
+static inline rdr::U8 clamp(int value)
+{
+  if (value < 0)
+    return 0;
+  if (value > 255)
+    return 255;
+  return value;
+}
+
+H264Decoder::H264Decoder() : Decoder(DecoderOrdered)
+{
+}
+
+H264Decoder::~H264Decoder()
+{
+  resetAllContexts();
+}
+
+void H264Decoder::readRect(const Rect& r, rdr::InStream* is,
+                           const ServerParams& server, rdr::OutStream* os)
+{
+  rdr::U32 len;
+
+  len = is->readU32();
+  os->writeU32(len);
+  os->writeU32(is->readU32());
+  os->copyBytes(is, len);
+}
+
+void H264Decoder::decodeRect(const Rect& r, const void* buffer,
+                             size_t buflen, const ServerParams& server,
+                             ModifiablePixelBuffer* pb)
+{
+  rdr::MemInStream is(buffer, buflen);
+  rdr::U32 len, flags;
+
+  Context* ctx;
+
+  unsigned char* yuv[3];
+  SBufferInfo info;
+
+  const PixelFormat& pf = pb->getPF();
+  rdr::U8* outbuf;
+  int stride;
+
+  rdr::U8* rgb;
+
+  len = is.readU32();
+  flags = is.readU32();
+
+  if (flags & resetAllContextsFlag)
+    resetAllContexts();
+  else if (flags & resetContextFlag)
+    resetContext(r);
+
+  if (len == 0)
+    return;
+
+  ctx = findContext(r);
+  if (ctx == NULL) {
+    SDecodingParam param;
+    Context newCtx;
+
+    if (contexts.size() >= MaxContexts)
+      resetContext(contexts.front().rect);
+
+    if (WelsCreateDecoder(&newCtx.decoder) != 0)
+      throw Exception("H264Decoder: Unable to create decoder");
+
+    memset(&param, 0, sizeof(param));
+    param.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_AVC;
+    if (newCtx.decoder->Initialize(&param) != cmResultSuccess) {
+      WelsDestroyDecoder(newCtx.decoder);
+      throw Exception("H264Decoder: Unable to initialise decoder");
+    }
+
+    newCtx.rect = r;
+    contexts.push_back(newCtx);
+    ctx = &contexts.back();
+  }
+
+  memset(yuv, 0, sizeof(yuv));
+  memset(&info, 0, sizeof(info));
+  if (ctx->decoder->DecodeFrameNoDelay((const unsigned char*)is.getptr(),
+                                       len, yuv, &info) != dsErrorFree) {
+    vlog.error("Failed to decode H.264 frame");
+    resetContext(r);
+    return;
+  }
+
+  // No picture yet, e.g. only parameter sets
+  if (info.iBufferStatus != 1)
+    return;
+
+  if ((info.UsrData.sSystemBuffer.iWidth < r.width()) ||
+      (info.UsrData.sSystemBuffer.iHeight < r.height()))
+    throw Exception("H264Decoder: Frame does not match rect");
+
+  outbuf = pb->getBufferRW(r, &stride);
+  rgb = new rdr::U8[r.width() * 3];
+
+  for (int row = 0;row < r.height();row++) {
+    const rdr::U8 *y, *u, *v;
+    rdr::U8* out;
+
+    y = yuv[0] + row * info.UsrData.sSystemBuffer.iStride[0];
+    u = yuv[1] + (row / 2) * info.UsrData.sSystemBuffer.iStride[1];
+    v = yuv[2] + (row / 2) * info.UsrData.sSystemBuffer.iStride[1];
+
+    out = rgb;
+    for (int col = 0;col < r.width();col++) {
+      int c, d, e;
+
+      c = (y[col] - 16) * 298;
+      d = u[col / 2] - 128;
+      e = v[col / 2] - 128;
+
+      *out++ = clamp((c + 409 * e + 128) >> 8);
+      *out++ = clamp((c - 100 * d - 208 * e + 128) >> 8);
+      *out++ = clamp((c + 516 * d + 128) >> 8);
+    }
+
+    pf.bufferFromRGB(outbuf + row * stride * pf.bpp/8, rgb, r.width());
+  }
+
+  delete [] rgb;
+
+  pb->commitBufferRW(r);
+}
+
+H264Decoder::Context* H264Decoder::findContext(const Rect& r)
+{
+  std::list<Context>::iterator iter;
+
+  for (iter = contexts.begin(); iter != contexts.end(); ++iter) {
+    if (iter->rect.equals(r))
+      return &*iter;
+  }
+
+  return NULL;
+}
+
+void H264Decoder::resetContext(const Rect& r)
+{
+  std::list<Context>::iterator iter;
+
+  for (iter = contexts.begin(); iter != contexts.end(); ++iter) {
+    if (iter->rect.equals(r)) {
+      iter->decoder->Uninitialize();
+      WelsDestroyDecoder(iter->decoder);
+      contexts.erase(iter);
+      return;
+    }
+  }
+}
+
+void H264Decoder::resetAllContexts()
+{
+  std::list<Context>::iterator iter;
+
+  for (iter = contexts.begin(); iter != contexts.end(); ++iter) {
+    iter->decoder->Uninitialize();
+    WelsDestroyDecoder(iter->decoder);
+  }
+
+  contexts.clear();
+}
+
+#endif
@@ -0,0 +1,303 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_H264
+
+#include <string.h>
+
+#include <wels/codec_api.h>
+
+#include <rdr/OutStream.h>
+#include <rfb/Configuration.h>
+#include <rfb/Exception.h>
+#include <rfb/H264Encoder.h>
+#include <rfb/LogWriter.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/SConnection.h>
+#include <rfb/encodings.h>
+
+using namespace rfb;
+
+static LogWriter vlog("H264Encoder");
+
+BoolParameter h264("H264",
+                   "Use H.264 for areas of the screen that are playing "
+                   "video, if the client supports it", true);
+
+// Flags in front of each rect, shared with the decoder
+static const rdr::U32 resetContext = 1 << 0;
+static const rdr::U32 resetAllContexts = 1 << 1;
+
+// Nominal frame rate, only used for rate control
+static const float FrameRate = 30.0f;
+
+// Target bits per pixel for each quality level
+static const float bitsPerPixel[10] = {
+  0.02f, 0.03f, 0.04f, 0.05f, 0.06f, 0.08f, 0.10f, 0.13f, 0.17f, 0.22f
+};
+
+H264Encoder::H264Encoder(SConnection* conn)
+  : Encoder(conn, encodingH264,
+            (EncoderFlags)(EncoderUseNativePF | EncoderLossy)),
+    qualityLevel(-1), encoder(NULL), encoderQuality(-1), yuv(NULL),
+    rgb(NULL), frames(0)
+{
+}
+
+H264Encoder::~H264Encoder()
+{
+  freeContext();
+}
+
+bool H264Encoder::isSupported()
+{
+  if (!h264)
+    return false;
+
+  // Lossy, so only if the client has said what quality it wants
+  if (conn->client.qualityLevel == -1)
+    return false;
+
+  return conn->client.supportsEncoding(encodingH264);
+}
+
+void H264Encoder::setQualityLevel(int level)
+{
+  qualityLevel = level;
+}
+
+void H264Encoder::writeRect(const PixelBuffer* pb, const Palette& palette)
+{
+  rdr::OutStream* os;
+
+  SSourcePicture pic;
+  SFrameBSInfo info;
+
+  rdr::U32 flags, length;
+
+  int width, height;
+
+  width = pb->width();
+  height = pb->height();
+
+  // The decoder keys its contexts on the rect, so any change means
+  // starting a new stream
+  flags = 0;
+  if ((encoder == NULL) || !encoderRect.equals(rect) ||
+      (encoderQuality != qualityLevel)) {
+    freeContext();
+    if (!initContext(width, height))
+      throw Exception("H264Encoder: Unable to create encoder");
+    encoderRect = rect;
+    encoderQuality = qualityLevel;
+    // We only ever have one context, so get rid of any old ones in
+    // the client as well
+    flags = resetAllContexts;
+  }
+
+  convertFrame(pb);
+
+  memset(&pic, 0, sizeof(pic));
+  pic.iColorFormat = videoFormatI420;
+  pic.iPicWidth = width;
+  pic.iPicHeight = height;
+  pic.iStride[0] = width;
+  pic.iStride[1] = width / 2;
+  pic.iStride[2] = width / 2;
+  pic.pData[0] = yuv;
+  pic.pData[1] = yuv + width * height;
+  pic.pData[2] = yuv + width * height + (width / 2) * (height / 2);
+  pic.uiTimeStamp = (long long)(frames * 1000 / FrameRate);
+
+  memset(&info, 0, sizeof(info));
+  if (encoder->EncodeFrame(&pic, &info) != cmResultSuccess)
+    throw Exception("H264Encoder: Failed to encode frame");
+
+  frames++;
+
+  length = 0;
+  if (info.eFrameType != videoFrameTypeSkip)
+    length = info.iFrameSizeInBytes;
+
+  os = conn->getOutStream();
+
+  os->writeU32(length);
+  os->writeU32(flags);
+
+  if (length == 0)
+    return;
+
+  for (int layer = 0;layer < info.iLayerNum;layer++) {
+    const SLayerBSInfo* li = &info.sLayerInfo[layer];
+    int size;
+
+    size = 0;
+    for (int nal = 0;nal < li->iNalCount;nal++)
+      size += li->pNalLengthInByte[nal];
+
+    os->writeBytes(li->pBsBuf, size);
+  }
+}
+
+void H264Encoder::writeSolidRect(int width, int height,
+                                 const PixelFormat& pf,
+                                 const rdr::U8* colour)
+{
+  // EncodeManager never sends us solid rects
+  throw Exception("H264Encoder: Solid rects are not supported");
+}
+
+size_t H264Encoder::memoryUsage()
+{
+  // The encoder's own state isn't visible to us
+  if (encoder == NULL)
+    return 0;
+
+  return encoderRect.area() * 3 / 2 + encoderRect.width() * 2 * 3;
+}
+
+void H264Encoder::releaseMemory()
+{
+  // The next frame starts a new stream, which resets the client
+  freeContext();
+}
+
+bool H264Encoder::initContext(int width, int height)
+{
+  SEncParamExt param;
+  int quality;
+
+  if (WelsCreateSVCEncoder(&encoder) != 0) {
+    encoder = NULL;
+    return false;
+  }
+
+  quality = qualityLevel;
+  if ((quality < 0) || (quality > 9))
+    quality = 6;
+
+  encoder->GetDefaultParams(&param);
+
+  param.iUsageType = CAMERA_VIDEO_REAL_TIME;
+  param.iPicWidth = width;
+  param.iPicHeight = height;
+  param.iTargetBitrate = width * height * FrameRate * bitsPerPixel[quality];
+  param.iRCMode = RC_BITRATE_MODE;
+  param.fMaxFrameRate = FrameRate;
+  param.iTemporalLayerNum = 1;
+  param.iSpatialLayerNum = 1;
+  param.sSpatialLayers[0].iVideoWidth = width;
+  param.sSpatialLayers[0].iVideoHeight = height;
+  param.sSpatialLayers[0].fFrameRate = FrameRate;
+  param.sSpatialLayers[0].iSpatialBitrate = param.iTargetBitrate;
+  param.sSpatialLayers[0].iMaxSpatialBitrate = param.iTargetBitrate * 2;
+  param.sSpatialLayers[0].sSliceArgument.uiSliceMode = SM_SINGLE_SLICE;
+  // Updates come irregularly, so don't let the rate control drop any
+  param.bEnableFrameSkip = false;
+  // Only the first frame needs to be an IDR frame
+  param.uiIntraPeriod = 0;
+  param.iEntropyCodingModeFlag = 0;
+  param.iMultipleThreadIdc = 1;
+
+  if (encoder->InitializeExt(&param) != cmResultSuccess) {
+    WelsDestroySVCEncoder(encoder);
+    encoder = NULL;
+    return false;
+  }
+
+  yuv = new rdr::U8[width * height * 3 / 2];
+  // Two rows at a time, as the chroma is shared between them
+  rgb = new rdr::U8[width * 2 * 3];
+  frames = 0;
+
+  vlog.debug("Started H.264 stream for %dx%d, %d kbit/s",
+             width, height, param.iTargetBitrate / 1000);
+
+  return true;
+}
+
+void H264Encoder::freeContext()
+{
+  if (encoder != NULL) {
+    encoder->Uninitialize();
+    WelsDestroySVCEncoder(encoder);
+    encoder = NULL;
+  }
+
+  delete [] yuv;
+  yuv = NULL;
+  delete [] rgb;
+  rgb = NULL;
+}
+
+void H264Encoder::convertFrame(const PixelBuffer* pb)
+{
+  const PixelFormat& pf = pb->getPF();
+
+  const rdr::U8* buffer;
+  int stride;
+
+  int width, height;
+  rdr::U8 *y, *u, *v;
+
+  width = pb->width();
+  height = pb->height();
+
+  buffer = pb->getBuffer(pb->getRect(), &stride);
+
+  y = yuv;
+  u = yuv + width * height;
+  v = u + (width / 2) * (height / 2);
+
+  // BT.601, limited range, with chroma averaged over 2x2 pixels
+  for (int row = 0;row < height;row += 2) {
+    const rdr::U8 *top, *bottom;
+
+    pf.rgbFromBuffer(rgb, buffer + row * stride * pf.bpp/8, width);
+    pf.rgbFromBuffer(rgb + width * 3,
+                     buffer + (row + 1) * stride * pf.bpp/8, width);
+
+    top = rgb;
+    bottom = rgb + width * 3;
+
+    for (int col = 0;col < width;col += 2) {
+      int r, g, b;
+
+      y[col] = (66 * top[0] + 129 * top[1] + 25 * top[2] + 4224) >> 8;
+      y[col + 1] = (66 * top[3] + 129 * top[4] + 25 * top[5] + 4224) >> 8;
+      y[width + col] = (66 * bottom[0] + 129 * bottom[1] +
+                        25 * bottom[2] + 4224) >> 8;
+      y[width + col + 1] = (66 * bottom[3] + 129 * bottom[4] +
+                            25 * bottom[5] + 4224) >> 8;
+
+      r = (top[0] + top[3] + bottom[0] + bottom[3] + 2) >> 2;
+      g = (top[1] + top[4] + bottom[1] + bottom[4] + 2) >> 2;
+      b = (top[2] + top[5] + bottom[2] + bottom[5] + 2) >> 2;
+
+      *u++ = (-38 * r - 74 * g + 112 * b + 32896) >> 8;
+      *v++ = (112 * r - 94 * g - 18 * b + 32896) >> 8;
+
+      top += 6;
+      bottom += 6;
+    }
+
+    y += width * 2;
+  }
+}
+
+#endif
@@ -0,0 +1,74 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_H264ENCODER_H__
+#define __RFB_H264ENCODER_H__
+
+#include <rfb/Encoder.h>
+#include <rfb/Rect.h>
+
+class ISVCEncoder;
+
+namespace rfb {
+
+  // H264Encoder is only used for areas of the screen that EncodeManager
+  // has found to be playing video. It keeps a single encoder context
+  // for the current video area, and starts over with a fresh context
+  // whenever that area moves or changes size.
+
+  class H264Encoder : public Encoder {
+  public:
+    H264Encoder(SConnection* conn);
+    virtual ~H264Encoder();
+
+    virtual bool isSupported();
+
+    virtual void setQualityLevel(int level);
+    virtual int getQualityLevel() { return qualityLevel; };
+
+    // The rect is needed as the client keeps one decoder per rect
+    void setRect(const Rect& r) { rect = r; };
+
+    virtual void writeRect(const PixelBuffer* pb, const Palette& palette);
+    virtual void writeSolidRect(int width, int height,
+                                const PixelFormat& pf,
+                                const rdr::U8* colour);
+
+    virtual size_t memoryUsage();
+    virtual void releaseMemory();
+
+  protected:
+    bool initContext(int width, int height);
+    void freeContext();
+
+    void convertFrame(const PixelBuffer* pb);
+
+  protected:
+    int qualityLevel;
+
+    Rect rect;
+
+    ISVCEncoder* encoder;
+    Rect encoderRect;
+    int encoderQuality;
+
+    rdr::U8* yuv;
+    rdr::U8* rgb;
+    unsigned long long frames;
+  };
+}
+#endif
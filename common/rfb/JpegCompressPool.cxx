@@ -0,0 +1,231 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <assert.h>
+
+#include <rdr/Exception.h>
+#include <os/Mutex.h>
+#include <rfb/JpegCompressor.h>
+#include <rfb/JpegCompressPool.h>
+#include <rfb/LogWriter.h>
+
+using namespace rfb;
+
+static LogWriter vlog("JpegCompressPool");
+
+// Jobs that can be waiting for, or worked on by, each thread. Enough
+// to keep the threads busy while the main thread fills the queue
+// again, without letting a single connection hog them.
+static const int QueueDepth = 2;
+
+JpegCompressPool* JpegCompressPool::instance = NULL;
+int JpegCompressPool::users = 0;
+
+static os::Mutex instanceMutex;
+
+JpegCompressPool* JpegCompressPool::acquire()
+{
+  os::AutoMutex a(&instanceMutex);
+
+  if (instance == NULL)
+    instance = new JpegCompressPool();
+
+  users++;
+
+  return instance;
+}
+
+void JpegCompressPool::release()
+{
+  os::AutoMutex a(&instanceMutex);
+
+  assert(users > 0);
+
+  users--;
+  if (users > 0)
+    return;
+
+  delete instance;
+  instance = NULL;
+}
+
+JpegCompressPool::JpegCompressPool()
+  : pendingJobs(0), maxPendingJobs(0)
+{
+  size_t cpuCount;
+
+  queueMutex = new os::Mutex();
+  jobCond = new os::Condition(queueMutex);
+  doneCond = new os::Condition(queueMutex);
+
+  cpuCount = os::Thread::getSystemCPUCount();
+  if (cpuCount == 0)
+    cpuCount = 1;
+
+  // No point in the context switches on single CPU machines
+  if (cpuCount == 1)
+    return;
+
+  vlog.debug("Creating %d compression thread(s)", (int)cpuCount);
+
+  maxPendingJobs = cpuCount * QueueDepth;
+
+  while (cpuCount--)
+    threads.push_back(new CompressThread(this));
+}
+
+JpegCompressPool::~JpegCompressPool()
+{
+  // Every user should have collected its jobs by now
+  assert(jobQueue.empty());
+
+  while (!threads.empty()) {
+    delete threads.back();
+    threads.pop_back();
+  }
+
+  delete doneCond;
+  delete jobCond;
+  delete queueMutex;
+}
+
+bool JpegCompressPool::queueJob(Job* job)
+{
+  os::AutoMutex a(queueMutex);
+
+  // Rather than waiting for a thread, the caller is better off doing
+  // the work itself. Waiting could also deadlock, as the caller might
+  // be the one that needs to write out done jobs.
+  if (pendingJobs >= maxPendingJobs)
+    return false;
+
+  job->active = false;
+  job->done = false;
+  job->error = NULL;
+
+  jobQueue.push_back(job);
+  pendingJobs++;
+
+  jobCond->signal();
+
+  return true;
+}
+
+void JpegCompressPool::waitJob(Job* job)
+{
+  os::AutoMutex a(queueMutex);
+
+  while (!job->done)
+    doneCond->wait();
+}
+
+void JpegCompressPool::cancelJob(Job* job)
+{
+  os::AutoMutex a(queueMutex);
+
+  if (job->done)
+    return;
+
+  if (!job->active) {
+    jobQueue.remove(job);
+    pendingJobs--;
+    job->done = true;
+    return;
+  }
+
+  while (!job->done)
+    doneCond->wait();
+}
+
+void JpegCompressPool::compress(Job* job)
+{
+  job->jc->clear();
+  job->jc->compress(job->buffer, job->stride, job->rect,
+                    job->pf, job->quality, job->subsampling,
+                    job->fastDCT, job->optimize);
+}
+
+JpegCompressPool::CompressThread::CompressThread(JpegCompressPool* pool)
+{
+  this->pool = pool;
+
+  stopRequested = false;
+
+  start();
+}
+
+JpegCompressPool::CompressThread::~CompressThread()
+{
+  stop();
+  wait();
+}
+
+void JpegCompressPool::CompressThread::stop()
+{
+  os::AutoMutex a(pool->queueMutex);
+
+  if (!isRunning())
+    return;
+
+  stopRequested = true;
+
+  // We can't wake just this thread, so wake everyone
+  pool->jobCond->broadcast();
+}
+
+void JpegCompressPool::CompressThread::worker()
+{
+  pool->queueMutex->lock();
+
+  while (!stopRequested) {
+    Job *job;
+
+    if (pool->jobQueue.empty()) {
+      // Wait and try again
+      pool->jobCond->wait();
+      continue;
+    }
+
+    job = pool->jobQueue.front();
+    pool->jobQueue.pop_front();
+
+    // This is ours now
+    job->active = true;
+
+    pool->queueMutex->unlock();
+
+    try {
+      compress(job);
+    } catch (rdr::Exception& e) {
+      job->error = new rdr::Exception("Exception on worker thread: %s",
+                                      e.str());
+    } catch(...) {
+      assert(false);
+    }
+
+    pool->queueMutex->lock();
+
+    job->done = true;
+    pool->pendingJobs--;
+
+    // Different owners might be waiting for different jobs
+    pool->doneCond->broadcast();
+  }
+
+  pool->queueMutex->unlock();
+}
@@ -0,0 +1,121 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// JpegCompressPool is a single set of threads, shared by every
+// connection in the process, that compresses JPEG rects. Jobs are
+// started in the order they are queued, no matter which connection
+// they come from, but can finish in any order. It is up to each
+// owner to write out its jobs in the order it needs.
+//
+
+#ifndef __RFB_JPEGCOMPRESSPOOL_H__
+#define __RFB_JPEGCOMPRESSPOOL_H__
+
+#include <list>
+
+#include <os/Thread.h>
+
+#include <rfb/PixelFormat.h>
+#include <rfb/Rect.h>
+
+namespace os {
+  class Condition;
+  class Mutex;
+}
+
+namespace rdr { struct Exception; }
+
+namespace rfb {
+
+  class JpegCompressor;
+
+  class JpegCompressPool {
+  public:
+    struct Job {
+      // Set up by the owner
+      Rect rect;
+      const rdr::U8* buffer;
+      int stride;
+      PixelFormat pf;
+      int quality;
+      int subsampling;
+      bool fastDCT;
+      bool optimize;
+      JpegCompressor* jc;
+
+      // Set by the pool
+      bool active;
+      bool done;
+      rdr::Exception* error;
+    };
+
+    // Every user holds a reference to the pool, which is created on
+    // first use and goes away with its last user
+    static JpegCompressPool* acquire();
+    static void release();
+
+    // Hands the job over to the threads. Returns false if there are
+    // no threads, or if they already have all the work they can take,
+    // in which case the caller should compress the job itself.
+    bool queueJob(Job* job);
+
+    // Waits until a queued job is done
+    void waitJob(Job* job);
+    // Takes back a queued job, or waits for it if it has been started
+    void cancelJob(Job* job);
+
+    static void compress(Job* job);
+
+  private:
+    JpegCompressPool();
+    ~JpegCompressPool();
+
+    class CompressThread : public os::Thread {
+    public:
+      CompressThread(JpegCompressPool* pool);
+      ~CompressThread();
+
+      void stop();
+
+    protected:
+      void worker();
+
+    private:
+      JpegCompressPool* pool;
+
+      bool stopRequested;
+    };
+
+    os::Mutex* queueMutex;
+    os::Condition* jobCond;
+    os::Condition* doneCond;
+
+    std::list<Job*> jobQueue;
+    size_t pendingJobs;
+    size_t maxPendingJobs;
+
+    std::list<CompressThread*> threads;
+
+    static JpegCompressPool* instance;
+    static int users;
+  };
+
+}
+
+#endif
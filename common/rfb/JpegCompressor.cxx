@@ -152,7 +152,8 @@ JpegCompressor::~JpegCompressor(void)
 }
 
 void JpegCompressor::compress(const rdr::U8 *buf, int stride, const Rect& r,
-  const PixelFormat& pf, int quality, int subsamp)
+  const PixelFormat& pf, int quality, int subsamp, bool fastDCT,
+  bool optimize)
 {
   int w = r.width();
   int h = r.height();
@@ -206,13 +207,15 @@ void JpegCompressor::compress(const rdr::U8 *buf, int stride, const Rect& r,
 
   jpeg_set_defaults(cinfo);
 
-  if (quality >= 1 && quality <= 100) {
+  if (quality >= 1 && quality <= 100)
     jpeg_set_quality(cinfo, quality, TRUE);
-    if (quality >= 96)
-      cinfo->dct_method = JDCT_ISLOW;
-    else
-      cinfo->dct_method = JDCT_FASTEST;
-  }
+
+  if (fastDCT)
+    cinfo->dct_method = JDCT_FASTEST;
+  else
+    cinfo->dct_method = JDCT_ISLOW;
+
+  cinfo->optimize_coding = optimize ? TRUE : FALSE;
 
   switch (subsamp) {
   case subsample16X:
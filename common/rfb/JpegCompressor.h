@@ -43,7 +43,10 @@ namespace rfb {
     JpegCompressor(int bufferLen = 128*1024);
     virtual ~JpegCompressor();
 
-    void compress(const rdr::U8 *, int, const Rect&, const PixelFormat&, int, int);
+    // The fast DCT trades accuracy for speed, and optimised Huffman
+    // tables trade speed for size (an extra pass over the data)
+    void compress(const rdr::U8 *, int, const Rect&, const PixelFormat&,
+                  int, int, bool fastDCT, bool optimize);
 
     void writeBytes(const void*, int);
 
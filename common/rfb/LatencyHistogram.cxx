@@ -0,0 +1,174 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <rfb/LatencyHistogram.h>
+#include <rfb/util.h>
+
+using namespace rfb;
+
+LatencyHistogram::LatencyHistogram()
+{
+  reset();
+}
+
+void LatencyHistogram::reset()
+{
+  samples = 0;
+  total = 0;
+  maxValue = 0;
+  memset(counts, 0, sizeof(counts));
+}
+
+// Values below SubBuckets get a bucket each. Above that every doubling
+// is split in SubBuckets buckets, picked by the bits right after the
+// most significant one.
+int LatencyHistogram::bucketIndex(unsigned long long value)
+{
+  int bits;
+
+  if (value < (unsigned long long)SubBuckets)
+    return value;
+
+  if (value >= (1ULL << MaxBits))
+    return NumBuckets - 1;
+
+  bits = SubBucketBits + 1;
+  while ((value >> bits) != 0)
+    bits++;
+
+  return (bits - SubBucketBits) * SubBuckets +
+         ((value >> (bits - SubBucketBits - 1)) & (SubBuckets - 1));
+}
+
+// The highest value that ends up in the bucket
+unsigned long long LatencyHistogram::bucketValue(int index)
+{
+  int bits, shift;
+
+  if (index < SubBuckets)
+    return index;
+
+  bits = index / SubBuckets + SubBucketBits;
+  shift = bits - SubBucketBits - 1;
+
+  return ((unsigned long long)(SubBuckets + index % SubBuckets) << shift) +
+         (1ULL << shift) - 1;
+}
+
+void LatencyHistogram::add(unsigned long long usecs)
+{
+  counts[bucketIndex(usecs)]++;
+  samples++;
+  total += usecs;
+  if (usecs > maxValue)
+    maxValue = usecs;
+}
+
+void LatencyHistogram::addSince(const struct timeval* start)
+{
+  struct timeval now;
+  long long usecs;
+
+  gettimeofday(&now, NULL);
+
+  usecs = (now.tv_sec - start->tv_sec) * 1000000LL +
+          (now.tv_usec - start->tv_usec);
+
+  // The clock might have been changed
+  if (usecs < 0)
+    usecs = 0;
+
+  add(usecs);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+  int i;
+
+  for (i = 0;i < NumBuckets;i++)
+    counts[i] += other.counts[i];
+
+  samples += other.samples;
+  total += other.total;
+  if (other.maxValue > maxValue)
+    maxValue = other.maxValue;
+}
+
+unsigned long long LatencyHistogram::mean() const
+{
+  if (samples == 0)
+    return 0;
+
+  return total / samples;
+}
+
+unsigned long long LatencyHistogram::percentile(double percent) const
+{
+  unsigned long long target, seen;
+  int i;
+
+  if (samples == 0)
+    return 0;
+
+  target = samples * percent / 100.0;
+  if (target < 1)
+    target = 1;
+  if (target > samples)
+    target = samples;
+
+  seen = 0;
+  for (i = 0;i < NumBuckets;i++) {
+    seen += counts[i];
+    if (seen >= target)
+      break;
+  }
+
+  return __rfbmin(bucketValue(i), maxValue);
+}
+
+static const char* formatTime(unsigned long long usecs,
+                              char* buffer, size_t maxlen)
+{
+  if (usecs < 1000000)
+    snprintf(buffer, maxlen, "%.3g ms", usecs / 1000.0);
+  else
+    snprintf(buffer, maxlen, "%.3g s", usecs / 1000000.0);
+
+  return buffer;
+}
+
+size_t LatencyHistogram::print(char* buffer, size_t maxlen) const
+{
+  char count[64];
+  char a[32], b[32], c[32], d[32], e[32], f[32];
+
+  siPrefix(samples, "samples", count, sizeof(count), 3);
+
+  return snprintf(buffer, maxlen,
+                  "%s, mean %s, 50%% %s, 90%% %s, 99%% %s, 99.9%% %s, max %s",
+                  count, formatTime(mean(), a, sizeof(a)),
+                  formatTime(percentile(50), b, sizeof(b)),
+                  formatTime(percentile(90), c, sizeof(c)),
+                  formatTime(percentile(99), d, sizeof(d)),
+                  formatTime(percentile(99.9), e, sizeof(e)),
+                  formatTime(maxValue, f, sizeof(f)));
+}
@@ -0,0 +1,76 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// LatencyHistogram counts how long something took, in microseconds,
+// without keeping the individual samples. As in an HDR histogram the
+// buckets get wider as the values grow, so every value is counted
+// with the same relative precision (about 6%) whatever its size, and
+// adding a sample is only a handful of instructions.
+//
+
+#ifndef __RFB_LATENCYHISTOGRAM_H__
+#define __RFB_LATENCYHISTOGRAM_H__
+
+#include <stddef.h>
+
+struct timeval;
+
+namespace rfb {
+
+  class LatencyHistogram {
+  public:
+    LatencyHistogram();
+
+    void reset();
+
+    void add(unsigned long long usecs);
+    // Adds the time that has passed since start
+    void addSince(const struct timeval* start);
+
+    void merge(const LatencyHistogram& other);
+
+    unsigned long long count() const { return samples; }
+    unsigned long long mean() const;
+    unsigned long long max() const { return maxValue; }
+
+    // Returns the value that the given percentage of the samples are
+    // at or below
+    unsigned long long percentile(double percent) const;
+
+    // Summarises the histogram on a single line
+    size_t print(char* buffer, size_t maxlen) const;
+
+  private:
+    static const int SubBucketBits = 4;
+    static const int SubBuckets = 1 << SubBucketBits;
+    static const int MaxBits = 36;
+    static const int NumBuckets = (MaxBits - SubBucketBits + 1) * SubBuckets;
+
+    static int bucketIndex(unsigned long long value);
+    static unsigned long long bucketValue(int index);
+
+    unsigned long long samples;
+    unsigned long long total;
+    unsigned long long maxValue;
+    unsigned long long counts[NumBuckets];
+  };
+
+}
+
+#endif
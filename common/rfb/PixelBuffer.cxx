@@ -22,9 +22,12 @@
 // The PixelBuffer class encapsulates the PixelFormat and dimensions
 // of a block of pixel data.
 
+#include <string.h>
+
 #include <rfb/Exception.h>
 #include <rfb/LogWriter.h>
 #include <rfb/PixelBuffer.h>
+#include <rfb/util.h>
 
 using namespace rfb;
 using namespace rdr;
@@ -344,6 +347,13 @@ ManagedPixelBuffer::~ManagedPixelBuffer() {
   if (data) delete [] data;
 };
 
+void
+ManagedPixelBuffer::release() {
+  if (data) delete [] data;
+  data = 0; datasize = 0;
+  width_ = height_ = stride = 0;
+};
+
 
 void
 ManagedPixelBuffer::setPF(const PixelFormat &pf) {
@@ -354,6 +364,41 @@ ManagedPixelBuffer::setSize(int w, int h) {
   width_ = w; height_ = h; stride = w; checkDataSize();
 };
 
+void
+ManagedPixelBuffer::resize(int w, int h) {
+  unsigned long new_datasize;
+  int bytesPerPixel, rowBytes, rows;
+
+  bytesPerPixel = format.bpp/8;
+  rowBytes = __rfbmin(w, width_) * bytesPerPixel;
+  rows = __rfbmin(h, height_);
+
+  new_datasize = w * h * bytesPerPixel;
+  if (datasize < new_datasize) {
+    U8* new_data;
+
+    new_data = new U8[new_datasize];
+    for (int y = 0; y < rows; y++)
+      memcpy(new_data + y * w * bytesPerPixel,
+             data + y * stride * bytesPerPixel, rowBytes);
+
+    delete [] data;
+    data = new_data;
+    datasize = new_datasize;
+  } else if (w < stride) {
+    // Rows move towards the start of the buffer
+    for (int y = 0; y < rows; y++)
+      memmove(data + y * w * bytesPerPixel,
+              data + y * stride * bytesPerPixel, rowBytes);
+  } else if (w > stride) {
+    // Rows move towards the end, so start with the last one
+    for (int y = rows - 1; y >= 0; y--)
+      memmove(data + y * w * bytesPerPixel,
+              data + y * stride * bytesPerPixel, rowBytes);
+  }
+
+  width_ = w; height_ = h; stride = w;
+};
 
 inline void
 ManagedPixelBuffer::checkDataSize() {
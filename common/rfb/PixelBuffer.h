@@ -172,9 +172,20 @@ namespace rfb {
     virtual void setPF(const PixelFormat &pf);
     virtual void setSize(int w, int h);
 
+    // Change the size but keep the pixels of the area that is in both
+    // the old and the new size. The rest of the buffer is undefined.
+    void resize(int w, int h);
+
     // Return the total number of bytes of pixel data in the buffer
     int dataLen() const { return width_ * height_ * (format.bpp/8); }
 
+    // Return the number of bytes allocated, which can be more than is
+    // currently needed
+    size_t memoryUsage() const { return datasize; }
+
+    // Give the pixel data back, leaving an empty buffer
+    void release();
+
   protected:
     unsigned long datasize;
     void checkDataSize();
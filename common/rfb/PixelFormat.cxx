@@ -25,6 +25,7 @@
 #include <rdr/OutStream.h>
 #include <rfb/Exception.h>
 #include <rfb/PixelFormat.h>
+#include <rfb/PixelFormatSIMD.h>
 #include <rfb/util.h>
 
 #ifdef _WIN32
@@ -233,22 +234,26 @@ void PixelFormat::bufferFromRGB(rdr::U8 *dst, const rdr::U8* src,
   if (is888()) {
     // Optimised common case
     rdr::U8 *r, *g, *b, *x;
+    int offsets[4];
+    int done;
 
-    if (bigEndian) {
-      r = dst + (24 - redShift)/8;
-      g = dst + (24 - greenShift)/8;
-      b = dst + (24 - blueShift)/8;
-      x = dst + (24 - (48 - redShift - greenShift - blueShift))/8;
-    } else {
-      r = dst + redShift/8;
-      g = dst + greenShift/8;
-      b = dst + blueShift/8;
-      x = dst + (48 - redShift - greenShift - blueShift)/8;
-    }
+    byteOffsets888(offsets);
+
+    // Vectorised where possible, with the remaining columns below
+    done = simdRGBTo888(dst, src, w, h, stride, w, offsets);
+    if (done == w)
+      return;
 
-    int dstPad = (stride - w) * 4;
+    r = dst + done*4 + offsets[0];
+    g = dst + done*4 + offsets[1];
+    b = dst + done*4 + offsets[2];
+    x = dst + done*4 + offsets[3];
+    src += done*3;
+
+    int dstPad = (stride - (w - done)) * 4;
+    int srcPad = done * 3;
     while (h--) {
-      int w_ = w;
+      int w_ = w - done;
       while (w_--) {
         *r = *(src++);
         *g = *(src++);
@@ -263,6 +268,7 @@ void PixelFormat::bufferFromRGB(rdr::U8 *dst, const rdr::U8* src,
       g += dstPad;
       b += dstPad;
       x += dstPad;
+      src += srcPad;
     }
   } else {
     // Generic code
@@ -300,20 +306,25 @@ void PixelFormat::rgbFromBuffer(rdr::U8* dst, const rdr::U8* src,
   if (is888()) {
     // Optimised common case
     const rdr::U8 *r, *g, *b;
+    int offsets[4];
+    int done;
 
-    if (bigEndian) {
-      r = src + (24 - redShift)/8;
-      g = src + (24 - greenShift)/8;
-      b = src + (24 - blueShift)/8;
-    } else {
-      r = src + redShift/8;
-      g = src + greenShift/8;
-      b = src + blueShift/8;
-    }
+    byteOffsets888(offsets);
+
+    // Vectorised where possible, with the remaining columns below
+    done = simd888ToRGB(dst, src, w, h, w, stride, offsets);
+    if (done == w)
+      return;
 
-    int srcPad = (stride - w) * 4;
+    r = src + done*4 + offsets[0];
+    g = src + done*4 + offsets[1];
+    b = src + done*4 + offsets[2];
+    dst += done*3;
+
+    int srcPad = (stride - (w - done)) * 4;
+    int dstPad = done * 3;
     while (h--) {
-      int w_ = w;
+      int w_ = w - done;
       while (w_--) {
         *(dst++) = *r;
         *(dst++) = *g;
@@ -325,6 +336,7 @@ void PixelFormat::rgbFromBuffer(rdr::U8* dst, const rdr::U8* src,
       r += srcPad;
       g += srcPad;
       b += srcPad;
+      dst += dstPad;
     }
   } else {
     // Generic code
@@ -380,30 +392,28 @@ void PixelFormat::bufferFromBuffer(rdr::U8* dst, const PixelFormat &srcPF,
   } else if (is888() && srcPF.is888()) {
     // Optimised common case A: byte shuffling (e.g. endian conversion)
     rdr::U8 *d[4], *s[4];
+    int dstOffsets[4], srcOffsets[4], offsets[4];
     int dstPad, srcPad;
+    int done;
 
-    if (bigEndian) {
-      s[0] = dst + (24 - redShift)/8;
-      s[1] = dst + (24 - greenShift)/8;
-      s[2] = dst + (24 - blueShift)/8;
-      s[3] = dst + (24 - (48 - redShift - greenShift - blueShift))/8;
-    } else {
-      s[0] = dst + redShift/8;
-      s[1] = dst + greenShift/8;
-      s[2] = dst + blueShift/8;
-      s[3] = dst + (48 - redShift - greenShift - blueShift)/8;
-    }
+    byteOffsets888(dstOffsets);
+    srcPF.byteOffsets888(srcOffsets);
+
+    for (int i = 0;i < 4;i++)
+      offsets[srcOffsets[i]] = dstOffsets[i];
+
+    // Vectorised where possible, with the remaining columns below
+    done = simdSwizzle888(dst, src, w, h, dstStride, srcStride, offsets);
+    if (done == w)
+      return;
 
-    if (srcPF.bigEndian) {
-      d[(24 - srcPF.redShift)/8] = s[0];
-      d[(24 - srcPF.greenShift)/8] = s[1];
-      d[(24 - srcPF.blueShift)/8] = s[2];
-      d[(24 - (48 - srcPF.redShift - srcPF.greenShift - srcPF.blueShift))/8] = s[3];
-    } else {
-      d[srcPF.redShift/8] = s[0];
-      d[srcPF.greenShift/8] = s[1];
-      d[srcPF.blueShift/8] = s[2];
-      d[(48 - srcPF.redShift - srcPF.greenShift - srcPF.blueShift)/8] = s[3];
+    dst += done*4;
+    src += done*4;
+    w -= done;
+
+    for (int i = 0;i < 4;i++) {
+      s[i] = dst + dstOffsets[i];
+      d[srcOffsets[i]] = s[i];
     }
 
     dstPad = (dstStride - w) * 4;
@@ -428,6 +438,28 @@ void PixelFormat::bufferFromBuffer(rdr::U8* dst, const PixelFormat &srcPF,
     }
   } else if (IS_ALIGNED(dst, bpp/8) && srcPF.is888()) {
     // Optimised common case B: 888 source
+    if (bpp == 16) {
+      int srcOffsets[4], shifts[3], maxes[3];
+      int done;
+
+      srcPF.byteOffsets888(srcOffsets);
+      shifts[0] = redShift;
+      shifts[1] = greenShift;
+      shifts[2] = blueShift;
+      maxes[0] = redMax;
+      maxes[1] = greenMax;
+      maxes[2] = blueMax;
+
+      done = simd888To16((rdr::U16*)dst, src, w, h, dstStride, srcStride,
+                         srcOffsets, shifts, maxes, endianMismatch);
+      if (done == w)
+        return;
+
+      dst += done*2;
+      src += done*4;
+      w -= done;
+    }
+
     switch (bpp) {
     case 8:
       directBufferFromBufferFrom888((rdr::U8*)dst, srcPF, src,
@@ -444,6 +476,29 @@ void PixelFormat::bufferFromBuffer(rdr::U8* dst, const PixelFormat &srcPF,
     }
   } else if (IS_ALIGNED(src, srcPF.bpp/8) && is888()) {
     // Optimised common case C: 888 destination
+    if (srcPF.bpp == 16) {
+      int dstOffsets[4], shifts[3], maxes[3];
+      int done;
+
+      byteOffsets888(dstOffsets);
+      shifts[0] = srcPF.redShift;
+      shifts[1] = srcPF.greenShift;
+      shifts[2] = srcPF.blueShift;
+      maxes[0] = srcPF.redMax;
+      maxes[1] = srcPF.greenMax;
+      maxes[2] = srcPF.blueMax;
+
+      done = simd16To888(dst, (const rdr::U16*)src, w, h,
+                         dstStride, srcStride, dstOffsets,
+                         shifts, maxes, srcPF.endianMismatch);
+      if (done == w)
+        return;
+
+      dst += done*4;
+      src += done*2;
+      w -= done;
+    }
+
     switch (srcPF.bpp) {
     case 8:
       directBufferFromBufferTo888(dst, srcPF, (rdr::U8*)src,
@@ -483,6 +538,26 @@ void PixelFormat::bufferFromBuffer(rdr::U8* dst, const PixelFormat &srcPF,
 }
 
 
+void PixelFormat::byteOffsets888(int offsets[4]) const
+{
+  int padShift;
+
+  padShift = 48 - redShift - greenShift - blueShift;
+
+  if (bigEndian) {
+    offsets[0] = (24 - redShift)/8;
+    offsets[1] = (24 - greenShift)/8;
+    offsets[2] = (24 - blueShift)/8;
+    offsets[3] = (24 - padShift)/8;
+  } else {
+    offsets[0] = redShift/8;
+    offsets[1] = greenShift/8;
+    offsets[2] = blueShift/8;
+    offsets[3] = padShift/8;
+  }
+}
+
+
 void PixelFormat::print(char* str, int len) const
 {
   // Unfortunately snprintf is not widely available so we build the string up
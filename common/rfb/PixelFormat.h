@@ -91,6 +91,10 @@ namespace rfb {
     bool isSane(void);
 
   private:
+    // Memory position of the red, green, blue and padding bytes of
+    // each pixel, for 888 formats
+    void byteOffsets888(int offsets[4]) const;
+
     // Preprocessor generated, optimised methods
 
     void directBufferFromBufferFrom888(rdr::U8* dst, const PixelFormat &srcPF,
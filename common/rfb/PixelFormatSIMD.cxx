@@ -0,0 +1,822 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#include <rfb/PixelFormatSIMD.h>
+
+// The kernels are built with per-function target attributes so that the
+// rest of the code doesn't need any special compiler flags, and so that
+// the binary still runs on CPUs without these extensions.
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+using namespace rfb;
+
+static int simdLevel = -1;
+
+SIMDLevel rfb::getCPUSIMDLevel()
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return simdAVX2;
+  if (__builtin_cpu_supports("ssse3"))
+    return simdSSSE3;
+#endif
+  return simdNone;
+}
+
+SIMDLevel rfb::getSIMDLevel()
+{
+  if (simdLevel < 0)
+    simdLevel = getCPUSIMDLevel();
+  return (SIMDLevel)simdLevel;
+}
+
+void rfb::setSIMDLevel(SIMDLevel level)
+{
+  if (level > getCPUSIMDLevel())
+    level = getCPUSIMDLevel();
+  simdLevel = level;
+}
+
+const char* rfb::simdLevelName(SIMDLevel level)
+{
+  switch (level) {
+  case simdSSSE3:
+    return "SSSE3";
+  case simdAVX2:
+    return "AVX2";
+  default:
+    return "scalar";
+  }
+}
+
+#ifdef HAVE_X86_SIMD
+
+// Number of leading columns that can be done in blocks of 'block'
+// pixels when each block reads or writes 'reach' pixels worth of data
+static inline int blockColumns(int w, int block, int reach)
+{
+  if (w < reach)
+    return 0;
+  return ((w - reach) / block + 1) * block;
+}
+
+//
+// SSSE3
+//
+
+static TARGET_SSSE3 int swizzle888SSSE3(rdr::U8* dst, const rdr::U8* src,
+                                        int w, int h,
+                                        int dstStride, int srcStride,
+                                        const int dstOffsets[4])
+{
+  rdr::U8 m[16];
+  __m128i mask;
+  int cols;
+
+  for (int p = 0;p < 4;p++) {
+    for (int i = 0;i < 4;i++)
+      m[p*4 + dstOffsets[i]] = p*4 + i;
+  }
+  mask = _mm_loadu_si128((const __m128i*)m);
+
+  cols = w & ~3;
+  while (h--) {
+    for (int x = 0;x < cols;x += 4) {
+      __m128i v;
+      v = _mm_loadu_si128((const __m128i*)(src + x*4));
+      v = _mm_shuffle_epi8(v, mask);
+      _mm_storeu_si128((__m128i*)(dst + x*4), v);
+    }
+    dst += dstStride * 4;
+    src += srcStride * 4;
+  }
+
+  return cols;
+}
+
+static TARGET_SSSE3 int rgbTo888SSSE3(rdr::U8* dst, const rdr::U8* src,
+                                      int w, int h,
+                                      int dstStride, int srcStride,
+                                      const int dstOffsets[4])
+{
+  rdr::U8 m[16];
+  __m128i mask;
+  int cols;
+
+  for (int p = 0;p < 4;p++) {
+    for (int i = 0;i < 3;i++)
+      m[p*4 + dstOffsets[i]] = p*3 + i;
+    m[p*4 + dstOffsets[3]] = 0x80;
+  }
+  mask = _mm_loadu_si128((const __m128i*)m);
+
+  // Four pixels are 12 bytes, but we load 16
+  cols = blockColumns(w, 4, 6);
+  while (h--) {
+    for (int x = 0;x < cols;x += 4) {
+      __m128i v;
+      v = _mm_loadu_si128((const __m128i*)(src + x*3));
+      v = _mm_shuffle_epi8(v, mask);
+      _mm_storeu_si128((__m128i*)(dst + x*4), v);
+    }
+    dst += dstStride * 4;
+    src += srcStride * 3;
+  }
+
+  return cols;
+}
+
+static TARGET_SSSE3 int rgbFrom888SSSE3(rdr::U8* dst, const rdr::U8* src,
+                                        int w, int h,
+                                        int dstStride, int srcStride,
+                                        const int srcOffsets[3])
+{
+  rdr::U8 m[16];
+  __m128i mask;
+  int cols;
+
+  for (int p = 0;p < 4;p++) {
+    for (int i = 0;i < 3;i++)
+      m[p*3 + i] = p*4 + srcOffsets[i];
+  }
+  for (int i = 12;i < 16;i++)
+    m[i] = 0x80;
+  mask = _mm_loadu_si128((const __m128i*)m);
+
+  // We store 16 bytes for every 12, so the next block (or the scalar
+  // code) has to overwrite the excess
+  cols = blockColumns(w, 4, 6);
+  while (h--) {
+    for (int x = 0;x < cols;x += 4) {
+      __m128i v;
+      v = _mm_loadu_si128((const __m128i*)(src + x*4));
+      v = _mm_shuffle_epi8(v, mask);
+      _mm_storeu_si128((__m128i*)(dst + x*3), v);
+    }
+    dst += dstStride * 3;
+    src += srcStride * 4;
+  }
+
+  return cols;
+}
+
+// Same rounding as PixelFormat's down conversion table, i.e.
+// (v * max + 128) / 255, with the division done as
+// (t + 1 + (t >> 8)) >> 8 which is exact for the values involved
+static TARGET_SSSE3 __m128i downconvSSSE3(__m128i v, __m128i max)
+{
+  __m128i t;
+
+  t = _mm_mullo_epi16(v, max);
+  t = _mm_add_epi16(t, _mm_set1_epi32(128));
+  t = _mm_add_epi16(_mm_add_epi16(t, _mm_set1_epi32(1)),
+                    _mm_srli_epi16(t, 8));
+  return _mm_srli_epi16(t, 8);
+}
+
+static TARGET_SSSE3 __m128i pack888To16SSSE3(__m128i v,
+                                             const __m128i srcShifts[3],
+                                             const __m128i dstShifts[3],
+                                             const __m128i maxes[3])
+{
+  __m128i d;
+
+  d = _mm_setzero_si128();
+  for (int i = 0;i < 3;i++) {
+    __m128i c;
+    c = _mm_srl_epi32(v, srcShifts[i]);
+    c = _mm_and_si128(c, _mm_set1_epi32(0xff));
+    c = downconvSSSE3(c, maxes[i]);
+    d = _mm_or_si128(d, _mm_sll_epi32(c, dstShifts[i]));
+  }
+
+  return d;
+}
+
+static TARGET_SSSE3 int from888To16SSSE3(rdr::U16* dst, const rdr::U8* src,
+                                         int w, int h,
+                                         int dstStride, int srcStride,
+                                         const int srcOffsets[3],
+                                         const int shifts[3],
+                                         const int maxes[3], bool swap)
+{
+  __m128i srcShiftv[3], dstShiftv[3], maxv[3];
+  __m128i pack;
+  int cols;
+
+  for (int i = 0;i < 3;i++) {
+    srcShiftv[i] = _mm_cvtsi32_si128(srcOffsets[i] * 8);
+    dstShiftv[i] = _mm_cvtsi32_si128(shifts[i]);
+    maxv[i] = _mm_set1_epi32(maxes[i]);
+  }
+
+  // Gather the low half of each 32-bit lane, byte swapped if needed
+  if (swap)
+    pack = _mm_setr_epi8(1, 0, 5, 4, 9, 8, 13, 12,
+                         -1, -1, -1, -1, -1, -1, -1, -1);
+  else
+    pack = _mm_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13,
+                         -1, -1, -1, -1, -1, -1, -1, -1);
+
+  cols = w & ~7;
+  while (h--) {
+    for (int x = 0;x < cols;x += 8) {
+      __m128i a, b;
+
+      a = _mm_loadu_si128((const __m128i*)(src + x*4));
+      b = _mm_loadu_si128((const __m128i*)(src + x*4 + 16));
+
+      a = pack888To16SSSE3(a, srcShiftv, dstShiftv, maxv);
+      b = pack888To16SSSE3(b, srcShiftv, dstShiftv, maxv);
+
+      a = _mm_shuffle_epi8(a, pack);
+      b = _mm_shuffle_epi8(b, pack);
+
+      _mm_storeu_si128((__m128i*)(dst + x), _mm_unpacklo_epi64(a, b));
+    }
+    dst += dstStride;
+    src += srcStride * 4;
+  }
+
+  return cols;
+}
+
+// Same result as PixelFormat's up conversion table, i.e.
+// v * 255 / max rounded down. The fractional part is always a multiple
+// of 1/max, so a bias of half that keeps float errors from pushing us
+// below an integer.
+static TARGET_SSSE3 __m128i unpack16To888SSSE3(__m128i v,
+                                               const __m128i srcShifts[3],
+                                               const __m128i dstShifts[3],
+                                               const __m128i maxes[3],
+                                               const __m128 scales[3],
+                                               const __m128 biases[3])
+{
+  __m128i d;
+
+  d = _mm_setzero_si128();
+  for (int i = 0;i < 3;i++) {
+    __m128i c;
+    __m128 f;
+    c = _mm_srl_epi32(v, srcShifts[i]);
+    c = _mm_and_si128(c, maxes[i]);
+    f = _mm_cvtepi32_ps(c);
+    f = _mm_add_ps(_mm_mul_ps(f, scales[i]), biases[i]);
+    c = _mm_cvttps_epi32(f);
+    d = _mm_or_si128(d, _mm_sll_epi32(c, dstShifts[i]));
+  }
+
+  return d;
+}
+
+static TARGET_SSSE3 int to888From16SSSE3(rdr::U8* dst, const rdr::U16* src,
+                                         int w, int h,
+                                         int dstStride, int srcStride,
+                                         const int dstOffsets[4],
+                                         const int shifts[3],
+                                         const int maxes[3], bool swap)
+{
+  __m128i srcShiftv[3], dstShiftv[3], maxv[3];
+  __m128 scalev[3], biasv[3];
+  __m128i swapMask, zero;
+  int cols;
+
+  for (int i = 0;i < 3;i++) {
+    srcShiftv[i] = _mm_cvtsi32_si128(shifts[i]);
+    dstShiftv[i] = _mm_cvtsi32_si128(dstOffsets[i] * 8);
+    maxv[i] = _mm_set1_epi32(maxes[i]);
+    scalev[i] = _mm_set1_ps(255.0f / maxes[i]);
+    biasv[i] = _mm_set1_ps(0.5f / maxes[i]);
+  }
+
+  swapMask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                           9, 8, 11, 10, 13, 12, 15, 14);
+  zero = _mm_setzero_si128();
+
+  cols = w & ~7;
+  while (h--) {
+    for (int x = 0;x < cols;x += 8) {
+      __m128i v, a, b;
+
+      v = _mm_loadu_si128((const __m128i*)(src + x));
+      if (swap)
+        v = _mm_shuffle_epi8(v, swapMask);
+
+      a = _mm_unpacklo_epi16(v, zero);
+      b = _mm_unpackhi_epi16(v, zero);
+
+      a = unpack16To888SSSE3(a, srcShiftv, dstShiftv, maxv, scalev, biasv);
+      b = unpack16To888SSSE3(b, srcShiftv, dstShiftv, maxv, scalev, biasv);
+
+      _mm_storeu_si128((__m128i*)(dst + x*4), a);
+      _mm_storeu_si128((__m128i*)(dst + x*4 + 16), b);
+    }
+    dst += dstStride * 4;
+    src += srcStride;
+  }
+
+  return cols;
+}
+
+// Exact dst * invAlpha / 255 for eight bytes in 16-bit lanes, using
+// the same division trick as above
+static TARGET_SSSE3 __m128i blendSSSE3(__m128i v, __m128i ia)
+{
+  __m128i t;
+
+  t = _mm_mullo_epi16(v, ia);
+  t = _mm_add_epi16(_mm_add_epi16(t, _mm_set1_epi16(1)),
+                    _mm_srli_epi16(t, 8));
+  return _mm_srli_epi16(t, 8);
+}
+
+static TARGET_SSSE3 int blend32SSSE3(rdr::U8* dst, const rdr::U8* invAlpha,
+                                     const rdr::U8* premul, int w, int h,
+                                     int dstStride, int srcStride)
+{
+  __m128i zero;
+  int cols;
+
+  zero = _mm_setzero_si128();
+
+  cols = w & ~3;
+  while (h--) {
+    for (int x = 0;x < cols;x += 4) {
+      __m128i v, ia, pm, lo, hi;
+
+      v = _mm_loadu_si128((const __m128i*)(dst + x*4));
+      ia = _mm_loadu_si128((const __m128i*)(invAlpha + x*4));
+      pm = _mm_loadu_si128((const __m128i*)(premul + x*4));
+
+      lo = blendSSSE3(_mm_unpacklo_epi8(v, zero),
+                      _mm_unpacklo_epi8(ia, zero));
+      hi = blendSSSE3(_mm_unpackhi_epi8(v, zero),
+                      _mm_unpackhi_epi8(ia, zero));
+
+      v = _mm_add_epi8(_mm_packus_epi16(lo, hi), pm);
+      _mm_storeu_si128((__m128i*)(dst + x*4), v);
+    }
+    dst += dstStride * 4;
+    invAlpha += srcStride * 4;
+    premul += srcStride * 4;
+  }
+
+  return cols;
+}
+
+//
+// AVX2
+//
+// The 256-bit byte shuffles only work within each 128-bit half, so the
+// masks are the SSSE3 ones repeated twice.
+//
+
+static TARGET_AVX2 int swizzle888AVX2(rdr::U8* dst, const rdr::U8* src,
+                                      int w, int h,
+                                      int dstStride, int srcStride,
+                                      const int dstOffsets[4])
+{
+  rdr::U8 m[32];
+  __m256i mask;
+  int cols;
+
+  for (int p = 0;p < 8;p++) {
+    for (int i = 0;i < 4;i++)
+      m[p*4 + dstOffsets[i]] = (p%4)*4 + i;
+  }
+  mask = _mm256_loadu_si256((const __m256i*)m);
+
+  cols = w & ~7;
+  while (h--) {
+    for (int x = 0;x < cols;x += 8) {
+      __m256i v;
+      v = _mm256_loadu_si256((const __m256i*)(src + x*4));
+      v = _mm256_shuffle_epi8(v, mask);
+      _mm256_storeu_si256((__m256i*)(dst + x*4), v);
+    }
+    dst += dstStride * 4;
+    src += srcStride * 4;
+  }
+
+  return cols;
+}
+
+static TARGET_AVX2 int rgbTo888AVX2(rdr::U8* dst, const rdr::U8* src,
+                                    int w, int h,
+                                    int dstStride, int srcStride,
+                                    const int dstOffsets[4])
+{
+  rdr::U8 m[32];
+  __m256i mask;
+  int cols;
+
+  for (int p = 0;p < 8;p++) {
+    for (int i = 0;i < 3;i++)
+      m[p*4 + dstOffsets[i]] = (p%4)*3 + i;
+    m[p*4 + dstOffsets[3]] = 0x80;
+  }
+  mask = _mm256_loadu_si256((const __m256i*)m);
+
+  // Each half gets four pixels, loaded 12 bytes apart
+  cols = blockColumns(w, 8, 10);
+  while (h--) {
+    for (int x = 0;x < cols;x += 8) {
+      __m256i v;
+      v = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(src + x*3)));
+      v = _mm256_inserti128_si256(v, _mm_loadu_si128((const __m128i*)(src + x*3 + 12)), 1);
+      v = _mm256_shuffle_epi8(v, mask);
+      _mm256_storeu_si256((__m256i*)(dst + x*4), v);
+    }
+    dst += dstStride * 4;
+    src += srcStride * 3;
+  }
+
+  return cols;
+}
+
+static TARGET_AVX2 int rgbFrom888AVX2(rdr::U8* dst, const rdr::U8* src,
+                                      int w, int h,
+                                      int dstStride, int srcStride,
+                                      const int srcOffsets[3])
+{
+  rdr::U8 m[32];
+  __m256i mask;
+  int cols;
+
+  for (int half = 0;half < 2;half++) {
+    for (int p = 0;p < 4;p++) {
+      for (int i = 0;i < 3;i++)
+        m[half*16 + p*3 + i] = p*4 + srcOffsets[i];
+    }
+    for (int i = 12;i < 16;i++)
+      m[half*16 + i] = 0x80;
+  }
+  mask = _mm256_loadu_si256((const __m256i*)m);
+
+  // Each half gives 12 bytes, stored with 16 byte writes in order so
+  // that the excess is overwritten
+  cols = blockColumns(w, 8, 10);
+  while (h--) {
+    for (int x = 0;x < cols;x += 8) {
+      __m256i v;
+      v = _mm256_loadu_si256((const __m256i*)(src + x*4));
+      v = _mm256_shuffle_epi8(v, mask);
+      _mm_storeu_si128((__m128i*)(dst + x*3), _mm256_castsi256_si128(v));
+      _mm_storeu_si128((__m128i*)(dst + x*3 + 12),
+                       _mm256_extracti128_si256(v, 1));
+    }
+    dst += dstStride * 3;
+    src += srcStride * 4;
+  }
+
+  return cols;
+}
+
+static TARGET_AVX2 __m256i downconvAVX2(__m256i v, __m256i max)
+{
+  __m256i t;
+
+  t = _mm256_mullo_epi16(v, max);
+  t = _mm256_add_epi16(t, _mm256_set1_epi32(128));
+  t = _mm256_add_epi16(_mm256_add_epi16(t, _mm256_set1_epi32(1)),
+                       _mm256_srli_epi16(t, 8));
+  return _mm256_srli_epi16(t, 8);
+}
+
+static TARGET_AVX2 __m256i pack888To16AVX2(__m256i v,
+                                           const __m128i srcShifts[3],
+                                           const __m128i dstShifts[3],
+                                           const __m256i maxes[3])
+{
+  __m256i d;
+
+  d = _mm256_setzero_si256();
+  for (int i = 0;i < 3;i++) {
+    __m256i c;
+    c = _mm256_srl_epi32(v, srcShifts[i]);
+    c = _mm256_and_si256(c, _mm256_set1_epi32(0xff));
+    c = downconvAVX2(c, maxes[i]);
+    d = _mm256_or_si256(d, _mm256_sll_epi32(c, dstShifts[i]));
+  }
+
+  return d;
+}
+
+static TARGET_AVX2 int from888To16AVX2(rdr::U16* dst, const rdr::U8* src,
+                                       int w, int h,
+                                       int dstStride, int srcStride,
+                                       const int srcOffsets[3],
+                                       const int shifts[3],
+                                       const int maxes[3], bool swap)
+{
+  __m128i srcShiftv[3], dstShiftv[3];
+  __m256i maxv[3];
+  __m256i pack;
+  int cols;
+
+  for (int i = 0;i < 3;i++) {
+    srcShiftv[i] = _mm_cvtsi32_si128(srcOffsets[i] * 8);
+    dstShiftv[i] = _mm_cvtsi32_si128(shifts[i]);
+    maxv[i] = _mm256_set1_epi32(maxes[i]);
+  }
+
+  if (swap)
+    pack = _mm256_setr_epi8(1, 0, 5, 4, 9, 8, 13, 12,
+                            -1, -1, -1, -1, -1, -1, -1, -1,
+                            1, 0, 5, 4, 9, 8, 13, 12,
+                            -1, -1, -1, -1, -1, -1, -1, -1);
+  else
+    pack = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13,
+                            -1, -1, -1, -1, -1, -1, -1, -1,
+                            0, 1, 4, 5, 8, 9, 12, 13,
+                            -1, -1, -1, -1, -1, -1, -1, -1);
+
+  cols = w & ~15;
+  while (h--) {
+    for (int x = 0;x < cols;x += 16) {
+      __m256i a, b;
+
+      a = _mm256_loadu_si256((const __m256i*)(src + x*4));
+      b = _mm256_loadu_si256((const __m256i*)(src + x*4 + 32));
+
+      a = pack888To16AVX2(a, srcShiftv, dstShiftv, maxv);
+      b = pack888To16AVX2(b, srcShiftv, dstShiftv, maxv);
+
+      a = _mm256_shuffle_epi8(a, pack);
+      b = _mm256_shuffle_epi8(b, pack);
+
+      // The halves now hold a0 b0 | a1 b1, so put them back in order
+      a = _mm256_unpacklo_epi64(a, b);
+      a = _mm256_permute4x64_epi64(a, 0xd8);
+
+      _mm256_storeu_si256((__m256i*)(dst + x), a);
+    }
+    dst += dstStride;
+    src += srcStride * 4;
+  }
+
+  return cols;
+}
+
+static TARGET_AVX2 __m256i unpack16To888AVX2(__m256i v,
+                                             const __m128i srcShifts[3],
+                                             const __m128i dstShifts[3],
+                                             const __m256i maxes[3],
+                                             const __m256 scales[3],
+                                             const __m256 biases[3])
+{
+  __m256i d;
+
+  d = _mm256_setzero_si256();
+  for (int i = 0;i < 3;i++) {
+    __m256i c;
+    __m256 f;
+    c = _mm256_srl_epi32(v, srcShifts[i]);
+    c = _mm256_and_si256(c, maxes[i]);
+    f = _mm256_cvtepi32_ps(c);
+    f = _mm256_add_ps(_mm256_mul_ps(f, scales[i]), biases[i]);
+    c = _mm256_cvttps_epi32(f);
+    d = _mm256_or_si256(d, _mm256_sll_epi32(c, dstShifts[i]));
+  }
+
+  return d;
+}
+
+static TARGET_AVX2 int to888From16AVX2(rdr::U8* dst, const rdr::U16* src,
+                                       int w, int h,
+                                       int dstStride, int srcStride,
+                                       const int dstOffsets[4],
+                                       const int shifts[3],
+                                       const int maxes[3], bool swap)
+{
+  __m128i srcShiftv[3], dstShiftv[3];
+  __m256i maxv[3];
+  __m256 scalev[3], biasv[3];
+  __m128i swapMask;
+  int cols;
+
+  for (int i = 0;i < 3;i++) {
+    srcShiftv[i] = _mm_cvtsi32_si128(shifts[i]);
+    dstShiftv[i] = _mm_cvtsi32_si128(dstOffsets[i] * 8);
+    maxv[i] = _mm256_set1_epi32(maxes[i]);
+    scalev[i] = _mm256_set1_ps(255.0f / maxes[i]);
+    biasv[i] = _mm256_set1_ps(0.5f / maxes[i]);
+  }
+
+  swapMask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                           9, 8, 11, 10, 13, 12, 15, 14);
+
+  cols = w & ~15;
+  while (h--) {
+    for (int x = 0;x < cols;x += 16) {
+      __m128i lo, hi;
+      __m256i a, b;
+
+      lo = _mm_loadu_si128((const __m128i*)(src + x));
+      hi = _mm_loadu_si128((const __m128i*)(src + x + 8));
+      if (swap) {
+        lo = _mm_shuffle_epi8(lo, swapMask);
+        hi = _mm_shuffle_epi8(hi, swapMask);
+      }
+
+      a = _mm256_cvtepu16_epi32(lo);
+      b = _mm256_cvtepu16_epi32(hi);
+
+      a = unpack16To888AVX2(a, srcShiftv, dstShiftv, maxv, scalev, biasv);
+      b = unpack16To888AVX2(b, srcShiftv, dstShiftv, maxv, scalev, biasv);
+
+      _mm256_storeu_si256((__m256i*)(dst + x*4), a);
+      _mm256_storeu_si256((__m256i*)(dst + x*4 + 32), b);
+    }
+    dst += dstStride * 4;
+    src += srcStride;
+  }
+
+  return cols;
+}
+
+static TARGET_AVX2 __m256i blendAVX2(__m256i v, __m256i ia)
+{
+  __m256i t;
+
+  t = _mm256_mullo_epi16(v, ia);
+  t = _mm256_add_epi16(_mm256_add_epi16(t, _mm256_set1_epi16(1)),
+                       _mm256_srli_epi16(t, 8));
+  return _mm256_srli_epi16(t, 8);
+}
+
+static TARGET_AVX2 int blend32AVX2(rdr::U8* dst, const rdr::U8* invAlpha,
+                                   const rdr::U8* premul, int w, int h,
+                                   int dstStride, int srcStride)
+{
+  __m256i zero;
+  int cols;
+
+  zero = _mm256_setzero_si256();
+
+  // Unpacking and packing both work per half, so the order of the
+  // pixels is preserved
+  cols = w & ~7;
+  while (h--) {
+    for (int x = 0;x < cols;x += 8) {
+      __m256i v, ia, pm, lo, hi;
+
+      v = _mm256_loadu_si256((const __m256i*)(dst + x*4));
+      ia = _mm256_loadu_si256((const __m256i*)(invAlpha + x*4));
+      pm = _mm256_loadu_si256((const __m256i*)(premul + x*4));
+
+      lo = blendAVX2(_mm256_unpacklo_epi8(v, zero),
+                     _mm256_unpacklo_epi8(ia, zero));
+      hi = blendAVX2(_mm256_unpackhi_epi8(v, zero),
+                     _mm256_unpackhi_epi8(ia, zero));
+
+      v = _mm256_add_epi8(_mm256_packus_epi16(lo, hi), pm);
+      _mm256_storeu_si256((__m256i*)(dst + x*4), v);
+    }
+    dst += dstStride * 4;
+    invAlpha += srcStride * 4;
+    premul += srcStride * 4;
+  }
+
+  return cols;
+}
+
+#endif // HAVE_X86_SIMD
+
+//
+// Dispatch
+//
+
+int rfb::simdSwizzle888(rdr::U8* dst, const rdr::U8* src, int w, int h,
+                        int dstStride, int srcStride,
+                        const int dstOffsets[4])
+{
+#ifdef HAVE_X86_SIMD
+  switch (getSIMDLevel()) {
+  case simdAVX2:
+    return swizzle888AVX2(dst, src, w, h, dstStride, srcStride,
+                          dstOffsets);
+  case simdSSSE3:
+    return swizzle888SSSE3(dst, src, w, h, dstStride, srcStride,
+                           dstOffsets);
+  default:
+    break;
+  }
+#endif
+  return 0;
+}
+
+int rfb::simdRGBTo888(rdr::U8* dst, const rdr::U8* src, int w, int h,
+                      int dstStride, int srcStride,
+                      const int dstOffsets[4])
+{
+#ifdef HAVE_X86_SIMD
+  switch (getSIMDLevel()) {
+  case simdAVX2:
+    return rgbTo888AVX2(dst, src, w, h, dstStride, srcStride, dstOffsets);
+  case simdSSSE3:
+    return rgbTo888SSSE3(dst, src, w, h, dstStride, srcStride, dstOffsets);
+  default:
+    break;
+  }
+#endif
+  return 0;
+}
+
+int rfb::simd888ToRGB(rdr::U8* dst, const rdr::U8* src, int w, int h,
+                      int dstStride, int srcStride,
+                      const int srcOffsets[3])
+{
+#ifdef HAVE_X86_SIMD
+  switch (getSIMDLevel()) {
+  case simdAVX2:
+    return rgbFrom888AVX2(dst, src, w, h, dstStride, srcStride,
+                          srcOffsets);
+  case simdSSSE3:
+    return rgbFrom888SSSE3(dst, src, w, h, dstStride, srcStride,
+                           srcOffsets);
+  default:
+    break;
+  }
+#endif
+  return 0;
+}
+
+int rfb::simd888To16(rdr::U16* dst, const rdr::U8* src, int w, int h,
+                     int dstStride, int srcStride,
+                     const int srcOffsets[3],
+                     const int shifts[3], const int maxes[3], bool swap)
+{
+#ifdef HAVE_X86_SIMD
+  switch (getSIMDLevel()) {
+  case simdAVX2:
+    return from888To16AVX2(dst, src, w, h, dstStride, srcStride,
+                           srcOffsets, shifts, maxes, swap);
+  case simdSSSE3:
+    return from888To16SSSE3(dst, src, w, h, dstStride, srcStride,
+                            srcOffsets, shifts, maxes, swap);
+  default:
+    break;
+  }
+#endif
+  return 0;
+}
+
+int rfb::simd16To888(rdr::U8* dst, const rdr::U16* src, int w, int h,
+                     int dstStride, int srcStride,
+                     const int dstOffsets[4],
+                     const int shifts[3], const int maxes[3], bool swap)
+{
+#ifdef HAVE_X86_SIMD
+  switch (getSIMDLevel()) {
+  case simdAVX2:
+    return to888From16AVX2(dst, src, w, h, dstStride, srcStride,
+                           dstOffsets, shifts, maxes, swap);
+  case simdSSSE3:
+    return to888From16SSSE3(dst, src, w, h, dstStride, srcStride,
+                            dstOffsets, shifts, maxes, swap);
+  default:
+    break;
+  }
+#endif
+  return 0;
+}
+
+int rfb::simdBlend32(rdr::U8* dst, const rdr::U8* invAlpha,
+                     const rdr::U8* premul, int w, int h,
+                     int dstStride, int srcStride)
+{
+#ifdef HAVE_X86_SIMD
+  switch (getSIMDLevel()) {
+  case simdAVX2:
+    return blend32AVX2(dst, invAlpha, premul, w, h, dstStride, srcStride);
+  case simdSSSE3:
+    return blend32SSSE3(dst, invAlpha, premul, w, h, dstStride, srcStride);
+  default:
+    break;
+  }
+#endif
+  return 0;
+}
@@ -0,0 +1,88 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// PixelFormatSIMD - vectorised kernels for the common pixel format
+// conversions and for blending, selected at run time depending on what
+// the CPU supports.
+//
+// Each kernel only converts the leftmost columns of the rectangle that
+// it can handle in whole vectors, and returns how many columns that
+// was. The remaining columns are left to the caller's scalar code. A
+// kernel that isn't available simply returns 0.
+//
+// Byte offsets give the position of a channel within a 32-bit pixel
+// in memory, and strides are in pixels.
+//
+
+#ifndef __RFB_PIXELFORMATSIMD_H__
+#define __RFB_PIXELFORMATSIMD_H__
+
+#include <rdr/types.h>
+
+namespace rfb {
+
+  enum SIMDLevel { simdNone, simdSSSE3, simdAVX2 };
+
+  // The best level supported by this CPU
+  SIMDLevel getCPUSIMDLevel();
+
+  // The level used for conversions. It can be lowered to compare the
+  // kernels against each other, but never raised above what the CPU
+  // supports.
+  SIMDLevel getSIMDLevel();
+  void setSIMDLevel(SIMDLevel level);
+
+  const char* simdLevelName(SIMDLevel level);
+
+  // 888 to 888 with the bytes of each pixel rearranged. Byte i of the
+  // source pixel ends up at byte dstOffsets[i] of the destination.
+  int simdSwizzle888(rdr::U8* dst, const rdr::U8* src, int w, int h,
+                     int dstStride, int srcStride, const int dstOffsets[4]);
+
+  // Packed RGB to 888. The fourth offset is the padding byte, which
+  // is cleared.
+  int simdRGBTo888(rdr::U8* dst, const rdr::U8* src, int w, int h,
+                   int dstStride, int srcStride, const int dstOffsets[4]);
+
+  // 888 to packed RGB.
+  int simd888ToRGB(rdr::U8* dst, const rdr::U8* src, int w, int h,
+                   int dstStride, int srcStride, const int srcOffsets[3]);
+
+  // 888 to a 16 bpp format described by its channel shifts and maxima,
+  // with the result byte swapped if swap is set.
+  int simd888To16(rdr::U16* dst, const rdr::U8* src, int w, int h,
+                  int dstStride, int srcStride, const int srcOffsets[3],
+                  const int shifts[3], const int maxes[3], bool swap);
+
+  // A 16 bpp format to 888, the reverse of the above.
+  int simd16To888(rdr::U8* dst, const rdr::U16* src, int w, int h,
+                  int dstStride, int srcStride, const int dstOffsets[4],
+                  const int shifts[3], const int maxes[3], bool swap);
+
+  // Blends an image into 32 bpp pixels, computing
+  // dst * invAlpha / 255 + premul for every byte. The image has one
+  // inverse alpha and one premultiplied value for every byte of the
+  // destination, so it must already be in the destination's layout.
+  int simdBlend32(rdr::U8* dst, const rdr::U8* invAlpha,
+                  const rdr::U8* premul, int w, int h,
+                  int dstStride, int srcStride);
+
+}
+
+#endif
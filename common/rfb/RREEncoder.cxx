@@ -113,3 +113,14 @@ void RREEncoder::writeSolidRect(int width, int height,
   os->writeU32(0);
   os->writeBytes(colour, pf.bpp/8);
 }
+
+size_t RREEncoder::memoryUsage()
+{
+  return mos.capacity() + bufferCopy.memoryUsage();
+}
+
+void RREEncoder::releaseMemory()
+{
+  mos.release();
+  bufferCopy.release();
+}
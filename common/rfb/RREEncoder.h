@@ -34,6 +34,9 @@ namespace rfb {
     virtual void writeSolidRect(int width, int height,
                                 const PixelFormat& pf,
                                 const rdr::U8* colour);
+
+    virtual size_t memoryUsage();
+    virtual void releaseMemory();
   private:
     rdr::MemOutStream mos;
     ManagedPixelBuffer bufferCopy;
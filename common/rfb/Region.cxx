@@ -19,8 +19,10 @@
 // Cross-platform Region class based on the X11 region implementation.  Note
 // that for efficiency this code manipulates the Xlib region structure
 // directly.  Apart from the layout of the structure, there is one other key
-// assumption made: a Region returned from XCreateRegion must always have its
-// rects member allocated so that there is space for at least one rectangle.
+// assumption made: a region must always have space for at least one
+// rectangle.  The region is embedded in the Region object, together with
+// storage for its first few rectangles, so that most regions never touch
+// the heap.
 //
 
 #include <rfb/Region.h>
@@ -51,6 +53,8 @@ public:
     region.extents.x2 = r.br.x;
     region.extents.y2 = r.br.y;
     region.size = 1;
+    region.inlineRects = NULL;
+    region.spare = NULL;
     if (r.is_empty())
       region.numRects = 0;
   }
@@ -59,24 +63,24 @@ public:
 
 
 rfb::Region::Region() {
-  xrgn = XCreateRegion();
-  assert(xrgn);
+  xrgn = &region;
+  XInitRegion(xrgn, rectStorage, inlineRects);
 }
 
 rfb::Region::Region(const Rect& r) {
-  xrgn = XCreateRegion();
-  assert(xrgn);
+  xrgn = &region;
+  XInitRegion(xrgn, rectStorage, inlineRects);
   reset(r);
 }
 
 rfb::Region::Region(const rfb::Region& r) {
-  xrgn = XCreateRegion();
-  assert(xrgn);
+  xrgn = &region;
+  XInitRegion(xrgn, rectStorage, inlineRects);
   XUnionRegion(xrgn, r.xrgn, xrgn);
 }
 
 rfb::Region::~Region() {
-  XDestroyRegion(xrgn);
+  XFiniRegion(xrgn);
 }
 
 rfb::Region& rfb::Region::operator=(const rfb::Region& r) {
@@ -121,16 +125,10 @@ void rfb::Region::setOrderedRects(const std::vector<Rect>& rects) {
 void rfb::Region::setExtentsAndOrderedRects(const ShortRect* extents,
                                             int nRects, const ShortRect* rects)
 {
-  if (xrgn->size < nRects)
-  {
-    BOX* prevRects = xrgn->rects;
-    xrgn->rects = (BOX*)Xrealloc((char*)xrgn->rects, nRects * sizeof(BOX));
-    if (!xrgn->rects) {
-      vlog.error("Xrealloc failed");
-      Xfree(prevRects);
-      return;
-    }
-    xrgn->size = nRects;
+  if (!XReserveRegion(xrgn, nRects)) {
+    vlog.error("XReserveRegion failed");
+    clear();
+    return;
   }
 
   xrgn->numRects = nRects;
@@ -187,39 +185,88 @@ int rfb::Region::numRects() const {
 bool rfb::Region::get_rects(std::vector<Rect>* rects,
                             bool left2right, bool topdown) const
 {
-  int nRects = xrgn->numRects;
-  int xInc = left2right ? 1 : -1;
-  int yInc = topdown ? 1 : -1;
-  int i = topdown ? 0 : nRects-1;
+  const_iterator i;
+
   rects->clear();
-  rects->reserve(nRects);
+  rects->reserve(xrgn->numRects);
 
-  while (nRects > 0) {
-    int firstInNextBand = i;
-    int nRectsInBand = 0;
+  for (i = begin(left2right, topdown); i != end(); ++i)
+    rects->push_back(*i);
 
-    while (nRects > 0 && xrgn->rects[firstInNextBand].y1 == xrgn->rects[i].y1)
-    {
-      firstInNextBand += yInc;
-      nRects--;
-      nRectsInBand++;
-    }
+  return !rects->empty();
+}
+
+rfb::Region::const_iterator rfb::Region::begin(bool left2right,
+                                               bool topdown) const
+{
+  const_iterator i;
 
-    if (xInc != yInc)
-      i = firstInNextBand - yInc;
+  if (xrgn->numRects == 0)
+    return i;
 
-    while (nRectsInBand > 0) {
-      Rect r(xrgn->rects[i].x1, xrgn->rects[i].y1,
-             xrgn->rects[i].x2, xrgn->rects[i].y2);
-      rects->push_back(r);
-      i += xInc;
-      nRectsInBand--;
+  i.rects = xrgn->rects;
+  i.numRects = xrgn->numRects;
+  i.left2right = left2right;
+  i.topdown = topdown;
+
+  if (topdown)
+    i.bandStart = i.bandEnd = 0;
+  else
+    i.bandStart = i.bandEnd = xrgn->numRects;
+
+  i.findBand();
+
+  return i;
+}
+
+rfb::Region::const_iterator& rfb::Region::const_iterator::operator++()
+{
+  if (left2right) {
+    if (++pos < bandEnd) {
+      setRect();
+      return *this;
+    }
+  } else {
+    if (--pos >= bandStart) {
+      setRect();
+      return *this;
     }
+  }
 
-    i = firstInNextBand;
+  if (topdown ? (bandEnd == numRects) : (bandStart == 0)) {
+    pos = -1;
+    return *this;
   }
 
-  return !rects->empty();
+  findBand();
+
+  return *this;
+}
+
+// findBand() moves on to the band after (or before, going upwards) the
+// current one. All rectangles in a band share the same y1.
+
+void rfb::Region::const_iterator::findBand()
+{
+  if (topdown) {
+    bandStart = bandEnd;
+    while ((bandEnd < numRects) &&
+           (rects[bandEnd].y1 == rects[bandStart].y1))
+      bandEnd++;
+  } else {
+    bandEnd = bandStart;
+    while ((bandStart > 0) &&
+           (rects[bandStart - 1].y1 == rects[bandEnd - 1].y1))
+      bandStart--;
+  }
+
+  pos = left2right ? bandStart : bandEnd - 1;
+  setRect();
+}
+
+void rfb::Region::const_iterator::setRect()
+{
+  rect = Rect(rects[pos].x1, rects[pos].y1, rects[pos].x2, rects[pos].y2);
 }
 
 rfb::Rect rfb::Region::get_bounding_rect() const {
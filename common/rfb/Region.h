@@ -24,7 +24,7 @@
 #include <rfb/Rect.h>
 #include <vector>
 
-struct _XRegion;
+#include <Xregion/Xregionstr.h>
 
 namespace rfb {
 
@@ -69,13 +69,56 @@ namespace rfb {
 
     bool get_rects(std::vector<Rect>* rects, bool left2right=true,
                    bool topdown=true) const;
+
+    // const_iterator walks the rectangles in the same order as
+    // get_rects() but without copying them anywhere. The region must
+    // not be changed whilst it is being walked.
+
+    class const_iterator {
+    public:
+      const_iterator() : rects(0), pos(-1) {}
+
+      const Rect& operator*() const { return rect; }
+      const Rect* operator->() const { return &rect; }
+      const_iterator& operator++();
+
+      bool operator==(const const_iterator& other) const {
+        return pos == other.pos;
+      }
+      bool operator!=(const const_iterator& other) const {
+        return pos != other.pos;
+      }
+
+    private:
+      friend class Region;
+
+      void findBand();
+      void setRect();
+
+      const BOX* rects;
+      int numRects;
+      int bandStart, bandEnd;
+      int pos;
+      bool left2right, topdown;
+      Rect rect;
+    };
+
+    const_iterator begin(bool left2right=true, bool topdown=true) const;
+    const_iterator end() const { return const_iterator(); }
+
     Rect get_bounding_rect() const;
 
     void debug_print(const char *prefix) const;
 
   protected:
 
+    // Most regions only ever hold a handful of rectangles, and those
+    // are kept right here rather than on the heap
+    enum { inlineRects = 8 };
+
     struct _XRegion* xrgn;
+    REGION region;
+    BOX rectStorage[inlineRects];
   };
 
 };
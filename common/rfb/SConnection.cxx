@@ -291,16 +291,19 @@ void SConnection::setEncodings(int nEncodings, const rdr::S32* encodings)
 {
   int i;
 
+  SMsgHandler::setEncodings(nEncodings, encodings);
+
+  // Not everything the client lists is necessarily usable (e.g. Zstd
+  // without its pseudo-encoding), so go by what ClientParams kept
   preferredEncoding = encodingRaw;
   for (i = 0;i < nEncodings;i++) {
-    if (EncodeManager::supported(encodings[i])) {
+    if (EncodeManager::supported(encodings[i]) &&
+        client.supportsEncoding(encodings[i])) {
       preferredEncoding = encodings[i];
       break;
     }
   }
 
-  SMsgHandler::setEncodings(nEncodings, encodings);
-
   if (client.supportsEncoding(pseudoEncodingExtendedClipboard)) {
     rdr::U32 sizes[] = { 0 };
     writer()->writeClipboardCaps(rfb::clipboardUTF8 |
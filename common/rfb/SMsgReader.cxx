@@ -17,6 +17,7 @@
  * USA.
  */
 #include <stdio.h>
+#include <limits.h>
 
 #include <rdr/InStream.h>
 #include <rdr/ZlibInStream.h>
@@ -35,15 +36,25 @@ using namespace rfb;
 
 static LogWriter vlog("SMsgReader");
 
-static IntParameter maxCutText("MaxCutText", "Maximum permitted length of an incoming clipboard update", 256*1024);
+static IntParameter maxCutText("MaxCutText", "Maximum permitted length of an incoming clipboard update", 1024*1024);
 
 SMsgReader::SMsgReader(SMsgHandler* handler_, rdr::InStream* is_)
-  : handler(handler_), is(is_)
+  : handler(handler_), is(is_), transfer(transferNone),
+    transferLen(0), transferPos(0), cutText(NULL), provideFlags(0),
+    provideIndex(0), provideHaveLength(false), provideNum(0)
 {
 }
 
 SMsgReader::~SMsgReader()
 {
+  size_t i;
+
+  delete [] cutText;
+  for (i = 0;i < provideNum;i++)
+    delete [] provideBuffers[i];
+
+  // Don't let zis try to read the rest of an unfinished transfer
+  zis.detach();
 }
 
 void SMsgReader::readClientInit()
@@ -54,6 +65,22 @@ void SMsgReader::readClientInit()
 
 void SMsgReader::readMsg()
 {
+  // Finish off any clipboard message that we are in the middle of
+  // before looking at the next message
+  switch (transfer) {
+  case transferNone:
+    break;
+  case transferCutText:
+    readCutTextData();
+    return;
+  case transferProvide:
+    readClipboardProvideData();
+    return;
+  case transferSkip:
+    readSkippedData();
+    return;
+  }
+
   int msgType = is->readU8();
   switch (msgType) {
   case msgTypeSetPixelFormat:
@@ -217,14 +244,45 @@ void SMsgReader::readClientCutText()
   }
 
   if (len > (size_t)maxCutText) {
-    is->skip(len);
     vlog.error("Cut text too long (%d bytes) - ignoring", len);
+    transfer = transferSkip;
+    transferLen = len;
+    transferPos = 0;
+    readSkippedData();
     return;
   }
-  CharArray ca(len);
-  is->readBytes(ca.buf, len);
-  CharArray filtered(convertLF(ca.buf, len));
+
+  cutText = new rdr::U8[len];
+  transfer = transferCutText;
+  transferLen = len;
+  transferPos = 0;
+  readCutTextData();
+}
+
+bool SMsgReader::readSkippedData()
+{
+  if (!readPartial(is, NULL, transferLen))
+    return false;
+
+  transfer = transferNone;
+
+  return true;
+}
+
+bool SMsgReader::readCutTextData()
+{
+  if (!readPartial(is, cutText, transferLen))
+    return false;
+
+  transfer = transferNone;
+
+  CharArray filtered(convertLF((const char*)cutText, transferLen));
+  delete [] cutText;
+  cutText = NULL;
+
   handler->clientCutText(filtered.buf);
+
+  return true;
 }
 
 void SMsgReader::readExtendedClipboard(rdr::S32 len)
@@ -236,7 +294,10 @@ void SMsgReader::readExtendedClipboard(rdr::S32 len)
     throw Exception("Invalid extended clipboard message");
   if (len > maxCutText) {
     vlog.error("Extended clipboard message too long (%d bytes) - ignoring", len);
-    is->skip(len);
+    transfer = transferSkip;
+    transferLen = len;
+    transferPos = 0;
+    readSkippedData();
     return;
   }
 
@@ -265,44 +326,15 @@ void SMsgReader::readExtendedClipboard(rdr::S32 len)
 
     handler->handleClipboardCaps(flags, lengths);
   } else if (action == clipboardProvide) {
-    rdr::ZlibInStream zis;
-
-    int i;
-    size_t num;
-    size_t lengths[16];
-    rdr::U8* buffers[16];
-
     zis.setUnderlying(is, len - 4);
 
-    num = 0;
-    for (i = 0;i < 16;i++) {
-      if (!(flags & 1 << i))
-        continue;
-
-      lengths[num] = zis.readU32();
-      if (lengths[num] > (size_t)maxCutText) {
-        vlog.error("Extended clipboard data too long (%d bytes) - ignoring",
-                   (unsigned)lengths[num]);
-        zis.skip(lengths[num]);
-        flags &= ~(1 << i);
-        continue;
-      }
-
-      buffers[num] = new rdr::U8[lengths[num]];
-      zis.readBytes(buffers[num], lengths[num]);
-      num++;
-    }
+    transfer = transferProvide;
+    provideFlags = flags;
+    provideIndex = 0;
+    provideHaveLength = false;
+    provideNum = 0;
 
-    zis.removeUnderlying();
-
-    handler->handleClipboardProvide(flags, lengths, buffers);
-
-    num = 0;
-    for (i = 0;i < 16;i++) {
-      if (!(flags & 1 << i))
-        continue;
-      delete [] buffers[num++];
-    }
+    readClipboardProvideData();
   } else {
     switch (action) {
     case clipboardRequest:
@@ -320,6 +352,85 @@ void SMsgReader::readExtendedClipboard(rdr::S32 len)
   }
 }
 
+bool SMsgReader::readClipboardProvideData()
+{
+  size_t i;
+
+  for (;provideIndex < 16;provideIndex++) {
+    if (!(provideFlags & (1 << provideIndex)))
+      continue;
+
+    if (!provideHaveLength) {
+      if (!zis.checkNoWait(4))
+        return false;
+
+      transferLen = zis.readU32();
+      transferPos = 0;
+      provideHaveLength = true;
+
+      if (transferLen > (size_t)maxCutText) {
+        vlog.error("Extended clipboard data too long (%d bytes) - ignoring",
+                   (unsigned)transferLen);
+        provideBuffers[provideNum] = NULL;
+      } else {
+        provideLengths[provideNum] = transferLen;
+        provideBuffers[provideNum] = new rdr::U8[transferLen];
+      }
+    }
+
+    if (!readPartial(&zis, provideBuffers[provideNum], transferLen))
+      return false;
+
+    provideHaveLength = false;
+
+    if (provideBuffers[provideNum] == NULL)
+      provideFlags &= ~(1 << provideIndex);
+    else
+      provideNum++;
+  }
+
+  handler->handleClipboardProvide(provideFlags, provideLengths,
+                                  provideBuffers);
+
+  for (i = 0;i < provideNum;i++)
+    delete [] provideBuffers[i];
+  provideNum = 0;
+
+  // Any compressed data we didn't need might not have arrived yet, so
+  // skip it like any other data rather than waiting for it here
+  transfer = transferSkip;
+  transferLen = zis.detach();
+  transferPos = 0;
+
+  readSkippedData();
+
+  return true;
+}
+
+// readPartial() reads, or skips if buf is NULL, whatever is available
+// of the remaining data, without blocking. transferPos tracks how far
+// we have come. Returns true once all len bytes have been consumed.
+
+bool SMsgReader::readPartial(rdr::InStream* s, rdr::U8* buf, size_t len)
+{
+  while (transferPos < len) {
+    size_t n;
+
+    n = s->check(1, __rfbmin(len - transferPos, (size_t)INT_MAX), false);
+    if (n == 0)
+      return false;
+
+    if (buf != NULL)
+      s->readBytes(buf + transferPos, n);
+    else
+      s->skip(n);
+
+    transferPos += n;
+  }
+
+  return true;
+}
+
 void SMsgReader::readQEMUMessage()
 {
   int subType = is->readU8();
@@ -24,7 +24,7 @@
 #ifndef __RFB_SMSGREADER_H__
 #define __RFB_SMSGREADER_H__
 
-namespace rdr { class InStream; }
+#include <rdr/ZlibInStream.h>
 
 namespace rfb {
   class SMsgHandler;
@@ -37,6 +37,8 @@ namespace rfb {
     void readClientInit();
 
     // readMsg() reads a message, calling the handler as appropriate.
+    // Clipboard data is only read as far as it has arrived, so such a
+    // message can take several calls to complete.
     void readMsg();
 
     rdr::InStream* getInStream() { return is; }
@@ -56,11 +58,35 @@ namespace rfb {
     void readClientCutText();
     void readExtendedClipboard(rdr::S32 len);
 
+    // These continue a clipboard message that is still arriving, and
+    // return true once it has been handled.
+    bool readSkippedData();
+    bool readCutTextData();
+    bool readClipboardProvideData();
+    bool readPartial(rdr::InStream* s, rdr::U8* buf, size_t len);
+
     void readQEMUMessage();
     void readQEMUKeyEvent();
 
     SMsgHandler* handler;
     rdr::InStream* is;
+
+    enum ClipboardTransfer { transferNone, transferCutText,
+                             transferProvide, transferSkip };
+
+    ClipboardTransfer transfer;
+    size_t transferLen;
+    size_t transferPos;
+
+    rdr::U8* cutText;
+
+    rdr::ZlibInStream zis;
+    rdr::U32 provideFlags;
+    int provideIndex;
+    bool provideHaveLength;
+    size_t provideNum;
+    size_t provideLengths[16];
+    rdr::U8* provideBuffers[16];
   };
 }
 #endif
@@ -42,8 +42,11 @@ SMsgWriter::SMsgWriter(ClientParams* client_, rdr::OutStream* os_)
   : client(client_), os(os_),
     nRectsInUpdate(0), nRectsInHeader(0),
     needSetDesktopName(false), needCursor(false),
-    needLEDState(false), needQEMUKeyEvent(false)
+    needLEDState(false), needQEMUKeyEvent(false),
+    cursorCacheCounter(0), cursorCacheSlot(-1), cursorCacheHit(false)
 {
+  for (int i = 0;i < cursorCacheSlots;i++)
+    cursorCache[i].valid = false;
 }
 
 SMsgWriter::~SMsgWriter()
@@ -174,7 +177,6 @@ void SMsgWriter::writeClipboardProvide(rdr::U32 flags,
                                       const rdr::U8* const* data)
 {
   rdr::MemOutStream mos;
-  rdr::ZlibOutStream zos;
 
   int i, count;
 
@@ -183,18 +185,21 @@ void SMsgWriter::writeClipboardProvide(rdr::U32 flags,
   if (!(client->clipboardFlags() & clipboardProvide))
     throw Exception("Client does not support clipboard \"provide\" action");
 
-  zos.setUnderlying(&mos);
+  // Each message is a separate zlib stream, but the compressor is
+  // kept between messages
+  clipboardZos.setUnderlying(&mos);
 
   count = 0;
   for (i = 0;i < 16;i++) {
     if (!(flags & (1 << i)))
       continue;
-    zos.writeU32(lengths[count]);
-    zos.writeBytes(data[count], lengths[count]);
+    clipboardZos.writeU32(lengths[count]);
+    clipboardZos.writeBytes(data[count], lengths[count]);
     count++;
   }
 
-  zos.flush();
+  clipboardZos.reset();
+  clipboardZos.setUnderlying(NULL);
 
   startMsg(msgTypeServerCutText);
   os->pad(3);
@@ -334,11 +339,16 @@ void SMsgWriter::writeFramebufferUpdateStart(int nRects)
   startMsg(msgTypeFramebufferUpdate);
   os->pad(1);
 
+  if (needCursor)
+    lookupCursorCache();
+
   if (nRects != 0xFFFF) {
     if (needSetDesktopName)
       nRects++;
     if (needCursor)
       nRects++;
+    if (needCursor && (cursorCacheSlot >= 0) && !cursorCacheHit)
+      nRects++;
     if (needLEDState)
       nRects++;
     if (needQEMUKeyEvent)
@@ -411,9 +421,18 @@ void SMsgWriter::endMsg()
 
 void SMsgWriter::writePseudoRects()
 {
+  if (needCursor && (cursorCacheSlot >= 0) && cursorCacheHit) {
+    writeCursorCacheRect(cursorCacheUse, cursorCacheSlot);
+    needCursor = false;
+  }
+
   if (needCursor) {
     const Cursor& cursor = client->cursor();
 
+    // The client keeps whatever we send next
+    if (cursorCacheSlot >= 0)
+      writeCursorCacheRect(cursorCacheStore, cursorCacheSlot);
+
     if (client->supportsEncoding(pseudoEncodingCursorWithAlpha)) {
       writeSetCursorWithAlphaRect(cursor.width(), cursor.height(),
                                   cursor.hotspot().x, cursor.hotspot().y,
@@ -648,6 +667,24 @@ void SMsgWriter::writeSetVMwareCursorRect(int width, int height,
   os->writeBytes(data, width*height*4);
 }
 
+void SMsgWriter::writeCursorCacheRect(rdr::U8 op, int slot)
+{
+  const Cursor& cursor = client->cursor();
+
+  if (!client->supportsEncoding(pseudoEncodingCursorCache))
+    throw Exception("Client does not support the cursor cache");
+  if (++nRectsInUpdate > nRectsInHeader && nRectsInHeader)
+    throw Exception("SMsgWriter::writeCursorCacheRect: nRects out of sync");
+
+  os->writeS16(cursor.hotspot().x);
+  os->writeS16(cursor.hotspot().y);
+  os->writeU16(cursor.width());
+  os->writeU16(cursor.height());
+  os->writeU32(pseudoEncodingCursorCache);
+  os->writeU8(op);
+  os->writeU32(slot);
+}
+
 void SMsgWriter::writeLEDStateRect(rdr::U8 state)
 {
   if (!client->supportsEncoding(pseudoEncodingLEDState) &&
@@ -684,3 +721,51 @@ void SMsgWriter::writeQEMUKeyEventRect()
   os->writeU16(0);
   os->writeU32(pseudoEncodingQEMUKeyEvent);
 }
+
+void SMsgWriter::lookupCursorCache()
+{
+  const Cursor& cursor = client->cursor();
+  const rdr::U8* data;
+  rdr::U64 hash;
+  int oldest;
+
+  cursorCacheSlot = -1;
+  cursorCacheHit = false;
+
+  if (!client->supportsEncoding(pseudoEncodingCursorCache))
+    return;
+
+  // FNV-1a over the shape, which is reliable enough to stand in for
+  // the cursor itself so that we don't have to keep copies around
+  hash = 14695981039346656037ULL;
+  hash = (hash ^ cursor.width()) * 1099511628211ULL;
+  hash = (hash ^ cursor.height()) * 1099511628211ULL;
+  hash = (hash ^ cursor.hotspot().x) * 1099511628211ULL;
+  hash = (hash ^ cursor.hotspot().y) * 1099511628211ULL;
+  data = cursor.getBuffer();
+  for (int i = 0;i < cursor.width()*cursor.height()*4;i++)
+    hash = (hash ^ data[i]) * 1099511628211ULL;
+
+  cursorCacheCounter++;
+
+  oldest = 0;
+  for (int i = 0;i < cursorCacheSlots;i++) {
+    if (cursorCache[i].valid && (cursorCache[i].hash == hash)) {
+      cursorCache[i].lastUsed = cursorCacheCounter;
+      cursorCacheSlot = i;
+      cursorCacheHit = true;
+      return;
+    }
+
+    if (!cursorCache[oldest].valid)
+      continue;
+    if (!cursorCache[i].valid ||
+        (cursorCache[i].lastUsed < cursorCache[oldest].lastUsed))
+      oldest = i;
+  }
+
+  cursorCache[oldest].valid = true;
+  cursorCache[oldest].hash = hash;
+  cursorCache[oldest].lastUsed = cursorCacheCounter;
+  cursorCacheSlot = oldest;
+}
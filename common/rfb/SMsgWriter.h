@@ -24,11 +24,11 @@
 #define __RFB_SMSGWRITER_H__
 
 #include <rdr/types.h>
+#include <rdr/ZlibOutStream.h>
 #include <rfb/encodings.h>
+#include <rfb/cursorCacheTypes.h>
 #include <rfb/ScreenSet.h>
 
-namespace rdr { class OutStream; }
-
 namespace rfb {
 
   class ClientParams;
@@ -141,9 +141,12 @@ namespace rfb {
     void writeSetVMwareCursorRect(int width, int height,
                                   int hotspotX, int hotspotY,
                                   const rdr::U8* data);
+    void writeCursorCacheRect(rdr::U8 op, int slot);
     void writeLEDStateRect(rdr::U8 state);
     void writeQEMUKeyEventRect();
 
+    void lookupCursorCache();
+
     ClientParams* client;
     rdr::OutStream* os;
 
@@ -155,6 +158,21 @@ namespace rfb {
     bool needLEDState;
     bool needQEMUKeyEvent;
 
+    rdr::ZlibOutStream clipboardZos;
+
+    // What the client has in its cursor cache, going by a hash of each
+    // cursor, and which slot the pending cursor should use
+    struct CursorCacheEntry {
+      bool valid;
+      rdr::U64 hash;
+      unsigned lastUsed;
+    };
+
+    CursorCacheEntry cursorCache[cursorCacheSlots];
+    unsigned cursorCacheCounter;
+    int cursorCacheSlot;
+    bool cursorCacheHit;
+
     typedef struct {
       rdr::U16 reason, result;
     } ExtendedDesktopSizeMsg;
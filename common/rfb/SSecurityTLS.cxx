@@ -37,8 +37,6 @@
 #include <rdr/TLSOutStream.h>
 #include <gnutls/x509.h>
 
-#define DH_BITS 1024 /* XXX This should be configurable! */
-
 using namespace rfb;
 
 StringParameter SSecurityTLS::X509_CertFile
@@ -47,10 +45,25 @@ StringParameter SSecurityTLS::X509_CertFile
 StringParameter SSecurityTLS::X509_KeyFile
 ("X509Key", "Path to the key of the X509 certificate in PEM format", "", ConfServer);
 
+StringParameter SSecurityTLS::DH_ParamsFile
+("DHParamsFile", "Path to Diffie-Hellman parameters in PEM format, "
+ "to use instead of a standard group", "", ConfServer);
+
+IntParameter SSecurityTLS::DH_Bits
+("DHBits", "Minimum size in bits of the Diffie-Hellman group used for "
+ "key exchange", 2048, 1024, 8192, ConfServer);
+
+BoolParameter SSecurityTLS::KernelTLS
+("KernelTLS", "Let the kernel do the encryption once the TLS handshake "
+ "is done, where supported", true, ConfServer);
+
 static LogWriter vlog("TLS");
 
+// Shared by all connections as they are expensive to set up
+static gnutls_dh_params_t dh_params = NULL;
+
 SSecurityTLS::SSecurityTLS(SConnection* sc, bool _anon)
-  : SSecurity(sc), session(NULL), dh_params(NULL), anon_cred(NULL),
+  : SSecurity(sc), session(NULL), anon_cred(NULL),
     cert_cred(NULL), anon(_anon), tlsis(NULL), tlsos(NULL),
     rawis(NULL), rawos(NULL)
 {
@@ -63,18 +76,16 @@ SSecurityTLS::SSecurityTLS(SConnection* sc, bool _anon)
 
 void SSecurityTLS::shutdown()
 {
-  if (session) {
+  // GnuTLS no longer knows the state of an offloaded session, so we
+  // can't say goodbye properly
+  if (session && !(tlsis && tlsis->isOffloaded()) &&
+      !(tlsos && tlsos->isOffloaded())) {
     if (gnutls_bye(session, GNUTLS_SHUT_RDWR) != GNUTLS_E_SUCCESS) {
       /* FIXME: Treat as non-fatal error */
       vlog.error("TLS session wasn't terminated gracefully");
     }
   }
 
-  if (dh_params) {
-    gnutls_dh_params_deinit(dh_params);
-    dh_params = 0;
-  }
-
   if (anon_cred) {
     gnutls_anon_free_server_credentials(anon_cred);
     anon_cred = 0;
@@ -166,6 +177,22 @@ bool SSecurityTLS::processMsg()
   vlog.debug("TLS handshake completed with %s",
              gnutls_session_get_desc(session));
 
+  if (KernelTLS) {
+    bool sending, receiving;
+
+    sending = tlsos->offload();
+    receiving = tlsis->offload();
+
+    if (sending && receiving)
+      vlog.debug("Kernel TLS enabled");
+    else if (sending)
+      vlog.debug("Kernel TLS enabled for sending only");
+    else if (receiving)
+      vlog.debug("Kernel TLS enabled for receiving only");
+    else
+      vlog.debug("Kernel TLS not available, using GnuTLS");
+  }
+
   sc->setStreams(tlsis, tlsos);
 
   return true;
@@ -198,17 +225,11 @@ void SSecurityTLS::setParams(gnutls_session_t session)
     throw AuthFailureException("gnutls_set_priority_direct failed");
   }
 
-  if (gnutls_dh_params_init(&dh_params) != GNUTLS_E_SUCCESS)
-    throw AuthFailureException("gnutls_dh_params_init failed");
-
-  if (gnutls_dh_params_generate2(dh_params, DH_BITS) != GNUTLS_E_SUCCESS)
-    throw AuthFailureException("gnutls_dh_params_generate2 failed");
-
   if (anon) {
     if (gnutls_anon_allocate_server_credentials(&anon_cred) != GNUTLS_E_SUCCESS)
       throw AuthFailureException("gnutls_anon_allocate_server_credentials failed");
 
-    gnutls_anon_set_server_dh_params(anon_cred, dh_params);
+    gnutls_anon_set_server_dh_params(anon_cred, getDHParams());
 
     if (gnutls_credentials_set(session, GNUTLS_CRD_ANON, anon_cred)
         != GNUTLS_E_SUCCESS)
@@ -220,7 +241,7 @@ void SSecurityTLS::setParams(gnutls_session_t session)
     if (gnutls_certificate_allocate_credentials(&cert_cred) != GNUTLS_E_SUCCESS)
       throw AuthFailureException("gnutls_certificate_allocate_credentials failed");
 
-    gnutls_certificate_set_dh_params(cert_cred, dh_params);
+    gnutls_certificate_set_dh_params(cert_cred, getDHParams());
 
     switch (gnutls_certificate_set_x509_key_file(cert_cred, certfile, keyfile, GNUTLS_X509_FMT_PEM)) {
     case GNUTLS_E_SUCCESS:
@@ -242,3 +263,83 @@ void SSecurityTLS::setParams(gnutls_session_t session)
   }
 
 }
+
+gnutls_dh_params_t SSecurityTLS::getDHParams()
+{
+  gnutls_dh_params_t params;
+  CharArray filename;
+  int bits;
+
+  if (dh_params)
+    return dh_params;
+
+  if (gnutls_dh_params_init(&params) != GNUTLS_E_SUCCESS)
+    throw AuthFailureException("gnutls_dh_params_init failed");
+
+  filename.buf = DH_ParamsFile.getData();
+  bits = DH_Bits;
+
+  try {
+    if (filename.buf[0] != '\0') {
+      gnutls_datum_t data;
+      int ret;
+
+      if (gnutls_load_file(filename.buf, &data) != GNUTLS_E_SUCCESS)
+        throw AuthFailureException("Unable to read DH parameters file");
+
+      ret = gnutls_dh_params_import_pkcs3(params, &data, GNUTLS_X509_FMT_PEM);
+      gnutls_free(data.data);
+
+      if (ret != GNUTLS_E_SUCCESS)
+        throw AuthFailureException("Unable to parse DH parameters file");
+
+      vlog.debug("Loaded DH parameters from %s", filename.buf);
+    } else {
+#if GNUTLS_VERSION_NUMBER >= 0x030506
+      // Standard groups from RFC 7919
+      const gnutls_datum_t *prime, *generator;
+      unsigned int key_bits;
+
+      if (bits <= 2048) {
+        prime = &gnutls_ffdhe_2048_group_prime;
+        generator = &gnutls_ffdhe_2048_group_generator;
+        key_bits = gnutls_ffdhe_2048_key_bits;
+      } else if (bits <= 3072) {
+        prime = &gnutls_ffdhe_3072_group_prime;
+        generator = &gnutls_ffdhe_3072_group_generator;
+        key_bits = gnutls_ffdhe_3072_key_bits;
+      } else if (bits <= 4096) {
+        prime = &gnutls_ffdhe_4096_group_prime;
+        generator = &gnutls_ffdhe_4096_group_generator;
+        key_bits = gnutls_ffdhe_4096_key_bits;
+      } else if (bits <= 6144) {
+        prime = &gnutls_ffdhe_6144_group_prime;
+        generator = &gnutls_ffdhe_6144_group_generator;
+        key_bits = gnutls_ffdhe_6144_key_bits;
+      } else {
+        prime = &gnutls_ffdhe_8192_group_prime;
+        generator = &gnutls_ffdhe_8192_group_generator;
+        key_bits = gnutls_ffdhe_8192_key_bits;
+      }
+
+      if (gnutls_dh_params_import_raw2(params, prime, generator,
+                                       key_bits) != GNUTLS_E_SUCCESS)
+        throw AuthFailureException("gnutls_dh_params_import_raw2 failed");
+
+      vlog.debug("Using RFC 7919 DH group for %d bits", bits);
+#else
+      vlog.info("Generating %d bit DH parameters", bits);
+
+      if (gnutls_dh_params_generate2(params, bits) != GNUTLS_E_SUCCESS)
+        throw AuthFailureException("gnutls_dh_params_generate2 failed");
+#endif
+    }
+  } catch (...) {
+    gnutls_dh_params_deinit(params);
+    throw;
+  }
+
+  dh_params = params;
+
+  return dh_params;
+}
@@ -36,6 +36,8 @@
 #include <rdr/OutStream.h>
 #include <gnutls/gnutls.h>
 
+namespace rdr { class TLSInStream; class TLSOutStream; }
+
 namespace rfb {
 
   class SSecurityTLS : public SSecurity {
@@ -48,14 +50,18 @@ namespace rfb {
 
     static StringParameter X509_CertFile;
     static StringParameter X509_KeyFile;
+    static StringParameter DH_ParamsFile;
+    static IntParameter DH_Bits;
+    static BoolParameter KernelTLS;
 
   protected:
     void shutdown();
     void setParams(gnutls_session_t session);
 
+    static gnutls_dh_params_t getDHParams();
+
   private:
     gnutls_session_t session;
-    gnutls_dh_params_t dh_params;
     gnutls_anon_server_credentials_t anon_cred;
     gnutls_certificate_credentials_t cert_cred;
     char *keyfile, *certfile;
@@ -63,8 +69,8 @@ namespace rfb {
     int type;
     bool anon;
 
-    rdr::InStream* tlsis;
-    rdr::OutStream* tlsos;
+    rdr::TLSInStream* tlsis;
+    rdr::TLSOutStream* tlsos;
 
     rdr::InStream* rawis;
     rdr::OutStream* rawos;
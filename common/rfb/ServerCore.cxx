@@ -56,6 +56,16 @@ rfb::IntParameter rfb::Server::frameRate
 ("FrameRate",
  "The maximum number of updates per second sent to each client",
  60);
+rfb::BoolParameter rfb::Server::prioritiseInput
+("PrioritiseInput",
+ "Send the parts of an update around the pointer and where the user is "
+ "typing before the rest of the screen",
+ true);
+rfb::IntParameter rfb::Server::latencyStatsInterval
+("LatencyStatsInterval",
+ "How often, in seconds, to log how long updates spend in each stage "
+ "(0 = only when a client disconnects)",
+ 0, 0);
 rfb::BoolParameter rfb::Server::protocol3_3
 ("Protocol3.3",
  "Always use protocol version 3.3 for backwards compatibility with "
@@ -101,3 +111,8 @@ rfb::BoolParameter rfb::Server::queryConnect
 ("QueryConnect",
  "Prompt the local user to accept or reject incoming connections.",
  false);
+rfb::BoolParameter rfb::Server::zeroCopy
+("ZeroCopy",
+ "Send large updates without copying them into the kernel, where "
+ "supported.",
+ false);
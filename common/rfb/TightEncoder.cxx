@@ -56,7 +56,7 @@ static const TightConf conf[10] = {
 };
 
 TightEncoder::TightEncoder(SConnection* conn) :
-  Encoder(conn, encodingTight, EncoderPlain, 256)
+  Encoder(conn, encodingTight, EncoderPlain, 256), resetStreams(0)
 {
   setCompressLevel(-1);
 }
@@ -105,10 +105,34 @@ void TightEncoder::writeSolidRect(int width, int height,
 
   os = conn->getOutStream();
 
-  os->writeU8(tightFill << 4);
+  writeCompressionControl(os, tightFill);
   writePixels(colour, pf, 1, os);
 }
 
+size_t TightEncoder::memoryUsage()
+{
+  size_t usage;
+
+  usage = memStream.capacity();
+  for (int i = 0;i < 4;i++)
+    usage += zlibStreams[i].memoryUsage();
+
+  return usage;
+}
+
+void TightEncoder::releaseMemory()
+{
+  // The client has to start over with its streams as well
+  for (int i = 0;i < 4;i++) {
+    if (zlibStreams[i].memoryUsage() == 0)
+      continue;
+    zlibStreams[i].release();
+    resetStreams |= 1 << i;
+  }
+
+  memStream.release();
+}
+
 void TightEncoder::writeMonoRect(const PixelBuffer* pb, const Palette& palette)
 {
   const rdr::U8* buffer;
@@ -166,7 +190,7 @@ void TightEncoder::writeFullColourRect(const PixelBuffer* pb, const Palette& pal
 
   os = conn->getOutStream();
 
-  os->writeU8(streamId << 4);
+  writeCompressionControl(os, streamId);
 
   // Set up compression
   if ((pb->getPF().bpp != 32) || !pb->getPF().is888())
@@ -232,6 +256,14 @@ void TightEncoder::writeCompact(rdr::OutStream* os, rdr::U32 value)
   }
 }
 
+void TightEncoder::writeCompressionControl(rdr::OutStream* os,
+                                           rdr::U8 type)
+{
+  // Any streams that were released get reset along with the next rect
+  os->writeU8((type << 4) | resetStreams);
+  resetStreams = 0;
+}
+
 rdr::OutStream* TightEncoder::getZlibOutStream(int streamId, int level, size_t length)
 {
   // Minimum amount of data to be compressed. This value should not be
@@ -40,6 +40,9 @@ namespace rfb {
                                 const PixelFormat& pf,
                                 const rdr::U8* colour);
 
+    virtual size_t memoryUsage();
+    virtual void releaseMemory();
+
   protected:
     void writeMonoRect(const PixelBuffer* pb, const Palette& palette);
     void writeIndexedRect(const PixelBuffer* pb, const Palette& palette);
@@ -50,6 +53,8 @@ namespace rfb {
 
     void writeCompact(rdr::OutStream* os, rdr::U32 value);
 
+    void writeCompressionControl(rdr::OutStream* os, rdr::U8 type);
+
     rdr::OutStream* getZlibOutStream(int streamId, int level, size_t length);
     void flushZlibOutStream(rdr::OutStream* os);
 
@@ -75,6 +80,10 @@ namespace rfb {
     rdr::ZlibOutStream zlibStreams[4];
     rdr::MemOutStream memStream;
 
+    // Streams that have been released and need to be reset in the
+    // client, as a mask for the compression control byte
+    rdr::U8 resetStreams;
+
     int idxZlibLevel, monoZlibLevel, rawZlibLevel;
   };
 
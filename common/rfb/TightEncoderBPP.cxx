@@ -40,7 +40,7 @@ void TightEncoder::writeMonoRect(int width, int height,
 
   os = conn->getOutStream();
 
-  os->writeU8((streamId | tightExplicitFilter) << 4);
+  writeCompressionControl(os, streamId | tightExplicitFilter);
   os->writeU8(tightFilterPalette);
 
   // Write the palette
@@ -127,7 +127,7 @@ void TightEncoder::writeIndexedRect(int width, int height,
 
   os = conn->getOutStream();
 
-  os->writeU8((streamId | tightExplicitFilter) << 4);
+  writeCompressionControl(os, streamId | tightExplicitFilter);
   os->writeU8(tightFilterPalette);
 
   // Write the palette
@@ -17,8 +17,12 @@
  * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
  * USA.
  */
+#include <assert.h>
+
+#include <rdr/Exception.h>
 #include <rdr/OutStream.h>
 #include <rfb/encodings.h>
+#include <rfb/LogWriter.h>
 #include <rfb/SConnection.h>
 #include <rfb/PixelBuffer.h>
 #include <rfb/TightJPEGEncoder.h>
@@ -26,9 +30,13 @@
 
 using namespace rfb;
 
+static LogWriter vlog("TightJPEGEncoder");
+
 struct TightJPEGConfiguration {
     int quality;
     int subsampling;
+    bool fastDCT;
+    bool optimize;
 };
 
 // NOTE:  The JPEG quality and subsampling levels below were obtained
@@ -48,30 +56,57 @@ struct TightJPEGConfiguration {
 // 2 = JPEG quality 41,  4:2:0 subsampling (ratio ~= 70:1)
 // 1 = JPEG quality 29,  4:2:0 subsampling (ratio ~= 80:1)
 // 0 = JPEG quality 15,  4:2:0 subsampling (ratio ~= 100:1)
+//
+// The fast DCT is only noticeable at the highest quality. The lowest
+// levels are used on slow links, where the extra pass for optimised
+// Huffman tables is worth the few percent it saves.
 
 static const struct TightJPEGConfiguration conf[10] = {
-  {  15, subsample4X }, // 0
-  {  29, subsample4X }, // 1
-  {  41, subsample4X }, // 2
-  {  42, subsample2X }, // 3
-  {  62, subsample2X }, // 4
-  {  77, subsample2X }, // 5
-  {  79, subsampleNone }, // 6
-  {  86, subsampleNone }, // 7
-  {  92, subsampleNone }, // 8
-  { 100, subsampleNone }  // 9
+  {  15, subsample4X, true, true }, // 0
+  {  29, subsample4X, true, true }, // 1
+  {  41, subsample4X, true, true }, // 2
+  {  42, subsample2X, true, false }, // 3
+  {  62, subsample2X, true, false }, // 4
+  {  77, subsample2X, true, false }, // 5
+  {  79, subsampleNone, true, false }, // 6
+  {  86, subsampleNone, true, false }, // 7
+  {  92, subsampleNone, true, false }, // 8
+  { 100, subsampleNone, false, false }  // 9
 };
 
 
 TightJPEGEncoder::TightJPEGEncoder(SConnection* conn) :
   Encoder(conn, encodingTight,
           (EncoderFlags)(EncoderUseNativePF | EncoderLossy), -1, 9),
-  qualityLevel(-1), fineQuality(-1), fineSubsampling(subsampleUndefined)
+  qualityLevel(-1), fineQuality(-1), fineSubsampling(subsampleUndefined),
+  pool(NULL)
 {
 }
 
 TightJPEGEncoder::~TightJPEGEncoder()
 {
+  // Only left behind if something failed half way through an update
+  while (!workQueue.empty()) {
+    JpegCompressPool::Job* job;
+
+    job = workQueue.front();
+    workQueue.pop_front();
+
+    if (pool != NULL)
+      pool->cancelJob(job);
+
+    delete job->error;
+    delete job->jc;
+    delete job;
+  }
+
+  if (pool != NULL)
+    JpegCompressPool::release();
+
+  while (!freeCompressors.empty()) {
+    delete freeCompressors.back();
+    freeCompressors.pop_back();
+  }
 }
 
 bool TightJPEGEncoder::isSupported()
@@ -109,48 +144,170 @@ int TightJPEGEncoder::getQualityLevel()
 
 void TightJPEGEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
 {
-  const rdr::U8* buffer;
-  int stride;
+  JpegCompressPool::Job job;
 
-  int quality, subsampling;
+  job.rect = pb->getRect();
+  job.buffer = pb->getBuffer(job.rect, &job.stride);
+  job.pf = pb->getPF();
+  job.jc = &jc;
 
-  rdr::OutStream* os;
+  getSettings(&job);
+  JpegCompressPool::compress(&job);
+
+  writeData(&jc);
+}
+
+void TightJPEGEncoder::writeSolidRect(int width, int height,
+                                      const PixelFormat& pf,
+                                      const rdr::U8* colour)
+{
+  // FIXME: Add a shortcut in the JPEG compressor to handle this case
+  //        without having to use the default fallback which is very slow.
+  Encoder::writeSolidRect(width, height, pf, colour);
+}
+
+size_t TightJPEGEncoder::memoryUsage()
+{
+  std::list<JpegCompressor*>::iterator iter;
+  size_t usage;
+
+  usage = jc.capacity();
+
+  // Compressors that are busy are counted once they are done
+  for (iter = freeCompressors.begin();iter != freeCompressors.end();++iter)
+    usage += (*iter)->capacity();
+
+  return usage;
+}
+
+void TightJPEGEncoder::releaseMemory()
+{
+  std::list<JpegCompressor*>::iterator iter;
+
+  jc.release();
+
+  for (iter = freeCompressors.begin();iter != freeCompressors.end();++iter)
+    (*iter)->release();
+}
+
+void TightJPEGEncoder::queueRect(const PixelBuffer* pb, const Rect& rect)
+{
+  JpegCompressPool::Job *job;
+
+  if (pool == NULL)
+    pool = JpegCompressPool::acquire();
+
+  job = new JpegCompressPool::Job;
+
+  job->rect = rect;
+  job->buffer = pb->getBuffer(rect, &job->stride);
+  job->pf = pb->getPF();
+
+  getSettings(job);
+
+  if (freeCompressors.empty())
+    freeCompressors.push_back(new JpegCompressor());
 
-  buffer = pb->getBuffer(pb->getRect(), &stride);
+  job->jc = freeCompressors.front();
+  freeCompressors.pop_front();
 
+  // The threads are shared with every other connection, so if they
+  // are busy we have to do the work ourselves
+  if (!pool->queueJob(job)) {
+    try {
+      JpegCompressPool::compress(job);
+    } catch (...) {
+      freeCompressors.push_back(job->jc);
+      delete job;
+      throw;
+    }
+
+    job->active = true;
+    job->done = true;
+    job->error = NULL;
+  }
+
+  workQueue.push_back(job);
+}
+
+bool TightJPEGEncoder::peekQueuedRect(Rect* rect)
+{
+  if (workQueue.empty())
+    return false;
+
+  *rect = workQueue.front()->rect;
+
+  return true;
+}
+
+void TightJPEGEncoder::writeQueuedRect()
+{
+  JpegCompressPool::Job *job;
+
+  assert(!workQueue.empty());
+
+  job = workQueue.front();
+  workQueue.pop_front();
+
+  // Rects are finished in any order, but have to be sent in the order
+  // they were queued
+  pool->waitJob(job);
+
+  freeCompressors.push_back(job->jc);
+
+  if (job->error != NULL) {
+    rdr::Exception e(*job->error);
+
+    delete job->error;
+    delete job;
+
+    throw e;
+  }
+
+  try {
+    writeData(job->jc);
+  } catch (...) {
+    delete job;
+    throw;
+  }
+
+  delete job;
+}
+
+void TightJPEGEncoder::getSettings(JpegCompressPool::Job* job)
+{
   if (qualityLevel >= 0 && qualityLevel <= 9) {
-    quality = conf[qualityLevel].quality;
-    subsampling = conf[qualityLevel].subsampling;
+    job->quality = conf[qualityLevel].quality;
+    job->subsampling = conf[qualityLevel].subsampling;
+    job->fastDCT = conf[qualityLevel].fastDCT;
+    job->optimize = conf[qualityLevel].optimize;
   } else {
-    quality = -1;
-    subsampling = subsampleUndefined;
+    job->quality = -1;
+    job->subsampling = subsampleUndefined;
+    job->fastDCT = false;
+    job->optimize = false;
   }
 
   // Fine settings trump level
-  if (fineQuality != -1)
-    quality = fineQuality;
+  if (fineQuality != -1) {
+    job->quality = fineQuality;
+    job->fastDCT = fineQuality < 96;
+    job->optimize = false;
+  }
   if (fineSubsampling != subsampleUndefined)
-    subsampling = fineSubsampling;
+    job->subsampling = fineSubsampling;
+}
 
-  jc.clear();
-  jc.compress(buffer, stride, pb->getRect(),
-              pb->getPF(), quality, subsampling);
+void TightJPEGEncoder::writeData(JpegCompressor* jc)
+{
+  rdr::OutStream* os;
 
   os = conn->getOutStream();
 
   os->writeU8(tightJpeg << 4);
 
-  writeCompact(jc.length(), os);
-  os->writeBytes(jc.data(), jc.length());
-}
-
-void TightJPEGEncoder::writeSolidRect(int width, int height,
-                                      const PixelFormat& pf,
-                                      const rdr::U8* colour)
-{
-  // FIXME: Add a shortcut in the JPEG compressor to handle this case
-  //        without having to use the default fallback which is very slow.
-  Encoder::writeSolidRect(width, height, pf, colour);
+  writeCompact(jc->length(), os);
+  os->writeBytes(jc->data(), jc->length());
 }
 
 void TightJPEGEncoder::writeCompact(rdr::U32 value, rdr::OutStream* os)
@@ -20,8 +20,11 @@
 #ifndef __RFB_TIGHTJPEGENCODER_H__
 #define __RFB_TIGHTJPEGENCODER_H__
 
+#include <list>
+
 #include <rfb/Encoder.h>
 #include <rfb/JpegCompressor.h>
+#include <rfb/JpegCompressPool.h>
 
 namespace rfb {
 
@@ -42,7 +45,24 @@ namespace rfb {
                                 const PixelFormat& pf,
                                 const rdr::U8* colour);
 
+    virtual size_t memoryUsage();
+    virtual void releaseMemory();
+
+    // Compress a part of the pixel buffer on the shared worker
+    // threads. The buffer must stay unchanged until the rect has been
+    // written.
+    void queueRect(const PixelBuffer* pb, const Rect& rect);
+
+    // Queued rects are written in the order they were queued. The
+    // caller is responsible for the rect header, so it first gets the
+    // coordinates of the next rect, if any.
+    bool peekQueuedRect(Rect* rect);
+    void writeQueuedRect();
+
   protected:
+    void getSettings(JpegCompressPool::Job* job);
+    void writeData(JpegCompressor* jc);
+
     void writeCompact(rdr::U32 value, rdr::OutStream* os);
 
   protected:
@@ -51,6 +71,11 @@ namespace rfb {
     int qualityLevel;
     int fineQuality;
     int fineSubsampling;
+
+    JpegCompressPool* pool;
+
+    std::list<JpegCompressor*> freeCompressors;
+    std::list<JpegCompressPool::Job*> workQueue;
   };
 }
 #endif
@@ -123,6 +123,23 @@ void SimpleUpdateTracker::subtract(const Region& region) {
   changed.assign_subtract(region);
 }
 
+void SimpleUpdateTracker::intersect(const Rect& r) {
+  Region invalid_src;
+
+  changed.assign_intersect(r);
+  copied.assign_intersect(r);
+
+  invalid_src = copied;
+  invalid_src.translate(copy_delta.negate());
+  invalid_src.assign_subtract(r);
+  if (invalid_src.is_empty())
+    return;
+
+  invalid_src.translate(copy_delta);
+  copied.assign_subtract(invalid_src);
+  changed.assign_union(invalid_src);
+}
+
 void SimpleUpdateTracker::getUpdateInfo(UpdateInfo* info, const Region& clip)
 {
   copied.assign_subtract(changed);
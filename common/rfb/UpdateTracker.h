@@ -85,6 +85,10 @@ namespace rfb {
     // Move the entire update region by an offset
     void translate(const Point& p) {changed.translate(p); copied.translate(p);}
 
+    // Clip the update to the given rectangle, turning any copy whose
+    // source falls outside it into a change
+    void intersect(const Rect& r);
+
     virtual bool is_empty() const {return changed.is_empty() && copied.is_empty();}
 
     virtual void clear() {changed.clear(); copied.clear();};
@@ -43,6 +43,19 @@ static LogWriter vlog("VNCSConnST");
 
 static Cursor emptyCursor(0, 0, Point(0, 0), NULL);
 
+// Size of the area around the pointer that is sent ahead of the rest
+static const int PointerFocusSize = 256;
+
+// The first changes no taller than this that show up within the time
+// limit after a key press are taken to be the echo of what was typed
+static const int KeyEchoHeight = 64;
+static const int KeyEchoTime = 500;
+
+// How long the area where the user was typing stays a priority, and how
+// much around it is included
+static const int TypingFocusTime = 2000;
+static const int TypingFocusMargin = 32;
+
 VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s,
                                    bool reverse)
   : sock(s), reverseConnection(reverse),
@@ -51,15 +64,21 @@ VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s,
     fenceDataLen(0), fenceData(NULL), congestionTimer(this),
     losslessTimer(this), server(server_),
     updateRenderedCursor(false), removeRenderedCursor(false),
-    continuousUpdates(false), encodeManager(this), idleTimer(this),
-    pointerEventTime(0), clientHasCursor(false),
-    authFailureTimer(this)
+    continuousUpdates(false), encodeManager(this), queuePending(false),
+    idleTimer(this), pointerEventTime(0), keyEchoPending(false),
+    clientHasCursor(false), authFailureTimer(this)
 {
+  keyEventTime.tv_sec = 0;
+  keyEventTime.tv_usec = 0;
+
   setStreams(&sock->inStream(), &sock->outStream());
   peerEndpoint.buf = sock->getPeerEndpoint();
 
   // Configure the socket
   setSocketTimeouts();
+  if (rfb::Server::zeroCopy && !sock->outStream().setZeroCopy(true))
+    vlog.debug("Zero-copy sends not available for %s", peerEndpoint.buf);
+  sock->outStream().setFlushCallback(this);
 
   // Kick off the idle timer
   if (rfb::Server::idleTimeout) {
@@ -78,6 +97,9 @@ VNCSConnectionST::~VNCSConnectionST()
   if (closeReason.buf)
     vlog.info("closing %s: %s", peerEndpoint.buf, closeReason.buf);
 
+  // The socket outlives us
+  sock->outStream().setFlushCallback(NULL);
+
   // Release any keys the client still had pressed
   while (!pressedKeys.empty()) {
     rdr::U32 keysym, keycode;
@@ -91,6 +113,16 @@ VNCSConnectionST::~VNCSConnectionST()
     server->keyEvent(keysym, keycode, false);
   }
 
+  if (queueLatency.count() != 0) {
+    char a[1024];
+
+    vlog.info("Update latency for %s:", peerEndpoint.buf);
+    queueLatency.print(a, sizeof(a));
+    vlog.info("  Queued: %s", a);
+    flushLatency.print(a, sizeof(a));
+    vlog.info("  Flush: %s", a);
+  }
+
   delete [] fenceData;
 }
 
@@ -148,8 +180,10 @@ void VNCSConnectionST::processMessages()
     inProcessMessages = true;
 
     // Get the underlying TCP layer to build large packets if we send
-    // multiple small responses.
+    // multiple small responses, and the streams above it to gather them
+    // into large writes (and TLS records).
     sock->cork(true);
+    getOutStream()->cork(true);
 
     while (getInStream()->checkNoWait(1)) {
       // Silently drop any data if we are currently delaying an
@@ -175,6 +209,7 @@ void VNCSConnectionST::processMessages()
     }
 
     // Flush out everything in case we go idle after this.
+    getOutStream()->cork(false);
     sock->cork(false);
 
     inProcessMessages = false;
@@ -205,33 +240,25 @@ void VNCSConnectionST::flushSocket()
   }
 }
 
-void VNCSConnectionST::pixelBufferChange()
+void VNCSConnectionST::pixelBufferChange(bool preserved)
 {
   try {
+    Rect oldRect, fbRect;
+
     if (!authenticated()) return;
+
+    oldRect.setXYWH(0, 0, client.width(), client.height());
+    fbRect = server->getPixelBuffer()->getRect();
+
     if (client.width() && client.height() &&
-        (server->getPixelBuffer()->width() != client.width() ||
-         server->getPixelBuffer()->height() != client.height()))
+        (fbRect.width() != client.width() ||
+         fbRect.height() != client.height()))
     {
-      // We need to clip the next update to the new size, but also add any
-      // extra bits if it's bigger.  If we wanted to do this exactly, something
-      // like the code below would do it, but at the moment we just update the
-      // entire new size.  However, we do need to clip the damagedCursorRegion
-      // because that might be added to updates in writeFramebufferUpdate().
-
-      //updates.intersect(server->pb->getRect());
-      //
-      //if (server->pb->width() > client.width())
-      //  updates.add_changed(Rect(client.width(), 0, server->pb->width(),
-      //                           server->pb->height()));
-      //if (server->pb->height() > client.height())
-      //  updates.add_changed(Rect(0, client.height(), client.width(),
-      //                           server->pb->height()));
-
-      damagedCursorRegion.assign_intersect(server->getPixelBuffer()->getRect());
-
-      client.setDimensions(server->getPixelBuffer()->width(),
-                           server->getPixelBuffer()->height(),
+      // We need to clip the damagedCursorRegion because that might be
+      // added to updates in writeFramebufferUpdate().
+      damagedCursorRegion.assign_intersect(fbRect);
+
+      client.setDimensions(fbRect.width(), fbRect.height(),
                            server->getScreenLayout());
       if (state() == RFBSTATE_NORMAL) {
         if (!client.supportsDesktopSize()) {
@@ -242,18 +269,49 @@ void VNCSConnectionST::pixelBufferChange()
       }
 
       // Drop any lossy tracking that is now outside the framebuffer
-      encodeManager.pruneLosslessRefresh(Region(server->getPixelBuffer()->getRect()));
+      encodeManager.pruneLosslessRefresh(Region(fbRect));
+    }
+
+    if (preserved) {
+      // The framebuffer has kept its contents, so the pending update only
+      // needs clipping to the new size, plus anything that is new
+      updates.intersect(fbRect);
+      updates.add_changed(Region(fbRect).subtract(oldRect));
+    } else {
+      // The contents are all new, so the whole screen has to be sent
+      updates.clear();
+      updates.add_changed(fbRect);
     }
-    // Just update the whole screen at the moment because we're too lazy to
-    // work out what's actually changed.
-    updates.clear();
-    updates.add_changed(server->getPixelBuffer()->getRect());
     writeFramebufferUpdate();
   } catch(rdr::Exception &e) {
     close(e.str());
   }
 }
 
+void VNCSConnectionST::add_changed(const Region& region)
+{
+  if (!region.is_empty())
+    startQueueClock();
+  updates.add_changed(region);
+}
+
+void VNCSConnectionST::add_copied(const Region& dest, const Point& delta)
+{
+  if (!dest.is_empty())
+    startQueueClock();
+  updates.add_copied(dest, delta);
+}
+
+void VNCSConnectionST::mergeLatency(LatencyHistogram* queue,
+                                    LatencyHistogram* flush,
+                                    LatencyHistogram* encode,
+                                    EncodeManager::LatencyVector* encoders)
+{
+  queue->merge(queueLatency);
+  flush->merge(flushLatency);
+  encodeManager.mergeEncodeLatency(encode, encoders);
+}
+
 void VNCSConnectionST::writeFramebufferUpdateOrClose()
 {
   try {
@@ -511,9 +569,13 @@ void VNCSConnectionST::keyEvent(rdr::U32 keysym, rdr::U32 keycode, bool down) {
   if (!accessCheck(AccessKeyEvents)) return;
   if (!rfb::Server::acceptKeyEvents) return;
 
-  if (down)
+  if (down) {
     vlog.debug("Key pressed: 0x%x / 0x%x", keysym, keycode);
-  else
+
+    // The echo of this will show up in the coming updates
+    gettimeofday(&keyEventTime, NULL);
+    keyEchoPending = true;
+  } else
     vlog.debug("Key released: 0x%x / 0x%x", keysym, keycode);
 
   // Avoid lock keys if we don't know the server state
@@ -807,6 +869,11 @@ bool VNCSConnectionST::handleTimeout(Timer* t)
   return false;
 }
 
+void VNCSConnectionST::flushCallback(unsigned long long usecs)
+{
+  flushLatency.add(usecs);
+}
+
 bool VNCSConnectionST::isShiftPressed()
 {
     std::map<rdr::U32, rdr::U32>::const_iterator iter;
@@ -896,8 +963,10 @@ void VNCSConnectionST::writeFramebufferUpdate()
   // Updates often consists of many small writes, and in continuous
   // mode, we will also have small fence messages around the update. We
   // need to aggregate these in order to not clog up TCP's congestion
-  // window.
+  // window. The streams hold back everything but full size writes until
+  // the end of the update.
   sock->cork(true);
+  getOutStream()->cork(true);
 
   // First take care of any updates that cannot contain framebuffer data
   // changes.
@@ -906,6 +975,8 @@ void VNCSConnectionST::writeFramebufferUpdate()
   // Then real data (if possible)
   writeDataUpdate();
 
+  // End of update, so send out whatever is left
+  getOutStream()->cork(false);
   sock->cork(false);
 
   congestion.updatePosition(sock->outStream().length());
@@ -1021,9 +1092,51 @@ void VNCSConnectionST::writeDataUpdate()
 
   // We have something to send, so let's get to it
 
+  if (queuePending)
+    queueLatency.addSince(&queueStart);
+
   writeRTTPing();
 
-  encodeManager.writeUpdate(ui, server->getPixelBuffer(), cursor);
+  // Without fences we have no real idea of the link speed
+  if (client.supportsFence())
+    encodeManager.setLinkBandwidth(congestion.getBandwidth());
+
+  // With continuous updates we are free to send more than one update,
+  // so what is around the user goes out first and on its own, and the
+  // rest follows only if the link has room for it
+  if (continuousUpdates && rfb::Server::prioritiseInput) {
+    Region pending;
+
+    updateTypingRegion(ui.changed);
+
+    pending = ui.changed.union_(ui.copied);
+    if (encodeManager.writePriorityUpdate(&ui, getFocusRegion(cursor),
+                                          server->getPixelBuffer(), cursor)) {
+      bool congested;
+
+      writeRTTPing();
+
+      updates.subtract(pending.subtract(ui.changed));
+
+      // Make sure it is on its way before we encode anything else
+      getOutStream()->cork(false);
+      sock->cork(false);
+
+      congested = isCongested();
+
+      sock->cork(true);
+      getOutStream()->cork(true);
+
+      if (congested) {
+        requested.clear();
+        return;
+      }
+    }
+
+    encodeManager.writeDeferredUpdate(ui, server->getPixelBuffer(), cursor);
+  } else {
+    encodeManager.writeUpdate(ui, server->getPixelBuffer(), cursor);
+  }
 
   writeRTTPing();
 
@@ -1031,16 +1144,87 @@ void VNCSConnectionST::writeDataUpdate()
   // just clear the entire update tracker.
   updates.subtract(req);
 
+  if (updates.is_empty())
+    queuePending = false;
+
   requested.clear();
 }
 
+void VNCSConnectionST::startQueueClock()
+{
+  if (queuePending)
+    return;
+
+  gettimeofday(&queueStart, NULL);
+  queuePending = true;
+}
+
+void VNCSConnectionST::updateTypingRegion(const Region& changed)
+{
+  Region::const_iterator i;
+  Region echo;
+
+  if (!keyEchoPending)
+    return;
+
+  // Nothing seems to have come of the key press
+  if (msSince(&keyEventTime) > KeyEchoTime) {
+    keyEchoPending = false;
+    return;
+  }
+
+  for (i = changed.begin(); i != changed.end(); ++i) {
+    Rect r;
+
+    if (i->height() > KeyEchoHeight)
+      continue;
+
+    r.setXYWH(i->tl.x - TypingFocusMargin, i->tl.y - TypingFocusMargin,
+              i->width() + TypingFocusMargin * 2,
+              i->height() + TypingFocusMargin * 2);
+    echo.assign_union(r);
+  }
+
+  if (echo.is_empty())
+    return;
+
+  typingRegion = echo;
+  keyEchoPending = false;
+}
+
+Region VNCSConnectionST::getFocusRegion(const RenderedCursor* cursor)
+{
+  Region focus;
+
+  if (pointerEventTime != 0) {
+    Rect r;
+
+    r.setXYWH(pointerEventPos.x - PointerFocusSize / 2,
+              pointerEventPos.y - PointerFocusSize / 2,
+              PointerFocusSize, PointerFocusSize);
+    focus.assign_union(r);
+  }
+
+  if (cursor != NULL)
+    focus.assign_union(cursor->getEffectiveRect());
+
+  if (!typingRegion.is_empty()) {
+    if (msSince(&keyEventTime) > TypingFocusTime)
+      typingRegion.clear();
+    else
+      focus.assign_union(typingRegion);
+  }
+
+  return focus;
+}
+
 void VNCSConnectionST::writeLosslessRefresh()
 {
   Region req, pending;
   const RenderedCursor *cursor;
 
   int nextRefresh, nextUpdate;
-  size_t bandwidth, maxUpdateSize;
+  size_t bandwidth, maxUpdateSize, inFlight;
 
   if (continuousUpdates)
     req = cuRegion.union_(requested);
@@ -1098,10 +1282,21 @@ void VNCSConnectionST::writeLosslessRefresh()
 
   maxUpdateSize = bandwidth * nextUpdate / 1000;
 
+  // Only use what is left over once the data already on its way has
+  // got through, so that the next real update isn't held up
+  inFlight = congestion.getInFlight();
+  if (maxUpdateSize <= inFlight) {
+    losslessTimer.start(nextUpdate);
+    return;
+  }
+  maxUpdateSize -= inFlight;
+
   writeRTTPing();
 
+  // Refine what is closest to the pointer first
   encodeManager.writeLosslessRefresh(req, server->getPixelBuffer(),
-                                     cursor, maxUpdateSize);
+                                     cursor, maxUpdateSize,
+                                     server->getCursorPos());
 
   writeRTTPing();
 
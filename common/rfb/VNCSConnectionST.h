@@ -29,8 +29,10 @@
 
 #include <map>
 
+#include <rdr/FdOutStream.h>
 #include <rfb/Congestion.h>
 #include <rfb/EncodeManager.h>
+#include <rfb/LatencyHistogram.h>
 #include <rfb/SConnection.h>
 #include <rfb/Timer.h>
 
@@ -38,7 +40,8 @@ namespace rfb {
   class VNCServerST;
 
   class VNCSConnectionST : public SConnection,
-                           public Timer::Callback {
+                           public Timer::Callback,
+                           public rdr::FdOutStreamFlushCallback {
   public:
     VNCSConnectionST(VNCServerST* server_, network::Socket* s, bool reverse);
     virtual ~VNCSConnectionST();
@@ -65,7 +68,9 @@ namespace rfb {
     void flushSocket();
 
     // Called when the underlying pixelbuffer is resized or replaced.
-    void pixelBufferChange();
+    // If preserved is set then the contents have been kept where the old
+    // and new framebuffer overlap.
+    void pixelBufferChange(bool preserved);
 
     // Wrappers to make these methods "safe" for VNCServerST.
     void writeFramebufferUpdateOrClose();
@@ -100,10 +105,15 @@ namespace rfb {
 
     // Change tracking
 
-    void add_changed(const Region& region) { updates.add_changed(region); }
-    void add_copied(const Region& dest, const Point& delta) {
-      updates.add_copied(dest, delta);
-    }
+    void add_changed(const Region& region);
+    void add_copied(const Region& dest, const Point& delta);
+
+    // mergeLatency() adds how long this client's updates have spent
+    // waiting, being encoded and being written out to the given
+    // histograms
+    void mergeLatency(LatencyHistogram* queue, LatencyHistogram* flush,
+                      LatencyHistogram* encode,
+                      EncodeManager::LatencyVector* encoders);
 
   private:
     // SConnection callbacks
@@ -134,6 +144,9 @@ namespace rfb {
     // Timer callbacks
     virtual bool handleTimeout(Timer* t);
 
+    // FdOutStream callbacks
+    virtual void flushCallback(unsigned long long usecs);
+
     // Internal methods
 
     bool isShiftPressed();
@@ -150,6 +163,11 @@ namespace rfb {
     void writeDataUpdate();
     void writeLosslessRefresh();
 
+    void startQueueClock();
+
+    void updateTypingRegion(const Region& changed);
+    Region getFocusRegion(const RenderedCursor* cursor);
+
     void screenLayoutChange(rdr::U16 reason);
     void setCursor();
     void setDesktopName(const char *name);
@@ -181,12 +199,22 @@ namespace rfb {
     Region cuRegion;
     EncodeManager encodeManager;
 
+    // Oldest change not yet sent, how long changes have had to wait,
+    // and how long each write to the socket took
+    bool queuePending;
+    struct timeval queueStart;
+    LatencyHistogram queueLatency;
+    LatencyHistogram flushLatency;
+
     std::map<rdr::U32, rdr::U32> pressedKeys;
 
     Timer idleTimer;
 
     time_t pointerEventTime;
     Point pointerEventPos;
+    struct timeval keyEventTime;
+    bool keyEchoPending;
+    Region typingRegion;
     bool clientHasCursor;
 
     Timer authFailureTimer;
@@ -49,6 +49,12 @@ namespace rfb {
     virtual void setPixelBuffer(PixelBuffer* pb, const ScreenSet& layout) = 0;
     virtual void setPixelBuffer(PixelBuffer* pb) = 0;
 
+    // resizePixelBuffer() is like setPixelBuffer(), but for a pixel buffer
+    // with the same format whose contents are unchanged where the old and
+    // the new size overlap. Clients will then only be sent the newly
+    // exposed areas. The old pixel buffer is not accessed.
+    virtual void resizePixelBuffer(PixelBuffer* pb, const ScreenSet& layout) = 0;
+
     // setScreenLayout() modifies the current screen layout without changing
     // the pixelbuffer. Clients will be notified of the new layout.
     virtual void setScreenLayout(const ScreenSet& layout) = 0;
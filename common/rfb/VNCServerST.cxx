@@ -82,7 +82,7 @@ VNCServerST::VNCServerST(const char* name_, SDesktop* desktop_)
     renderedCursorInvalid(false),
     keyRemapper(&KeyRemapper::defInstance),
     idleTimer(this), disconnectTimer(this), connectTimer(this),
-    frameTimer(this)
+    frameTimer(this), damagePending(false), latencyTimer(this)
 {
   slog.debug("creating single-threaded server %s", name.buf);
 
@@ -91,6 +91,8 @@ VNCServerST::VNCServerST(const char* name_, SDesktop* desktop_)
     idleTimer.start(secsToMillis(rfb::Server::maxIdleTime));
   if (rfb::Server::maxDisconnectionTime)
     disconnectTimer.start(secsToMillis(rfb::Server::maxDisconnectionTime));
+  if (rfb::Server::latencyStatsInterval)
+    latencyTimer.start(secsToMillis(rfb::Server::latencyStatsInterval));
 }
 
 VNCServerST::~VNCServerST()
@@ -177,6 +179,10 @@ void VNCServerST::removeSocket(network::Socket* sock) {
       if (rfb::Server::maxDisconnectionTime && clients.empty())
         disconnectTimer.start(secsToMillis(rfb::Server::maxDisconnectionTime));
 
+      // - Keep the client's figures for the server's totals
+      (*ci)->mergeLatency(&closedQueueLatency, &closedFlushLatency,
+                          &closedEncodeLatency, &closedEncoderLatency);
+
       // - Delete the per-Socket resources
       delete *ci;
 
@@ -281,7 +287,7 @@ void VNCServerST::setPixelBuffer(PixelBuffer* pb_, const ScreenSet& layout)
   std::list<VNCSConnectionST*>::iterator ci, ci_next;
   for (ci=clients.begin();ci!=clients.end();ci=ci_next) {
     ci_next = ci; ci_next++;
-    (*ci)->pixelBufferChange();
+    (*ci)->pixelBufferChange(false);
     // Since the new pixel buffer means an ExtendedDesktopSize needs to
     // be sent anyway, we don't need to call screenLayoutChange.
   }
@@ -318,6 +324,33 @@ void VNCServerST::setPixelBuffer(PixelBuffer* pb_)
   setPixelBuffer(pb_, layout);
 }
 
+void VNCServerST::resizePixelBuffer(PixelBuffer* pb_, const ScreenSet& layout)
+{
+  // Nothing to keep if we didn't have a framebuffer before
+  if (!pb || !pb_ || !comparer) {
+    setPixelBuffer(pb_, layout);
+    return;
+  }
+
+  if (!layout.validate(pb_->width(), pb_->height()))
+    throw Exception("resizePixelBuffer: invalid screen layout");
+
+  pb = pb_;
+  screenLayout = layout;
+
+  // Everything that tracks the framebuffer contents only needs to be
+  // clipped, with the newly exposed area added
+  comparer->resize(pb);
+  renderedCursorInvalid = true;
+  startFrameClock();
+
+  std::list<VNCSConnectionST*>::iterator ci, ci_next;
+  for (ci=clients.begin();ci!=clients.end();ci=ci_next) {
+    ci_next = ci; ci_next++;
+    (*ci)->pixelBufferChange(true);
+  }
+}
+
 void VNCServerST::setScreenLayout(const ScreenSet& layout)
 {
   if (!pb)
@@ -397,6 +430,11 @@ void VNCServerST::add_changed(const Region& region)
   if (comparer == NULL)
     return;
 
+  if (!damagePending) {
+    gettimeofday(&damageStart, NULL);
+    damagePending = true;
+  }
+
   comparer->add_changed(region);
   startFrameClock();
 }
@@ -406,6 +444,11 @@ void VNCServerST::add_copied(const Region& dest, const Point& delta)
   if (comparer == NULL)
     return;
 
+  if (!damagePending) {
+    gettimeofday(&damageStart, NULL);
+    damagePending = true;
+  }
+
   comparer->add_copied(dest, delta);
   startFrameClock();
 }
@@ -624,6 +667,11 @@ bool VNCServerST::handleTimeout(Timer* t)
   } else if (t == &connectTimer) {
     slog.info("MaxConnectionTime reached, exiting");
     desktop->terminate();
+  } else if (t == &latencyTimer) {
+    logLatencyStats();
+    // The interval might have been changed
+    if (rfb::Server::latencyStatsInterval)
+      latencyTimer.start(secsToMillis(rfb::Server::latencyStatsInterval));
   }
 
   return false;
@@ -773,12 +821,22 @@ void VNCServerST::writeUpdate()
 {
   UpdateInfo ui;
   Region toCheck;
+  struct timeval start;
 
   std::list<VNCSConnectionST*>::iterator ci, ci_next;
 
   assert(blockCounter == 0);
   assert(desktopStarted);
 
+  if (damagePending) {
+    damageLatency.addSince(&damageStart);
+    damagePending = false;
+  }
+
+  // Logging might have been turned on since we started
+  if (rfb::Server::latencyStatsInterval && !latencyTimer.isStarted())
+    latencyTimer.start(secsToMillis(rfb::Server::latencyStatsInterval));
+
   comparer->getUpdateInfo(&ui, pb->getRect());
   toCheck = ui.changed.union_(ui.copied);
 
@@ -791,15 +849,19 @@ void VNCServerST::writeUpdate()
       renderedCursorInvalid = true;
   }
 
+  gettimeofday(&start, NULL);
   pb->grabRegion(toCheck);
+  grabLatency.addSince(&start);
 
   if (getComparerState())
     comparer->enable();
   else
     comparer->disable();
 
+  gettimeofday(&start, NULL);
   if (comparer->compare())
     comparer->getUpdateInfo(&ui, pb->getRect());
+  compareLatency.addSince(&start);
 
   comparer->clear();
 
@@ -811,6 +873,36 @@ void VNCServerST::writeUpdate()
   }
 }
 
+void VNCServerST::logLatencyStats()
+{
+  LatencyHistogram queue, flush, encode;
+  std::vector<LatencyHistogram> encoders;
+  std::list<VNCSConnectionST*>::iterator ci;
+  char a[1024];
+
+  queue.merge(closedQueueLatency);
+  flush.merge(closedFlushLatency);
+  encode.merge(closedEncodeLatency);
+  encoders = closedEncoderLatency;
+
+  for (ci = clients.begin(); ci != clients.end(); ci++)
+    (*ci)->mergeLatency(&queue, &flush, &encode, &encoders);
+
+  slog.info("Update latency:");
+  damageLatency.print(a, sizeof(a));
+  slog.info("  Damage: %s", a);
+  grabLatency.print(a, sizeof(a));
+  slog.info("  Grab: %s", a);
+  compareLatency.print(a, sizeof(a));
+  slog.info("  Compare: %s", a);
+  queue.print(a, sizeof(a));
+  slog.info("  Queued: %s", a);
+  flush.print(a, sizeof(a));
+  slog.info("  Flush: %s", a);
+
+  EncodeManager::logEncodeLatency(encode, encoders);
+}
+
 // checkUpdate() is called by clients to see if it is safe to read from
 // the framebuffer at this time.
 
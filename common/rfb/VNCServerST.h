@@ -26,10 +26,13 @@
 
 #include <sys/time.h>
 
+#include <vector>
+
 #include <rfb/SDesktop.h>
 #include <rfb/VNCServer.h>
 #include <rfb/Blacklist.h>
 #include <rfb/Cursor.h>
+#include <rfb/LatencyHistogram.h>
 #include <rfb/Timer.h>
 #include <rfb/ScreenSet.h>
 
@@ -83,6 +86,7 @@ namespace rfb {
     virtual void unblockUpdates();
     virtual void setPixelBuffer(PixelBuffer* pb, const ScreenSet& layout);
     virtual void setPixelBuffer(PixelBuffer* pb);
+    virtual void resizePixelBuffer(PixelBuffer* pb, const ScreenSet& layout);
     virtual void setScreenLayout(const ScreenSet& layout);
     virtual const PixelBuffer* getPixelBuffer() const { return pb; }
 
@@ -148,6 +152,10 @@ namespace rfb {
     // ready to be sent to clients
     Region getPendingRegion();
 
+    // logLatencyStats() logs how long updates have spent in each stage
+    // so far, for the server and all clients, past and present.
+    void logLatencyStats();
+
     // getRenderedCursor() returns an up to date version of the server
     // side rendered cursor buffer
     const RenderedCursor* getRenderedCursor();
@@ -205,6 +213,22 @@ namespace rfb {
     Timer connectTimer;
 
     Timer frameTimer;
+
+    // Time from a change to the frame that picks it up, and the time
+    // it takes to process that frame
+    bool damagePending;
+    struct timeval damageStart;
+    LatencyHistogram damageLatency;
+    LatencyHistogram grabLatency;
+    LatencyHistogram compareLatency;
+
+    // Figures of clients that have disconnected
+    LatencyHistogram closedQueueLatency;
+    LatencyHistogram closedFlushLatency;
+    LatencyHistogram closedEncodeLatency;
+    std::vector<LatencyHistogram> closedEncoderLatency;
+
+    Timer latencyTimer;
   };
 
 };
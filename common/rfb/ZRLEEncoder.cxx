@@ -45,6 +45,15 @@ bool ZRLEEncoder::isSupported()
   return conn->client.supportsEncoding(encodingZRLE);
 }
 
+void ZRLEEncoder::setCompressLevel(int level)
+{
+  // An explicit ZlibLevel always wins
+  if (zlibLevel != -1)
+    return;
+
+  zos.setCompressionLevel(level);
+}
+
 void ZRLEEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
 {
   int x, y;
@@ -114,6 +123,18 @@ void ZRLEEncoder::writeSolidRect(int width, int height,
   mos.clear();
 }
 
+size_t ZRLEEncoder::memoryUsage()
+{
+  return zos.memoryUsage() + mos.capacity();
+}
+
+void ZRLEEncoder::releaseMemory()
+{
+  // ZRLE has no way of resetting the zlib stream, so its state has
+  // to stay
+  mos.release();
+}
+
 void ZRLEEncoder::writePaletteTile(const Rect& tile, const PixelBuffer* pb,
                                    const Palette& palette)
 {
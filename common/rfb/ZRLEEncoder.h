@@ -32,11 +32,16 @@ namespace rfb {
 
     virtual bool isSupported();
 
+    virtual void setCompressLevel(int level);
+
     virtual void writeRect(const PixelBuffer* pb, const Palette& palette);
     virtual void writeSolidRect(int width, int height,
                                 const PixelFormat& pf,
                                 const rdr::U8* colour);
 
+    virtual size_t memoryUsage();
+    virtual void releaseMemory();
+
   protected:
     void writePaletteTile(const Rect& tile, const PixelBuffer* pb,
                           const Palette& palette);
@@ -0,0 +1,34 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_ZSTDCONSTANTS_H__
+#define __RFB_ZSTDCONSTANTS_H__
+namespace rfb {
+  // Each rect is a U32 length followed by that many bytes of a single
+  // zstd stream that lives as long as the connection. The first byte of
+  // the decompressed data is one of these subencodings.
+  //
+  // Pixels are sent as three bytes of RGB for 888 formats, and in the
+  // negotiated pixel format otherwise. Palette indices are packed into
+  // 1, 2, 4 or 8 bits depending on the palette size, with every row
+  // starting on a byte boundary.
+  const unsigned int zstdRaw = 0x00;
+  const unsigned int zstdSolid = 0x01;
+  const unsigned int zstdPalette = 0x02;
+  const unsigned int zstdMaxSubencoding = 0x02;
+}
+#endif
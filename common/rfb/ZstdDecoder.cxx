@@ -0,0 +1,188 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_ZSTD
+
+#include <string.h>
+
+#include <rdr/InStream.h>
+#include <rdr/MemInStream.h>
+#include <rdr/OutStream.h>
+
+#include <rfb/Exception.h>
+#include <rfb/ServerParams.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/ZstdConstants.h>
+#include <rfb/ZstdDecoder.h>
+
+using namespace rfb;
+
+ZstdDecoder::ZstdDecoder() : Decoder(DecoderOrdered)
+{
+}
+
+ZstdDecoder::~ZstdDecoder()
+{
+}
+
+void ZstdDecoder::readRect(const Rect& r, rdr::InStream* is,
+                           const ServerParams& server, rdr::OutStream* os)
+{
+  rdr::U32 len;
+
+  len = is->readU32();
+  os->writeU32(len);
+  os->copyBytes(is, len);
+}
+
+void ZstdDecoder::decodeRect(const Rect& r, const void* buffer,
+                             size_t buflen, const ServerParams& server,
+                             ModifiablePixelBuffer* pb)
+{
+  rdr::MemInStream is(buffer, buflen);
+  const PixelFormat& pf = server.pf();
+  const int bpp = pf.bpp/8;
+
+  rdr::U8 subencoding;
+
+  bool directDecode;
+  rdr::U8* outbuf;
+  int stride;
+
+  zis.setUnderlying(&is, is.readU32());
+
+  subencoding = zis.readU8();
+  if (subencoding > zstdMaxSubencoding)
+    throw Exception("Zstd decode error: bad subencoding %d", subencoding);
+
+  if (subencoding == zstdSolid) {
+    rdr::U8 pix[4];
+
+    readPixels(pix, pf, 1);
+    pb->fillRect(pf, r, pix);
+
+    zis.removeUnderlying();
+    return;
+  }
+
+  if (pb->getPF().equal(pf)) {
+    // Decode directly into the framebuffer (fast path)
+    directDecode = true;
+    outbuf = pb->getBufferRW(r, &stride);
+  } else {
+    // Decode into an intermediate buffer and use pixel translation
+    directDecode = false;
+    outbuf = new rdr::U8[r.area() * bpp];
+    stride = r.width();
+  }
+
+  try {
+    if (subencoding == zstdRaw) {
+      rdr::U8* ptr = outbuf;
+
+      for (int y = 0;y < r.height();y++) {
+        readPixels(ptr, pf, r.width());
+        ptr += stride * bpp;
+      }
+    } else {
+      rdr::U8 palette[256 * 4];
+      int palSize, bits;
+
+      palSize = zis.readU8() + 1;
+      readPixels(palette, pf, palSize);
+
+      if (palSize <= 2)
+        bits = 1;
+      else if (palSize <= 4)
+        bits = 2;
+      else if (palSize <= 16)
+        bits = 4;
+      else
+        bits = 8;
+
+      for (int y = 0;y < r.height();y++) {
+        rdr::U8* ptr;
+        rdr::U8 byte;
+        int nbits;
+
+        ptr = outbuf + y * stride * bpp;
+        byte = 0;
+        nbits = 0;
+
+        for (int x = 0;x < r.width();x++) {
+          int index;
+
+          if (nbits == 0) {
+            byte = zis.readU8();
+            nbits = 8;
+          }
+
+          nbits -= bits;
+          index = (byte >> nbits) & ((1 << bits) - 1);
+          if (index >= palSize)
+            throw Exception("Zstd decode error: bad palette index");
+
+          memcpy(ptr, &palette[index * bpp], bpp);
+          ptr += bpp;
+        }
+      }
+    }
+  } catch (...) {
+    if (directDecode)
+      pb->commitBufferRW(r);
+    else
+      delete [] outbuf;
+    throw;
+  }
+
+  if (directDecode)
+    pb->commitBufferRW(r);
+  else {
+    pb->imageRect(pf, r, outbuf);
+    delete [] outbuf;
+  }
+
+  zis.removeUnderlying();
+}
+
+void ZstdDecoder::readPixels(rdr::U8* buffer, const PixelFormat& pf,
+                             unsigned int count)
+{
+  rdr::U8 rgb[1024 * 3];
+
+  if (!pf.is888()) {
+    zis.readBytes(buffer, count * pf.bpp/8);
+    return;
+  }
+
+  while (count > 0) {
+    unsigned int len;
+
+    len = count;
+    if (len > 1024)
+      len = 1024;
+
+    zis.readBytes(rgb, len * 3);
+    pf.bufferFromRGB(buffer, rgb, len);
+
+    buffer += len * 4;
+    count -= len;
+  }
+}
+
+#endif
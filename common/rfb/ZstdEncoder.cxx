@@ -0,0 +1,237 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_ZSTD
+
+#include <rdr/OutStream.h>
+#include <rfb/encodings.h>
+#include <rfb/Palette.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/SConnection.h>
+#include <rfb/ZstdConstants.h>
+#include <rfb/ZstdEncoder.h>
+
+using namespace rfb;
+
+// Equivalent zstd levels for the client's compression levels. zstd's
+// lowest levels already compress about as well as zlib's highest.
+static const int zstdLevels[10] = { 1, 1, 2, 3, 4, 5, 6, 8, 12, 16 };
+
+template<class T>
+static void writePaletteIndices(rdr::OutStream* os, int width, int height,
+                                const T* buffer, int stride,
+                                const Palette& palette, int bits)
+{
+  int pad;
+
+  pad = stride - width;
+
+  while (height--) {
+    rdr::U8 byte;
+    int nbits;
+
+    byte = 0;
+    nbits = 0;
+
+    for (int x = 0;x < width;x++) {
+      byte = (byte << bits) | palette.lookup(*buffer++);
+      nbits += bits;
+      if (nbits == 8) {
+        os->writeU8(byte);
+        byte = 0;
+        nbits = 0;
+      }
+    }
+
+    if (nbits != 0)
+      os->writeU8(byte << (8 - nbits));
+
+    buffer += pad;
+  }
+}
+
+ZstdEncoder::ZstdEncoder(SConnection* conn)
+  : Encoder(conn, encodingZstd, EncoderPlain, 256),
+  zos(0, 0, zstdLevels[0]), mos(129*1024)
+{
+  zos.setUnderlying(&mos);
+}
+
+ZstdEncoder::~ZstdEncoder()
+{
+  zos.setUnderlying(NULL);
+}
+
+bool ZstdEncoder::isSupported()
+{
+  return conn->client.supportsEncoding(encodingZstd);
+}
+
+void ZstdEncoder::setCompressLevel(int level)
+{
+  if ((level < 0) || (level > 9))
+    level = 0;
+
+  zos.setCompressionLevel(zstdLevels[level]);
+}
+
+void ZstdEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
+{
+  // RLE classification makes no difference to us as zstd's match
+  // finder already collapses runs, so all we need is the palette
+
+  if (palette.size() == 1) {
+    Encoder::writeSolidRect(pb, palette);
+    return;
+  }
+
+  if (palette.size() == 0)
+    writeFullColourRect(pb);
+  else
+    writePaletteRect(pb, palette);
+
+  flushRect();
+}
+
+void ZstdEncoder::writeSolidRect(int width, int height,
+                                 const PixelFormat& pf,
+                                 const rdr::U8* colour)
+{
+  zos.writeU8(zstdSolid);
+  writePixels(colour, pf, 1);
+
+  flushRect();
+}
+
+size_t ZstdEncoder::memoryUsage()
+{
+  return zos.memoryUsage() + mos.capacity();
+}
+
+void ZstdEncoder::releaseMemory()
+{
+  // The compression context is part of the stream the client keeps,
+  // so only the output buffer can go
+  mos.release();
+}
+
+void ZstdEncoder::writePaletteRect(const PixelBuffer* pb,
+                                   const Palette& palette)
+{
+  const PixelFormat& pf = pb->getPF();
+
+  rdr::U8 colours[256 * 4];
+
+  const rdr::U8* buffer;
+  int stride;
+
+  int bits;
+
+  zos.writeU8(zstdPalette);
+
+  zos.writeU8(palette.size() - 1);
+  for (int i = 0;i < palette.size();i++)
+    pf.bufferFromPixel(&colours[i * pf.bpp/8], palette.getColour(i));
+  writePixels(colours, pf, palette.size());
+
+  if (palette.size() <= 2)
+    bits = 1;
+  else if (palette.size() <= 4)
+    bits = 2;
+  else if (palette.size() <= 16)
+    bits = 4;
+  else
+    bits = 8;
+
+  buffer = pb->getBuffer(pb->getRect(), &stride);
+
+  switch (pf.bpp) {
+  case 32:
+    writePaletteIndices(&zos, pb->width(), pb->height(),
+                        (const rdr::U32*)buffer, stride, palette, bits);
+    break;
+  case 16:
+    writePaletteIndices(&zos, pb->width(), pb->height(),
+                        (const rdr::U16*)buffer, stride, palette, bits);
+    break;
+  default:
+    writePaletteIndices(&zos, pb->width(), pb->height(),
+                        (const rdr::U8*)buffer, stride, palette, bits);
+  }
+}
+
+void ZstdEncoder::writeFullColourRect(const PixelBuffer* pb)
+{
+  const rdr::U8* buffer;
+  int stride;
+
+  int w, h;
+
+  zos.writeU8(zstdRaw);
+
+  buffer = pb->getBuffer(pb->getRect(), &stride);
+
+  w = pb->width();
+  h = pb->height();
+
+  while (h--) {
+    writePixels(buffer, pb->getPF(), w);
+    buffer += stride * pb->getPF().bpp/8;
+  }
+}
+
+void ZstdEncoder::writePixels(const rdr::U8* buffer, const PixelFormat& pf,
+                              unsigned int count)
+{
+  rdr::U8 rgb[1024 * 3];
+
+  if (!pf.is888()) {
+    zos.writeBytes(buffer, count * pf.bpp/8);
+    return;
+  }
+
+  while (count > 0) {
+    unsigned int len;
+
+    len = count;
+    if (len > 1024)
+      len = 1024;
+
+    pf.rgbFromBuffer(rgb, buffer, len);
+    zos.writeBytes(rgb, len * 3);
+
+    buffer += len * 4;
+    count -= len;
+  }
+}
+
+void ZstdEncoder::flushRect()
+{
+  rdr::OutStream* os;
+
+  zos.flush();
+
+  os = conn->getOutStream();
+
+  os->writeU32(mos.length());
+  os->writeBytes(mos.data(), mos.length());
+
+  mos.clear();
+}
+
+#endif
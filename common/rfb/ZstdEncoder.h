@@ -0,0 +1,58 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_ZSTDENCODER_H__
+#define __RFB_ZSTDENCODER_H__
+
+#include <rdr/MemOutStream.h>
+#include <rdr/ZstdOutStream.h>
+#include <rfb/Encoder.h>
+
+namespace rfb {
+
+  class ZstdEncoder : public Encoder {
+  public:
+    ZstdEncoder(SConnection* conn);
+    virtual ~ZstdEncoder();
+
+    virtual bool isSupported();
+
+    virtual void setCompressLevel(int level);
+
+    virtual void writeRect(const PixelBuffer* pb, const Palette& palette);
+    virtual void writeSolidRect(int width, int height,
+                                const PixelFormat& pf,
+                                const rdr::U8* colour);
+
+    virtual size_t memoryUsage();
+    virtual void releaseMemory();
+
+  protected:
+    void writePaletteRect(const PixelBuffer* pb, const Palette& palette);
+    void writeFullColourRect(const PixelBuffer* pb);
+
+    void writePixels(const rdr::U8* buffer, const PixelFormat& pf,
+                     unsigned int count);
+
+    void flushRect();
+
+  protected:
+    rdr::ZstdOutStream zos;
+    rdr::MemOutStream mos;
+  };
+}
+#endif
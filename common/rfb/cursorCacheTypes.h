@@ -0,0 +1,37 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_CURSORCACHETYPES_H__
+#define __RFB_CURSORCACHETYPES_H__
+
+#include <rdr/types.h>
+
+namespace rfb {
+  // A cursor cache pseudo-rectangle has the hotspot and size of the
+  // cursor in its header, followed by an operation and a slot number.
+  //
+  // Store means that the next cursor shape pseudo-rectangle in the same
+  // update should be kept in the slot, replacing what was there. Use
+  // means that the cursor kept in the slot becomes the current cursor.
+  const rdr::U8 cursorCacheStore = 0;
+  const rdr::U8 cursorCacheUse   = 1;
+
+  // Both sides must be able to hold this many cursors
+  const int cursorCacheSlots = 32;
+}
+
+#endif
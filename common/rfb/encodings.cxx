@@ -28,6 +28,8 @@ int rfb::encodingNum(const char* name)
   if (strcasecmp(name, "hextile") == 0)  return encodingHextile;
   if (strcasecmp(name, "ZRLE") == 0)     return encodingZRLE;
   if (strcasecmp(name, "Tight") == 0)    return encodingTight;
+  if (strcasecmp(name, "Zstd") == 0)     return encodingZstd;
+  if (strcasecmp(name, "H264") == 0)     return encodingH264;
   return -1;
 }
 
@@ -41,6 +43,8 @@ const char* rfb::encodingName(int num)
   case encodingHextile:  return "hextile";
   case encodingZRLE:     return "ZRLE";
   case encodingTight:    return "Tight";
+  case encodingZstd:     return "Zstd";
+  case encodingH264:     return "H264";
   default:               return "[unknown encoding]";
   }
 }
@@ -29,6 +29,13 @@ namespace rfb {
   const int encodingTight = 7;
   const int encodingZRLE = 16;
 
+  // TigerVNC-specific, only used if the client also sends
+  // pseudoEncodingZstd, as the number isn't registered
+  const int encodingZstd = 25;
+
+  // Open H.264
+  const int encodingH264 = 50;
+
   const int encodingMax = 255;
 
   const int pseudoEncodingXCursor = -240;
@@ -42,6 +49,12 @@ namespace rfb {
   const int pseudoEncodingCursorWithAlpha = -314;
   const int pseudoEncodingQEMUKeyEvent = -258;
 
+  // TigerVNC-specific, in a block of our own made up of "TGV" and
+  // an index, the same way VMware picks its numbers, so that they
+  // can't clash with anything registered
+  const int pseudoEncodingZstd = 0x54475600;
+  const int pseudoEncodingCursorCache = 0x54475601;
+
   // TightVNC-specific
   const int pseudoEncodingLastRect = -224;
   const int pseudoEncodingQualityLevel0 = -32;
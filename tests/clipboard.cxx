@@ -0,0 +1,250 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * This program feeds clipboard transfers to SMsgReader, either all at
+ * once or a little at a time, and checks that they arrive intact
+ * without SMsgReader ever having to wait for data.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include <rdr/Exception.h>
+#include <rdr/InStream.h>
+#include <rdr/MemOutStream.h>
+#include <rdr/ZlibOutStream.h>
+
+#include <rfb/Configuration.h>
+#include <rfb/SMsgHandler.h>
+#include <rfb/SMsgReader.h>
+#include <rfb/clipboardTypes.h>
+#include <rfb/msgTypes.h>
+
+// Compresses to a tiny fraction of its size, so zlib has lots of
+// output left long after it has been given all the input
+static const size_t pasteSize = 4 * 1024 * 1024;
+
+// The message type, padding, length and flags, which SMsgReader reads
+// in one go
+static const size_t headerSize = 12;
+
+// Hands out data only as it "arrives", and complains if anyone tries
+// to wait for more
+class TrickleInStream : public rdr::InStream {
+public:
+  TrickleInStream(const std::vector<rdr::U8>& data,
+                  const std::vector<size_t>& headers)
+    : data(data), headers(headers), waited(false)
+  {
+    ptr = end = &this->data[0];
+  }
+
+  // Makes up to n more bytes available. Like a client would send
+  // them, that never goes past the end of the current message, nor
+  // stops in the middle of a header.
+  void arrive(size_t n)
+  {
+    size_t cur, pos, i;
+
+    cur = end - &data[0];
+    if (n > data.size() - cur)
+      n = data.size() - cur;
+    pos = cur + n;
+
+    for (i = 0;i < headers.size();i++) {
+      if ((cur < headers[i]) && (pos > headers[i]))
+        pos = headers[i];
+      if ((pos > headers[i]) && (pos < headers[i] + headerSize))
+        pos = headers[i] + headerSize;
+    }
+
+    end = &data[0] + pos;
+  }
+
+  bool hasWaited() { return waited; }
+
+  size_t arrived() { return end - &data[0]; }
+
+  int pos() { return ptr - &data[0]; }
+
+private:
+  int overrun(int itemSize, int nItems, bool wait)
+  {
+    if (wait) {
+      waited = true;
+      throw rdr::Exception("Waited for data");
+    }
+
+    if (end - ptr < itemSize)
+      return 0;
+
+    if (itemSize * nItems > end - ptr)
+      nItems = (end - ptr) / itemSize;
+
+    return nItems;
+  }
+
+  std::vector<rdr::U8> data;
+  std::vector<size_t> headers;
+  bool waited;
+};
+
+class ProvideHandler : public rfb::SMsgHandler {
+public:
+  ProvideHandler() {}
+
+  virtual void framebufferUpdateRequest(const rfb::Rect&, bool) {}
+  virtual void setDesktopSize(int, int, const rfb::ScreenSet&) {}
+  virtual void fence(rdr::U32, unsigned, const char[]) {}
+  virtual void enableContinuousUpdates(bool, int, int, int, int) {}
+
+  virtual void handleClipboardProvide(rdr::U32 flags,
+                                      const size_t* lengths,
+                                      const rdr::U8* const* data)
+  {
+    if (flags & rfb::clipboardUTF8)
+      received.push_back(std::vector<rdr::U8>(data[0], data[0] + lengths[0]));
+    else
+      received.push_back(std::vector<rdr::U8>());
+  }
+
+  std::vector<std::vector<rdr::U8> > received;
+};
+
+// Same as CMsgWriter::writeClipboardProvide()
+static void writeProvide(rdr::MemOutStream* os,
+                         const std::vector<rdr::U8>& text)
+{
+  rdr::MemOutStream mos;
+  rdr::ZlibOutStream zos;
+
+  zos.setUnderlying(&mos);
+  zos.writeU32(text.size());
+  zos.writeBytes(&text[0], text.size());
+  zos.flush();
+
+  os->writeU8(rfb::msgTypeClientCutText);
+  os->pad(3);
+  os->writeS32(-(4 + mos.length()));
+  os->writeU32(rfb::clipboardUTF8 | rfb::clipboardProvide);
+  os->writeBytes(mos.data(), mos.length());
+}
+
+static bool testTransfer(size_t chunkSize)
+{
+  std::vector<rdr::U8> paste, small, message;
+  std::vector<size_t> headers;
+  rdr::MemOutStream mos;
+  size_t i;
+
+  // A text file full of the same line
+  for (i = 0;i < pasteSize;i++)
+    paste.push_back("The quick brown fox jumps over the lazy dog\n"[i % 44]);
+  paste.back() = '\0';
+
+  small.assign((const rdr::U8*)"Hello", (const rdr::U8*)"Hello" + 6);
+
+  // The small one checks that we're in step again after the big one
+  headers.push_back(mos.length());
+  writeProvide(&mos, paste);
+  headers.push_back(mos.length());
+  writeProvide(&mos, small);
+  message.assign((const rdr::U8*)mos.data(),
+                 (const rdr::U8*)mos.data() + mos.length());
+
+  TrickleInStream is(message, headers);
+  ProvideHandler handler;
+  rfb::SMsgReader reader(&handler, &is);
+
+  try {
+    while (is.pos() < (int)message.size()) {
+      size_t arrived;
+      int pos, idle;
+
+      arrived = is.arrived();
+      pos = is.pos();
+
+      is.arrive(chunkSize);
+
+      // Same as VNCSConnectionST::processMessages(). A call might only
+      // finish off a transfer, but the next one has to read something.
+      idle = 0;
+      while (is.checkNoWait(1)) {
+        int before;
+
+        before = is.pos();
+        reader.readMsg();
+
+        if (is.pos() != before)
+          idle = 0;
+        else if (++idle > 1)
+          throw rdr::Exception("Not reading any data");
+      }
+
+      // Everything the client sent has arrived, but we are still waiting
+      if ((is.arrived() == arrived) && (is.pos() == pos))
+        throw rdr::Exception("Stalled");
+    }
+  } catch (rdr::Exception& e) {
+    printf("%s: ", e.str());
+    return false;
+  }
+
+  if (is.hasWaited())
+    return false;
+
+  if (handler.received.size() != 2)
+    return false;
+  if (handler.received[0] != paste)
+    return false;
+  if (handler.received[1] != small)
+    return false;
+
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  static const size_t chunkSizes[] = { (size_t)-1, 65536, 1000, 1 };
+  size_t i;
+
+  printf("Clipboard Transfer Correctness Test\n");
+  printf("\n");
+
+  rfb::Configuration::setParam("MaxCutText", "16777216");
+
+  for (i = 0;i < sizeof(chunkSizes)/sizeof(chunkSizes[0]);i++) {
+    if (chunkSizes[i] == (size_t)-1)
+      printf("A message at a time: ");
+    else
+      printf("%d bytes at a time: ", (int)chunkSizes[i]);
+    fflush(stdout);
+
+    if (testTransfer(chunkSizes[i]))
+      printf("OK");
+    else
+      printf("FAILED");
+    printf("\n");
+  }
+
+  return 0;
+}
@@ -20,7 +20,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <rfb/Cursor.h>
+#include <rfb/PixelBuffer.h>
 #include <rfb/PixelFormat.h>
+#include <rfb/PixelFormatSIMD.h>
 
 static const rdr::U8 pixelRed = 0xf1;
 static const rdr::U8 pixelGreen = 0xc3;
@@ -256,11 +259,76 @@ static bool testPixelRGB(const rfb::PixelFormat &dstpf,
   return true;
 }
 
+static bool testScalar(const rfb::PixelFormat &dstpf,
+                       const rfb::PixelFormat &srcpf)
+{
+  int i, w, unaligned;
+  rfb::SIMDLevel level;
+  rdr::U8 bufIn[fbMalloc], bufOut[fbMalloc], bufRef[fbMalloc];
+  bool ok;
+
+  level = rfb::getSIMDLevel();
+  if (level == rfb::simdNone)
+    return true;
+
+  // An odd width so that the vector code always leaves some columns
+  // for the scalar code
+  w = fbWidth - 3;
+
+  ok = true;
+  for (unaligned = 0;unaligned < 2;unaligned++) {
+    for (i = 0;i < fbMalloc;i++)
+      bufIn[i] = rand();
+
+    memset(bufRef, 0, sizeof(bufRef));
+    rfb::setSIMDLevel(rfb::simdNone);
+    dstpf.bufferFromBuffer(bufRef + unaligned, srcpf, bufIn + unaligned,
+                           w, fbHeight, fbWidth, fbWidth);
+
+    memset(bufOut, 0, sizeof(bufOut));
+    rfb::setSIMDLevel(level);
+    dstpf.bufferFromBuffer(bufOut + unaligned, srcpf, bufIn + unaligned,
+                           w, fbHeight, fbWidth, fbWidth);
+
+    if (memcmp(bufOut, bufRef, sizeof(bufOut)) != 0)
+      ok = false;
+
+    memset(bufRef, 0, sizeof(bufRef));
+    rfb::setSIMDLevel(rfb::simdNone);
+    srcpf.rgbFromBuffer(bufRef + unaligned, bufIn + unaligned,
+                        w, fbWidth, fbHeight);
+
+    memset(bufOut, 0, sizeof(bufOut));
+    rfb::setSIMDLevel(level);
+    srcpf.rgbFromBuffer(bufOut + unaligned, bufIn + unaligned,
+                        w, fbWidth, fbHeight);
+
+    if (memcmp(bufOut, bufRef, sizeof(bufOut)) != 0)
+      ok = false;
+
+    memset(bufRef, 0, sizeof(bufRef));
+    rfb::setSIMDLevel(rfb::simdNone);
+    dstpf.bufferFromRGB(bufRef + unaligned, bufIn + unaligned,
+                        w, fbWidth, fbHeight);
+
+    memset(bufOut, 0, sizeof(bufOut));
+    rfb::setSIMDLevel(level);
+    dstpf.bufferFromRGB(bufOut + unaligned, bufIn + unaligned,
+                        w, fbWidth, fbHeight);
+
+    if (memcmp(bufOut, bufRef, sizeof(bufOut)) != 0)
+      ok = false;
+  }
+
+  return ok;
+}
+
 struct TestEntry tests[] = {
   {"Pixel from pixel", testPixel},
   {"Buffer from buffer", testBuffer},
   {"Buffer to/from RGB", testRGB},
   {"Pixel to/from RGB", testPixelRGB},
+  {"Same result as scalar code", testScalar},
 };
 
 static void doTests(const rfb::PixelFormat &dstpf,
@@ -287,12 +355,10 @@ static void doTests(const rfb::PixelFormat &dstpf,
   }
 }
 
-int main(int argc, char **argv)
+static void doFormats()
 {
   rfb::PixelFormat dstpf, srcpf;
 
-  printf("Pixel Conversion Correctness Test\n");
-
   /* rgb888 targets */
 
   dstpf.parse("rgb888");
@@ -306,9 +372,32 @@ int main(int argc, char **argv)
   srcpf.parse("rgb565");
   doTests(dstpf, srcpf);
 
+  srcpf.parse("bgr555");
+  doTests(dstpf, srcpf);
+
   srcpf.parse("rgb232");
   doTests(dstpf, srcpf);
 
+  /* bgr888 targets */
+
+  dstpf.parse("bgr888");
+
+  srcpf.parse("rgb888");
+  doTests(dstpf, srcpf);
+
+  srcpf.parse("rgb565");
+  doTests(dstpf, srcpf);
+
+  /* rgb555 targets */
+
+  dstpf.parse("rgb555");
+
+  srcpf.parse("rgb888");
+  doTests(dstpf, srcpf);
+
+  srcpf.parse("bgr888");
+  doTests(dstpf, srcpf);
+
   /* rgb565 targets */
 
   dstpf.parse("rgb565");
@@ -351,6 +440,13 @@ int main(int argc, char **argv)
 
   doTests(srcpf, dstpf);
 
+  dstpf = rfb::PixelFormat(32, 24, false, true, 255, 255, 255, 0, 8, 16);
+  srcpf = rfb::PixelFormat(16, 16, true, true, 31, 63, 31, 0, 5, 11);
+
+  doTests(dstpf, srcpf);
+
+  doTests(srcpf, dstpf);
+
   // Pesky case that is very asymetrical
   dstpf = rfb::PixelFormat(32, 24, false, true, 255, 255, 255, 0, 8, 16);
   srcpf = rfb::PixelFormat(32, 24, true, true, 255, 255, 255, 0, 24, 8);
@@ -359,3 +455,183 @@ int main(int argc, char **argv)
 
   doTests(srcpf, dstpf);
 }
+
+// A cursor with an odd width, so that the vector code in the 888
+// case always leaves some columns for the scalar code
+static const int cursorWidth = 37;
+static const int cursorHeight = 13;
+
+// Straightforward per pixel blending of the cursor at pos into fb
+static void blendReference(rfb::ManagedPixelBuffer *fb,
+                           const rdr::U8 *cursor, const rfb::Point &pos)
+{
+  const rfb::PixelFormat &pf = fb->getPF();
+  rdr::U8 *data;
+  int stride, bpp;
+  int x, y, i;
+
+  data = fb->getBufferRW(fb->getRect(), &stride);
+  bpp = pf.bpp / 8;
+
+  for (y = 0;y < cursorHeight;y++) {
+    for (x = 0;x < cursorWidth;x++) {
+      const rdr::U8 *fg;
+      rdr::U8 *pixel;
+      rdr::U8 rgb[3];
+
+      if (!fb->getRect().contains(rfb::Point(pos.x + x, pos.y + y)))
+        continue;
+
+      fg = cursor + (y * cursorWidth + x) * 4;
+      pixel = data + ((pos.y + y) * stride + pos.x + x) * bpp;
+
+      if (fg[3] == 0x00)
+        continue;
+
+      pf.rgbFromBuffer(rgb, pixel, 1);
+      for (i = 0;i < 3;i++)
+        rgb[i] = (unsigned)rgb[i]*(255-fg[3])/255 +
+                 (unsigned)fg[i]*fg[3]/255;
+      pf.bufferFromRGB(pixel, rgb, 1);
+    }
+  }
+
+  fb->commitBufferRW(fb->getRect());
+}
+
+static bool testBlendAt(const rfb::PixelFormat &pf,
+                        rfb::Cursor *cursor, const rfb::Point &pos,
+                        rfb::RenderedCursor *rendered)
+{
+  rfb::ManagedPixelBuffer fb(pf, fbWidth, fbHeight), ref(pf, fbWidth, fbHeight);
+  rdr::U8 *data;
+  const rdr::U8 *out, *expected;
+  int stride, outStride, refStride, bpp;
+  rfb::Rect rect;
+  int i, y;
+
+  data = fb.getBufferRW(fb.getRect(), &stride);
+  for (i = 0;i < stride * fbHeight * pf.bpp/8;i++)
+    data[i] = rand();
+  fb.commitBufferRW(fb.getRect());
+
+  ref.imageRect(ref.getRect(), fb.getBuffer(fb.getRect(), &stride), stride);
+  blendReference(&ref, cursor->getBuffer(), pos);
+
+  rendered->update(&fb, cursor, pos);
+
+  rect = rfb::Rect(0, 0, cursorWidth, cursorHeight).translate(pos)
+                                                   .intersect(fb.getRect());
+  if (!rendered->getEffectiveRect().equals(rect))
+    return false;
+
+  bpp = pf.bpp / 8;
+  out = rendered->getBuffer(rect, &outStride);
+  expected = ref.getBuffer(rect, &refStride);
+  for (y = 0;y < rect.height();y++) {
+    if (memcmp(out + y * outStride * bpp, expected + y * refStride * bpp,
+               rect.width() * bpp) != 0)
+      return false;
+  }
+
+  return true;
+}
+
+static bool testBlend(const rfb::PixelFormat &pf)
+{
+  rdr::U8 data[cursorWidth * cursorHeight * 4];
+  rfb::RenderedCursor rendered;
+  bool ok;
+  int i;
+
+  // Plenty of fully transparent and fully opaque pixels, as those
+  // are special cases
+  for (i = 0;i < cursorWidth * cursorHeight * 4;i++)
+    data[i] = rand();
+  for (i = 0;i < cursorWidth * cursorHeight;i++) {
+    switch (rand() % 3) {
+    case 0:
+      data[i * 4 + 3] = 0x00;
+      break;
+    case 1:
+      data[i * 4 + 3] = 0xff;
+      break;
+    }
+  }
+
+  rfb::Cursor cursor(cursorWidth, cursorHeight, rfb::Point(0, 0), data);
+
+  ok = true;
+
+  // Fully visible, and then clipped by every edge of the screen
+  if (!testBlendAt(pf, &cursor, rfb::Point(1, 1), &rendered))
+    ok = false;
+  if (!testBlendAt(pf, &cursor, rfb::Point(-5, -3), &rendered))
+    ok = false;
+  if (!testBlendAt(pf, &cursor, rfb::Point(fbWidth - 20, fbHeight - 6),
+                   &rendered))
+    ok = false;
+  if (!testBlendAt(pf, &cursor, rfb::Point(-cursorWidth + 2, 7), &rendered))
+    ok = false;
+
+  return ok;
+}
+
+static void doBlendTests(const rfb::PixelFormat &pf)
+{
+  char b[256];
+
+  pf.print(b, sizeof(b));
+
+  printf("\n");
+  printf("Cursor blending in %s\n", b);
+  printf("\n");
+
+  printf("    Same result as reference blending: ");
+  fflush(stdout);
+  if (testBlend(pf))
+    printf("OK");
+  else
+    printf("FAILED");
+  printf("\n");
+}
+
+static void doBlendFormats()
+{
+  int bigEndian;
+
+  for (bigEndian = 0;bigEndian < 2;bigEndian++) {
+    doBlendTests(rfb::PixelFormat(32, 24, bigEndian, true,
+                                  255, 255, 255, 16, 8, 0));
+    doBlendTests(rfb::PixelFormat(32, 24, bigEndian, true,
+                                  255, 255, 255, 0, 8, 16));
+    doBlendTests(rfb::PixelFormat(32, 24, bigEndian, true,
+                                  255, 255, 255, 24, 16, 8));
+    doBlendTests(rfb::PixelFormat(16, 16, bigEndian, true,
+                                  31, 63, 31, 11, 5, 0));
+    doBlendTests(rfb::PixelFormat(16, 15, bigEndian, true,
+                                  31, 31, 31, 10, 5, 0));
+    doBlendTests(rfb::PixelFormat(8, 7, bigEndian, true,
+                                  3, 7, 3, 5, 2, 0));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int level;
+
+  printf("Pixel Conversion Correctness Test\n");
+
+  // Every conversion kernel this CPU can run, starting with the
+  // plain scalar code
+  for (level = rfb::simdNone;level <= rfb::getCPUSIMDLevel();level++) {
+    rfb::setSIMDLevel((rfb::SIMDLevel)level);
+
+    printf("\n");
+    printf("Using %s conversion\n",
+           rfb::simdLevelName((rfb::SIMDLevel)level));
+
+    doFormats();
+    doBlendFormats();
+  }
+}
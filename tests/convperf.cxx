@@ -22,6 +22,7 @@
 #include <time.h>
 
 #include <rfb/PixelFormat.h>
+#include <rfb/PixelFormatSIMD.h>
 
 #include "util.h"
 
@@ -35,6 +36,8 @@ typedef void (*testfn) (rfb::PixelFormat&, rfb::PixelFormat&, rdr::U8*, rdr::U8*
 struct TestEntry {
   const char *label;
   testfn fn;
+  // Run once for every conversion kernel the CPU supports
+  bool perLevel;
 };
 
 static void testMemcpy(rfb::PixelFormat &dstpf, rfb::PixelFormat &srcpf,
@@ -92,15 +95,16 @@ static void doTest(testfn fn, rfb::PixelFormat &dstpf, rfb::PixelFormat &srcpf)
 }
 
 struct TestEntry tests[] = {
-  {"memcpy", testMemcpy},
-  {"bufferFromBuffer", testBuffer},
-  {"rgbFromBuffer", testToRGB},
-  {"bufferFromRGB", testFromRGB},
+  {"memcpy", testMemcpy, false},
+  {"bufferFromBuffer", testBuffer, true},
+  {"rgbFromBuffer", testToRGB, true},
+  {"bufferFromRGB", testFromRGB, true},
 };
 
 static void doTests(rfb::PixelFormat &dstpf, rfb::PixelFormat &srcpf)
 {
   size_t i;
+  int level;
   char dstb[256], srcb[256];
 
   dstpf.print(dstb, sizeof(dstb));
@@ -109,10 +113,21 @@ static void doTests(rfb::PixelFormat &dstpf, rfb::PixelFormat &srcpf)
   printf("%s,%s", srcb, dstb);
 
   for (i = 0;i < sizeof(tests)/sizeof(tests[0]);i++) {
-    printf(",");
-    doTest(tests[i].fn, dstpf, srcpf);
+    if (!tests[i].perLevel) {
+      printf(",");
+      doTest(tests[i].fn, dstpf, srcpf);
+      continue;
+    }
+
+    for (level = rfb::simdNone;level <= rfb::getCPUSIMDLevel();level++) {
+      rfb::setSIMDLevel((rfb::SIMDLevel)level);
+      printf(",");
+      doTest(tests[i].fn, dstpf, srcpf);
+    }
   }
 
+  rfb::setSIMDLevel(rfb::getCPUSIMDLevel());
+
   printf("\n");
 }
 
@@ -124,6 +139,7 @@ int main(int argc, char **argv)
   char datebuffer[256];
 
   size_t i;
+  int level;
 
   bufsize = fbsize * fbsize * 4;
 
@@ -147,8 +163,17 @@ int main(int argc, char **argv)
   printf("#\n");
 
   printf("Source format,Destination Format");
-  for (i = 0;i < sizeof(tests)/sizeof(tests[0]);i++)
-    printf(",%s", tests[i].label);
+  for (i = 0;i < sizeof(tests)/sizeof(tests[0]);i++) {
+    if (!tests[i].perLevel) {
+      printf(",%s", tests[i].label);
+      continue;
+    }
+
+    for (level = rfb::simdNone;level <= rfb::getCPUSIMDLevel();level++) {
+      printf(",%s (%s)", tests[i].label,
+             rfb::simdLevelName((rfb::SIMDLevel)level));
+    }
+  }
   printf("\n");
 
   rfb::PixelFormat dstpf, srcpf;
@@ -168,6 +193,9 @@ int main(int argc, char **argv)
   srcpf.parse("rgb565");
   doTests(dstpf, srcpf);
 
+  srcpf.parse("bgr555");
+  doTests(dstpf, srcpf);
+
   srcpf.parse("rgb232");
   doTests(dstpf, srcpf);
 
@@ -180,6 +208,9 @@ int main(int argc, char **argv)
   srcpf.parse("rgb888");
   doTests(dstpf, srcpf);
 
+  srcpf.parse("bgr888");
+  doTests(dstpf, srcpf);
+
   srcpf.parse("bgr565");
   doTests(dstpf, srcpf);
 
@@ -31,9 +31,11 @@
 
 #include <rdr/Exception.h>
 #include <rdr/FileInStream.h>
+#include <rdr/MemOutStream.h>
 
 #include <rfb/CConnection.h>
 #include <rfb/CMsgReader.h>
+#include <rfb/CMsgWriter.h>
 #include <rfb/PixelBuffer.h>
 #include <rfb/PixelFormat.h>
 
@@ -61,6 +63,7 @@ public:
 
 protected:
   rdr::FileInStream *in;
+  rdr::MemOutStream *out;
 };
 
 CConn::CConn(const char *filename)
@@ -68,17 +71,20 @@ CConn::CConn(const char *filename)
   cpuTime = 0.0;
 
   in = new rdr::FileInStream(filename);
-  setStreams(in, NULL);
+  out = new rdr::MemOutStream;
+  setStreams(in, out);
 
   // Need to skip the initial handshake
   setState(RFBSTATE_INITIALISATION);
   // That also means that the reader and writer weren't setup
   setReader(new rfb::CMsgReader(this, in));
+  setWriter(new rfb::CMsgWriter(&server, out));
 }
 
 CConn::~CConn()
 {
   delete in;
+  delete out;
 }
 
 void CConn::initDone()
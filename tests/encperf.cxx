@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <sys/time.h>
 
@@ -39,7 +40,9 @@
 
 #include <rfb/CConnection.h>
 #include <rfb/CMsgReader.h>
+#include <rfb/CMsgWriter.h>
 #include <rfb/UpdateTracker.h>
+#include <rfb/encodings.h>
 
 #include <rfb/EncodeManager.h>
 #include <rfb/SConnection.h>
@@ -53,6 +56,10 @@ static rfb::IntParameter count("count", "Number of benchmark iterations", 9);
 
 static rfb::StringParameter format("format", "Pixel format (e.g. bgr888)", "");
 
+static rfb::StringParameter encoding("encoding",
+                                     "Preferred encoding (e.g. Tight, ZRLE or Zstd)",
+                                     "Tight");
+
 static rfb::BoolParameter translate("translate",
                                     "Translate 8-bit and 16-bit datasets into 24-bit",
                                     true);
@@ -60,9 +67,9 @@ static rfb::BoolParameter translate("translate",
 // The frame buffer (and output) is always this format
 static const rfb::PixelFormat fbPF(32, 24, false, true, 255, 255, 255, 0, 8, 16);
 
-// Encodings to use
+// Encodings to use, after the preferred one
 static const rdr::S32 encodings[] = {
-  rfb::encodingTight, rfb::encodingCopyRect, rfb::encodingRRE,
+  rfb::encodingCopyRect, rfb::encodingRRE,
   rfb::encodingHextile, rfb::encodingZRLE, rfb::pseudoEncodingLastRect,
   rfb::pseudoEncodingQualityLevel0 + 8,
   rfb::pseudoEncodingCompressLevel0 + 2};
@@ -104,6 +111,7 @@ public:
 
 protected:
   rdr::FileInStream *in;
+  DummyOutStream *out;
   rfb::SimpleUpdateTracker updates;
   class SConn *sc;
 };
@@ -167,27 +175,38 @@ CConn::CConn(const char *filename)
   encodeTime = 0.0;
 
   in = new rdr::FileInStream(filename);
-  setStreams(in, NULL);
+  out = new DummyOutStream;
+  setStreams(in, out);
 
   // Need to skip the initial handshake and ServerInit
   setState(RFBSTATE_NORMAL);
   // That also means that the reader and writer weren't setup
   setReader(new rfb::CMsgReader(this, in));
+  setWriter(new rfb::CMsgWriter(&server, out));
   // Nor the frame buffer size and format
   rfb::PixelFormat pf;
   pf.parse(format);
   setPixelFormat(pf);
-  setDesktopSize(width, height);
+  server.setDimensions(width, height);
+  // And we never get a ServerInit to trigger creating the frame buffer
+  initDone();
 
   sc = new SConn();
   sc->client.setPF((bool)translate ? fbPF : pf);
-  sc->setEncodings(sizeof(encodings) / sizeof(*encodings), encodings);
+  rdr::S32 clientEncodings[sizeof(encodings) / sizeof(*encodings) + 1];
+  clientEncodings[0] = rfb::encodingNum(encoding);
+  if (clientEncodings[0] == -1)
+    throw rdr::Exception("Unknown encoding %s", (const char*)encoding);
+  memcpy(clientEncodings + 1, encodings, sizeof(encodings));
+  sc->setEncodings(sizeof(clientEncodings) / sizeof(*clientEncodings),
+                   clientEncodings);
 }
 
 CConn::~CConn()
 {
   delete sc;
   delete in;
+  delete out;
 }
 
 void CConn::getStats(double& ratio, unsigned long long& bytes,
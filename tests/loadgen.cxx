@@ -0,0 +1,790 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * This program connects a number of headless viewers to a running
+ * VNC server and lets them receive updates for a while. The data is
+ * decoded like a real viewer would, but never shown. The link to
+ * every viewer can be slowed down to a given bandwidth and latency.
+ * At the end, frame rate, update latency and amount of data are
+ * reported per viewer, together with the CPU usage of the server if
+ * its process id is given.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <list>
+#include <vector>
+
+#include <rdr/Exception.h>
+#include <rdr/InStream.h>
+
+#include <network/TcpSocket.h>
+
+#include <os/Mutex.h>
+#include <os/Thread.h>
+
+#include <rfb/CConnection.h>
+#include <rfb/CMsgWriter.h>
+#include <rfb/CSecurity.h>
+#include <rfb/Configuration.h>
+#include <rfb/Hostname.h>
+#include <rfb/Logger_stdio.h>
+#include <rfb/LogWriter.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/SecurityClient.h>
+#include <rfb/UserMsgBox.h>
+#include <rfb/UserPasswdGetter.h>
+#include <rfb/encodings.h>
+#include <rfb/util.h>
+#ifdef HAVE_GNUTLS
+#include <rfb/CSecurityTLS.h>
+#endif
+
+static rfb::IntParameter clients("clients", "Number of viewers to connect",
+                                 10);
+static rfb::IntParameter duration("duration",
+                                  "Number of seconds to run once all "
+                                  "viewers are connected", 30);
+static rfb::IntParameter connectInterval("connectinterval",
+                                         "Milliseconds between opening "
+                                         "connections", 10);
+
+static rfb::StringParameter encoding("encoding",
+                                     "Preferred encoding (e.g. Tight, ZRLE or Zstd)",
+                                     "Tight");
+static rfb::IntParameter compressLevel("compresslevel",
+                                       "Compression level requested from "
+                                       "the server", 2);
+static rfb::IntParameter qualityLevel("qualitylevel",
+                                      "JPEG quality level requested from "
+                                      "the server (-1 for lossless)", -1);
+static rfb::BoolParameter continuous("continuous",
+                                     "Use continuous updates when the "
+                                     "server supports them", true);
+
+static rfb::IntParameter bandwidth("bandwidth",
+                                   "Simulated bandwidth of the link to "
+                                   "every viewer in kbit/s (0 for "
+                                   "unlimited)", 0);
+static rfb::IntParameter latency("latency",
+                                 "Simulated round trip time of the link "
+                                 "to every viewer in milliseconds", 0);
+
+static rfb::StringParameter password("password",
+                                     "Password for VNC authentication", "");
+static rfb::IntParameter serverPid("serverpid",
+                                   "Process id of the server, to report "
+                                   "its CPU usage", 0);
+static rfb::BoolParameter perViewer("perviewer",
+                                    "Report statistics for every viewer",
+                                    true);
+
+// The frame buffer is always this format
+static const rfb::PixelFormat fbPF(32, 24, false, true, 255, 255, 255, 0, 8, 16);
+
+static unsigned long long usSince(const struct timeval *then)
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+
+  return (now.tv_sec - then->tv_sec) * 1000000ULL +
+         (now.tv_usec - then->tv_usec);
+}
+
+// LinkInStream reads from a socket, but only hands over the data once
+// it has been delayed by the simulated latency, and at no more than
+// the simulated bandwidth. It only reads from the socket as long as
+// the simulated link has room, so the server will see the same back
+// pressure it would from a real slow link.
+
+class LinkInStream : public rdr::InStream {
+public:
+  LinkInStream(int fd, unsigned bandwidth, unsigned latency);
+  virtual ~LinkInStream();
+
+  virtual int pos();
+
+  unsigned long long bytes;
+
+protected:
+  virtual int overrun(int itemSize, int nItems, bool wait);
+
+private:
+  bool receive();
+  size_t deliver(rdr::U8* buf, size_t len, int* timeout);
+
+private:
+  int fd;
+  unsigned bandwidth;
+  unsigned latency;
+
+  struct Chunk {
+    struct timeval arrival;
+    size_t length;
+    size_t offset;
+    rdr::U8* data;
+  };
+
+  std::list<Chunk> pending;
+  size_t pendingBytes;
+  size_t maxPending;
+
+  struct timeval lastRefill;
+  double tokens;
+
+  int offset;
+  rdr::U8* start;
+
+  static const int bufSize = 65536;
+};
+
+LinkInStream::LinkInStream(int fd_, unsigned bandwidth_, unsigned latency_)
+  : bytes(0), fd(fd_), bandwidth(bandwidth_), latency(latency_),
+    pendingBytes(0), tokens(0), offset(0)
+{
+  ptr = end = start = new rdr::U8[bufSize];
+
+  // Room for what is in flight on the simulated link, plus some
+  // slack for the socket buffers of a real one. Without a bandwidth
+  // limit the link can hold anything that arrives within the latency.
+  if (bandwidth > 0)
+    maxPending = (size_t)bandwidth / 8 * 1000 * latency / 1000 + 65536;
+  else
+    maxPending = (size_t)-1;
+
+  gettimeofday(&lastRefill, NULL);
+}
+
+LinkInStream::~LinkInStream()
+{
+  while (!pending.empty()) {
+    delete [] pending.front().data;
+    pending.pop_front();
+  }
+
+  delete [] start;
+}
+
+int LinkInStream::pos()
+{
+  return offset + ptr - start;
+}
+
+int LinkInStream::overrun(int itemSize, int nItems, bool wait)
+{
+  if (itemSize > bufSize)
+    throw rdr::Exception("LinkInStream overrun: max itemSize exceeded");
+
+  if (end - ptr != 0)
+    memmove(start, ptr, end - ptr);
+
+  offset += ptr - start;
+  end -= ptr - start;
+  ptr = start;
+
+  while (end < start + itemSize) {
+    size_t n;
+    int timeout;
+    struct pollfd pfd;
+
+    n = deliver((rdr::U8*)end, start + bufSize - end, &timeout);
+    if (n != 0) {
+      end += n;
+      continue;
+    }
+
+    pfd.fd = fd;
+    pfd.events = (pendingBytes < maxPending) ? POLLIN : 0;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, wait ? timeout : 0) < 0) {
+      if (errno == EINTR)
+        continue;
+      throw rdr::SystemException("poll", errno);
+    }
+
+    if (pfd.revents != 0) {
+      if (!receive())
+        throw rdr::EndOfStream();
+    } else if (!wait) {
+      return 0;
+    }
+  }
+
+  if (itemSize * nItems > end - ptr)
+    nItems = (end - ptr) / itemSize;
+
+  return nItems;
+}
+
+bool LinkInStream::receive()
+{
+  Chunk chunk;
+  rdr::U8 buf[65536];
+  ssize_t len;
+
+  len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+  if (len < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+      return true;
+    throw rdr::SystemException("recv", errno);
+  }
+
+  if (len == 0)
+    return false;
+
+  gettimeofday(&chunk.arrival, NULL);
+  chunk.length = len;
+  chunk.offset = 0;
+  chunk.data = new rdr::U8[len];
+  memcpy(chunk.data, buf, len);
+
+  pending.push_back(chunk);
+  pendingBytes += len;
+
+  return true;
+}
+
+size_t LinkInStream::deliver(rdr::U8* buf, size_t len, int* timeout)
+{
+  size_t total;
+
+  *timeout = -1;
+
+  if (bandwidth != 0) {
+    double rate;
+
+    // Bytes per microsecond, and never more than 10 ms worth of burst
+    rate = bandwidth / 8.0 * 1000.0 / 1000000.0;
+    tokens += usSince(&lastRefill) * rate;
+    if (tokens > rate * 10000)
+      tokens = rate * 10000;
+    gettimeofday(&lastRefill, NULL);
+
+    if (tokens < 1.0) {
+      *timeout = 1;
+      return 0;
+    }
+
+    if (len > (size_t)tokens)
+      len = (size_t)tokens;
+  }
+
+  total = 0;
+  while ((total < len) && !pending.empty()) {
+    Chunk* chunk;
+    unsigned long long age;
+    size_t n;
+
+    chunk = &pending.front();
+
+    age = usSince(&chunk->arrival);
+    if (age < latency * 1000ULL) {
+      *timeout = (latency * 1000ULL - age + 999) / 1000;
+      break;
+    }
+
+    n = __rfbmin(len - total, chunk->length - chunk->offset);
+    memcpy(buf + total, chunk->data + chunk->offset, n);
+
+    chunk->offset += n;
+    total += n;
+
+    if (chunk->offset == chunk->length) {
+      delete [] chunk->data;
+      pending.pop_front();
+    }
+  }
+
+  pendingBytes -= total;
+  bytes += total;
+  if (bandwidth != 0)
+    tokens -= total;
+
+  return total;
+}
+
+class Auth : public rfb::UserPasswdGetter, public rfb::UserMsgBox {
+public:
+  virtual void getUserPasswd(bool secure, char** user, char** passwd) {
+    if (user)
+      *user = rfb::strDup("");
+    *passwd = password.getData();
+  }
+
+  // Nobody is there to look at certificates
+  virtual bool showMsgBox(int flags, const char* title, const char* text) {
+    return true;
+  }
+};
+
+struct ViewerStats {
+  unsigned updates;
+  unsigned long long bytes;
+  unsigned long long latencyTotal;
+  unsigned long long latencyMax;
+  double time;
+};
+
+class Viewer : public rfb::CConnection {
+public:
+  Viewer(int id, const char* host, int port);
+  ~Viewer();
+
+  // Runs the connection until it is stopped or fails
+  void run();
+  void stop();
+
+  void getStats(ViewerStats* stats);
+  const char* getError() { return error.buf; }
+
+  virtual void initDone();
+  virtual void resizeFramebuffer();
+  virtual void endOfContinuousUpdates();
+  virtual void framebufferUpdateStart();
+  virtual void framebufferUpdateEnd();
+  virtual void setCursor(int, int, const rfb::Point&, const rdr::U8*);
+  virtual void setColourMapEntries(int, int, rdr::U16*);
+  virtual void bell();
+  virtual void serverCutText(const char*);
+
+protected:
+  int id;
+
+  network::Socket* sock;
+  LinkInStream* in;
+
+  os::Mutex mutex;
+  bool stopping;
+  rfb::CharArray error;
+
+  struct timeval started;
+  struct timeval stopped;
+  struct timeval lastRequest;
+  struct timeval updateStart;
+  struct timeval updateRequested;
+  bool running;
+  unsigned updates;
+  unsigned long long latencyTotal;
+  unsigned long long latencyMax;
+};
+
+Viewer::Viewer(int id_, const char* host, int port)
+  : id(id_), in(NULL), stopping(false), running(false),
+    updates(0), latencyTotal(0), latencyMax(0)
+{
+  rfb::CharArray endpoint;
+
+  sock = new network::TcpSocket(host, port);
+
+  in = new LinkInStream(sock->getFd(), bandwidth, latency);
+
+  endpoint.buf = sock->getPeerEndpoint();
+  setServerName(endpoint.buf);
+  setStreams(in, &sock->outStream());
+
+  // Several viewers on the same server must not kick each other out
+  setShared(true);
+
+  // Like a real viewer, so that cursor changes are sent as shapes
+  supportsLocalCursor = true;
+  supportsDesktopResize = true;
+
+  setPreferredEncoding(rfb::encodingNum(encoding));
+  setCompressLevel(::compressLevel);
+  setQualityLevel(::qualityLevel);
+
+  initialiseProtocol();
+}
+
+Viewer::~Viewer()
+{
+  delete in;
+  delete sock;
+}
+
+void Viewer::run()
+{
+  try {
+    while (true)
+      processMsg();
+  } catch (rdr::Exception& e) {
+    os::AutoMutex a(&mutex);
+    if (!stopping)
+      error.replaceBuf(rfb::strDup(e.str()));
+  }
+
+  os::AutoMutex a(&mutex);
+  if (running) {
+    running = false;
+    gettimeofday(&stopped, NULL);
+  }
+}
+
+void Viewer::stop()
+{
+  os::AutoMutex a(&mutex);
+
+  stopping = true;
+  sock->shutdown();
+}
+
+void Viewer::getStats(ViewerStats* stats)
+{
+  os::AutoMutex a(&mutex);
+
+  stats->updates = updates;
+  stats->bytes = in->bytes;
+  stats->latencyTotal = latencyTotal;
+  stats->latencyMax = latencyMax;
+  if (running)
+    stats->time = usSince(&started) / 1000000.0;
+  else
+    stats->time = (stopped.tv_sec - started.tv_sec) +
+                  (stopped.tv_usec - started.tv_usec) / 1000000.0;
+}
+
+void Viewer::initDone()
+{
+  setFramebuffer(new rfb::ManagedPixelBuffer(fbPF, server.width(),
+                                             server.height()));
+
+  os::AutoMutex a(&mutex);
+
+  running = true;
+  gettimeofday(&started, NULL);
+  lastRequest = started;
+}
+
+void Viewer::resizeFramebuffer()
+{
+  setFramebuffer(new rfb::ManagedPixelBuffer(fbPF, server.width(),
+                                             server.height()));
+}
+
+void Viewer::endOfContinuousUpdates()
+{
+  rfb::CConnection::endOfContinuousUpdates();
+
+  // Keep CConnection from enabling them
+  if (!continuous)
+    server.supportsContinuousUpdates = false;
+}
+
+void Viewer::framebufferUpdateStart()
+{
+  // This will also send the request for the next update, unless
+  // continuous updates are active
+  rfb::CConnection::framebufferUpdateStart();
+
+  gettimeofday(&updateStart, NULL);
+  updateRequested = lastRequest;
+  lastRequest = updateStart;
+}
+
+void Viewer::framebufferUpdateEnd()
+{
+  unsigned long long elapsed;
+
+  rfb::CConnection::framebufferUpdateEnd();
+
+  // With continuous updates there is no request to measure from, so
+  // we can only see how long it took to get the update across
+  if (continuous && server.supportsContinuousUpdates)
+    elapsed = usSince(&updateStart);
+  else
+    elapsed = usSince(&updateRequested);
+
+  os::AutoMutex a(&mutex);
+
+  updates++;
+  latencyTotal += elapsed;
+  if (elapsed > latencyMax)
+    latencyMax = elapsed;
+}
+
+void Viewer::setCursor(int, int, const rfb::Point&, const rdr::U8*)
+{
+}
+
+void Viewer::setColourMapEntries(int, int, rdr::U16*)
+{
+}
+
+void Viewer::bell()
+{
+}
+
+void Viewer::serverCutText(const char*)
+{
+}
+
+class ViewerThread : public os::Thread {
+public:
+  ViewerThread(Viewer* viewer_) : viewer(viewer_) { start(); }
+
+protected:
+  virtual void worker() { viewer->run(); }
+
+private:
+  Viewer* viewer;
+};
+
+// CPU time of another process, in seconds
+static double getProcessCpuTime(int pid)
+{
+  char path[64];
+  char buf[1024];
+  FILE* f;
+  size_t len;
+  const char* fields;
+  unsigned long utime, stime;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+  f = fopen(path, "r");
+  if (f == NULL)
+    return -1;
+
+  len = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[len] = '\0';
+
+  // The process name can contain anything, so skip past it
+  fields = strrchr(buf, ')');
+  if (fields == NULL)
+    return -1;
+
+  // utime and stime are the 12th and 13th fields after the name
+  if (sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+             "%lu %lu", &utime, &stime) != 2)
+    return -1;
+
+  return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static double getOwnCpuTime()
+{
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 +
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [options] <host>[:<display>]\n", argv0);
+  fprintf(stderr, "Options:\n");
+  rfb::Configuration::listParams(79, 14);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  int i;
+
+  const char *target;
+  char *host;
+  int port;
+
+  Auth auth;
+
+  std::vector<Viewer*> viewers;
+  std::vector<ViewerThread*> threads;
+  std::vector<ViewerStats> stats;
+
+  struct timeval start;
+  double serverCpu, ownCpu, elapsed;
+
+  unsigned updates, active;
+  unsigned long long bytes, latencyTotal, latencyMax;
+  double minRate;
+  char a[64];
+
+  rfb::initStdIOLoggers();
+  rfb::LogWriter::setLogParams("*:stderr:0");
+
+  // Something that doesn't need any interaction
+  rfb::SecurityClient::secTypes.setParam("None,VncAuth");
+
+  target = NULL;
+  for (i = 1; i < argc; i++) {
+    if (rfb::Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i + 1 < argc) {
+        if (rfb::Configuration::setParam(&argv[i][1], argv[i + 1])) {
+          i++;
+          continue;
+        }
+      }
+      usage(argv[0]);
+    }
+
+    if (target != NULL)
+      usage(argv[0]);
+
+    target = argv[i];
+  }
+
+  if (target == NULL) {
+    fprintf(stderr, "No server specified!\n\n");
+    usage(argv[0]);
+  }
+
+  if (rfb::encodingNum(encoding) == -1) {
+    fprintf(stderr, "Unknown encoding %s\n\n", (const char*)encoding);
+    usage(argv[0]);
+  }
+
+  try {
+    rfb::getHostAndPort(target, &host, &port);
+  } catch (rdr::Exception& e) {
+    fprintf(stderr, "%s\n", e.str());
+    exit(1);
+  }
+
+  rfb::CSecurity::upg = &auth;
+#ifdef HAVE_GNUTLS
+  rfb::CSecurityTLS::msg = &auth;
+#endif
+
+  for (i = 0; i < clients; i++) {
+    Viewer* viewer;
+
+    try {
+      viewer = new Viewer(i, host, port);
+    } catch (rdr::Exception& e) {
+      fprintf(stderr, "Viewer %d failed to connect: %s\n", i, e.str());
+      break;
+    }
+
+    viewers.push_back(viewer);
+    threads.push_back(new ViewerThread(viewer));
+
+    if (connectInterval > 0)
+      usleep(connectInterval * 1000);
+  }
+
+  rfb::strFree(host);
+
+  printf("Connected %d viewer(s), running for %d s\n",
+         (int)viewers.size(), (int)duration);
+
+  gettimeofday(&start, NULL);
+  serverCpu = serverPid != 0 ? getProcessCpuTime(serverPid) : -1;
+  ownCpu = getOwnCpuTime();
+
+  sleep(duration);
+
+  // Sample everything before we start tearing things down
+  stats.resize(viewers.size());
+  for (i = 0; i < (int)viewers.size(); i++)
+    viewers[i]->getStats(&stats[i]);
+
+  elapsed = usSince(&start) / 1000000.0;
+  if (serverCpu >= 0)
+    serverCpu = getProcessCpuTime(serverPid) - serverCpu;
+  ownCpu = getOwnCpuTime() - ownCpu;
+
+  for (i = 0; i < (int)viewers.size(); i++)
+    viewers[i]->stop();
+  for (i = 0; i < (int)threads.size(); i++) {
+    threads[i]->wait();
+    delete threads[i];
+  }
+
+  if (perViewer) {
+    printf("\n%6s %8s %8s %10s %10s %10s %12s\n", "Viewer", "Updates",
+           "fps", "Lat. avg", "Lat. max", "Data", "Rate");
+  }
+
+  updates = active = 0;
+  bytes = latencyTotal = latencyMax = 0;
+  minRate = -1;
+
+  for (i = 0; i < (int)viewers.size(); i++) {
+    const ViewerStats* s;
+    double rate;
+
+    s = &stats[i];
+
+    rate = s->time > 0 ? s->updates / s->time : 0;
+
+    if (perViewer) {
+      rfb::iecPrefix(s->bytes, "B", a, sizeof(a), 3);
+      printf("%6d %8u %8.1f %8.1fms %8.1fms %10s %8.0fkbit/s",
+             i, s->updates, rate,
+             s->updates ? s->latencyTotal / 1000.0 / s->updates : 0.0,
+             s->latencyMax / 1000.0, a,
+             s->time > 0 ? s->bytes * 8 / 1000.0 / s->time : 0.0);
+      if (viewers[i]->getError() != NULL)
+        printf("  (%s)", viewers[i]->getError());
+      printf("\n");
+    }
+
+    if (viewers[i]->getError() != NULL) {
+      if (!perViewer)
+        fprintf(stderr, "Viewer %d failed: %s\n", i, viewers[i]->getError());
+    } else {
+      active++;
+    }
+
+    updates += s->updates;
+    bytes += s->bytes;
+    latencyTotal += s->latencyTotal;
+    if (s->latencyMax > latencyMax)
+      latencyMax = s->latencyMax;
+    if ((minRate < 0) || (rate < minRate))
+      minRate = rate;
+  }
+
+  printf("\n");
+  printf("Viewers: %u running, %u failed\n", active,
+         (unsigned)viewers.size() - active);
+  printf("Updates: %u (%.1f fps per viewer, slowest %.1f fps)\n", updates,
+         viewers.empty() ? 0.0 : updates / elapsed / viewers.size(),
+         minRate < 0 ? 0.0 : minRate);
+  printf("Update latency: %.1f ms average, %.1f ms max\n",
+         updates ? latencyTotal / 1000.0 / updates : 0.0,
+         latencyMax / 1000.0);
+  rfb::iecPrefix(bytes, "B", a, sizeof(a), 3);
+  printf("Data: %s (%.0f kbit/s total)\n", a,
+         bytes * 8 / 1000.0 / elapsed);
+  if (serverCpu >= 0)
+    printf("Server CPU: %.1f %%\n", serverCpu * 100 / elapsed);
+  printf("Load generator CPU: %.1f %%\n", ownCpu * 100 / elapsed);
+
+  for (i = 0; i < (int)viewers.size(); i++)
+    delete viewers[i];
+
+  return 0;
+}
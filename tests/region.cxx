@@ -0,0 +1,399 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * This program checks the region code against a plain bitmap of the
+ * same area. Regions are made with anything from a single rectangle up
+ * to well past what is kept inline, so that every operation crosses
+ * between inline and heap storage in both directions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include <rfb/Region.h>
+
+static const int width = 64;
+static const int height = 64;
+
+// Region keeps this many rectangles inline
+static const int inlineRects = 8;
+static const int maxRects = inlineRects * 2;
+
+static const int randomRuns = 2000;
+
+typedef std::vector<bool> Bitmap;
+
+// Gives access to the rectangles exactly as they are stored
+class TestRegion : public rfb::Region {
+public:
+  TestRegion() {}
+  TestRegion(const rfb::Region& r) : rfb::Region(r) {}
+
+  void get_stored_rects(std::vector<rfb::Rect>* rects) const
+  {
+    long i;
+
+    rects->clear();
+    for (i = 0;i < xrgn->numRects;i++)
+      rects->push_back(rfb::Rect(xrgn->rects[i].x1, xrgn->rects[i].y1,
+                                 xrgn->rects[i].x2, xrgn->rects[i].y2));
+  }
+
+  bool is_inline() const { return xrgn->rects == rectStorage; }
+};
+
+static void addRect(rfb::Region* region, Bitmap* bitmap,
+                    const rfb::Rect& r)
+{
+  int x, y;
+
+  region->assign_union(rfb::Region(r));
+
+  for (y = r.tl.y;y < r.br.y;y++) {
+    for (x = r.tl.x;x < r.br.x;x++)
+      (*bitmap)[y * width + x] = true;
+  }
+}
+
+// Separate bars, so exactly n rectangles
+static void makeBars(int n, int offset, rfb::Region* region,
+                     Bitmap* bitmap)
+{
+  int i;
+
+  region->clear();
+  bitmap->assign(width * height, false);
+
+  for (i = 0;i < n;i++) {
+    int x;
+
+    x = (i * 13 + offset) % (width - 16);
+    addRect(region, bitmap,
+            rfb::Rect(x, i * 4 + offset % 2, x + 16, i * 4 + 3));
+  }
+}
+
+// Overlapping rectangles, so any number of rectangles
+static void makeRandom(int n, rfb::Region* region, Bitmap* bitmap)
+{
+  int i;
+
+  region->clear();
+  bitmap->assign(width * height, false);
+
+  for (i = 0;i < n;i++) {
+    int x1, y1, x2, y2;
+
+    x1 = rand() % width;
+    y1 = rand() % height;
+    x2 = x1 + 1 + rand() % (width - x1);
+    y2 = y1 + 1 + rand() % (height - y1);
+
+    addRect(region, bitmap, rfb::Rect(x1, y1, x2, y2));
+  }
+}
+
+// The way get_rects() ordered the stored rectangles before it was
+// built on const_iterator
+static void referenceOrder(const std::vector<rfb::Rect>& stored,
+                           std::vector<rfb::Rect>* rects,
+                           bool left2right, bool topdown)
+{
+  int nRects = stored.size();
+  int xInc = left2right ? 1 : -1;
+  int yInc = topdown ? 1 : -1;
+  int i = topdown ? 0 : nRects-1;
+
+  rects->clear();
+
+  while (nRects > 0) {
+    int firstInNextBand = i;
+    int nRectsInBand = 0;
+
+    while (nRects > 0 && stored[firstInNextBand].tl.y == stored[i].tl.y) {
+      firstInNextBand += yInc;
+      nRects--;
+      nRectsInBand++;
+    }
+
+    if (xInc != yInc)
+      i = firstInNextBand - yInc;
+
+    while (nRectsInBand > 0) {
+      rects->push_back(stored[i]);
+      i += xInc;
+      nRectsInBand--;
+    }
+
+    i = firstInNextBand;
+  }
+}
+
+static bool sameRects(const std::vector<rfb::Rect>& a,
+                      const std::vector<rfb::Rect>& b)
+{
+  size_t i;
+
+  if (a.size() != b.size())
+    return false;
+
+  for (i = 0;i < a.size();i++) {
+    if (!a[i].equals(b[i]))
+      return false;
+  }
+
+  return true;
+}
+
+static bool checkRegion(const rfb::Region& region, const Bitmap& bitmap)
+{
+  TestRegion tr(region);
+  std::vector<rfb::Rect> stored, rects, reference, walked;
+  rfb::Region::const_iterator iter;
+  Bitmap covered;
+  int left2right, topdown;
+  size_t i;
+  int x, y;
+
+  // The copy must hold the same rectangles in the same order
+  tr.get_stored_rects(&stored);
+  if ((int)stored.size() != region.numRects())
+    return false;
+  if (!tr.equals(region))
+    return false;
+
+  // Every pixel once, and nothing else
+  covered.assign(width * height, false);
+  for (i = 0;i < stored.size();i++) {
+    const rfb::Rect& r = stored[i];
+
+    if (r.is_empty())
+      return false;
+
+    for (y = r.tl.y;y < r.br.y;y++) {
+      for (x = r.tl.x;x < r.br.x;x++) {
+        if (covered[y * width + x])
+          return false;
+        covered[y * width + x] = true;
+      }
+    }
+  }
+  if (covered != bitmap)
+    return false;
+
+  for (left2right = 0;left2right < 2;left2right++) {
+    for (topdown = 0;topdown < 2;topdown++) {
+      referenceOrder(stored, &reference, left2right, topdown);
+
+      if (region.get_rects(&rects, left2right, topdown) == rects.empty())
+        return false;
+      if (!sameRects(rects, reference))
+        return false;
+
+      walked.clear();
+      for (iter = region.begin(left2right, topdown);
+           iter != region.end(); ++iter)
+        walked.push_back(*iter);
+      if (!sameRects(walked, reference))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+static bool checkOperations(const rfb::Region& a, const Bitmap& abits,
+                            const rfb::Region& b, const Bitmap& bbits)
+{
+  Bitmap unionBits, intersectBits, subtractBits;
+  rfb::Region r;
+  int i;
+
+  unionBits.resize(width * height);
+  intersectBits.resize(width * height);
+  subtractBits.resize(width * height);
+  for (i = 0;i < width * height;i++) {
+    unionBits[i] = abits[i] || bbits[i];
+    intersectBits[i] = abits[i] && bbits[i];
+    subtractBits[i] = abits[i] && !bbits[i];
+  }
+
+  if (!checkRegion(a.union_(b), unionBits))
+    return false;
+  if (!checkRegion(a.intersect(b), intersectBits))
+    return false;
+  if (!checkRegion(a.subtract(b), subtractBits))
+    return false;
+
+  // The in place versions, starting from whatever storage the last
+  // result left behind
+  r = a;
+  r.assign_union(b);
+  if (!checkRegion(r, unionBits))
+    return false;
+  r = a;
+  r.assign_intersect(b);
+  if (!checkRegion(r, intersectBits))
+    return false;
+  r = a;
+  r.assign_subtract(b);
+  if (!checkRegion(r, subtractBits))
+    return false;
+
+  return true;
+}
+
+static bool testOrdering()
+{
+  rfb::Region region;
+  Bitmap bitmap;
+  int n;
+
+  for (n = 0;n <= maxRects;n++) {
+    makeBars(n, n, &region, &bitmap);
+    if (region.numRects() != n)
+      return false;
+    if (!checkRegion(region, bitmap))
+      return false;
+  }
+
+  // Several rectangles per band
+  for (n = 0;n < randomRuns;n++) {
+    makeRandom(1 + rand() % maxRects, &region, &bitmap);
+    if (!checkRegion(region, bitmap))
+      return false;
+  }
+
+  return true;
+}
+
+static bool testOperations()
+{
+  rfb::Region a, b;
+  Bitmap abits, bbits;
+  int i, j;
+
+  for (i = 0;i <= maxRects;i++) {
+    for (j = 0;j <= maxRects;j++) {
+      makeBars(i, 0, &a, &abits);
+      makeBars(j, 5, &b, &bbits);
+      if (!checkOperations(a, abits, b, bbits))
+        return false;
+    }
+  }
+
+  for (i = 0;i < randomRuns;i++) {
+    makeRandom(1 + rand() % maxRects, &a, &abits);
+    makeRandom(1 + rand() % maxRects, &b, &bbits);
+    if (!checkOperations(a, abits, b, bbits))
+      return false;
+  }
+
+  return true;
+}
+
+static bool testCopy()
+{
+  rfb::Region small, big;
+  Bitmap smallBits, bigBits;
+
+  makeBars(inlineRects, 0, &small, &smallBits);
+  makeBars(maxRects, 3, &big, &bigBits);
+
+  // A copy must get its own storage, not point at the original's
+  {
+    TestRegion copy(small);
+
+    if (!copy.is_inline())
+      return false;
+
+    small.clear();
+    if (!checkRegion(copy, smallBits))
+      return false;
+
+    makeBars(inlineRects, 0, &small, &smallBits);
+  }
+
+  {
+    TestRegion copy(big);
+
+    if (copy.is_inline())
+      return false;
+    if (!checkRegion(copy, bigBits))
+      return false;
+  }
+
+  // Inline over heap, and heap over inline
+  {
+    rfb::Region r(big);
+
+    r = small;
+    if (!checkRegion(r, smallBits))
+      return false;
+    if (!checkRegion(small, smallBits))
+      return false;
+
+    r = big;
+    if (!checkRegion(r, bigBits))
+      return false;
+
+    r = small;
+    small.clear();
+    if (!checkRegion(r, smallBits))
+      return false;
+
+    makeBars(inlineRects, 0, &small, &smallBits);
+  }
+
+  // Returned by value
+  {
+    rfb::Region r;
+
+    r = small.union_(rfb::Region());
+    if (!checkRegion(r, smallBits))
+      return false;
+  }
+
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  printf("Region Correctness Test\n");
+  printf("\n");
+
+  srand(0);
+
+  printf("Ordering: ");
+  printf(testOrdering() ? "OK" : "FAILED");
+  printf("\n");
+
+  printf("Operations: ");
+  printf(testOperations() ? "OK" : "FAILED");
+  printf("\n");
+
+  printf("Copy and assignment: ");
+  printf(testCopy() ? "OK" : "FAILED");
+  printf("\n");
+
+  return 0;
+}
@@ -0,0 +1,384 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * This program replays damage traces through the region code the same
+ * way the server's update path does: changes and copies are fed to an
+ * update tracker, and every frame the update is fetched, clipped,
+ * walked rectangle by rectangle and subtracted from again.
+ *
+ * A trace can be given as a text file with one operation per line:
+ *
+ *   frame
+ *   damage <x> <y> <w> <h>
+ *   copy <x> <y> <w> <h> <dx> <dy>
+ *
+ * where the copy rectangle is the destination. Without a file a set of
+ * built in traces modelled on common desktop activity is used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include <rfb/Region.h>
+#include <rfb/UpdateTracker.h>
+
+#include "util.h"
+
+static const int fbwidth = 1920;
+static const int fbheight = 1080;
+
+static const int runs = 20;
+
+struct Op {
+  bool copy;
+  rfb::Rect rect;
+  rfb::Point delta;
+};
+
+typedef std::vector<Op> Frame;
+typedef std::vector<Frame> Trace;
+
+static void addDamage(Frame* frame, int x, int y, int w, int h)
+{
+  Op op;
+
+  op.copy = false;
+  op.rect.setXYWH(x, y, w, h);
+  frame->push_back(op);
+}
+
+static void addCopy(Frame* frame, int x, int y, int w, int h,
+                    int dx, int dy)
+{
+  Op op;
+
+  op.copy = true;
+  op.rect.setXYWH(x, y, w, h);
+  op.delta = rfb::Point(dx, dy);
+  frame->push_back(op);
+}
+
+// A terminal where a line of text is typed, one glyph per frame, with
+// a blinking cursor and the occasional line feed
+static void makeTyping(Trace* trace)
+{
+  int col, row;
+
+  col = row = 0;
+  for (int i = 0;i < 2000;i++) {
+    Frame frame;
+
+    addDamage(&frame, 40 + col * 8, 100 + row * 16, 8, 16);
+    addDamage(&frame, 40 + (col + 1) * 8, 100 + row * 16, 8, 16);
+    if (i % 30 == 0)
+      addDamage(&frame, 1800, 5, 100, 20);
+
+    col++;
+    if (col == 200) {
+      col = 0;
+      row = (row + 1) % 50;
+    }
+
+    trace->push_back(frame);
+  }
+}
+
+// A terminal scrolling a line at a time, with new text appearing at
+// the bottom and the scroll bar moving
+static void makeScrolling(Trace* trace)
+{
+  for (int i = 0;i < 2000;i++) {
+    Frame frame;
+
+    addCopy(&frame, 40, 100, 1600, 784, 0, -16);
+    for (int x = 0;x < 1600;x += 8 * (1 + rand() % 6))
+      addDamage(&frame, 40 + x, 884, 8 * (1 + rand() % 4), 16);
+    addDamage(&frame, 1650, 100 + (i % 784), 12, 40);
+
+    trace->push_back(frame);
+  }
+}
+
+// A video player pushing its frames in horizontal strips, plus some
+// playback controls
+static void makeVideo(Trace* trace)
+{
+  for (int i = 0;i < 1000;i++) {
+    Frame frame;
+
+    for (int y = 0;y < 540;y += 32)
+      addDamage(&frame, 320, 180 + y, 960, 32);
+    addDamage(&frame, 320 + (i % 960), 730, 4, 12);
+    if (i % 25 == 0)
+      addDamage(&frame, 1200, 730, 80, 12);
+
+    trace->push_back(frame);
+  }
+}
+
+// A window being dragged around, leaving exposed areas behind that the
+// windows underneath redraw piece by piece
+static void makeDrag(Trace* trace)
+{
+  int x, y, dx, dy;
+
+  x = 100;
+  y = 100;
+  dx = 7;
+  dy = 5;
+  for (int i = 0;i < 2000;i++) {
+    Frame frame;
+    int nx, ny;
+
+    nx = x + dx;
+    ny = y + dy;
+    if ((nx < 0) || (nx + 800 > fbwidth))
+      dx = -dx;
+    if ((ny < 0) || (ny + 600 > fbheight))
+      dy = -dy;
+    nx = x + dx;
+    ny = y + dy;
+
+    addCopy(&frame, nx, ny, 800, 600, nx - x, ny - y);
+
+    // Exposed strips, redrawn in chunks
+    if (dx > 0) {
+      for (int j = 0;j < 600;j += 64)
+        addDamage(&frame, x, y + j, dx, 64);
+    } else {
+      for (int j = 0;j < 600;j += 64)
+        addDamage(&frame, nx + 800, y + j, -dx, 64);
+    }
+    if (dy > 0) {
+      for (int j = 0;j < 800;j += 64)
+        addDamage(&frame, x + j, y, 64, dy);
+    } else {
+      for (int j = 0;j < 800;j += 64)
+        addDamage(&frame, x + j, ny + 600, 64, -dy);
+    }
+
+    x = nx;
+    y = ny;
+
+    trace->push_back(frame);
+  }
+}
+
+// A busy web page with many small independent changes
+static void makeScattered(Trace* trace)
+{
+  for (int i = 0;i < 1000;i++) {
+    Frame frame;
+
+    for (int j = 0;j < 60;j++) {
+      addDamage(&frame, rand() % (fbwidth - 64), rand() % (fbheight - 64),
+                4 + rand() % 60, 4 + rand() % 60);
+    }
+
+    trace->push_back(frame);
+  }
+}
+
+static bool readTrace(const char* filename, Trace* trace)
+{
+  FILE* f;
+  char line[256];
+  Frame frame;
+
+  f = fopen(filename, "r");
+  if (f == NULL) {
+    perror(filename);
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    int x, y, w, h, dx, dy;
+
+    if ((line[0] == '#') || (line[0] == '\n'))
+      continue;
+
+    if (strncmp(line, "frame", 5) == 0) {
+      trace->push_back(frame);
+      frame.clear();
+    } else if (sscanf(line, "damage %d %d %d %d", &x, &y, &w, &h) == 4) {
+      addDamage(&frame, x, y, w, h);
+    } else if (sscanf(line, "copy %d %d %d %d %d %d",
+                      &x, &y, &w, &h, &dx, &dy) == 6) {
+      addCopy(&frame, x, y, w, h, dx, dy);
+    } else {
+      fprintf(stderr, "%s: Invalid line: %s", filename, line);
+      fclose(f);
+      return false;
+    }
+  }
+
+  if (!frame.empty())
+    trace->push_back(frame);
+
+  fclose(f);
+
+  return true;
+}
+
+static unsigned long long replay(const Trace& trace, bool useIterator)
+{
+  rfb::SimpleUpdateTracker tracker;
+  rfb::Region clip(rfb::Rect(0, 0, fbwidth, fbheight));
+  rfb::Region cursor;
+  rfb::UpdateInfo ui;
+  std::vector<rfb::Rect> rects;
+  std::vector<rfb::Rect>::const_iterator ri;
+  rfb::Region::const_iterator i;
+  unsigned long long area;
+
+  area = 0;
+
+  for (Trace::const_iterator frame = trace.begin();
+       frame != trace.end(); ++frame) {
+    for (Frame::const_iterator op = frame->begin();
+         op != frame->end(); ++op) {
+      if (op->copy)
+        tracker.add_copied(op->rect, op->delta);
+      else
+        tracker.add_changed(op->rect);
+    }
+
+    tracker.getUpdateInfo(&ui, clip);
+
+    // The encoder walks both the copies and the changes
+    if (useIterator) {
+      for (i = ui.copied.begin();i != ui.copied.end();++i)
+        area += i->area();
+      for (i = ui.changed.begin();i != ui.changed.end();++i)
+        area += i->area();
+    } else {
+      ui.copied.get_rects(&rects);
+      for (ri = rects.begin();ri != rects.end();++ri)
+        area += ri->area();
+      ui.changed.get_rects(&rects);
+      for (ri = rects.begin();ri != rects.end();++ri)
+        area += ri->area();
+    }
+
+    // The cursor is drawn separately and removed from the update
+    cursor.reset(rfb::Rect(0, 0, 16, 16).translate(
+      rfb::Point((frame - trace.begin()) % fbwidth, fbheight / 2)));
+    ui.changed.assign_subtract(cursor);
+
+    tracker.subtract(ui.changed);
+    tracker.subtract(ui.copied);
+    tracker.clear();
+  }
+
+  return area;
+}
+
+static void doTest(const char* label, const Trace& trace)
+{
+  size_t ops;
+  double times[2];
+
+  ops = 0;
+  for (Trace::const_iterator frame = trace.begin();
+       frame != trace.end(); ++frame)
+    ops += frame->size();
+
+  for (int useIterator = 0;useIterator < 2;useIterator++) {
+    double best;
+
+    best = 0;
+    for (int run = 0;run < runs;run++) {
+      double time;
+
+      startCpuCounter();
+      replay(trace, useIterator);
+      endCpuCounter();
+
+      time = getCpuCounter();
+      if ((run == 0) || (time < best))
+        best = time;
+    }
+
+    times[useIterator] = best;
+  }
+
+  printf("%s,%d,%d,%g,%g\n", label, (int)trace.size(), (int)ops,
+         times[0] * 1000000.0 / trace.size(),
+         times[1] * 1000000.0 / trace.size());
+}
+
+int main(int argc, char **argv)
+{
+  time_t t;
+  char datebuffer[256];
+
+  Trace trace;
+
+  if (argc > 2) {
+    fprintf(stderr, "Syntax: %s [trace file]\n", argv[0]);
+    return 1;
+  }
+
+  time(&t);
+  strftime(datebuffer, sizeof(datebuffer), "%Y-%m-%d %H:%M UTC", gmtime(&t));
+
+  printf("# Region Performance Test %s\n", datebuffer);
+  printf("#\n");
+  printf("# Frame buffer: %dx%d pixels\n", fbwidth, fbheight);
+  printf("#\n");
+  printf("# Note: Results are microseconds/frame, best of %d runs\n", runs);
+  printf("#\n");
+
+  printf("Trace,Frames,Operations,get_rects,iterator\n");
+
+  if (argc == 2) {
+    if (!readTrace(argv[1], &trace))
+      return 1;
+    doTest(argv[1], trace);
+    return 0;
+  }
+
+  srand(0);
+
+  makeTyping(&trace);
+  doTest("typing", trace);
+  trace.clear();
+
+  makeScrolling(&trace);
+  doTest("scrolling", trace);
+  trace.clear();
+
+  makeVideo(&trace);
+  doTest("video", trace);
+  trace.clear();
+
+  makeDrag(&trace);
+  doTest("drag", trace);
+  trace.clear();
+
+  makeScattered(&trace);
+  doTest("scattered", trace);
+  trace.clear();
+
+  return 0;
+}
@@ -0,0 +1,235 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * This program pushes data through TLSOutStream over a local TCP
+ * connection, with every combination of zero-copy sends and kernel
+ * TLS, and checks that it all arrives intact at the other end.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <gnutls/gnutls.h>
+
+#include <os/Thread.h>
+
+#include <rdr/Exception.h>
+#include <rdr/FdInStream.h>
+#include <rdr/FdOutStream.h>
+#include <rdr/TLSInStream.h>
+#include <rdr/TLSOutStream.h>
+
+#include <rfb/LogWriter.h>
+#include <rfb/Logger_stdio.h>
+
+// Kernel TLS only handles TLS 1.2 for anonymous sessions
+static const char* priority = "NORMAL:-VERS-TLS1.3:+ANON-ECDH";
+
+// Enough to go well past any socket buffer, and with large enough
+// flushes that zero-copy sends are used
+static const int dataSize = 16 * 1024 * 1024;
+static const int flushSize = 256 * 1024;
+
+static rdr::U8 pattern(int offset)
+{
+  return (offset * 7) ^ (offset >> 11);
+}
+
+class Receiver : public os::Thread {
+public:
+  Receiver(int fd) : fd(fd), ok(false) { start(); }
+
+  bool result() { wait(); return ok; }
+
+protected:
+  virtual void worker();
+
+private:
+  int fd;
+  bool ok;
+};
+
+void Receiver::worker()
+{
+  gnutls_session_t session;
+  gnutls_anon_client_credentials_t cred;
+  int ret, offset;
+
+  gnutls_init(&session, GNUTLS_CLIENT);
+  gnutls_anon_allocate_client_credentials(&cred);
+  gnutls_priority_set_direct(session, priority, NULL);
+  gnutls_credentials_set(session, GNUTLS_CRD_ANON, cred);
+
+  try {
+    rdr::FdInStream fis(fd);
+    rdr::FdOutStream fos(fd);
+    rdr::TLSInStream is(&fis, session);
+    rdr::TLSOutStream os(&fos, session);
+
+    do {
+      ret = gnutls_handshake(session);
+    } while ((ret != GNUTLS_E_SUCCESS) && !gnutls_error_is_fatal(ret));
+
+    if (ret == GNUTLS_E_SUCCESS) {
+      ok = true;
+      for (offset = 0;offset < dataSize;offset++) {
+        if (is.readU8() != pattern(offset)) {
+          ok = false;
+          break;
+        }
+      }
+    }
+  } catch (rdr::Exception& e) {
+    fprintf(stderr, "Receiver: %s\n", e.str());
+    ok = false;
+  }
+
+  gnutls_deinit(session);
+  gnutls_anon_free_client_credentials(cred);
+}
+
+static bool testTransfer(bool zeroCopy, bool kernelTLS, bool* offloaded)
+{
+  int listener, sender, receiver;
+  struct sockaddr_in addr;
+  socklen_t addrlen;
+  Receiver* thread;
+
+  gnutls_session_t session;
+  gnutls_anon_server_credentials_t cred;
+  int ret, offset;
+  bool ok;
+
+  *offloaded = false;
+
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0) ||
+      (listen(listener, 1) < 0)) {
+    perror("listen");
+    close(listener);
+    return false;
+  }
+  addrlen = sizeof(addr);
+  getsockname(listener, (struct sockaddr*)&addr, &addrlen);
+
+  receiver = socket(AF_INET, SOCK_STREAM, 0);
+  if (connect(receiver, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("connect");
+    close(receiver);
+    close(listener);
+    return false;
+  }
+  sender = accept(listener, NULL, NULL);
+  close(listener);
+
+  thread = new Receiver(receiver);
+
+  gnutls_init(&session, GNUTLS_SERVER);
+  gnutls_anon_allocate_server_credentials(&cred);
+  gnutls_priority_set_direct(session, priority, NULL);
+  gnutls_credentials_set(session, GNUTLS_CRD_ANON, cred);
+
+  ok = true;
+
+  try {
+    rdr::FdInStream fis(sender);
+    rdr::FdOutStream fos(sender);
+    rdr::TLSInStream is(&fis, session);
+    rdr::TLSOutStream os(&fos, session);
+
+    // Like VNCSConnectionST, before there is any talk of TLS
+    if (zeroCopy && !fos.setZeroCopy(true))
+      printf("(zero-copy not supported) ");
+
+    do {
+      ret = gnutls_handshake(session);
+    } while ((ret != GNUTLS_E_SUCCESS) && !gnutls_error_is_fatal(ret));
+
+    if (ret != GNUTLS_E_SUCCESS)
+      throw rdr::Exception("Handshake failed: %s", gnutls_strerror(ret));
+
+    if (kernelTLS)
+      *offloaded = os.offload();
+
+    for (offset = 0;offset < dataSize;offset++) {
+      os.writeU8(pattern(offset));
+      if ((offset % flushSize) == flushSize - 1)
+        os.flush();
+    }
+    os.flush();
+  } catch (rdr::Exception& e) {
+    fprintf(stderr, "Sender: %s\n", e.str());
+    ok = false;
+    shutdown(sender, SHUT_RDWR);
+  }
+
+  if (!thread->result())
+    ok = false;
+  delete thread;
+
+  gnutls_deinit(session);
+  gnutls_anon_free_server_credentials(cred);
+
+  close(sender);
+  close(receiver);
+
+  return ok;
+}
+
+int main(int argc, char** argv)
+{
+  int zeroCopy, kernelTLS;
+
+  printf("TLS Stream Correctness Test\n");
+  printf("\n");
+
+  rfb::initStdIOLoggers();
+  rfb::LogWriter::setLogParams("*:stderr:0");
+
+  gnutls_global_init();
+
+  for (zeroCopy = 0;zeroCopy < 2;zeroCopy++) {
+    for (kernelTLS = 0;kernelTLS < 2;kernelTLS++) {
+      bool offloaded;
+
+      printf("Zero-copy %s, kernel TLS %s: ",
+             zeroCopy ? "on" : "off", kernelTLS ? "on" : "off");
+      fflush(stdout);
+
+      if (testTransfer(zeroCopy, kernelTLS, &offloaded))
+        printf("OK");
+      else
+        printf("FAILED");
+      if (kernelTLS && !offloaded)
+        printf(" (kernel TLS not available)");
+      printf("\n");
+    }
+  }
+
+  gnutls_global_deinit();
+
+  return 0;
+}
@@ -0,0 +1,261 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// DamageTracker.cxx
+//
+
+#ifdef HAVE_XDAMAGE
+
+#include <algorithm>
+
+#include <rfb/Configuration.h>
+#include <rfb/LogWriter.h>
+#include <rfb/Region.h>
+#include <rfb/VNCServer.h>
+#include <rfb/util.h>
+#include <x0vncserver/DamageTracker.h>
+
+using namespace rfb;
+
+static LogWriter vlog("DamageTracker");
+
+IntParameter damageStormRate("DamageStormRate",
+                             "Number of damage events per second above "
+                             "which only the bounding box of changes is "
+                             "reported", 2000);
+IntParameter damageStormArea("DamageStormArea",
+                             "Percentage of the screen that must keep "
+                             "changing before damage reporting is "
+                             "replaced by polling", 50);
+IntParameter damageStormHoldTime("DamageStormHoldTime",
+                                 "Minimum number of milliseconds to stay "
+                                 "in a fallback damage mode", 2000);
+
+// Granularity of the dirty tile grid
+static const int TILE_SIZE = 16;
+
+// Length of the window over which event rates are measured
+static const unsigned WINDOW_MS = 500;
+
+DamageTracker::DamageTracker(Display *dpy, const Rect &rect)
+  : m_dpy(dpy), m_mode(ReportRaw), m_refreshAll(false),
+    m_events(0), m_frames(0), m_activeFrames(0), m_damagedArea(0)
+{
+  m_damage = XDamageCreate(m_dpy, DefaultRootWindow(m_dpy),
+                           XDamageReportRawRectangles);
+
+  setGeometry(rect);
+
+  gettimeofday(&m_windowStart, NULL);
+  m_modeChanged = m_windowStart;
+}
+
+DamageTracker::~DamageTracker()
+{
+  XDamageDestroy(m_dpy, m_damage);
+}
+
+void DamageTracker::setGeometry(const Rect &rect)
+{
+  m_rect = rect;
+
+  m_tilesX = (rect.width() + TILE_SIZE - 1) / TILE_SIZE;
+  m_tilesY = (rect.height() + TILE_SIZE - 1) / TILE_SIZE;
+  m_tiles.assign(m_tilesX * m_tilesY, false);
+  m_dirtyTop = m_tilesY;
+  m_dirtyBottom = -1;
+
+  m_frameBounds.clear();
+}
+
+void DamageTracker::handleEvent(const XDamageNotifyEvent *ev)
+{
+  Rect rect;
+
+  m_events++;
+
+  rect.setXYWH(ev->area.x, ev->area.y, ev->area.width, ev->area.height);
+  rect = rect.translate(m_rect.tl.negate());
+  rect = rect.intersect(Rect(0, 0, m_rect.width(), m_rect.height()));
+  if (rect.is_empty())
+    return;
+
+  m_frameBounds = m_frameBounds.union_boundary(rect);
+
+  // The poller will find the changes for us
+  if (m_mode == Polling)
+    return;
+
+  markTiles(rect);
+}
+
+void DamageTracker::flush(VNCServer *server)
+{
+  std::vector<Rect> rects;
+  Region changed;
+
+  // Bounding box notifications only come again once the damage has
+  // been cleared
+  if (m_mode != ReportRaw)
+    XDamageSubtract(m_dpy, m_damage, None, None);
+
+  m_frames++;
+  if (!m_frameBounds.is_empty()) {
+    m_activeFrames++;
+    m_damagedArea += m_frameBounds.area();
+    m_frameBounds.clear();
+  }
+
+  if (m_refreshAll) {
+    changed.reset(Rect(0, 0, m_rect.width(), m_rect.height()));
+    m_refreshAll = false;
+  } else {
+    for (int ty = m_dirtyTop; ty <= m_dirtyBottom; ty++) {
+      std::vector<bool>::iterator row;
+      int tx;
+
+      row = m_tiles.begin() + ty * m_tilesX;
+
+      tx = 0;
+      while (tx < m_tilesX) {
+        int start;
+
+        if (!row[tx]) {
+          tx++;
+          continue;
+        }
+
+        start = tx;
+        while ((tx < m_tilesX) && row[tx])
+          tx++;
+
+        rects.push_back(Rect(start * TILE_SIZE, ty * TILE_SIZE,
+                             __rfbmin(tx * TILE_SIZE, m_rect.width()),
+                             __rfbmin((ty + 1) * TILE_SIZE,
+                                      m_rect.height())));
+      }
+    }
+
+    changed.setOrderedRects(rects);
+  }
+
+  if (m_dirtyTop <= m_dirtyBottom) {
+    std::fill(m_tiles.begin() + m_dirtyTop * m_tilesX,
+              m_tiles.begin() + (m_dirtyBottom + 1) * m_tilesX, false);
+    m_dirtyTop = m_tilesY;
+    m_dirtyBottom = -1;
+  }
+
+  if (!changed.is_empty())
+    server->add_changed(changed);
+
+  adapt();
+}
+
+void DamageTracker::setMode(Mode mode)
+{
+  static const char* names[] = { "raw", "bounding box", "polling" };
+
+  vlog.info("Switching damage reporting from %s to %s mode",
+            names[m_mode], names[mode]);
+
+  if ((m_mode == ReportRaw) != (mode == ReportRaw)) {
+    XDamageDestroy(m_dpy, m_damage);
+    m_damage = XDamageCreate(m_dpy, DefaultRootWindow(m_dpy),
+                             (mode == ReportRaw) ?
+                             XDamageReportRawRectangles :
+                             XDamageReportBoundingBox);
+  }
+
+  // Changes may get lost in the switch, so resend everything
+  if (mode != Polling)
+    m_refreshAll = true;
+
+  m_mode = mode;
+  gettimeofday(&m_modeChanged, NULL);
+}
+
+void DamageTracker::adapt()
+{
+  unsigned elapsed, rate, coverage;
+  unsigned long long screenArea;
+  bool holdExpired;
+
+  elapsed = msSince(&m_windowStart);
+  if (elapsed < WINDOW_MS)
+    return;
+
+  rate = (unsigned long long)m_events * 1000 / elapsed;
+
+  screenArea = (unsigned long long)m_rect.area() * m_frames;
+  coverage = screenArea ? m_damagedArea * 100 / screenArea : 0;
+
+  holdExpired = msSince(&m_modeChanged) >= (unsigned)damageStormHoldTime;
+
+  switch (m_mode) {
+  case ReportRaw:
+    if (rate > (unsigned)damageStormRate) {
+      vlog.debug("Damage event storm: %u events/s", rate);
+      setMode(ReportBoundingBox);
+    }
+    break;
+  case ReportBoundingBox:
+    if (coverage >= (unsigned)damageStormArea) {
+      vlog.debug("Damage covers %u%% of the screen", coverage);
+      setMode(Polling);
+    } else if (holdExpired && (m_activeFrames * 2 < m_frames)) {
+      setMode(ReportRaw);
+    }
+    break;
+  case Polling:
+    if (holdExpired && (coverage < (unsigned)damageStormArea))
+      setMode(ReportBoundingBox);
+    break;
+  }
+
+  gettimeofday(&m_windowStart, NULL);
+  m_events = 0;
+  m_frames = 0;
+  m_activeFrames = 0;
+  m_damagedArea = 0;
+}
+
+void DamageTracker::markTiles(const Rect &rect)
+{
+  int x1, y1, x2, y2;
+
+  x1 = rect.tl.x / TILE_SIZE;
+  y1 = rect.tl.y / TILE_SIZE;
+  x2 = (rect.br.x - 1) / TILE_SIZE;
+  y2 = (rect.br.y - 1) / TILE_SIZE;
+
+  for (int ty = y1; ty <= y2; ty++) {
+    std::vector<bool>::iterator row;
+
+    row = m_tiles.begin() + ty * m_tilesX;
+    std::fill(row + x1, row + x2 + 1, true);
+  }
+
+  if (y1 < m_dirtyTop)
+    m_dirtyTop = y1;
+  if (y2 > m_dirtyBottom)
+    m_dirtyBottom = y2;
+}
+
+#endif // HAVE_XDAMAGE
@@ -0,0 +1,103 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// DamageTracker collects XDamage events into a tile grid and hands the
+// result to the VNC server once per polling cycle, instead of passing
+// on every single rectangle as it arrives. When the event rate gets too
+// high (e.g. video playback), it switches the damage object over to
+// bounding box reporting, and if most of the screen keeps changing it
+// gives up on damage entirely and asks for the screen to be polled.
+// Raw reporting is restored once things calm down again.
+//
+
+#ifndef __DAMAGETRACKER_H__
+#define __DAMAGETRACKER_H__
+
+#ifdef HAVE_XDAMAGE
+
+#include <sys/time.h>
+
+#include <vector>
+
+#include <X11/Xlib.h>
+#include <X11/extensions/Xdamage.h>
+
+#include <rfb/Rect.h>
+
+namespace rfb { class VNCServer; }
+
+class DamageTracker {
+
+public:
+
+  enum Mode { ReportRaw, ReportBoundingBox, Polling };
+
+  // The rect is the part of the root window that is exported, in root
+  // window coordinates.
+  DamageTracker(Display *dpy, const rfb::Rect &rect);
+  virtual ~DamageTracker();
+
+  // Update the exported area after the root window has changed.
+  void setGeometry(const rfb::Rect &rect);
+
+  void handleEvent(const XDamageNotifyEvent *ev);
+
+  // Send the accumulated changes to the server and adapt the reporting
+  // mode to the recent event rate.
+  void flush(rfb::VNCServer *server);
+
+  // Whether the caller should poll the screen instead.
+  bool isPolling() const { return m_mode == Polling; }
+
+protected:
+
+  void setMode(Mode mode);
+  void adapt();
+
+  void markTiles(const rfb::Rect &rect);
+
+  Display *m_dpy;
+  Damage m_damage;
+  Mode m_mode;
+
+  rfb::Rect m_rect;
+
+  // Dirty tile grid, and the range of tile rows that may be dirty.
+  int m_tilesX;
+  int m_tilesY;
+  std::vector<bool> m_tiles;
+  int m_dirtyTop;
+  int m_dirtyBottom;
+
+  // Full screen refresh needed after a mode change.
+  bool m_refreshAll;
+
+  // Statistics for the current measurement window.
+  struct timeval m_windowStart;
+  struct timeval m_modeChanged;
+  unsigned m_events;
+  unsigned m_frames;
+  unsigned m_activeFrames;
+  unsigned long long m_damagedArea;
+  rfb::Rect m_frameBounds;
+};
+
+#endif // HAVE_XDAMAGE
+
+#endif // __DAMAGETRACKER_H__
@@ -42,6 +42,14 @@ const int PollingManager::m_pollingOrder[32] = {
   19,  3, 27, 11, 29, 13,  5, 21
 };
 
+// Number of passes a tile stays hot after a change, i.e. one full
+// cycle of the sampling pattern above.
+static const unsigned char HOT_PASSES = 32;
+
+// Maximum share of tiles (1/n) to check in full on each pass, so that
+// a busy screen does not turn every pass into a full screen compare.
+static const int HOT_TILES_DIVISOR = 8;
+
 //
 // Constructor.
 //
@@ -70,25 +78,33 @@ PollingManager::PollingManager(Display *dpy, const Image *image,
   // primary image.
   m_rowImage = factory.newImage(m_dpy, m_width, 1);
   m_columnImage = factory.newImage(m_dpy, 1, m_height);
+  m_bandImage = factory.newImage(m_dpy, m_width, 32);
   const char *primaryImgClass = m_image->className();
   const char *rowImgClass = m_rowImage->className();
   const char *columnImgClass = m_columnImage->className();
+  const char *bandImgClass = m_bandImage->className();
   if (strcmp(rowImgClass, primaryImgClass) != 0 ||
-      strcmp(columnImgClass, primaryImgClass) != 0) {
-    vlog.error("Image types do not match (%s, %s, %s)",
-               primaryImgClass, rowImgClass, columnImgClass);
+      strcmp(columnImgClass, primaryImgClass) != 0 ||
+      strcmp(bandImgClass, primaryImgClass) != 0) {
+    vlog.error("Image types do not match (%s, %s, %s, %s)",
+               primaryImgClass, rowImgClass, columnImgClass, bandImgClass);
   }
 
   m_changeFlags = new bool[m_numTiles];
   memset(m_changeFlags, 0, m_numTiles * sizeof(bool));
+
+  m_tileHeat = new unsigned char[m_numTiles];
+  memset(m_tileHeat, 0, m_numTiles * sizeof(unsigned char));
 }
 
 PollingManager::~PollingManager()
 {
   delete[] m_changeFlags;
+  delete[] m_tileHeat;
 
   delete m_rowImage;
   delete m_columnImage;
+  delete m_bandImage;
 }
 
 //
@@ -159,6 +175,12 @@ bool PollingManager::pollScreen(VNCServer *server)
 
   DBG_REPORT_CHANGES("After 1st pass");
 
+  // Tiles that changed recently are likely to change again, so don't
+  // wait for the sampling pattern to come around to them.
+  nTilesChanged += checkHotTiles();
+
+  DBG_REPORT_CHANGES("After checking hot tiles");
+
   // If some changes have been detected:
   if (nTilesChanged) {
     // Try to find more changes around.
@@ -168,6 +190,8 @@ bool PollingManager::pollScreen(VNCServer *server)
     nTilesChanged = sendChanges(server);
   }
 
+  updateHeat();
+
 #ifdef DEBUG_PRINT_NUM_CHANGED_TILES
   printf("%3d ", nTilesChanged);
   if (m_pollingStep % 32 == 0) {
@@ -286,6 +310,69 @@ int PollingManager::sendChanges(VNCServer *server) const
   return nTilesChanged;
 }
 
+int PollingManager::checkHotTiles()
+{
+  int nTilesChanged = 0;
+  int budget = m_numTiles / HOT_TILES_DIVISOR + 1;
+
+  for (int y = 0; y < m_heightTiles && budget > 0; y++) {
+    bool *pChangeFlags = &m_changeFlags[y * m_widthTiles];
+    const unsigned char *pHeat = &m_tileHeat[y * m_widthTiles];
+
+    // Find the span of hot tiles in this row that aren't known to
+    // have changed already, and fetch it with a single request.
+    int first = -1, last = -1;
+    for (int x = 0; x < m_widthTiles; x++) {
+      if (pHeat[x] && !pChangeFlags[x]) {
+        if (first < 0)
+          first = x;
+        last = x;
+      }
+    }
+    if (first < 0)
+      continue;
+
+    int band_x = first * 32;
+    int band_y = y * 32;
+    int band_w = ((last + 1) * 32 < m_width ? (last + 1) * 32 : m_width) -
+                 band_x;
+    int band_h = (m_height - band_y >= 32) ? 32 : m_height - band_y;
+
+    getBand(band_x, band_y, band_w, band_h);
+
+    for (int x = first; x <= last && budget > 0; x++) {
+      if (!pHeat[x] || pChangeFlags[x])
+        continue;
+
+      budget--;
+
+      int tile_w = (m_width - x * 32 >= 32) ? 32 : m_width - x * 32;
+      int nBytes = tile_w * m_bytesPerPixel;
+      for (int i = 0; i < band_h; i++) {
+        char *ptr_old = m_image->locatePixel(x * 32, band_y + i);
+        char *ptr_new = m_bandImage->locatePixel(x * 32 - band_x, i);
+        if (memcmp(ptr_old, ptr_new, nBytes)) {
+          pChangeFlags[x] = true;
+          nTilesChanged++;
+          break;
+        }
+      }
+    }
+  }
+
+  return nTilesChanged;
+}
+
+void PollingManager::updateHeat()
+{
+  for (int i = 0; i < m_numTiles; i++) {
+    if (m_changeFlags[i])
+      m_tileHeat[i] = HOT_PASSES;
+    else if (m_tileHeat[i])
+      m_tileHeat[i]--;
+  }
+}
+
 void
 PollingManager::checkNeighbors()
 {
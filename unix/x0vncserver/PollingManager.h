@@ -70,6 +70,17 @@ private:
     }
   }
 
+  inline void getBand(int x, int y, int w, int h) {
+    if (w == m_width && h == 32) {
+      // Getting full rows may be more efficient.
+      m_bandImage->get(DefaultRootWindow(m_dpy),
+                       m_offsetLeft, m_offsetTop + y);
+    } else {
+      m_bandImage->get(DefaultRootWindow(m_dpy),
+                       m_offsetLeft + x, m_offsetTop + y, w, h);
+    }
+  }
+
   inline void getColumn(int x, int y, int h) {
     m_columnImage->get(DefaultRootWindow(m_dpy),
                        m_offsetLeft + x, m_offsetTop + y, 1, h);
@@ -85,6 +96,12 @@ private:
   int checkColumn(int x, int y, int h, bool *pChangeFlags);
   int sendChanges(rfb::VNCServer *server) const;
 
+  // Check recently changed tiles in full and update m_changeFlags[].
+  int checkHotTiles();
+
+  // Update m_tileHeat[] after a polling pass.
+  void updateHeat();
+
   // Check neighboring tiles and update m_changeFlags[].
   void checkNeighbors();
 
@@ -94,6 +111,7 @@ private:
   // Additional images used in polling algorithms.
   Image *m_rowImage;            // one row of the framebuffer
   Image *m_columnImage;         // one column of the framebuffer
+  Image *m_bandImage;           // one row of tiles
 
   const int m_widthTiles;       // shortcut for ((m_width + 31) / 32)
   const int m_heightTiles;      // shortcut for ((m_height + 31) / 32)
@@ -104,6 +122,12 @@ private:
   // in that tile.
   bool *m_changeFlags;
 
+  // m_tileHeat[] holds the number of polling passes each tile will
+  // still be considered "hot" after a change was last detected in it.
+  // Hot tiles are compared in full on every pass rather than only on
+  // the sampled scan lines.
+  unsigned char *m_tileHeat;
+
   unsigned int m_pollingStep;
   static const int m_pollingOrder[];
 
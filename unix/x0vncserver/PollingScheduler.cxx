@@ -29,16 +29,19 @@
 
 #include <x0vncserver/PollingScheduler.h>
 
-PollingScheduler::PollingScheduler(int interval, int maxload)
+PollingScheduler::PollingScheduler(int interval, int maxload,
+                                   int maxinterval)
 {
-  setParameters(interval, maxload);
+  setParameters(interval, maxload, maxinterval);
   reset();
 }
 
-void PollingScheduler::setParameters(int interval, int maxload)
+void PollingScheduler::setParameters(int interval, int maxload,
+                                     int maxinterval)
 {
   m_interval = interval;
   m_maxload = maxload;
+  m_maxinterval = maxinterval;
 
   if (m_interval < 0) {
     m_interval = 0;
@@ -48,6 +51,11 @@ void PollingScheduler::setParameters(int interval, int maxload)
   } else if (m_maxload > 100) {
     m_maxload = 100;
   }
+  if (m_maxinterval < 0) {
+    m_maxinterval = 0;
+  } else if (m_maxinterval != 0 && m_maxinterval < m_interval) {
+    m_maxinterval = m_interval;
+  }
 }
 
 void PollingScheduler::reset()
@@ -151,6 +159,9 @@ void PollingScheduler::newPass()
     } else if (m_ratedDuration > 1000) {
       m_ratedDuration = 1000;
     }
+    if (m_maxinterval != 0 && m_ratedDuration > m_maxinterval) {
+      m_ratedDuration = m_maxinterval;
+    }
 
 #ifdef DEBUG
     fprintf(stderr, "<final est %3d>\t", m_ratedDuration);
@@ -21,7 +21,9 @@
 // polling pass, and how much time it is ok to sleep before starting. 
 // PollingScheduler is given a desired polling interval, but it can
 // add time between polling passes if needed for satisfying processor
-// usage limitation.
+// usage limitation. An optional maximum interval takes priority over
+// the processor usage limitation, to bound the delay before changes
+// are detected.
 //
 
 #ifndef __POLLINGSCHEDULER_H__
@@ -33,10 +35,10 @@ class PollingScheduler {
 
 public:
 
-  PollingScheduler(int interval, int maxload = 50);
+  PollingScheduler(int interval, int maxload = 50, int maxinterval = 0);
 
   // Set polling parameters.
-  void setParameters(int interval, int maxload = 50);
+  void setParameters(int interval, int maxload = 50, int maxinterval = 0);
 
   // Reset the object into the initial state (no polling performed).
   void reset();
@@ -62,6 +64,7 @@ protected:
   // Parameters.
   int m_interval;
   int m_maxload;
+  int m_maxinterval;
 
   // This boolean flag is true when we do not poll the screen.
   bool m_initialState;
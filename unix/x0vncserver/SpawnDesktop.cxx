@@ -20,9 +20,10 @@
 
 #include <assert.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
 #include <unistd.h>
-#include <sys/types.h>
-#include <sys/wait.h>
 
 #include <rfb/LogWriter.h>
 
@@ -34,6 +35,7 @@
 #endif
 #ifdef HAVE_XDAMAGE
 #include <X11/extensions/Xdamage.h>
+#include <x0vncserver/DamageTracker.h>
 #endif
 #ifdef HAVE_XFIXES
 #include <X11/extensions/Xfixes.h>
@@ -77,68 +79,49 @@ SpawnDesktop::SpawnDesktop()
   : dpy(0), geometry(0, 0), pb(0), server(0),
     queryConnectDialog(0), queryConnectSock(0),
     oldButtonMask(0), haveXtest(false), haveDamage(false),
-    maxButtons(0), running(false), ledMasks(), ledState(0),
-    codeMap(0), codeMapLen(0)
+    maxButtons(0), running(false), sessionPool(this), haveSession(false),
+    placeholder(0), ledMasks(), ledState(0), codeMap(0), codeMapLen(0)
 {
+  const char* home;
+  char xauthority[4096];
 
+  home = getenv("HOME");
+  if (home == NULL)
+    home = "/tmp";
+
+  snprintf(xauthority, sizeof(xauthority), "%s/TESTAUTH", home);
+  setenv("XAUTHORITY", xauthority, 1);
+
+  // Get some sessions warmed up before the first client shows up
+  sessionPool.start();
 }
 
-void SpawnDesktop::startXserver()
+bool SpawnDesktop::startXserver()
 {
   vlog.info("Starting the X11 server connection");
 
-  int pid = fork();
-  if (pid) { // parent
-
-    vlog.info("PARENT");
-
-    children_pid[pid] = 0;
-
-    sleep(10);
-
-  } else { //child
-
-    vlog.info("CHILD");
-
-    char const * home = getenv("HOME");
-
-    std::string log = std::string{home}+std::string{"/Xorg.10.log"};
-
-    char * exec_args[] = {
-        strdup("/usr/bin/startx"),
-        strdup("--"),
-        strdup(":10"),
-        strdup("-config"),
-        strdup("simple-vnc-xdummy.conf"),
-        strdup("-logfile"),
-        strdup(log.c_str()),
-        0
-    };
-
-    if(execv(exec_args[0], exec_args) < 0)
-      vlog.info("execve failed");
+  if (!sessionPool.acquire(&session))
+    return false;
 
-    exit(1); // terminate forked child
+  haveSession = true;
 
-  }
+  return true;
 }
 
-void SpawnDesktop::openXDisplay()
+bool SpawnDesktop::openXDisplay()
 {
-  char const * home = getenv("HOME");
+  char dpyStr[16];
 
-  std::string xauthority = std::string{home}+std::string{"/TESTAUTH"};
-  setenv("XAUTHORITY", xauthority.c_str(), 1);
-
-  startXserver();
+  if (!startXserver())
+    return false;
 
   vlog.info("Starting the X11 display connection");
 
-//  CharArray dpyStr(displayname.getData());
-  if (!(dpy = XOpenDisplay(":10"))) {
+  snprintf(dpyStr, sizeof(dpyStr), ":%d", session.display);
+  if (!(dpy = XOpenDisplay(dpyStr))) {
     // FIXME: Why not vlog.error(...)?
     fprintf(stderr,"%s: unable to open display \"%s\"\r\n",
-            "TODO", XDisplayName(NULL));
+            "TODO", dpyStr);
     exit(1);
   }
 
@@ -146,7 +129,7 @@ void SpawnDesktop::openXDisplay()
                DisplayHeight(dpy, DefaultScreen(dpy)));
   if (geometry.getRect().is_empty()) {
     vlog.error("Exiting with error");
-    return;
+    return true;
   }
 
   TXWindow::init(dpy,"x0vncserver");
@@ -271,22 +254,33 @@ void SpawnDesktop::openXDisplay()
 #endif
 
   TXWindow::setGlobalEventHandler(this);
+
+  return true;
 }
 
 SpawnDesktop::~SpawnDesktop() {
-  for (auto & x: children_pid) {
-    kill(x.first, SIGTERM);
-    int status;
-    waitpid(x.first, &status, 0);
-  }
   if (running)
     stop();
+  if (haveSession)
+    sessionPool.release(session);
 }
 
 
 void SpawnDesktop::poll() {
-  if (pb and not haveDamage)
-    pb->poll(server);
+  bool needPoll;
+
+  needPoll = !haveDamage;
+#ifdef HAVE_XDAMAGE
+  if (running && haveDamage) {
+    damage->flush(server);
+    needPoll = damage->isPolling();
+  }
+#endif
+  if (pb) {
+    pb->setExactCapture(needPoll);
+    if (needPoll)
+      pb->poll(server);
+  }
   if (running) {
     Window root, child;
     int x, y, wx, wy;
@@ -302,7 +296,28 @@ void SpawnDesktop::poll() {
 
 void SpawnDesktop::start(VNCServer* vs) {
 
-  openXDisplay();
+  server = vs;
+
+  // Keep the same session if a client reconnects
+  if (!dpy && !openXDisplay()) {
+    PixelFormat pf(32, 24, false, true, 255, 255, 255, 16, 8, 0);
+    rdr::U32 black = 0;
+
+    // The session pool lets us know when there is one, until then the
+    // clients get a blank screen
+    vlog.info("Waiting for an X session to become ready");
+
+    placeholder = new ManagedPixelBuffer(pf, 1024, 768);
+    placeholder->fillRect(placeholder->getRect(), &black);
+    server->setPixelBuffer(placeholder);
+
+    return;
+  }
+
+  attachXDisplay();
+}
+
+void SpawnDesktop::attachXDisplay() {
 
   // Determine actual number of buttons of the X pointer device.
   unsigned char btnMap[8];
@@ -318,14 +333,14 @@ void SpawnDesktop::start(VNCServer* vs) {
   pb = new XPixelBuffer(dpy, factory, geometry.getRect());
   vlog.info("Allocated %s", pb->getImage()->classDesc());
 
-  server = vs;
   server->setPixelBuffer(pb, computeScreenLayout());
 
+  delete placeholder;
+  placeholder = 0;
+
 #ifdef HAVE_XDAMAGE
-  if (haveDamage) {
-    damage = XDamageCreate(dpy, DefaultRootWindow(dpy),
-                           XDamageReportRawRectangles);
-  }
+  if (haveDamage)
+    damage = new DamageTracker(dpy, geometry.getRect());
 #endif
 
 #ifdef HAVE_XFIXES
@@ -338,11 +353,23 @@ void SpawnDesktop::start(VNCServer* vs) {
 }
 
 void SpawnDesktop::stop() {
+  if (placeholder) {
+    server->setPixelBuffer(0);
+    server = 0;
+
+    delete placeholder;
+    placeholder = 0;
+
+    return;
+  }
+
   running = false;
 
 #ifdef HAVE_XDAMAGE
-  if (haveDamage)
-    XDamageDestroy(dpy, damage);
+  if (haveDamage) {
+    delete damage;
+    damage = 0;
+  }
 #endif
 
   delete queryConnectDialog;
@@ -355,6 +382,18 @@ void SpawnDesktop::stop() {
   pb = 0;
 }
 
+void SpawnDesktop::sessionReady() {
+  if (dpy)
+    return;
+
+  if (!openXDisplay())
+    return;
+
+  // Replace the blank screen if there are clients waiting for it
+  if (placeholder)
+    attachXDisplay();
+}
+
 void SpawnDesktop::terminate() {
   kill(getpid(), SIGTERM);
 }
@@ -567,6 +606,11 @@ unsigned int SpawnDesktop::setScreenLayout(int fb_width, int fb_height,
 {
 #ifdef HAVE_XRANDR
   char buffer[2048];
+
+  // Still waiting for the X session
+  if (!dpy)
+    return rfb::resultProhibited;
+
   vlog.debug("Got request for framebuffer resize to %dx%d",
              fb_width, fb_height);
   layout.print(buffer, sizeof(buffer));
@@ -744,17 +788,11 @@ bool SpawnDesktop::handleGlobalEvent(XEvent* ev) {
     return true;
 #ifdef HAVE_XDAMAGE
   } else if (ev->type == xdamageEventBase) {
-    XDamageNotifyEvent* dev;
-    Rect rect;
-
     if (!running)
       return true;
 
-    dev = (XDamageNotifyEvent*)ev;
-    rect.setXYWH(dev->area.x, dev->area.y, dev->area.width, dev->area.height);
-    rect = rect.translate(Point(-geometry.offsetLeft(),
-                                -geometry.offsetTop()));
-    server->add_changed(rect);
+    // Changes are sent to the server on the next poll()
+    damage->handleEvent((XDamageNotifyEvent*)ev);
 
     return true;
 #endif
@@ -798,7 +836,14 @@ bool SpawnDesktop::handleGlobalEvent(XEvent* ev) {
       ImageFactory factory((bool)useShm);
       delete pb;
       pb = new XPixelBuffer(dpy, factory, geometry.getRect());
-      server->setPixelBuffer(pb, computeScreenLayout());
+      // The new buffer starts out with a copy of the screen, so the
+      // overlapping part doesn't need to be sent again
+      server->resizePixelBuffer(pb, computeScreenLayout());
+
+#ifdef HAVE_XDAMAGE
+      if (haveDamage)
+        damage->setGeometry(geometry.getRect());
+#endif
 
       // Mark entire screen as changed
       server->add_changed(rfb::Region(Rect(0, 0, cev->width, cev->height)));
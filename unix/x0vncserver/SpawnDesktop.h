@@ -22,6 +22,7 @@
 #ifndef __SPAWNDESKTOP_H__
 #define __SPAWNDESKTOP_H__
 
+#include <rfb/PixelBuffer.h>
 #include <rfb/SDesktop.h>
 #include <tx/TXWindow.h>
 #include <unixcommon.h>
@@ -34,22 +35,25 @@
 #include <vncconfig/QueryConnectDialog.h>
 
 #include <x0vncserver/Geometry.h>
+#include <x0vncserver/XSessionPool.h>
 
 class XPixelBuffer;
+class DamageTracker;
 
 // number of XKb indicator leds to handle
 #define SPAWNDESKTOP_N_LEDS 3
 
 class SpawnDesktop : public rfb::SDesktop,
                  public TXGlobalEventHandler,
-                 public QueryResultCallback
+                 public QueryResultCallback,
+                 public XSessionPool::Callback
 {
 public:
   SpawnDesktop();
   virtual ~SpawnDesktop();
 
-  void startXserver();
-  void openXDisplay();
+  bool startXserver();
+  bool openXDisplay();
 
   void poll();
   // -=- SDesktop interface
@@ -73,9 +77,11 @@ public:
   virtual void queryApproved();
   virtual void queryRejected();
 
+  // -=- XSessionPool::Callback interface
+  virtual void sessionReady();
+
   Display* dpy;
 protected:
-  std::map<int, int> children_pid;
   Geometry geometry;
   XPixelBuffer* pb;
   rfb::VNCServer* server;
@@ -87,8 +93,13 @@ protected:
   int maxButtons;
   std::map<KeySym, KeyCode> pressedKeys;
   bool running;
+  XSessionPool sessionPool;
+  XSessionPool::Session session;
+  bool haveSession;
+  // Shown to the clients until the X session is ready
+  rfb::ManagedPixelBuffer* placeholder;
 #ifdef HAVE_XDAMAGE
-  Damage damage;
+  DamageTracker* damage;
   int xdamageEventBase;
 #endif
   int xkbEventBase;
@@ -104,6 +115,7 @@ protected:
   unsigned ledState;
   const unsigned short *codeMap;
   unsigned codeMapLen;
+  void attachXDisplay();
   bool setCursor();
   rfb::ScreenSet computeScreenLayout();
 };
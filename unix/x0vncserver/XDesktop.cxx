@@ -32,6 +32,7 @@
 #endif
 #ifdef HAVE_XDAMAGE
 #include <X11/extensions/Xdamage.h>
+#include <x0vncserver/DamageTracker.h>
 #endif
 #ifdef HAVE_XFIXES
 #include <X11/extensions/Xfixes.h>
@@ -207,8 +208,20 @@ XDesktop::~XDesktop() {
 
 
 void XDesktop::poll() {
-  if (pb and not haveDamage)
-    pb->poll(server);
+  bool needPoll;
+
+  needPoll = !haveDamage;
+#ifdef HAVE_XDAMAGE
+  if (running && haveDamage) {
+    damage->flush(server);
+    needPoll = damage->isPolling();
+  }
+#endif
+  if (pb) {
+    pb->setExactCapture(needPoll);
+    if (needPoll)
+      pb->poll(server);
+  }
   if (running) {
     Window root, child;
     int x, y, wx, wy;
@@ -242,10 +255,8 @@ void XDesktop::start(VNCServer* vs) {
   server->setPixelBuffer(pb, computeScreenLayout());
 
 #ifdef HAVE_XDAMAGE
-  if (haveDamage) {
-    damage = XDamageCreate(dpy, DefaultRootWindow(dpy),
-                           XDamageReportRawRectangles);
-  }
+  if (haveDamage)
+    damage = new DamageTracker(dpy, geometry->getRect());
 #endif
 
 #ifdef HAVE_XFIXES
@@ -261,8 +272,10 @@ void XDesktop::stop() {
   running = false;
 
 #ifdef HAVE_XDAMAGE
-  if (haveDamage)
-    XDamageDestroy(dpy, damage);
+  if (haveDamage) {
+    delete damage;
+    damage = 0;
+  }
 #endif
 
   delete queryConnectDialog;
@@ -664,17 +677,11 @@ bool XDesktop::handleGlobalEvent(XEvent* ev) {
     return true;
 #ifdef HAVE_XDAMAGE
   } else if (ev->type == xdamageEventBase) {
-    XDamageNotifyEvent* dev;
-    Rect rect;
-
     if (!running)
       return true;
 
-    dev = (XDamageNotifyEvent*)ev;
-    rect.setXYWH(dev->area.x, dev->area.y, dev->area.width, dev->area.height);
-    rect = rect.translate(Point(-geometry->offsetLeft(),
-                                -geometry->offsetTop()));
-    server->add_changed(rect);
+    // Changes are sent to the server on the next poll()
+    damage->handleEvent((XDamageNotifyEvent*)ev);
 
     return true;
 #endif
@@ -718,7 +725,14 @@ bool XDesktop::handleGlobalEvent(XEvent* ev) {
       ImageFactory factory((bool)useShm);
       delete pb;
       pb = new XPixelBuffer(dpy, factory, geometry->getRect());
-      server->setPixelBuffer(pb, computeScreenLayout());
+      // The new buffer starts out with a copy of the screen, so the
+      // overlapping part doesn't need to be sent again
+      server->resizePixelBuffer(pb, computeScreenLayout());
+
+#ifdef HAVE_XDAMAGE
+      if (haveDamage)
+        damage->setGeometry(geometry->getRect());
+#endif
 
       // Mark entire screen as changed
       server->add_changed(rfb::Region(Rect(0, 0, cev->width, cev->height)));
@@ -34,6 +34,7 @@
 
 class Geometry;
 class XPixelBuffer;
+class DamageTracker;
 
 // number of XKb indicator leds to handle
 #define XDESKTOP_N_LEDS 3
@@ -81,7 +82,7 @@ protected:
   std::map<KeySym, KeyCode> pressedKeys;
   bool running;
 #ifdef HAVE_XDAMAGE
-  Damage damage;
+  DamageTracker* damage;
   int xdamageEventBase;
 #endif
   int xkbEventBase;
@@ -22,20 +22,40 @@
 //
 
 #include <vector>
+#include <rfb/LogWriter.h>
 #include <rfb/Region.h>
+#include <rfb/util.h>
 #include <X11/Xlib.h>
 #include <x0vncserver/XPixelBuffer.h>
 
 using namespace rfb;
 
+static LogWriter vlog("XPixelBuffer");
+
+// Each separate fetch is a synchronous round trip to the X server,
+// which costs about as much as transferring this many extra pixels.
+static const int ROUND_TRIP_PIXELS = 128 * 64;
+
+// Past this many fetches in a single frame we just grab the full rows
+// covering the changed area in one go.
+static const int MAX_REQUESTS = 16;
+
+// How often to report capture statistics (in milliseconds)
+static const unsigned STATS_INTERVAL = 10000;
+
 XPixelBuffer::XPixelBuffer(Display *dpy, ImageFactory &factory,
                            const Rect &rect)
   : FullFramePixelBuffer(),
     m_poller(0),
     m_dpy(dpy),
+    m_factory(factory),
     m_image(factory.newImage(dpy, rect.width(), rect.height())),
+    m_scratch(0),
+    m_exactCapture(true),
     m_offsetLeft(rect.tl.x),
-    m_offsetTop(rect.tl.y)
+    m_offsetTop(rect.tl.y),
+    m_statsFrames(0), m_statsRects(0), m_statsRequests(0),
+    m_statsFullGrabs(0), m_statsPixels(0), m_statsUsecs(0)
 {
   // Fill in the PixelFormat structure of the parent class.
   format = PixelFormat(m_image->xim->bits_per_pixel,
@@ -64,22 +84,162 @@ XPixelBuffer::XPixelBuffer(Display *dpy, ImageFactory &factory,
   // PollingManager will detect changed pixels.
   m_poller = new PollingManager(dpy, getImage(), factory,
                                 m_offsetLeft, m_offsetTop);
+
+  gettimeofday(&m_statsStart, NULL);
 }
 
 XPixelBuffer::~XPixelBuffer()
 {
+  logStats();
+
   delete m_poller;
+  delete m_scratch;
   delete m_image;
 }
 
 void
 XPixelBuffer::grabRegion(const rfb::Region& region)
 {
-  std::vector<Rect> rects;
+  std::vector<Rect> plan;
   std::vector<Rect>::const_iterator i;
-  region.get_rects(&rects);
-  for (i = rects.begin(); i != rects.end(); i++) {
-    grabRect(*i);
+  struct timeval start, end;
+  int area;
+
+  if (region.is_empty())
+    return;
+
+  gettimeofday(&start, NULL);
+
+  planCapture(region, &plan);
+
+  area = 0;
+  for (i = plan.begin(); i != plan.end(); i++)
+    area += i->area();
+
+  if (area > width_ * height_ / 4) {
+    // Large updates are cheapest as a single full screen fetch, which
+    // also lets ShmImage use XShmGetImage()
+    fetchRect(getRect(), region);
+    m_statsFullGrabs++;
+    m_statsRequests++;
+    m_statsPixels += width_ * height_;
+  } else if (plan.size() > MAX_REQUESTS) {
+    Rect rows;
+
+    rows = region.get_bounding_rect();
+    rows.tl.x = 0;
+    rows.br.x = width_;
+
+    fetchRect(rows, region);
+    m_statsRequests++;
+    m_statsPixels += rows.area();
+  } else {
+    for (i = plan.begin(); i != plan.end(); i++)
+      fetchRect(*i, region);
+    m_statsRequests += plan.size();
+    m_statsPixels += area;
+  }
+
+  gettimeofday(&end, NULL);
+
+  m_statsFrames++;
+  m_statsRects += region.numRects();
+  m_statsUsecs += (end.tv_sec - start.tv_sec) * 1000000ULL +
+                  end.tv_usec - start.tv_usec;
+
+  if (msSince(&m_statsStart) >= STATS_INTERVAL)
+    logStats();
+}
+
+void
+XPixelBuffer::fetchRect(const Rect &r, const rfb::Region &region)
+{
+  rfb::Region wanted;
+  rfb::Region::const_iterator i;
+
+  wanted = region.intersect(r);
+  if (!m_exactCapture || (wanted.numRects() == 1 &&
+                          wanted.get_bounding_rect().equals(r))) {
+    if (r.equals(getRect()))
+      m_image->get(DefaultRootWindow(m_dpy), m_offsetLeft, m_offsetTop);
+    else
+      grabRect(r);
+    return;
   }
+
+  if (m_scratch == NULL)
+    m_scratch = m_factory.newImage(m_dpy, width_, height_);
+
+  if (r.equals(getRect()))
+    m_scratch->get(DefaultRootWindow(m_dpy), m_offsetLeft, m_offsetTop);
+  else
+    m_scratch->get(DefaultRootWindow(m_dpy),
+                   m_offsetLeft + r.tl.x, m_offsetTop + r.tl.y,
+                   r.width(), r.height(), r.tl.x, r.tl.y);
+
+  for (i = wanted.begin(); i != wanted.end(); ++i)
+    m_image->updateRect(m_scratch, i->tl.x, i->tl.y,
+                        i->tl.x, i->tl.y, i->width(), i->height());
+}
+
+void
+XPixelBuffer::planCapture(const rfb::Region &region,
+                          std::vector<Rect> *plan)
+{
+  rfb::Region::const_iterator i;
+  std::vector<int> useful;
+
+  plan->clear();
+
+  // The rects come in y-x banded order, so neighbours worth merging
+  // are almost always among the last few entries of the plan
+  for (i = region.begin(); i != region.end(); ++i) {
+    size_t j, first;
+
+    first = plan->size() > 4 ? plan->size() - 4 : 0;
+    for (j = plan->size(); j > first; j--) {
+      Rect merged;
+
+      merged = (*plan)[j-1].union_boundary(*i);
+      if (merged.area() - useful[j-1] - i->area() > ROUND_TRIP_PIXELS)
+        continue;
+
+      (*plan)[j-1] = merged;
+      useful[j-1] += i->area();
+      break;
+    }
+
+    if (j == first) {
+      plan->push_back(*i);
+      useful.push_back(i->area());
+    }
+  }
+}
+
+void
+XPixelBuffer::logStats()
+{
+  unsigned elapsed;
+
+  elapsed = msSince(&m_statsStart);
+
+  if (m_statsFrames != 0) {
+    vlog.debug("Captured %u frames in %u ms: %.2f ms/frame, "
+               "%.1f rects/frame, %.1f requests/frame, "
+               "%u full screen grabs, %.1f Mpixels",
+               m_statsFrames, elapsed,
+               (double)m_statsUsecs / m_statsFrames / 1000.0,
+               (double)m_statsRects / m_statsFrames,
+               (double)m_statsRequests / m_statsFrames,
+               m_statsFullGrabs, (double)m_statsPixels / 1000000.0);
+  }
+
+  gettimeofday(&m_statsStart, NULL);
+  m_statsFrames = 0;
+  m_statsRects = 0;
+  m_statsRequests = 0;
+  m_statsFullGrabs = 0;
+  m_statsPixels = 0;
+  m_statsUsecs = 0;
 }
 
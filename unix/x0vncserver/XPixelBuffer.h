@@ -23,6 +23,10 @@
 #ifndef __XPIXELBUFFER_H__
 #define __XPIXELBUFFER_H__
 
+#include <sys/time.h>
+
+#include <vector>
+
 #include <rfb/PixelBuffer.h>
 #include <rfb/VNCServer.h>
 #include <x0vncserver/Image.h>
@@ -47,11 +51,20 @@ public:
   // Override PixelBuffer::grabRegion().
   virtual void grabRegion(const rfb::Region& region);
 
+  // Polling finds changes by comparing the screen with our image, so
+  // while it is in use nothing outside of the region being grabbed may
+  // be refreshed, or those changes would go unnoticed. Extra pixels
+  // that are fetched to save round trips then go via a scratch image.
+  void setExactCapture(bool exact) { m_exactCapture = exact; }
+
 protected:
   PollingManager *m_poller;
 
   Display *m_dpy;
+  ImageFactory m_factory;
   Image* m_image;
+  Image* m_scratch;
+  bool m_exactCapture;
   int m_offsetLeft;
   int m_offsetTop;
 
@@ -62,6 +75,27 @@ protected:
 		 m_offsetLeft + r.tl.x, m_offsetTop + r.tl.y,
 		 r.width(), r.height(), r.tl.x, r.tl.y);
   }
+
+  // Fetch a rect that may be larger than the part of the region it
+  // covers, without touching any other pixels when m_exactCapture is set.
+  void fetchRect(const rfb::Rect &r, const rfb::Region &region);
+
+  // Turn the rects of a region into a (usually smaller) list of
+  // rects to fetch, merging neighbours when over-fetching is cheaper
+  // than another round trip to the X server.
+  void planCapture(const rfb::Region &region,
+                   std::vector<rfb::Rect> *plan);
+
+  // Capture statistics, reported periodically.
+  void logStats();
+
+  struct timeval m_statsStart;
+  unsigned m_statsFrames;
+  unsigned m_statsRects;
+  unsigned m_statsRequests;
+  unsigned m_statsFullGrabs;
+  unsigned long long m_statsPixels;
+  unsigned long long m_statsUsecs;
 };
 
 #endif // __XPIXELBUFFER_H__
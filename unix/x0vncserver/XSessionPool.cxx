@@ -0,0 +1,403 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// XSessionPool.cxx
+//
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <X11/Xlib.h>
+
+#include <rfb/Configuration.h>
+#include <rfb/LogWriter.h>
+#include <x0vncserver/XSessionPool.h>
+
+using namespace rfb;
+
+static LogWriter vlog("XSessionPool");
+
+IntParameter sessionPoolLow("SessionPoolLow",
+                            "Start new idle X sessions when fewer than "
+                            "this many are available", 1);
+IntParameter sessionPoolHigh("SessionPoolHigh",
+                             "Number of idle X sessions to start when "
+                             "refilling the pool", 2);
+IntParameter sessionBaseDisplay("SessionBaseDisplay",
+                                "First X display number to use for "
+                                "spawned sessions", 10);
+IntParameter sessionWarmupTime("SessionWarmupTime",
+                               "Milliseconds to give the desktop of a new "
+                               "idle session to start before handing it "
+                               "out", 5000);
+IntParameter sessionStartTimeout("SessionStartTimeout",
+                                 "Milliseconds to wait for a new X server "
+                                 "to accept connections", 30000);
+IntParameter sessionCheckInterval("SessionCheckInterval",
+                                  "Milliseconds between health checks of "
+                                  "idle X sessions", 2000);
+
+// How often to check for a ready session when a client is waiting
+static const int WaitCheckInterval = 100;
+
+XSessionPool::XSessionPool(Callback* cb_)
+  : cb(cb_), checkTimer(this), waiting(false), retired(false)
+{
+}
+
+XSessionPool::~XSessionPool()
+{
+  std::list<Session>::iterator i;
+
+  for (i = sessions.begin(); i != sessions.end(); i++)
+    kill(*i);
+  for (i = active.begin(); i != active.end(); i++)
+    kill(*i);
+}
+
+void XSessionPool::start()
+{
+  refill();
+  checkTimer.start(sessionCheckInterval);
+}
+
+int XSessionPool::readyCount() const
+{
+  std::list<Session>::const_iterator i;
+  int count;
+
+  count = 0;
+  for (i = sessions.begin(); i != sessions.end(); i++) {
+    if (i->ready)
+      count++;
+  }
+
+  return count;
+}
+
+bool XSessionPool::acquire(Session* session)
+{
+  std::list<Session>::iterator i;
+
+  if (retired)
+    return false;
+
+  // Someone is waiting, so a session is good enough as soon as its X
+  // server accepts connections
+  waiting = true;
+
+  check();
+
+  for (i = sessions.begin(); i != sessions.end(); i++) {
+    if (i->ready)
+      break;
+  }
+
+  if (i == sessions.end()) {
+    if (sessions.empty()) {
+      Session fresh;
+
+      if (spawn(&fresh))
+        sessions.push_back(fresh);
+    }
+
+    vlog.info("No warm X session available, waiting for one to start");
+    checkTimer.start(WaitCheckInterval);
+
+    return false;
+  }
+
+  *session = *i;
+  sessions.erase(i);
+
+  waiting = false;
+
+  vlog.info("Using X session on display :%d", session->display);
+
+  active.push_back(*session);
+
+  retire();
+
+  return true;
+}
+
+void XSessionPool::release(const Session& session)
+{
+  std::list<Session>::iterator i;
+
+  for (i = active.begin(); i != active.end(); i++) {
+    if (i->pid == session.pid) {
+      active.erase(i);
+      break;
+    }
+  }
+
+  kill(session);
+}
+
+bool XSessionPool::handleTimeout(Timer* t)
+{
+  check();
+  refill();
+
+  if (waiting) {
+    if (readyCount() > 0)
+      cb->sessionReady();
+    // The callback might have acquired a session
+    if (retired)
+      return false;
+    if (waiting) {
+      checkTimer.start(WaitCheckInterval);
+      return false;
+    }
+  }
+
+  if (checkTimer.getTimeoutMs() != sessionCheckInterval) {
+    checkTimer.start(sessionCheckInterval);
+    return false;
+  }
+
+  return true;
+}
+
+bool XSessionPool::spawn(Session* session)
+{
+  int display;
+  int pid;
+
+  display = allocDisplay();
+  if (display < 0) {
+    vlog.error("No free X display number for a new session");
+    return false;
+  }
+
+  vlog.info("Starting X session on display :%d", display);
+
+  pid = fork();
+  if (pid < 0) {
+    vlog.error("Unable to fork X session: %s", strerror(errno));
+    return false;
+  }
+
+  if (pid == 0) {
+    char displayStr[16];
+    char logFile[4096];
+    const char* home;
+
+    // Own process group so that the whole session can be terminated
+    setsid();
+
+    home = getenv("HOME");
+    if (home == NULL)
+      home = "/tmp";
+
+    snprintf(displayStr, sizeof(displayStr), ":%d", display);
+    snprintf(logFile, sizeof(logFile), "%s/Xorg.%d.log", home, display);
+
+    char * exec_args[] = {
+        strdup("/usr/bin/startx"),
+        strdup("--"),
+        strdup(displayStr),
+        strdup("-config"),
+        strdup("simple-vnc-xdummy.conf"),
+        strdup("-logfile"),
+        strdup(logFile),
+        0
+    };
+
+    execv(exec_args[0], exec_args);
+    fprintf(stderr, "Unable to execute %s: %s\n",
+            exec_args[0], strerror(errno));
+    _exit(1);
+  }
+
+  session->pid = pid;
+  session->display = display;
+  session->started.update();
+  session->ready = false;
+
+  return true;
+}
+
+void XSessionPool::kill(const Session& session)
+{
+  int status;
+
+  vlog.debug("Terminating X session on display :%d", session.display);
+
+  if (::kill(-session.pid, SIGTERM) != 0)
+    ::kill(session.pid, SIGTERM);
+  waitpid(session.pid, &status, 0);
+}
+
+void XSessionPool::check()
+{
+  std::list<Session>::iterator i, next;
+  TimeMillis now;
+
+  for (i = sessions.begin(); i != sessions.end(); i = next) {
+    next = i;
+    next++;
+
+    if (hasExited(*i)) {
+      vlog.error("Idle X session on display :%d exited", i->display);
+      sessions.erase(i);
+      continue;
+    }
+
+    if (i->ready) {
+      if (probeDisplay(i->display))
+        continue;
+      vlog.error("Idle X session on display :%d stopped responding",
+                 i->display);
+      kill(*i);
+      sessions.erase(i);
+      continue;
+    }
+
+    // Give the desktop some time to start as well, unless someone is
+    // already waiting for it
+    if (!waiting && (now.diffFrom(i->started) < sessionWarmupTime))
+      continue;
+
+    if (displayInUse(i->display) && probeDisplay(i->display)) {
+      vlog.debug("X session on display :%d is ready", i->display);
+      i->ready = true;
+      continue;
+    }
+
+    if (now.diffFrom(i->started) > sessionStartTimeout) {
+      vlog.error("X session on display :%d failed to start", i->display);
+      kill(*i);
+      sessions.erase(i);
+    }
+  }
+}
+
+void XSessionPool::refill()
+{
+  int low, high;
+
+  if (retired)
+    return;
+
+  low = sessionPoolLow;
+  high = sessionPoolHigh;
+  // Someone needs a session, whatever the pool is configured to keep
+  if (waiting && (low < 1))
+    low = 1;
+  if (high < low)
+    high = low;
+
+  if (idleCount() >= low)
+    return;
+
+  while (idleCount() < high) {
+    Session session;
+
+    if (!spawn(&session))
+      break;
+
+    sessions.push_back(session);
+  }
+}
+
+void XSessionPool::retire()
+{
+  std::list<Session>::iterator i;
+
+  for (i = sessions.begin(); i != sessions.end(); i++)
+    kill(*i);
+  sessions.clear();
+
+  checkTimer.stop();
+  retired = true;
+}
+
+int XSessionPool::allocDisplay()
+{
+  std::list<Session>::const_iterator i;
+
+  for (int display = sessionBaseDisplay;
+       display < sessionBaseDisplay + 256;
+       display++) {
+    bool used;
+
+    used = false;
+    for (i = sessions.begin(); i != sessions.end(); i++) {
+      if (i->display == display)
+        used = true;
+    }
+    for (i = active.begin(); i != active.end(); i++) {
+      if (i->display == display)
+        used = true;
+    }
+
+    if (used || displayInUse(display))
+      continue;
+
+    return display;
+  }
+
+  return -1;
+}
+
+bool XSessionPool::hasExited(const Session& session)
+{
+  int status;
+
+  return waitpid(session.pid, &status, WNOHANG) == session.pid;
+}
+
+bool XSessionPool::displayInUse(int display)
+{
+  char path[64];
+
+  snprintf(path, sizeof(path), "/tmp/.X11-unix/X%d", display);
+  if (access(path, F_OK) == 0)
+    return true;
+
+  snprintf(path, sizeof(path), "/tmp/.X%d-lock", display);
+  if (access(path, F_OK) == 0)
+    return true;
+
+  return false;
+}
+
+bool XSessionPool::probeDisplay(int display)
+{
+  char name[16];
+  Display* dpy;
+
+  snprintf(name, sizeof(name), ":%d", display);
+
+  dpy = XOpenDisplay(name);
+  if (dpy == NULL)
+    return false;
+
+  XCloseDisplay(dpy);
+
+  return true;
+}
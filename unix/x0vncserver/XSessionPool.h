@@ -0,0 +1,106 @@
+/* Copyright 2019 Benoit Gschwind <gschwind@gnu-log.net>
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// XSessionPool keeps a number of pre-started, idle X sessions around so
+// that a connecting client does not have to wait for the X server and
+// the desktop environment to come up. The pool is kept between a low
+// and a high watermark of idle sessions, and is periodically checked
+// for sessions that have died or stopped responding.
+//
+// Each spawnx0vncserver process serves a single desktop, so once a
+// session has been handed out the pool has done its job. The idle
+// sessions are then terminated and no new ones are started.
+//
+
+#ifndef __XSESSIONPOOL_H__
+#define __XSESSIONPOOL_H__
+
+#include <list>
+
+#include <rfb/Timer.h>
+#include <x0vncserver/TimeMillis.h>
+
+class XSessionPool : public rfb::Timer::Callback {
+
+public:
+
+  struct Session {
+    int pid;
+    int display;
+    TimeMillis started;
+    bool ready;
+  };
+
+  class Callback {
+  public:
+    virtual ~Callback() {}
+    // Called from the pool's timer when a session became ready for
+    // someone that acquire() had to turn down.
+    virtual void sessionReady() = 0;
+  };
+
+  XSessionPool(Callback* cb);
+  virtual ~XSessionPool();
+
+  // Start the initial sessions and the background maintenance timer.
+  void start();
+
+  // Take a ready session out of the pool. If none is ready yet then
+  // false is returned, the pool makes sure one is on its way, and the
+  // callback is called once it can be acquired. This never blocks.
+  bool acquire(Session* session);
+
+  // Terminate a session previously handed out by acquire().
+  void release(const Session& session);
+
+  // Number of idle sessions, ready or still starting.
+  int idleCount() const { return sessions.size(); }
+  int readyCount() const;
+
+  // -=- Timer::Callback interface
+  virtual bool handleTimeout(rfb::Timer* t);
+
+protected:
+
+  bool spawn(Session* session);
+  void kill(const Session& session);
+
+  // Reap dead sessions and promote started ones that became ready.
+  void check();
+  // Start new sessions if we have fallen below the low watermark.
+  void refill();
+  // Get rid of the idle sessions once they are of no further use.
+  void retire();
+
+  int allocDisplay();
+  static bool hasExited(const Session& session);
+  static bool displayInUse(int display);
+  static bool probeDisplay(int display);
+
+protected:
+  Callback* cb;
+  std::list<Session> sessions;
+  std::list<Session> active;
+  rfb::Timer checkTimer;
+  // Someone is waiting for a session to become ready
+  bool waiting;
+  bool retired;
+};
+
+#endif // __XSESSIONPOOL_H__
@@ -55,6 +55,10 @@ IntParameter pollingCycle("PollingCycle", "Milliseconds per one polling "
                           "adjusted to satisfy MaxProcessorUsage setting", 30);
 IntParameter maxProcessorUsage("MaxProcessorUsage", "Maximum percentage of "
                                "CPU time to be consumed", 35);
+IntParameter pollingLatency("PollingLatency", "Maximum milliseconds before "
+                            "a change anywhere on the screen is detected "
+                            "by polling, even if this exceeds "
+                            "MaxProcessorUsage (0 means no limit)", 0);
 StringParameter displayname("display", "The X display", "");
 IntParameter rfbport("rfbport", "TCP port to listen for RFB protocol",5900);
 StringParameter rfbunixpath("rfbunixpath", "Unix socket to listen for RFB protocol", "");
@@ -278,7 +282,9 @@ int main(int argc, char** argv)
         (*i)->setFilter(&fileTcpFilter);
     delete[] hostsData;
 
-    PollingScheduler sched((int)pollingCycle, (int)maxProcessorUsage);
+    // Polling samples each tile once every 32 passes
+    PollingScheduler sched((int)pollingCycle, (int)maxProcessorUsage,
+                           (int)pollingLatency / 32);
 
     while (!caughtSignal) {
       int wait_ms;
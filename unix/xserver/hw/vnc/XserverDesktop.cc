@@ -25,6 +25,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 #include <unistd.h>
 #include <pwd.h>
@@ -39,6 +40,7 @@
 #include <rfb/LogWriter.h>
 #include <rfb/Configuration.h>
 #include <rfb/ServerCore.h>
+#include <rfb/util.h>
 
 #include "XserverDesktop.h"
 #include "vncBlockHandler.h"
@@ -115,28 +117,55 @@ void XserverDesktop::unblockUpdates()
 void XserverDesktop::setFramebuffer(int w, int h, void* fbptr, int stride_)
 {
   ScreenSet layout;
+  bool resize;
+  rdr::U8* shadow;
 
-  width_ = w;
-  height_ = h;
+  // Anything set up before means this is a resize of the screen
+  resize = (data != NULL);
 
-  if (!directFbptr) {
-    delete [] data;
-    directFbptr = true;
+  shadow = NULL;
+  if (!fbptr) {
+    shadow = new rdr::U8[w * h * (format.bpp/8)];
+
+    // Keep the overlapping part of the old shadow framebuffer. A direct
+    // framebuffer will have been freed already, but the X server takes
+    // care of keeping its contents.
+    if (resize && !directFbptr) {
+      int rows, rowBytes;
+
+      rows = __rfbmin(h, height_);
+      rowBytes = __rfbmin(w, width_) * (format.bpp/8);
+
+      for (int y = 0;y < rows;y++) {
+        memcpy(shadow + y * w * (format.bpp/8),
+               data + y * stride * (format.bpp/8), rowBytes);
+      }
+    }
   }
 
-  if (!fbptr) {
-    fbptr = new rdr::U8[w * h * (format.bpp/8)];
-    stride_ = w;
+  if (!directFbptr)
+    delete [] data;
+
+  width_ = w;
+  height_ = h;
+
+  if (shadow != NULL) {
+    data = shadow;
+    stride = w;
     directFbptr = false;
+  } else {
+    data = (rdr::U8*)fbptr;
+    stride = stride_;
+    directFbptr = true;
   }
 
-  data = (rdr::U8*)fbptr;
-  stride = stride_;
-
   vncSetGlueContext(screenIndex);
   layout = ::computeScreenLayout(&outputIdMap);
 
-  server->setPixelBuffer(this, layout);
+  if (resize)
+    server->resizePixelBuffer(this, layout);
+  else
+    server->setPixelBuffer(this, layout);
 }
 
 void XserverDesktop::refreshScreenLayout()
@@ -495,10 +524,8 @@ void XserverDesktop::grabRegion(const rfb::Region& region)
   if (directFbptr)
     return;
 
-  std::vector<rfb::Rect> rects;
-  std::vector<rfb::Rect>::iterator i;
-  region.get_rects(&rects);
-  for (i = rects.begin(); i != rects.end(); i++) {
+  rfb::Region::const_iterator i;
+  for (i = region.begin(); i != region.end(); ++i) {
     rdr::U8 *buffer;
     int stride;
 
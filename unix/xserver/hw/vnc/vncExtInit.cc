@@ -420,7 +420,8 @@ void vncPostScreenResize(int scrIdx, int success, int width, int height)
   desktop[scrIdx]->unblockUpdates();
 
   if (success) {
-    // Mark entire screen as changed
+    // Mark entire screen as changed, as X redraws all of it. The update
+    // comparer will drop anything that didn't really change.
     desktop[scrIdx]->add_changed(Region(Rect(0, 0, width, height)));
   }
 }
@@ -1185,6 +1185,23 @@ static Bool vncRandRScreenSetSize(ScreenPtr pScreen,
         return FALSE;
     }
 
+    /*
+     * Keep what is in both the old and the new framebuffer, so that
+     * VNC clients only need the newly exposed area.
+     */
+    if (pvfb->fb.pfbMemory != NULL) {
+        int rows, rowBytes;
+
+        rows = min(oldheight, height);
+        rowBytes = min(oldwidth, width) * fb.bitsPerPixel / 8;
+
+        for (int y = 0;y < rows;y++) {
+            memcpy((char*)pbits + y * fb.paddedBytesWidth,
+                   (char*)pvfb->fb.pfbMemory + y * pvfb->fb.paddedBytesWidth,
+                   rowBytes);
+        }
+    }
+
     /* Free the old framebuffer and keep the info about the new one */
     vfbFreeFramebufferMemory(&pvfb->fb);
     memcpy(&pvfb->fb, &fb, sizeof(vfbFramebufferInfo));
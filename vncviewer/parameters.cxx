@@ -80,8 +80,8 @@ IntParameter lowColourLevel("LowColorLevel",
                             "2 = Medium (256 colors)", 2);
 AliasParameter lowColourLevelAlias("LowColourLevel", "Alias for LowColorLevel", &lowColourLevel);
 StringParameter preferredEncoding("PreferredEncoding",
-                                  "Preferred encoding to use (Tight, ZRLE, Hextile or"
-                                  " Raw)", "Tight");
+                                  "Preferred encoding to use (Tight, ZRLE, Zstd, "
+                                  "Hextile or Raw)", "Tight");
 BoolParameter customCompressLevel("CustomCompressLevel",
                                   "Use custom compression level. "
                                   "Default if CompressLevel is specified.", false);